@@ -0,0 +1,340 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Verify and benchmark the zio compression algorithms on real data.
+ *
+ * The given files are split into blocks of the requested size, which are
+ * compressed and decompressed with each algorithm using the same code
+ * path as the zio pipeline.  Every block is verified after the round
+ * trip, and the compression ratio and throughput of each algorithm is
+ * reported.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/time.h>
+#include <sys/zio.h>
+#include <sys/zio_compress.h>
+#include <sys/abd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define	DEFAULT_ALGORITHMS	\
+	"lz4,gzip-1,gzip-6,gzip-9,zstd-fast-1,zstd-1,zstd-3,zstd-9,zstd-19"
+
+typedef struct ct_opts {
+	size_t		cto_blocksize;
+	uint64_t	cto_iterations;
+	char		*cto_algorithms;
+	boolean_t	cto_verbose;
+} ct_opts_t;
+
+static ct_opts_t ct_opts = {
+	.cto_blocksize = SPA_OLD_MAXBLOCKSIZE,
+	.cto_iterations = 1,
+	.cto_algorithms = DEFAULT_ALGORITHMS,
+	.cto_verbose = B_FALSE,
+};
+
+typedef struct ct_data {
+	char		*ctd_buf;	/* contents of all files */
+	size_t		ctd_size;	/* rounded up to the block size */
+	uint64_t	ctd_nblocks;
+} ct_data_t;
+
+static void
+usage(boolean_t requested)
+{
+	FILE *fp = requested ? stdout : stderr;
+
+	(void) fprintf(fp, "Usage: compress_test [options] file ...\n"
+	    "\t[-b block size in bytes (default: %zu)]\n"
+	    "\t[-c comma separated algorithms (default: %s)]\n"
+	    "\t[-i iterations over the data (default: %llu)]\n"
+	    "\t[-v print per file statistics]\n"
+	    "\t[-h (print help)]\n",
+	    ct_opts.cto_blocksize, DEFAULT_ALGORITHMS,
+	    (u_longlong_t)ct_opts.cto_iterations);
+
+	exit(requested ? 0 : 1);
+}
+
+static void
+process_options(int argc, char **argv)
+{
+	size_t value;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:c:i:vh")) != -1) {
+		switch (opt) {
+		case 'b':
+			value = strtoull(optarg, NULL, 0);
+			if (!ISP2(value) || value < SPA_MINBLOCKSIZE ||
+			    value > SPA_MAXBLOCKSIZE) {
+				(void) fprintf(stderr, "block size must be a "
+				    "power of 2 from %llu to %llu\n",
+				    (u_longlong_t)SPA_MINBLOCKSIZE,
+				    (u_longlong_t)SPA_MAXBLOCKSIZE);
+				usage(B_FALSE);
+			}
+			ct_opts.cto_blocksize = value;
+			break;
+		case 'c':
+			ct_opts.cto_algorithms = optarg;
+			break;
+		case 'i':
+			ct_opts.cto_iterations = MAX(1,
+			    strtoull(optarg, NULL, 0));
+			break;
+		case 'v':
+			ct_opts.cto_verbose = B_TRUE;
+			break;
+		case 'h':
+			usage(B_TRUE);
+			break;
+		case '?':
+		default:
+			usage(B_FALSE);
+			break;
+		}
+	}
+
+	if (optind == argc) {
+		(void) fprintf(stderr, "missing file operand\n");
+		usage(B_FALSE);
+	}
+}
+
+/*
+ * Read the named files into a single buffer, padding each one with zeroes
+ * up to a multiple of the block size, as the tail of a file would be.
+ */
+static int
+load_files(int nfiles, char **files, ct_data_t *ctd)
+{
+	size_t bs = ct_opts.cto_blocksize;
+	int i;
+
+	bzero(ctd, sizeof (*ctd));
+
+	for (i = 0; i < nfiles; i++) {
+		struct stat64 st;
+		size_t len, off;
+		int fd;
+
+		if ((fd = open64(files[i], O_RDONLY)) < 0 ||
+		    fstat64(fd, &st) != 0) {
+			(void) fprintf(stderr, "cannot open '%s': %s\n",
+			    files[i], strerror(errno));
+			if (fd >= 0)
+				(void) close(fd);
+			return (1);
+		}
+
+		len = P2ROUNDUP((size_t)st.st_size, bs);
+		ctd->ctd_buf = realloc(ctd->ctd_buf, ctd->ctd_size + len);
+		VERIFY3P(ctd->ctd_buf, !=, NULL);
+		bzero(ctd->ctd_buf + ctd->ctd_size, len);
+
+		for (off = 0; off < st.st_size; ) {
+			ssize_t n = read(fd, ctd->ctd_buf + ctd->ctd_size + off,
+			    st.st_size - off);
+			if (n <= 0) {
+				(void) fprintf(stderr, "cannot read '%s': %s\n",
+				    files[i], n < 0 ? strerror(errno) :
+				    "unexpected end of file");
+				(void) close(fd);
+				return (1);
+			}
+			off += n;
+		}
+		(void) close(fd);
+
+		if (ct_opts.cto_verbose) {
+			(void) printf("%s: %llu bytes, %llu blocks\n", files[i],
+			    (u_longlong_t)st.st_size,
+			    (u_longlong_t)(len / bs));
+		}
+
+		ctd->ctd_size += len;
+	}
+
+	ctd->ctd_nblocks = ctd->ctd_size / bs;
+	if (ctd->ctd_nblocks == 0) {
+		(void) fprintf(stderr, "no data to compress\n");
+		return (1);
+	}
+
+	return (0);
+}
+
+static enum zio_compress
+lookup_algorithm(const char *name)
+{
+	enum zio_compress c;
+
+	for (c = 0; c < ZIO_COMPRESS_FUNCTIONS; c++) {
+		if (zio_compress_table[c].ci_compress != NULL &&
+		    strcmp(zio_compress_table[c].ci_name, name) == 0)
+			return (c);
+	}
+
+	return (ZIO_COMPRESS_FUNCTIONS);
+}
+
+static double
+mb_per_sec(uint64_t bytes, hrtime_t ns)
+{
+	if (ns == 0)
+		return (0.0);
+
+	return ((double)bytes / (1024.0 * 1024.0) / NSEC2SEC((double)ns));
+}
+
+/*
+ * Compress and decompress every block with the given algorithm, verify
+ * the results, and print one line of statistics.  Returns non-zero if a
+ * block did not survive the round trip.
+ */
+static int
+run_algorithm(enum zio_compress c, ct_data_t *ctd)
+{
+	size_t bs = ct_opts.cto_blocksize;
+	uint64_t psize = 0, iter, blk;
+	hrtime_t ctime = 0, dtime = 0, start;
+	char *cbuf, *dbuf;
+	int err = 0;
+
+	cbuf = umem_alloc(bs, UMEM_NOFAIL);
+	dbuf = umem_alloc(bs, UMEM_NOFAIL);
+
+	for (iter = 0; iter < ct_opts.cto_iterations && err == 0; iter++) {
+		for (blk = 0; blk < ctd->ctd_nblocks; blk++) {
+			char *src = ctd->ctd_buf + blk * bs;
+			abd_t *abd = abd_get_from_buf(src, bs);
+			size_t c_len;
+
+			start = gethrtime();
+			c_len = zio_compress_data(c, abd, cbuf, bs);
+			ctime += gethrtime() - start;
+			abd_put(abd);
+
+			if (iter == 0)
+				psize += MIN(c_len, bs);
+
+			/* Stored uncompressed or as a hole. */
+			if (c_len == 0 || c_len >= bs)
+				continue;
+
+			start = gethrtime();
+			if (zio_decompress_data_buf(c, cbuf, dbuf, c_len,
+			    bs) != 0) {
+				(void) fprintf(stderr, "%s: block %llu failed "
+				    "to decompress\n",
+				    zio_compress_table[c].ci_name,
+				    (u_longlong_t)blk);
+				err = 1;
+				break;
+			}
+			dtime += gethrtime() - start;
+
+			if (bcmp(src, dbuf, bs) != 0) {
+				(void) fprintf(stderr, "%s: block %llu "
+				    "differs after decompression\n",
+				    zio_compress_table[c].ci_name,
+				    (u_longlong_t)blk);
+				err = 1;
+				break;
+			}
+		}
+	}
+
+	if (err == 0) {
+		uint64_t total = ctd->ctd_size * ct_opts.cto_iterations;
+
+		(void) printf("%-14s %8.2fx %12.1f %12.1f\n",
+		    zio_compress_table[c].ci_name,
+		    psize == 0 ? 0.0 : (double)ctd->ctd_size / psize,
+		    mb_per_sec(total, ctime), mb_per_sec(total, dtime));
+	}
+
+	umem_free(cbuf, bs);
+	umem_free(dbuf, bs);
+
+	return (err);
+}
+
+int
+main(int argc, char **argv)
+{
+	ct_data_t ctd;
+	char *algs, *name, *last = NULL;
+	int err = 0;
+
+	(void) setvbuf(stdout, NULL, _IOLBF, 0);
+
+	dprintf_setup(&argc, argv);
+
+	process_options(argc, argv);
+
+	if (load_files(argc - optind, argv + optind, &ctd) != 0)
+		exit(1);
+
+	kernel_init(FREAD);
+
+	(void) printf("%llu blocks of %zu bytes\n\n",
+	    (u_longlong_t)ctd.ctd_nblocks, ct_opts.cto_blocksize);
+	(void) printf("%-14s %9s %12s %12s\n", "algorithm", "ratio",
+	    "comp MB/s", "decomp MB/s");
+
+	algs = strdup(ct_opts.cto_algorithms);
+	VERIFY3P(algs, !=, NULL);
+
+	for (name = strtok_r(algs, ",", &last); name != NULL;
+	    name = strtok_r(NULL, ",", &last)) {
+		enum zio_compress c = lookup_algorithm(name);
+
+		if (c == ZIO_COMPRESS_FUNCTIONS) {
+			(void) fprintf(stderr, "unknown algorithm '%s'\n",
+			    name);
+			err = 1;
+			continue;
+		}
+
+		if (!zio_compress_available(c)) {
+			(void) printf("%-14s %9s\n", name, "unavailable");
+			continue;
+		}
+
+		err |= run_algorithm(c, &ctd);
+	}
+
+	free(algs);
+	free(ctd.ctd_buf);
+
+	kernel_fini();
+
+	return (err);
+}
@@ -665,10 +665,16 @@ get_dtl_refcount(vdev_t *vd)
 int
 get_metaslab_refcount(vdev_t *vd)
 {
+	spa_vdev_removal_t *svr = vd->vdev_spa->spa_vdev_removal;
 	int refcount = 0;
 	int c, m;
 
-	if (vd->vdev_top == vd && !vd->vdev_removing) {
+	/*
+	 * A top-level vdev which is being removed keeps its metaslab space
+	 * maps until all of its data has been copied.
+	 */
+	if (vd->vdev_top == vd && (!vd->vdev_removing ||
+	    (svr != NULL && svr->svr_vdev_id == vd->vdev_id))) {
 		for (m = 0; m < vd->vdev_ms_count; m++) {
 			space_map_t *sm = vd->vdev_ms[m]->ms_sm;
 
@@ -781,7 +787,7 @@ dump_metaslab(metaslab_t *msp)
 	space_map_t *sm = msp->ms_sm;
 	char freebuf[32];
 
-	zdb_nicenum(msp->ms_size - space_map_allocated(sm), freebuf);
+	zdb_nicenum(msp->ms_size - msp->ms_allocated_space, freebuf);
 
 	(void) printf(
 	    "\tmetaslab %6llu   offset %12llx   spacemap %6llu   free    %5s\n",
@@ -2942,6 +2948,7 @@ typedef struct zdb_cb {
 	uint64_t	zcb_start;
 	uint64_t	zcb_lastprint;
 	uint64_t	zcb_totalasize;
+	uint64_t	zcb_removing_size;
 	uint64_t	zcb_errors[256];
 	int		zcb_readfails;
 	int		zcb_haderrors;
@@ -3216,6 +3223,57 @@ zdb_ddt_leak_init(spa_t *spa, zdb_cb_t *zcb)
 	ASSERT(error == ENOENT);
 }
 
+/* ARGSUSED */
+static void
+zdb_claim_removing_cb(uint64_t inner_offset, vdev_t *vd, uint64_t offset,
+    uint64_t size, void *arg)
+{
+	zdb_cb_t *zcb = arg;
+
+	VERIFY0(metaslab_claim_impl(vd, offset, size,
+	    spa_first_txg(vd->vdev_spa)));
+	zcb->zcb_removing_size += size;
+}
+
+/*
+ * Until a device removal has finished copying, the copied data of the
+ * removing vdev is allocated twice: at its source, which the traversal
+ * claims, and at its new location.  Claim the new locations of the
+ * source segments which are still allocated.
+ */
+static void
+zdb_claim_removing(spa_t *spa, zdb_cb_t *zcb)
+{
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+	uint64_t max_offset, m;
+	vdev_t *vd;
+
+	if (svr == NULL || svr->svr_copy_done)
+		return;
+
+	vd = vdev_lookup_top(spa, svr->svr_vdev_id);
+	max_offset = vdev_indirect_mapping_max_offset(
+	    vd->vdev_indirect_mapping);
+
+	for (m = 0; m < vd->vdev_ms_count; m++) {
+		metaslab_t *msp = vd->vdev_ms[m];
+		range_seg_t *rs;
+
+		if (msp->ms_start >= max_offset)
+			break;
+
+		mutex_enter(&msp->ms_lock);
+		for (rs = avl_first(&msp->ms_tree->rt_root); rs != NULL &&
+		    rs->rs_start < max_offset;
+		    rs = AVL_NEXT(&msp->ms_tree->rt_root, rs)) {
+			vdev_indirect_remap(vd, rs->rs_start,
+			    MIN(rs->rs_end, max_offset) - rs->rs_start,
+			    zdb_claim_removing_cb, zcb);
+		}
+		mutex_exit(&msp->ms_lock);
+	}
+}
+
 static void
 zdb_leak_init(spa_t *spa, zdb_cb_t *zcb)
 {
@@ -3232,6 +3290,8 @@ zdb_leak_init(spa_t *spa, zdb_cb_t *zcb)
 		 */
 		spa->spa_normal_class->mc_ops = &zdb_metaslab_ops;
 		spa->spa_log_class->mc_ops = &zdb_metaslab_ops;
+		spa->spa_special_class->mc_ops = &zdb_metaslab_ops;
+		spa->spa_dedup_class->mc_ops = &zdb_metaslab_ops;
 
 		for (c = 0; c < rvd->vdev_children; c++) {
 			vdev_t *vd = rvd->vdev_child[c];
@@ -3268,6 +3328,8 @@ zdb_leak_init(spa_t *spa, zdb_cb_t *zcb)
 					msp->ms_tree->rt_ops = NULL;
 					VERIFY0(space_map_load(msp->ms_sm,
 					    msp->ms_tree, SM_ALLOC));
+					metaslab_unflushed_load(msp,
+					    msp->ms_tree, SM_ALLOC);
 
 					if (!msp->ms_loaded)
 						msp->ms_loaded = B_TRUE;
@@ -3280,6 +3342,9 @@ zdb_leak_init(spa_t *spa, zdb_cb_t *zcb)
 
 	spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
 
+	if (!dump_opt['L'])
+		zdb_claim_removing(spa, zcb);
+
 	zdb_ddt_leak_init(spa, zcb);
 
 	spa_config_exit(spa, SCL_CONFIG, FTAG);
@@ -3343,6 +3408,7 @@ dump_block_stats(spa_t *spa)
 	zdb_cb_t zcb;
 	zdb_blkstats_t *zb, *tzb;
 	uint64_t norm_alloc, norm_space, total_alloc, total_found;
+	uint64_t special_alloc, special_space, dedup_alloc, dedup_space;
 	int flags = TRAVERSE_PRE | TRAVERSE_PREFETCH_METADATA |
 	    TRAVERSE_NO_DECRYPT | TRAVERSE_HARD;
 	boolean_t leaks = B_FALSE;
@@ -3385,7 +3451,9 @@ dump_block_stats(spa_t *spa)
 	if (dump_opt['c'] > 1)
 		flags |= TRAVERSE_PREFETCH_DATA;
 
-	zcb.zcb_totalasize = metaslab_class_get_alloc(spa_normal_class(spa));
+	zcb.zcb_totalasize = metaslab_class_get_alloc(spa_normal_class(spa)) +
+	    metaslab_class_get_alloc(spa_special_class(spa)) +
+	    metaslab_class_get_alloc(spa_dedup_class(spa));
 	zcb.zcb_start = zcb.zcb_lastprint = gethrtime();
 	zcb.zcb_haderrors |= traverse_pool(spa, 0, flags, zdb_blkptr_cb, &zcb);
 
@@ -3423,9 +3491,15 @@ dump_block_stats(spa_t *spa)
 
 	norm_alloc = metaslab_class_get_alloc(spa_normal_class(spa));
 	norm_space = metaslab_class_get_space(spa_normal_class(spa));
+	special_alloc = metaslab_class_get_alloc(spa_special_class(spa));
+	special_space = metaslab_class_get_space(spa_special_class(spa));
+	dedup_alloc = metaslab_class_get_alloc(spa_dedup_class(spa));
+	dedup_space = metaslab_class_get_space(spa_dedup_class(spa));
 
-	total_alloc = norm_alloc + metaslab_class_get_alloc(spa_log_class(spa));
-	total_found = tzb->zb_asize - zcb.zcb_dedup_asize;
+	total_alloc = norm_alloc + special_alloc + dedup_alloc +
+	    metaslab_class_get_alloc(spa_log_class(spa));
+	total_found = tzb->zb_asize - zcb.zcb_dedup_asize +
+	    zcb.zcb_removing_size;
 
 	if (total_found == total_alloc) {
 		if (!dump_opt['L'])
@@ -3470,6 +3544,18 @@ dump_block_stats(spa_t *spa)
 	(void) printf("\tSPA allocated: %10llu     used: %5.2f%%\n",
 	    (u_longlong_t)norm_alloc, 100.0 * norm_alloc / norm_space);
 
+	if (special_space != 0) {
+		(void) printf("\tSpecial class  %10llu     used: %5.2f%%\n",
+		    (u_longlong_t)special_alloc,
+		    100.0 * special_alloc / special_space);
+	}
+
+	if (dedup_space != 0) {
+		(void) printf("\tDedup class    %10llu     used: %5.2f%%\n",
+		    (u_longlong_t)dedup_alloc,
+		    100.0 * dedup_alloc / dedup_space);
+	}
+
 	for (i = 0; i < NUM_BP_EMBEDDED_TYPES; i++) {
 		if (zcb.zcb_embedded_blocks[i] == 0)
 			continue;
@@ -48,6 +48,7 @@
 #include <grp.h>
 #include <pwd.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/list.h>
 #include <sys/mkdev.h>
 #include <sys/mntent.h>
@@ -6213,6 +6214,40 @@ report_mount_progress(int current, int total)
 		update_progress(info);
 }
 
+typedef struct share_mount_state {
+	int		sm_op;
+	boolean_t	sm_verbose;
+	int		sm_flags;
+	char		*sm_options;
+	char		*sm_proto;
+	pthread_mutex_t	sm_lock; /* protects the remaining fields */
+	uint_t		sm_total; /* number of filesystems to process */
+	uint_t		sm_done; /* number of filesystems processed */
+	int		sm_status; /* nonzero if any operation failed */
+} share_mount_state_t;
+
+/*
+ * share/mount one filesystem on behalf of zfs_foreach_mountpoint().
+ */
+static int
+share_mount_one_cb(zfs_handle_t *zhp, void *arg)
+{
+	share_mount_state_t *sms = arg;
+	int ret;
+
+	ret = share_mount_one(zhp, sms->sm_op, sms->sm_flags, sms->sm_proto,
+	    B_FALSE, sms->sm_options);
+
+	pthread_mutex_lock(&sms->sm_lock);
+	if (ret != 0)
+		sms->sm_status = ret;
+	sms->sm_done++;
+	if (sms->sm_verbose)
+		report_mount_progress(sms->sm_done - 1, sms->sm_total);
+	pthread_mutex_unlock(&sms->sm_lock);
+	return (ret);
+}
+
 static void
 append_options(char *mntopts, char *newopts)
 {
@@ -6317,18 +6352,42 @@ share_mount(int op, int argc, char **argv)
 			return (0);
 		}
 
-		qsort(dslist, count, sizeof (void *), libzfs_dataset_cmp);
+		if (op == OP_MOUNT) {
+			share_mount_state_t sms = { 0 };
 
-		for (i = 0; i < count; i++) {
-			if (verbose)
-				report_mount_progress(i, count);
-
-			if (share_mount_one(dslist[i], op, flags, protocol,
-			    B_FALSE, options) != 0)
+			/*
+			 * Mount independent subtrees in parallel; a
+			 * filesystem is only mounted once the filesystem
+			 * holding its mountpoint has been.  Loading keys
+			 * may prompt, so that is done one at a time.
+			 */
+			sms.sm_op = op;
+			sms.sm_verbose = verbose;
+			sms.sm_flags = flags;
+			sms.sm_options = options;
+			sms.sm_proto = protocol;
+			sms.sm_total = count;
+			(void) pthread_mutex_init(&sms.sm_lock, NULL);
+
+			(void) zfs_foreach_mountpoint(g_zfs, dslist, count,
+			    share_mount_one_cb, &sms, !(flags & MS_CRYPT));
+			if (sms.sm_status != 0)
 				ret = 1;
-			zfs_close(dslist[i]);
+
+			(void) pthread_mutex_destroy(&sms.sm_lock);
+		} else {
+			qsort(dslist, count, sizeof (void *),
+			    libzfs_dataset_cmp);
+
+			for (i = 0; i < count; i++) {
+				if (share_mount_one(dslist[i], op, flags,
+				    protocol, B_FALSE, options) != 0)
+					ret = 1;
+			}
 		}
 
+		for (i = 0; i < count; i++)
+			zfs_close(dslist[i]);
 		free(dslist);
 	} else if (argc == 0) {
 		struct mnttab entry;
@@ -6552,6 +6611,17 @@ out:
 /*
  * Generic callback for unsharing or unmounting a filesystem.
  */
+/*
+ * Unmount one filesystem on behalf of zfs_foreach_mounted().
+ */
+static int
+unmount_one_cb(zfs_handle_t *zhp, const char *mountpoint, void *arg)
+{
+	int *flags = arg;
+
+	return (zfs_unmount(zhp, mountpoint, *flags));
+}
+
 static int
 unshare_unmount(int op, int argc, char **argv)
 {
@@ -6600,7 +6670,8 @@ unshare_unmount(int op, int argc, char **argv)
 		 * have to unmount the deepest filesystems first.  To accomplish
 		 * this, we place all the mountpoints in an AVL tree sorted by
 		 * the special type (dataset name), and walk the result in
-		 * reverse to make sure to get any snapshots first.
+		 * reverse to make sure to get any snapshots first.  Unmounts
+		 * are ordered by mountpoint instead, by zfs_foreach_mounted().
 		 */
 		struct mnttab entry;
 		uu_avl_pool_t *pool;
@@ -6608,6 +6679,9 @@ unshare_unmount(int op, int argc, char **argv)
 		unshare_unmount_node_t *node;
 		uu_avl_index_t idx;
 		uu_avl_walk_t *walk;
+		zfs_handle_t **handles;
+		char **mountpoints;
+		size_t count;
 		char *protocol = NULL;
 
 		if (op == OP_SHARE && argc > 0) {
@@ -6710,7 +6784,33 @@ unshare_unmount(int op, int argc, char **argv)
 		}
 
 		/*
-		 * Walk the AVL tree in reverse, unmounting each filesystem and
+		 * Filesystems are unmounted in parallel, each one only after
+		 * everything mounted beneath it, so first gather them up.
+		 */
+		if (op == OP_MOUNT) {
+			size_t i = 0;
+
+			count = uu_avl_numnodes(tree);
+			handles = safe_malloc((count + 1) *
+			    sizeof (zfs_handle_t *));
+			mountpoints = safe_malloc((count + 1) *
+			    sizeof (char *));
+			for (node = uu_avl_first(tree); node != NULL;
+			    node = uu_avl_next(tree, node), i++) {
+				handles[i] = node->un_zhp;
+				mountpoints[i] = node->un_mountp;
+			}
+
+			if (zfs_foreach_mounted(g_zfs, handles, mountpoints,
+			    count, unmount_one_cb, &flags) != 0)
+				ret = 1;
+
+			free(handles);
+			free(mountpoints);
+		}
+
+		/*
+		 * Walk the AVL tree in reverse, unsharing each filesystem and
 		 * removing it from the AVL tree in the process.
 		 */
 		if ((walk = uu_avl_walk_start(tree,
@@ -6720,19 +6820,10 @@ unshare_unmount(int op, int argc, char **argv)
 		while ((node = uu_avl_walk_next(walk)) != NULL) {
 			uu_avl_remove(tree, node);
 
-			switch (op) {
-			case OP_SHARE:
-				if (zfs_unshareall_bytype(node->un_zhp,
-				    node->un_mountp, protocol) != 0)
-					ret = 1;
-				break;
-
-			case OP_MOUNT:
-				if (zfs_unmount(node->un_zhp,
-				    node->un_mountp, flags) != 0)
-					ret = 1;
-				break;
-			}
+			if (op == OP_SHARE &&
+			    zfs_unshareall_bytype(node->un_zhp,
+			    node->un_mountp, protocol) != 0)
+				ret = 1;
 
 			zfs_close(node->un_zhp);
 			free(node->un_mountp);
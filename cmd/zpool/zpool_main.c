@@ -90,6 +90,7 @@ static int zpool_do_replace(int, char **);
 static int zpool_do_split(int, char **);
 
 static int zpool_do_scrub(int, char **);
+static int zpool_do_trim(int, char **);
 
 static int zpool_do_import(int, char **);
 static int zpool_do_export(int, char **);
@@ -142,6 +143,7 @@ typedef enum {
 	HELP_REMOVE,
 	HELP_SCRUB,
 	HELP_STATUS,
+	HELP_TRIM,
 	HELP_UPGRADE,
 	HELP_EVENTS,
 	HELP_GET,
@@ -180,7 +182,7 @@ enum iostat_type {
  * of all the nvlists a flag requires.  Also specifies the order in
  * which data gets printed in zpool iostat.
  */
-static const char *vsx_type_to_nvlist[IOS_COUNT][11] = {
+static const char *vsx_type_to_nvlist[IOS_COUNT][13] = {
 	[IOS_L_HISTO] = {
 	    ZPOOL_CONFIG_VDEV_TOT_R_LAT_HISTO,
 	    ZPOOL_CONFIG_VDEV_TOT_W_LAT_HISTO,
@@ -191,6 +193,7 @@ static const char *vsx_type_to_nvlist[IOS_COUNT][11] = {
 	    ZPOOL_CONFIG_VDEV_ASYNC_R_LAT_HISTO,
 	    ZPOOL_CONFIG_VDEV_ASYNC_W_LAT_HISTO,
 	    ZPOOL_CONFIG_VDEV_SCRUB_LAT_HISTO,
+	    ZPOOL_CONFIG_VDEV_TRIM_LAT_HISTO,
 	    NULL},
 	[IOS_LATENCY] = {
 	    ZPOOL_CONFIG_VDEV_TOT_R_LAT_HISTO,
@@ -204,6 +207,7 @@ static const char *vsx_type_to_nvlist[IOS_COUNT][11] = {
 	    ZPOOL_CONFIG_VDEV_ASYNC_R_ACTIVE_QUEUE,
 	    ZPOOL_CONFIG_VDEV_ASYNC_W_ACTIVE_QUEUE,
 	    ZPOOL_CONFIG_VDEV_SCRUB_ACTIVE_QUEUE,
+	    ZPOOL_CONFIG_VDEV_TRIM_ACTIVE_QUEUE,
 	    NULL},
 	[IOS_RQ_HISTO] = {
 	    ZPOOL_CONFIG_VDEV_SYNC_IND_R_HISTO,
@@ -216,6 +220,8 @@ static const char *vsx_type_to_nvlist[IOS_COUNT][11] = {
 	    ZPOOL_CONFIG_VDEV_ASYNC_AGG_W_HISTO,
 	    ZPOOL_CONFIG_VDEV_IND_SCRUB_HISTO,
 	    ZPOOL_CONFIG_VDEV_AGG_SCRUB_HISTO,
+	    ZPOOL_CONFIG_VDEV_IND_TRIM_HISTO,
+	    ZPOOL_CONFIG_VDEV_AGG_TRIM_HISTO,
 	    NULL},
 };
 
@@ -266,6 +272,7 @@ static zpool_command_t command_table[] = {
 	{ "split",	zpool_do_split,		HELP_SPLIT		},
 	{ NULL },
 	{ "scrub",	zpool_do_scrub,		HELP_SCRUB		},
+	{ "trim",	zpool_do_trim,		HELP_TRIM		},
 	{ NULL },
 	{ "import",	zpool_do_import,	HELP_IMPORT		},
 	{ "export",	zpool_do_export,	HELP_EXPORT		},
@@ -282,6 +289,19 @@ static zpool_command_t command_table[] = {
 
 #define	NCOMMAND	(ARRAY_SIZE(command_table))
 
+/*
+ * Allocation classes other than the normal class, in the order in which
+ * they are displayed after the main pool vdevs.
+ */
+static const struct {
+	const char *class;
+	const char *label;
+} vdev_classes[] = {
+	{ VDEV_ALLOC_BIAS_DEDUP,	"dedup" },
+	{ VDEV_ALLOC_BIAS_SPECIAL,	"special" },
+	{ VDEV_ALLOC_BIAS_LOG,		"logs" },
+};
+
 static zpool_command_t *current_command;
 static char history_str[HIS_MAX_RECORD_LEN];
 static boolean_t log_history = B_TRUE;
@@ -340,14 +360,18 @@ get_usage(zpool_help_t idx)
 		return (gettext("\treplace [-f] [-o property=value] "
 		    "<pool> <device> [new-device]\n"));
 	case HELP_REMOVE:
-		return (gettext("\tremove <pool> <device> ...\n"));
+		return (gettext("\tremove <pool> <device> ...\n"
+		    "\tremove -s <pool>\n"));
 	case HELP_REOPEN:
 		return (gettext("\treopen <pool>\n"));
 	case HELP_SCRUB:
 		return (gettext("\tscrub [-s | -p] <pool> ...\n"));
 	case HELP_STATUS:
-		return (gettext("\tstatus [-c [script1,script2,...]] [-gLPvxD]"
+		return (gettext("\tstatus [-c [script1,script2,...]] [-gLPvxDt]"
 		    "[-T d|u] [pool] ... [interval [count]]\n"));
+	case HELP_TRIM:
+		return (gettext("\ttrim [-r <rate>] [-c | -s] <pool> "
+		    "[<device> ...]\n"));
 	case HELP_UPGRADE:
 		return (gettext("\tupgrade\n"
 		    "\tupgrade -v\n"
@@ -459,9 +483,13 @@ usage(boolean_t requested)
 	exit(requested ? 0 : 2);
 }
 
+/*
+ * Print the vdev tree below 'nv', restricted at the top level to vdevs of
+ * the allocation class 'class' (NULL for the normal class).
+ */
 void
 print_vdev_tree(zpool_handle_t *zhp, const char *name, nvlist_t *nv, int indent,
-    boolean_t print_logs, int name_flags)
+    const char *class, int name_flags)
 {
 	nvlist_t **child;
 	uint_t c, children;
@@ -475,16 +503,15 @@ print_vdev_tree(zpool_handle_t *zhp, const char *name, nvlist_t *nv, int indent,
 		return;
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
+		const char *cls = vdev_class(child[c]);
 
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &is_log);
-		if ((is_log && !print_logs) || (!is_log && print_logs))
+		if ((cls == NULL) != (class == NULL) ||
+		    (cls != NULL && strcmp(cls, class) != 0))
 			continue;
 
 		vname = zpool_vdev_name(g_zfs, zhp, child[c], name_flags);
 		print_vdev_tree(zhp, vname, child[c], indent + 2,
-		    B_FALSE, name_flags);
+		    NULL, name_flags);
 		free(vname);
 	}
 }
@@ -723,19 +750,24 @@ zpool_do_add(int argc, char **argv)
 		    "configuration:\n"), zpool_get_name(zhp));
 
 		/* print original main pool and new tree */
-		print_vdev_tree(zhp, poolname, poolnvroot, 0, B_FALSE,
+		print_vdev_tree(zhp, poolname, poolnvroot, 0, NULL,
 		    name_flags);
-		print_vdev_tree(zhp, NULL, nvroot, 0, B_FALSE, name_flags);
-
-		/* Do the same for the logs */
-		if (num_logs(poolnvroot) > 0) {
-			print_vdev_tree(zhp, "logs", poolnvroot, 0, B_TRUE,
-			    name_flags);
-			print_vdev_tree(zhp, NULL, nvroot, 0, B_TRUE,
-			    name_flags);
-		} else if (num_logs(nvroot) > 0) {
-			print_vdev_tree(zhp, "logs", nvroot, 0, B_TRUE,
-			    name_flags);
+		print_vdev_tree(zhp, NULL, nvroot, 0, NULL, name_flags);
+
+		/* Do the same for the dedup, special and log classes */
+		for (c = 0; c < ARRAY_SIZE(vdev_classes); c++) {
+			const char *class = vdev_classes[c].class;
+			const char *label = vdev_classes[c].label;
+
+			if (num_class_vdevs(poolnvroot, class) > 0) {
+				print_vdev_tree(zhp, label, poolnvroot, 0,
+				    class, name_flags);
+				print_vdev_tree(zhp, NULL, nvroot, 0, class,
+				    name_flags);
+			} else if (num_class_vdevs(nvroot, class) > 0) {
+				print_vdev_tree(zhp, label, nvroot, 0, class,
+				    name_flags);
+			}
 		}
 
 		/* Do the same for the caches */
@@ -776,38 +808,67 @@ zpool_do_add(int argc, char **argv)
 
 /*
  * zpool remove  <pool> <vdev> ...
+ * zpool remove -s <pool>
+ *
+ *	-s	Stop and cancel an in-progress removal of a top-level vdev.
  *
  * Removes the given vdev from the pool.  Currently, this supports removing
- * spares, cache, and log devices from the pool.
+ * spares, cache, and log devices, and top-level mirror and disk vdevs,
+ * whose data is copied to the rest of the pool in the background.
  */
 int
 zpool_do_remove(int argc, char **argv)
 {
 	char *poolname;
-	int i, ret = 0;
+	int i, c, ret = 0;
+	boolean_t stop = B_FALSE;
 	zpool_handle_t *zhp = NULL;
 
-	argc--;
-	argv++;
+	/* check options */
+	while ((c = getopt(argc, argv, "s")) != -1) {
+		switch (c) {
+		case 's':
+			stop = B_TRUE;
+			break;
+		case '?':
+			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
+			    optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
 
 	/* get pool name and check number of arguments */
 	if (argc < 1) {
 		(void) fprintf(stderr, gettext("missing pool name argument\n"));
 		usage(B_FALSE);
 	}
-	if (argc < 2) {
+
+	poolname = argv[0];
+
+	if (stop) {
+		if (argc > 1) {
+			(void) fprintf(stderr, gettext("too many arguments\n"));
+			usage(B_FALSE);
+		}
+	} else if (argc < 2) {
 		(void) fprintf(stderr, gettext("missing device\n"));
 		usage(B_FALSE);
 	}
 
-	poolname = argv[0];
-
 	if ((zhp = zpool_open(g_zfs, poolname)) == NULL)
 		return (1);
 
-	for (i = 1; i < argc; i++) {
-		if (zpool_vdev_remove(zhp, argv[i]) != 0)
+	if (stop) {
+		if (zpool_vdev_remove_cancel(zhp) != 0)
 			ret = 1;
+	} else {
+		for (i = 1; i < argc; i++) {
+			if (zpool_vdev_remove(zhp, argv[i]) != 0)
+				ret = 1;
+		}
 	}
 	zpool_close(zhp);
 
@@ -1234,9 +1295,14 @@ zpool_do_create(int argc, char **argv)
 		(void) printf(gettext("would create '%s' with the "
 		    "following layout:\n\n"), poolname);
 
-		print_vdev_tree(NULL, poolname, nvroot, 0, B_FALSE, 0);
-		if (num_logs(nvroot) > 0)
-			print_vdev_tree(NULL, "logs", nvroot, 0, B_TRUE, 0);
+		print_vdev_tree(NULL, poolname, nvroot, 0, NULL, 0);
+		for (c = 0; c < ARRAY_SIZE(vdev_classes); c++) {
+			const char *class = vdev_classes[c].class;
+
+			if (num_class_vdevs(nvroot, class) > 0)
+				print_vdev_tree(NULL, vdev_classes[c].label,
+				    nvroot, 0, class, 0);
+		}
 
 		ret = 0;
 	} else {
@@ -1564,6 +1630,7 @@ typedef struct status_cbdata {
 	boolean_t	cb_first;
 	boolean_t	cb_dedup_stats;
 	boolean_t	cb_print_status;
+	boolean_t	cb_print_vdev_trim;
 	vdev_cmd_data_list_t	*vcdl;
 } status_cbdata_t;
 
@@ -1632,6 +1699,64 @@ zpool_print_cmd(vdev_cmd_data_list_t *vcdl, const char *pool, char *path)
 	}
 }
 
+/*
+ * Print the manual TRIM state of a leaf vdev.  When 'verbose' is set the
+ * progress, or the reason the vdev was not trimmed, is always printed;
+ * otherwise only an active TRIM is noted.
+ */
+static void
+print_status_trim(vdev_stat_t *vs, uint_t vsc, boolean_t verbose)
+{
+	char tbuf[256];
+	time_t t;
+
+	/* The stats may be from a kernel which predates TRIM. */
+	if (vsc < (offsetof(vdev_stat_t, vs_trim_action_time) /
+	    sizeof (uint64_t)) + 1)
+		return;
+
+	if (!verbose) {
+		if (vs->vs_trim_state == VDEV_TRIM_ACTIVE)
+			(void) printf(gettext("  (trimming)"));
+		return;
+	}
+
+	if (vs->vs_trim_notsup) {
+		(void) printf(gettext("  (trim unsupported)"));
+		return;
+	}
+
+	if (vs->vs_trim_state == VDEV_TRIM_NONE) {
+		(void) printf(gettext("  (untrimmed)"));
+		return;
+	}
+
+	t = vs->vs_trim_action_time;
+	(void) strftime(tbuf, sizeof (tbuf), "%c", localtime(&t));
+
+	(void) printf("  (%d%% %s", vs->vs_trim_bytes_est == 0 ? 0 :
+	    (int)(vs->vs_trim_bytes_done * 100 / vs->vs_trim_bytes_est),
+	    gettext("trimmed"));
+
+	switch (vs->vs_trim_state) {
+	case VDEV_TRIM_SUSPENDED:
+		(void) printf(gettext(", suspended, started at %s)"), tbuf);
+		break;
+	case VDEV_TRIM_ACTIVE:
+		(void) printf(gettext(", started at %s)"), tbuf);
+		break;
+	case VDEV_TRIM_CANCELED:
+		(void) printf(gettext(", canceled at %s)"), tbuf);
+		break;
+	case VDEV_TRIM_COMPLETE:
+		(void) printf(gettext(", completed at %s)"), tbuf);
+		break;
+	default:
+		(void) printf(")");
+		break;
+	}
+}
+
 /*
  * Print out configuration state as requested by status_callback.
  */
@@ -1640,7 +1765,7 @@ print_status_config(zpool_handle_t *zhp, status_cbdata_t *cb, const char *name,
     nvlist_t *nv, int depth, boolean_t isspare)
 {
 	nvlist_t **child;
-	uint_t c, children;
+	uint_t c, vsc, children;
 	pool_scan_stat_t *ps = NULL;
 	vdev_stat_t *vs;
 	char rbuf[6], wbuf[6], cbuf[6];
@@ -1655,7 +1780,7 @@ print_status_config(zpool_handle_t *zhp, status_cbdata_t *cb, const char *name,
 		children = 0;
 
 	verify(nvlist_lookup_uint64_array(nv, ZPOOL_CONFIG_VDEV_STATS,
-	    (uint64_t **)&vs, &c) == 0);
+	    (uint64_t **)&vs, &vsc) == 0);
 
 	state = zpool_state_to_name(vs->vs_state, vs->vs_aux);
 	if (isspare) {
@@ -1765,6 +1890,10 @@ print_status_config(zpool_handle_t *zhp, status_cbdata_t *cb, const char *name,
 		    "resilvering" : "repairing");
 	}
 
+	/* Display TRIM state and progress of leaf vdevs */
+	if (children == 0 && !isspare)
+		print_status_trim(vs, vsc, cb->cb_print_vdev_trim);
+
 	if (cb->vcdl != NULL) {
 		if (nvlist_lookup_string(nv, ZPOOL_CONFIG_PATH, &path) == 0) {
 			printf("  ");
@@ -1775,14 +1904,11 @@ print_status_config(zpool_handle_t *zhp, status_cbdata_t *cb, const char *name,
 	(void) printf("\n");
 
 	for (c = 0; c < children; c++) {
-		uint64_t islog = B_FALSE, ishole = B_FALSE;
-
-		/* Don't print logs or holes here */
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &islog);
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_HOLE,
-		    &ishole);
-		if (islog || ishole)
+		/*
+		 * Don't print logs, other allocation classes, holes or
+		 * removed devices here
+		 */
+		if (vdev_class(child[c]) != NULL || vdev_is_hidden(child[c]))
 			continue;
 		vname = zpool_vdev_name(g_zfs, zhp, child[c],
 		    cb->cb_name_flags | VDEV_NAME_TYPE_ID);
@@ -1806,8 +1932,7 @@ print_import_config(status_cbdata_t *cb, const char *name, nvlist_t *nv,
 	char *type, *vname;
 
 	verify(nvlist_lookup_string(nv, ZPOOL_CONFIG_TYPE, &type) == 0);
-	if (strcmp(type, VDEV_TYPE_MISSING) == 0 ||
-	    strcmp(type, VDEV_TYPE_HOLE) == 0)
+	if (strcmp(type, VDEV_TYPE_MISSING) == 0 || vdev_is_hidden(nv))
 		return;
 
 	verify(nvlist_lookup_uint64_array(nv, ZPOOL_CONFIG_VDEV_STATS,
@@ -1860,11 +1985,7 @@ print_import_config(status_cbdata_t *cb, const char *name, nvlist_t *nv,
 		return;
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
-
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &is_log);
-		if (is_log)
+		if (vdev_class(child[c]) != NULL)
 			continue;
 
 		vname = zpool_vdev_name(g_zfs, NULL, child[c],
@@ -1897,32 +2018,33 @@ print_import_config(status_cbdata_t *cb, const char *name, nvlist_t *nv,
 }
 
 /*
- * Print log vdevs.
- * Logs are recorded as top level vdevs in the main pool child array
- * but with "is_log" set to 1. We use either print_status_config() or
- * print_import_config() to print the top level logs then any log
- * children (eg mirrored slogs) are printed recursively - which
- * works because only the top level vdev is marked "is_log"
+ * Print log, special or dedup vdevs.
+ * These are recorded as top level vdevs in the main pool child array
+ * but with "is_log" set to 1 or an "alloc_bias" string. We use either
+ * print_status_config() or print_import_config() to print the top level
+ * vdevs of the class, then any children (eg mirrored slogs) are printed
+ * recursively - which works because only the top level vdev is marked.
  */
 static void
-print_logs(zpool_handle_t *zhp, status_cbdata_t *cb, nvlist_t *nv)
+print_class_vdevs(zpool_handle_t *zhp, status_cbdata_t *cb, nvlist_t *nv,
+    const char *class, const char *label)
 {
 	uint_t c, children;
 	nvlist_t **child;
 
-	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN, &child,
-	    &children) != 0)
+	if (num_class_vdevs(nv, class) == 0)
 		return;
 
-	(void) printf(gettext("\tlogs\n"));
+	verify(nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN, &child,
+	    &children) == 0);
+
+	(void) printf("\t%s\n", gettext(label));
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
+		const char *cls = vdev_class(child[c]);
 		char *name;
 
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &is_log);
-		if (!is_log)
+		if (cls == NULL || strcmp(cls, class) != 0)
 			continue;
 		name = zpool_vdev_name(g_zfs, zhp, child[c],
 		    cb->cb_name_flags | VDEV_NAME_TYPE_ID);
@@ -1952,7 +2074,7 @@ show_import(nvlist_t *config)
 	zpool_status_t reason;
 	zpool_errata_t errata;
 	const char *health;
-	uint_t vsc;
+	uint_t vsc, c;
 	char *comment;
 	status_cbdata_t cb = { 0 };
 
@@ -2218,8 +2340,9 @@ show_import(nvlist_t *config)
 		cb.cb_namewidth = 10;
 
 	print_import_config(&cb, name, nvroot, 0);
-	if (num_logs(nvroot) > 0)
-		print_logs(NULL, &cb, nvroot);
+	for (c = 0; c < ARRAY_SIZE(vdev_classes); c++)
+		print_class_vdevs(NULL, &cb, nvroot, vdev_classes[c].class,
+		    vdev_classes[c].label);
 
 	if (reason == ZPOOL_STATUS_BAD_GUID_SUM) {
 		(void) printf(gettext("\n\tAdditional devices are known to "
@@ -2874,21 +2997,22 @@ typedef struct name_and_columns {
 	unsigned int columns;	/* Center name to this number of columns */
 } name_and_columns_t;
 
-#define	IOSTAT_MAX_LABELS	11	/* Max number of labels on one line */
+#define	IOSTAT_MAX_LABELS	13	/* Max number of labels on one line */
 
 static const name_and_columns_t iostat_top_labels[][IOSTAT_MAX_LABELS] =
 {
 	[IOS_DEFAULT] = {{"capacity", 2}, {"operations", 2}, {"bandwidth", 2},
 	    {NULL}},
 	[IOS_LATENCY] = {{"total_wait", 2}, {"disk_wait", 2}, {"syncq_wait", 2},
-	    {"asyncq_wait", 2}, {"scrub"}},
+	    {"asyncq_wait", 2}, {"scrub"}, {"trim"}, {NULL}},
 	[IOS_QUEUES] = {{"syncq_read", 2}, {"syncq_write", 2},
 	    {"asyncq_read", 2}, {"asyncq_write", 2}, {"scrubq_read", 2},
-	    {NULL}},
+	    {"trimq_write", 2}, {NULL}},
 	[IOS_L_HISTO] = {{"total_wait", 2}, {"disk_wait", 2},
 	    {"sync_queue", 2}, {"async_queue", 2}, {NULL}},
 	[IOS_RQ_HISTO] = {{"sync_read", 2}, {"sync_write", 2},
-	    {"async_read", 2}, {"async_write", 2}, {"scrub", 2}, {NULL}},
+	    {"async_read", 2}, {"async_write", 2}, {"scrub", 2},
+	    {"trim", 2}, {NULL}},
 
 };
 
@@ -2898,13 +3022,14 @@ static const name_and_columns_t iostat_bottom_labels[][IOSTAT_MAX_LABELS] =
 	[IOS_DEFAULT] = {{"alloc"}, {"free"}, {"read"}, {"write"}, {"read"},
 	    {"write"}, {NULL}},
 	[IOS_LATENCY] = {{"read"}, {"write"}, {"read"}, {"write"}, {"read"},
-	    {"write"}, {"read"}, {"write"}, {"wait"}, {NULL}},
+	    {"write"}, {"read"}, {"write"}, {"wait"}, {"wait"}, {NULL}},
 	[IOS_QUEUES] = {{"pend"}, {"activ"}, {"pend"}, {"activ"}, {"pend"},
-	    {"activ"}, {"pend"}, {"activ"}, {"pend"}, {"activ"}, {NULL}},
+	    {"activ"}, {"pend"}, {"activ"}, {"pend"}, {"activ"},
+	    {"pend"}, {"activ"}, {NULL}},
 	[IOS_L_HISTO] = {{"read"}, {"write"}, {"read"}, {"write"}, {"read"},
-	    {"write"}, {"read"}, {"write"}, {"scrub"}, {NULL}},
+	    {"write"}, {"read"}, {"write"}, {"scrub"}, {"trim"}, {NULL}},
 	[IOS_RQ_HISTO] = {{"ind"}, {"agg"}, {"ind"}, {"agg"}, {"ind"}, {"agg"},
-	    {"ind"}, {"agg"}, {"ind"}, {"agg"}, {NULL}},
+	    {"ind"}, {"agg"}, {"ind"}, {"agg"}, {"ind"}, {"agg"}, {NULL}},
 };
 
 static const char *histo_to_title[] = {
@@ -3528,6 +3653,8 @@ print_iostat_queues(iostat_cbdata_t *cb, nvlist_t *oldnv,
 		ZPOOL_CONFIG_VDEV_ASYNC_W_ACTIVE_QUEUE,
 		ZPOOL_CONFIG_VDEV_SCRUB_PEND_QUEUE,
 		ZPOOL_CONFIG_VDEV_SCRUB_ACTIVE_QUEUE,
+		ZPOOL_CONFIG_VDEV_TRIM_PEND_QUEUE,
+		ZPOOL_CONFIG_VDEV_TRIM_ACTIVE_QUEUE,
 	};
 
 	struct stat_array *nva;
@@ -3566,6 +3693,7 @@ print_iostat_latency(iostat_cbdata_t *cb, nvlist_t *oldnv,
 		ZPOOL_CONFIG_VDEV_ASYNC_R_LAT_HISTO,
 		ZPOOL_CONFIG_VDEV_ASYNC_W_LAT_HISTO,
 		ZPOOL_CONFIG_VDEV_SCRUB_LAT_HISTO,
+		ZPOOL_CONFIG_VDEV_TRIM_LAT_HISTO,
 	};
 	struct stat_array *nva;
 
@@ -3646,6 +3774,7 @@ print_vdev_stats(zpool_handle_t *zhp, const char *name, nvlist_t *oldnv,
 	vdev_stat_t *oldvs, *newvs, *calcvs;
 	vdev_stat_t zerovs = { 0 };
 	char *vname;
+	uint_t n;
 	int i;
 	int ret = 0;
 	uint64_t tdelta;
@@ -3759,15 +3888,8 @@ children:
 		return (ret);
 
 	for (c = 0; c < children; c++) {
-		uint64_t ishole = B_FALSE, islog = B_FALSE;
-
-		(void) nvlist_lookup_uint64(newchild[c], ZPOOL_CONFIG_IS_HOLE,
-		    &ishole);
-
-		(void) nvlist_lookup_uint64(newchild[c], ZPOOL_CONFIG_IS_LOG,
-		    &islog);
-
-		if (ishole || islog)
+		if (vdev_is_hidden(newchild[c]) ||
+		    vdev_class(newchild[c]) != NULL)
 			continue;
 
 		vname = zpool_vdev_name(g_zfs, zhp, newchild[c],
@@ -3778,22 +3900,24 @@ children:
 	}
 
 	/*
-	 * Log device section
+	 * Dedup, special and log device sections
 	 */
+	for (n = 0; n < ARRAY_SIZE(vdev_classes); n++) {
+		const char *class = vdev_classes[n].class;
+
+		if (num_class_vdevs(newnv, class) == 0)
+			continue;
 
-	if (num_logs(newnv) > 0) {
 		if ((!(cb->cb_flags & IOS_ANYHISTO_M)) && !cb->cb_scripted &&
 		    !cb->cb_vdev_names) {
-			print_iostat_dashes(cb, 0, "logs");
+			print_iostat_dashes(cb, 0, vdev_classes[n].label);
 		}
 		printf("\n");
 
 		for (c = 0; c < children; c++) {
-			uint64_t islog = B_FALSE;
-			(void) nvlist_lookup_uint64(newchild[c],
-			    ZPOOL_CONFIG_IS_LOG, &islog);
+			const char *cls = vdev_class(newchild[c]);
 
-			if (islog) {
+			if (cls != NULL && strcmp(cls, class) == 0) {
 				vname = zpool_vdev_name(g_zfs, zhp, newchild[c],
 				    cb->cb_name_flags);
 				ret += print_vdev_stats(zhp, vname, oldnv ?
@@ -3802,7 +3926,6 @@ children:
 				free(vname);
 			}
 		}
-
 	}
 
 	/*
@@ -4924,8 +5047,7 @@ print_list_stats(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
 	uint_t c, children;
 	char *vname;
 	boolean_t scripted = cb->cb_scripted;
-	uint64_t islog = B_FALSE;
-	boolean_t haslog = B_FALSE;
+	uint_t n;
 	char *dashes = "%-*s      -      -      -         -      -      -\n";
 
 	verify(nvlist_lookup_uint64_array(nv, ZPOOL_CONFIG_VDEV_STATS,
@@ -4979,17 +5101,11 @@ print_list_stats(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
 		return;
 
 	for (c = 0; c < children; c++) {
-		uint64_t ishole = B_FALSE;
-
-		if (nvlist_lookup_uint64(child[c],
-		    ZPOOL_CONFIG_IS_HOLE, &ishole) == 0 && ishole)
+		if (vdev_is_hidden(child[c]))
 			continue;
 
-		if (nvlist_lookup_uint64(child[c],
-		    ZPOOL_CONFIG_IS_LOG, &islog) == 0 && islog) {
-			haslog = B_TRUE;
+		if (vdev_class(child[c]) != NULL)
 			continue;
-		}
 
 		vname = zpool_vdev_name(g_zfs, zhp, child[c],
 		    cb->cb_name_flags);
@@ -4997,12 +5113,18 @@ print_list_stats(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
 		free(vname);
 	}
 
-	if (haslog == B_TRUE) {
+	for (n = 0; n < ARRAY_SIZE(vdev_classes); n++) {
+		const char *class = vdev_classes[n].class;
+
+		if (num_class_vdevs(nv, class) == 0)
+			continue;
+
 		/* LINTED E_SEC_PRINTF_VAR_FMT */
-		(void) printf(dashes, cb->cb_namewidth, "log");
+		(void) printf(dashes, cb->cb_namewidth, class);
 		for (c = 0; c < children; c++) {
-			if (nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-			    &islog) != 0 || !islog)
+			const char *cls = vdev_class(child[c]);
+
+			if (cls == NULL || strcmp(cls, class) != 0)
 				continue;
 			vname = zpool_vdev_name(g_zfs, zhp, child[c],
 			    cb->cb_name_flags);
@@ -5519,7 +5641,7 @@ zpool_do_split(int argc, char **argv)
 		if (flags.dryrun) {
 			(void) printf(gettext("would create '%s' with the "
 			    "following layout:\n\n"), newpool);
-			print_vdev_tree(NULL, newpool, config, 0, B_FALSE,
+			print_vdev_tree(NULL, newpool, config, 0, NULL,
 			    flags.name_flags);
 		}
 	}
@@ -5966,6 +6088,128 @@ zpool_do_scrub(int argc, char **argv)
 	return (for_each_pool(argc, argv, B_TRUE, NULL, scrub_callback, &cb));
 }
 
+/*
+ * Add the names of all concrete leaf vdevs below 'nv' to the list of
+ * vdevs to be trimmed.  Spares and cache devices are not part of the
+ * vdev tree and are never trimmed.
+ */
+static void
+trim_add_leaves(zpool_handle_t *zhp, nvlist_t *nv, nvlist_t *vdevs)
+{
+	nvlist_t **child;
+	uint_t c, children;
+	char *type;
+
+	verify(nvlist_lookup_string(nv, ZPOOL_CONFIG_TYPE, &type) == 0);
+	if (vdev_is_hidden(nv) || strcmp(type, VDEV_TYPE_MISSING) == 0)
+		return;
+
+	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0) {
+		char *vname = zpool_vdev_name(g_zfs, zhp, nv, VDEV_NAME_PATH);
+		fnvlist_add_boolean(vdevs, vname);
+		free(vname);
+		return;
+	}
+
+	for (c = 0; c < children; c++)
+		trim_add_leaves(zhp, child[c], vdevs);
+}
+
+/*
+ * zpool trim [-r <rate>] [-c | -s] <pool> [<device> ...]
+ *
+ *	-c		Cancel. Ends any in-progress trim.
+ *	-s		Suspend. TRIM can then be restarted with no flags.
+ *	-r <rate>	Limit the TRIM to <rate> bytes/sec per device.
+ *
+ * Trim the free space of the given devices, or of all leaf devices in
+ * the pool when no devices are specified.
+ */
+int
+zpool_do_trim(int argc, char **argv)
+{
+	zpool_handle_t *zhp;
+	nvlist_t *vdevs, *config, *nvroot;
+	pool_trim_func_t cmd_type = POOL_TRIM_START;
+	uint64_t rate = 0;
+	char *poolname;
+	int c, i, err;
+
+	/* check options */
+	while ((c = getopt(argc, argv, "csr:")) != -1) {
+		switch (c) {
+		case 'c':
+			if (cmd_type != POOL_TRIM_START &&
+			    cmd_type != POOL_TRIM_CANCEL) {
+				(void) fprintf(stderr, gettext("-c cannot be "
+				    "combined with other options\n"));
+				usage(B_FALSE);
+			}
+			cmd_type = POOL_TRIM_CANCEL;
+			break;
+		case 's':
+			if (cmd_type != POOL_TRIM_START &&
+			    cmd_type != POOL_TRIM_SUSPEND) {
+				(void) fprintf(stderr, gettext("-s cannot be "
+				    "combined with other options\n"));
+				usage(B_FALSE);
+			}
+			cmd_type = POOL_TRIM_SUSPEND;
+			break;
+		case 'r':
+			if (zfs_nicestrtonum(g_zfs, optarg, &rate) == -1 ||
+			    rate == 0) {
+				(void) fprintf(stderr, gettext("invalid value "
+				    "'%s' for -r option\n"), optarg);
+				usage(B_FALSE);
+			}
+			break;
+		case '?':
+			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
+			    optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) {
+		(void) fprintf(stderr, gettext("missing pool name argument\n"));
+		usage(B_FALSE);
+	}
+
+	if (rate != 0 && cmd_type != POOL_TRIM_START) {
+		(void) fprintf(stderr, gettext("-r cannot be combined with "
+		    "the -c or -s options\n"));
+		usage(B_FALSE);
+	}
+
+	poolname = argv[0];
+	if ((zhp = zpool_open(g_zfs, poolname)) == NULL)
+		return (1);
+
+	vdevs = fnvlist_alloc();
+	if (argc == 1) {
+		/* no individual leaf vdevs specified, so add them all */
+		config = zpool_get_config(zhp, NULL);
+		verify(nvlist_lookup_nvlist(config, ZPOOL_CONFIG_VDEV_TREE,
+		    &nvroot) == 0);
+		trim_add_leaves(zhp, nvroot, vdevs);
+	} else {
+		for (i = 1; i < argc; i++)
+			fnvlist_add_boolean(vdevs, argv[i]);
+	}
+
+	err = zpool_trim(zhp, cmd_type, vdevs, rate);
+
+	fnvlist_free(vdevs);
+	zpool_close(zhp);
+
+	return (err != 0);
+}
+
 /*
  * Print out detailed scrub status.
  */
@@ -5974,10 +6218,11 @@ print_scan_status(pool_scan_stat_t *ps)
 {
 	time_t start, end, pause;
 	uint64_t elapsed, mins_left, hours_left;
-	uint64_t pass_exam, examined, total;
-	uint_t rate;
+	uint64_t pass_scanned, scanned, pass_issued, issued, total;
+	uint_t scan_rate, issue_rate;
 	double fraction_done;
-	char processed_buf[7], examined_buf[7], total_buf[7], rate_buf[7];
+	char processed_buf[7], scanned_buf[7], issued_buf[7], total_buf[7];
+	char srate_buf[7], irate_buf[7];
 
 	(void) printf(gettext("  scan: "));
 
@@ -6049,50 +6294,158 @@ print_scan_status(pool_scan_stat_t *ps)
 		    ctime(&start));
 	}
 
-	examined = ps->pss_examined ? ps->pss_examined : 1;
+	/*
+	 * A scan first finds blocks ("scanned") and may then hold on to
+	 * them so it can read them in order ("issued"); progress and the
+	 * time left are based on what has been issued.
+	 */
+	scanned = ps->pss_examined;
+	pass_scanned = ps->pss_pass_exam;
+	issued = ps->pss_issued;
+	pass_issued = ps->pss_pass_issued;
 	total = ps->pss_to_examine;
-	fraction_done = (double)examined / total;
 
-	/* elapsed time for this pass */
+	/* we are only done with a block once we have issued the IO for it */
+	fraction_done = (double)issued / total;
+
+	/* elapsed time for this pass, rounding up to 1 if it's 0 */
 	elapsed = time(NULL) - ps->pss_pass_start;
 	elapsed -= ps->pss_pass_scrub_spent_paused;
-	elapsed = elapsed ? elapsed : 1;
-	pass_exam = ps->pss_pass_exam ? ps->pss_pass_exam : 1;
-	rate = pass_exam / elapsed;
-	rate = rate ? rate : 1;
-	mins_left = ((total - examined) / rate) / 60;
+	elapsed = (elapsed != 0) ? elapsed : 1;
+
+	scan_rate = pass_scanned / elapsed;
+	issue_rate = pass_issued / elapsed;
+	issue_rate = issue_rate ? issue_rate : 1;
+	mins_left = ((total - MIN(issued, total)) / issue_rate) / 60;
 	hours_left = mins_left / 60;
 
-	zfs_nicebytes(examined, examined_buf, sizeof (examined_buf));
+	zfs_nicebytes(scanned, scanned_buf, sizeof (scanned_buf));
+	zfs_nicebytes(issued, issued_buf, sizeof (issued_buf));
 	zfs_nicebytes(total, total_buf, sizeof (total_buf));
+	zfs_nicebytes(scan_rate, srate_buf, sizeof (srate_buf));
+	zfs_nicebytes(issue_rate, irate_buf, sizeof (irate_buf));
+
+	/* do not print rates for a paused scrub */
+	if (pause == 0) {
+		(void) printf(gettext("\t%s scanned at %s/s, "
+		    "%s issued at %s/s, %s total\n"),
+		    scanned_buf, srate_buf, issued_buf, irate_buf, total_buf);
+	} else {
+		(void) printf(gettext("\t%s scanned, %s issued, %s total\n"),
+		    scanned_buf, issued_buf, total_buf);
+	}
+
+	if (ps->pss_func == POOL_SCAN_RESILVER) {
+		(void) printf(gettext("\t%s resilvered, %.2f%% done"),
+		    processed_buf, 100 * fraction_done);
+	} else if (ps->pss_func == POOL_SCAN_SCRUB) {
+		(void) printf(gettext("\t%s repaired, %.2f%% done"),
+		    processed_buf, 100 * fraction_done);
+	}
 
 	/*
 	 * do not print estimated time if hours_left is more than 30 days
 	 * or we have a paused scrub
 	 */
 	if (pause == 0) {
-		zfs_nicebytes(rate, rate_buf, sizeof (rate_buf));
-		(void) printf(gettext("\t%s scanned out of %s at %s/s"),
-		    examined_buf, total_buf, rate_buf);
 		if (hours_left < (30 * 24)) {
 			(void) printf(gettext(", %lluh%um to go\n"),
 			    (u_longlong_t)hours_left, (uint_t)(mins_left % 60));
 		} else {
 			(void) printf(gettext(
-			    ", (scan is slow, no estimated time)\n"));
+			    ", no estimated completion time\n"));
 		}
 	} else {
-		(void) printf(gettext("\t%s scanned out of %s\n"),
-		    examined_buf, total_buf);
+		(void) printf("\n");
 	}
+}
 
-	if (ps->pss_func == POOL_SCAN_RESILVER) {
-		(void) printf(gettext("\t%s resilvered, %.2f%% done\n"),
-		    processed_buf, 100 * fraction_done);
-	} else if (ps->pss_func == POOL_SCAN_SCRUB) {
-		(void) printf(gettext("\t%s repaired, %.2f%% done\n"),
-		    processed_buf, 100 * fraction_done);
+/*
+ * Print out the progress, or the result, of the last top-level device
+ * removal.
+ */
+static void
+print_removal_status(zpool_handle_t *zhp, pool_removal_stat_t *prs)
+{
+	char copied_buf[7], total_buf[7], rate_buf[7], mem_buf[7];
+	time_t start, end;
+	nvlist_t *config, *nvroot;
+	nvlist_t **child;
+	uint_t children;
+	char *vdev_name;
+
+	if (prs == NULL || prs->prs_state == DSS_NONE)
+		return;
+
+	config = zpool_get_config(zhp, NULL);
+	nvroot = fnvlist_lookup_nvlist(config, ZPOOL_CONFIG_VDEV_TREE);
+	verify(nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) == 0);
+	assert(prs->prs_removing_vdev < children);
+	vdev_name = zpool_vdev_name(g_zfs, zhp,
+	    child[prs->prs_removing_vdev], VDEV_NAME_TYPE_ID);
+
+	(void) printf(gettext("remove: "));
+
+	start = prs->prs_start_time;
+	end = prs->prs_end_time;
+	zfs_nicebytes(prs->prs_copied, copied_buf, sizeof (copied_buf));
+
+	if (prs->prs_state == DSS_FINISHED) {
+		uint64_t minutes_taken = (end - start) / 60;
+
+		(void) printf(gettext("removal of %s copied %s in %lluh%um, "
+		    "completed on %s"), vdev_name, copied_buf,
+		    (u_longlong_t)(minutes_taken / 60),
+		    (uint_t)(minutes_taken % 60), ctime(&end));
+	} else if (prs->prs_state == DSS_CANCELED) {
+		(void) printf(gettext("removal of %s canceled on %s"),
+		    vdev_name, ctime(&end));
+	} else {
+		uint64_t copied, total, elapsed, rate, mins_left, hours_left;
+
+		assert(prs->prs_state == DSS_SCANNING);
+
+		(void) printf(gettext("evacuation of %s in progress "
+		    "since %s"), vdev_name, ctime(&start));
+
+		copied = prs->prs_copied;
+		total = prs->prs_to_copy;
+
+		/* elapsed time, rounding up to 1 if it's 0 */
+		elapsed = time(NULL) - start;
+		elapsed = (elapsed != 0) ? elapsed : 1;
+		rate = copied / elapsed;
+		rate = rate ? rate : 1;
+		mins_left = ((total - MIN(copied, total)) / rate) / 60;
+		hours_left = mins_left / 60;
+
+		zfs_nicebytes(total, total_buf, sizeof (total_buf));
+		zfs_nicebytes(rate, rate_buf, sizeof (rate_buf));
+
+		(void) printf(gettext("\t%s copied out of %s at %s/s, "
+		    "%.2f%% done"), copied_buf, total_buf, rate_buf,
+		    total != 0 ? 100 * (double)MIN(copied, total) / total :
+		    100.0);
+
+		/* do not print estimated time if it is more than 30 days */
+		if (hours_left < (30 * 24)) {
+			(void) printf(gettext(", %lluh%um to go\n"),
+			    (u_longlong_t)hours_left, (uint_t)(mins_left % 60));
+		} else {
+			(void) printf(gettext(
+			    ", no estimated completion time\n"));
+		}
 	}
+
+	if (prs->prs_mapping_memory > 0) {
+		zfs_nicebytes(prs->prs_mapping_memory, mem_buf,
+		    sizeof (mem_buf));
+		(void) printf(gettext("\t%s memory used for removed device "
+		    "mappings\n"), mem_buf);
+	}
+
+	free(vdev_name);
 }
 
 static void
@@ -6501,11 +6854,16 @@ status_callback(zpool_handle_t *zhp, void *data)
 		nvlist_t **spares, **l2cache;
 		uint_t nspares, nl2cache;
 		pool_scan_stat_t *ps = NULL;
+		pool_removal_stat_t *prs = NULL;
 
 		(void) nvlist_lookup_uint64_array(nvroot,
 		    ZPOOL_CONFIG_SCAN_STATS, (uint64_t **)&ps, &c);
 		print_scan_status(ps);
 
+		(void) nvlist_lookup_uint64_array(nvroot,
+		    ZPOOL_CONFIG_REMOVAL_STATS, (uint64_t **)&prs, &c);
+		print_removal_status(zhp, prs);
+
 		cbp->cb_namewidth = max_width(zhp, nvroot, 0, 0,
 		    cbp->cb_name_flags | VDEV_NAME_TYPE_ID);
 		if (cbp->cb_namewidth < 10)
@@ -6523,8 +6881,9 @@ status_callback(zpool_handle_t *zhp, void *data)
 		print_status_config(zhp, cbp, zpool_get_name(zhp), nvroot, 0,
 		    B_FALSE);
 
-		if (num_logs(nvroot) > 0)
-			print_logs(zhp, cbp, nvroot);
+		for (c = 0; c < ARRAY_SIZE(vdev_classes); c++)
+			print_class_vdevs(zhp, cbp, nvroot,
+			    vdev_classes[c].class, vdev_classes[c].label);
 		if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_L2CACHE,
 		    &l2cache, &nl2cache) == 0)
 			print_l2cache(zhp, cbp, l2cache, nl2cache);
@@ -6579,7 +6938,7 @@ status_callback(zpool_handle_t *zhp, void *data)
 }
 
 /*
- * zpool status [-c [script1,script2,...]] [-gLPvx] [-T d|u] [pool] ...
+ * zpool status [-c [script1,script2,...]] [-gLPvxt] [-T d|u] [pool] ...
  *              [interval [count]]
  *
  *	-c CMD	For each vdev, run command CMD
@@ -6589,6 +6948,7 @@ status_callback(zpool_handle_t *zhp, void *data)
  *	-v	Display complete error logs
  *	-x	Display only pools with potential problems
  *	-D	Display dedup status (undocumented)
+ *	-t	Display TRIM status of each leaf vdev
  *	-T	Display a timestamp in date(1) or Unix format
  *
  * Describes the health status of all pools or some subset.
@@ -6604,7 +6964,7 @@ zpool_do_status(int argc, char **argv)
 	char *cmd = NULL;
 
 	/* check options */
-	while ((c = getopt(argc, argv, "c:gLPvxDT:")) != -1) {
+	while ((c = getopt(argc, argv, "c:gLPvxDtT:")) != -1) {
 		switch (c) {
 		case 'c':
 			if (cmd != NULL) {
@@ -6648,6 +7008,9 @@ zpool_do_status(int argc, char **argv)
 		case 'D':
 			cb.cb_dedup_stats = B_TRUE;
 			break;
+		case 't':
+			cb.cb_print_vdev_trim = B_TRUE;
+			break;
 		case 'T':
 			get_timestamp_arg(*optarg);
 			break;
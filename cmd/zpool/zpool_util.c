@@ -86,6 +86,69 @@ num_logs(nvlist_t *nv)
 	return (nlogs);
 }
 
+/*
+ * Return the allocation class of a top-level vdev: "log", "special" or
+ * "dedup", or NULL for a vdev in the normal class.
+ */
+const char *
+vdev_class(nvlist_t *nv)
+{
+	uint64_t is_log = B_FALSE;
+	char *bias;
+
+	(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_LOG, &is_log);
+	if (is_log)
+		return (VDEV_ALLOC_BIAS_LOG);
+
+	if (nvlist_lookup_string(nv, ZPOOL_CONFIG_ALLOCATION_BIAS, &bias) == 0)
+		return (bias);
+
+	return (NULL);
+}
+
+/*
+ * Holes and the indirect vdevs left behind by device removal take up a
+ * slot in the vdev tree but have no storage, so they are never shown.
+ */
+boolean_t
+vdev_is_hidden(nvlist_t *nv)
+{
+	uint64_t ishole = B_FALSE;
+	char *type;
+
+	(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_HOLE, &ishole);
+	if (ishole)
+		return (B_TRUE);
+
+	return (nvlist_lookup_string(nv, ZPOOL_CONFIG_TYPE, &type) == 0 &&
+	    (strcmp(type, VDEV_TYPE_HOLE) == 0 ||
+	    strcmp(type, VDEV_TYPE_INDIRECT) == 0));
+}
+
+/*
+ * Return the number of top-level vdevs of the given allocation class in
+ * the supplied nvlist
+ */
+uint_t
+num_class_vdevs(nvlist_t *nv, const char *class)
+{
+	uint_t nclass = 0;
+	uint_t c, children;
+	nvlist_t **child;
+
+	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0)
+		return (0);
+
+	for (c = 0; c < children; c++) {
+		const char *cls = vdev_class(child[c]);
+
+		if (cls != NULL && strcmp(cls, class) == 0)
+			nclass++;
+	}
+	return (nclass);
+}
+
 /* Find the max element in an array of uint64_t values */
 uint64_t
 array64_max(uint64_t array[], unsigned int len)
@@ -41,6 +41,9 @@ extern "C" {
 void *safe_malloc(size_t);
 void zpool_no_memory(void);
 uint_t num_logs(nvlist_t *nv);
+const char *vdev_class(nvlist_t *nv);
+boolean_t vdev_is_hidden(nvlist_t *nv);
+uint_t num_class_vdevs(nvlist_t *nv, const char *class);
 uint64_t array64_max(uint64_t array[], unsigned int len);
 int isnumber(char *str);
 int highbit64(uint64_t i);
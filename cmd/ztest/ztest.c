@@ -198,6 +198,7 @@ extern uint64_t metaslab_df_alloc_threshold;
 extern int metaslab_preload_limit;
 extern boolean_t zfs_compressed_arc_enabled;
 extern int  zfs_abd_scatter_enabled;
+extern unsigned long l2arc_rebuild_blocks_min_l2size;
 
 static ztest_shared_opts_t *ztest_shared_opts;
 static ztest_shared_opts_t ztest_opts;
@@ -329,11 +330,14 @@ ztest_func_t ztest_dmu_snapshot_hold;
 ztest_func_t ztest_mmp_enable_disable;
 ztest_func_t ztest_spa_rename;
 ztest_func_t ztest_scrub;
+ztest_func_t ztest_vdev_trim;
 ztest_func_t ztest_dsl_dataset_promote_busy;
 ztest_func_t ztest_vdev_attach_detach;
 ztest_func_t ztest_vdev_LUN_growth;
 ztest_func_t ztest_vdev_add_remove;
+ztest_func_t ztest_vdev_class_add;
 ztest_func_t ztest_vdev_aux_add_remove;
+ztest_func_t ztest_device_removal;
 ztest_func_t ztest_split_pool;
 ztest_func_t ztest_reguid;
 ztest_func_t ztest_spa_upgrade;
@@ -380,12 +384,15 @@ ztest_info_t ztest_info[] = {
 	ZTI_INIT(ztest_reguid, 1, &zopt_rarely),
 	ZTI_INIT(ztest_spa_rename, 1, &zopt_rarely),
 	ZTI_INIT(ztest_scrub, 1, &zopt_rarely),
+	ZTI_INIT(ztest_vdev_trim, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_spa_upgrade, 1, &zopt_rarely),
 	ZTI_INIT(ztest_dsl_dataset_promote_busy, 1, &zopt_rarely),
 	ZTI_INIT(ztest_vdev_attach_detach, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_vdev_LUN_growth, 1, &zopt_rarely),
 	ZTI_INIT(ztest_vdev_add_remove, 1, &ztest_opts.zo_vdevtime),
+	ZTI_INIT(ztest_vdev_class_add, 1, &ztest_opts.zo_vdevtime),
 	ZTI_INIT(ztest_vdev_aux_add_remove, 1, &ztest_opts.zo_vdevtime),
+	ZTI_INIT(ztest_device_removal, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_fletcher, 1, &zopt_rarely),
 	ZTI_INIT(ztest_fletcher_incr, 1, &zopt_rarely),
 	ZTI_INIT(ztest_verify_dnode_bt, 1, &zopt_sometimes),
@@ -987,7 +994,7 @@ make_vdev_mirror(char *path, char *aux, char *pool, size_t size,
 
 static nvlist_t *
 make_vdev_root(char *path, char *aux, char *pool, size_t size, uint64_t ashift,
-    int log, int r, int m, int t)
+    const char *class, int r, int m, int t)
 {
 	nvlist_t *root, **child;
 	int c;
@@ -1000,7 +1007,13 @@ make_vdev_root(char *path, char *aux, char *pool, size_t size, uint64_t ashift,
 		child[c] = make_vdev_mirror(path, aux, pool, size, ashift,
 		    r, m);
 		VERIFY(nvlist_add_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    log) == 0);
+		    class != NULL &&
+		    strcmp(class, VDEV_ALLOC_BIAS_LOG) == 0) == 0);
+
+		if (class != NULL && strcmp(class, VDEV_ALLOC_BIAS_LOG) != 0) {
+			VERIFY0(nvlist_add_string(child[c],
+			    ZPOOL_CONFIG_ALLOCATION_BIAS, class));
+		}
 	}
 
 	VERIFY(nvlist_alloc(&root, NV_UNIQUE_NAME, 0) == 0);
@@ -1102,6 +1115,7 @@ ztest_random_vdev_top(spa_t *spa, boolean_t log_ok)
 		top = ztest_random(rvd->vdev_children);
 		tvd = rvd->vdev_child[top];
 	} while (tvd->vdev_ishole || (tvd->vdev_islog && !log_ok) ||
+	    !vdev_is_concrete(tvd) || tvd->vdev_removing ||
 	    tvd->vdev_mg == NULL || tvd->vdev_mg->mg_class == NULL);
 
 	return (top);
@@ -2094,14 +2108,15 @@ ztest_get_done(zgd_t *zgd, int error)
 	ztest_object_unlock(zd, object);
 
 	if (error == 0 && zgd->zgd_bp)
-		zil_add_block(zgd->zgd_zilog, zgd->zgd_bp);
+		zil_lwb_add_block(zgd->zgd_lwb, zgd->zgd_bp);
 
 	umem_free(zgd, sizeof (*zgd));
 	umem_free(zzp, sizeof (*zzp));
 }
 
 static int
-ztest_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
+ztest_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb,
+    zio_t *zio)
 {
 	ztest_ds_t *zd = arg;
 	objset_t *os = zd->zd_os;
@@ -2116,6 +2131,10 @@ ztest_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
 	int error;
 	ztest_zgd_private_t *zgd_private;
 
+	ASSERT3P(lwb, !=, NULL);
+	ASSERT3P(zio, !=, NULL);
+	ASSERT3U(size, !=, 0);
+
 	ztest_object_lock(zd, object, RL_READER);
 	error = dmu_bonus_hold(os, object, FTAG, &db);
 	if (error) {
@@ -2136,7 +2155,7 @@ ztest_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
 	db = NULL;
 
 	zgd = umem_zalloc(sizeof (*zgd), UMEM_NOFAIL);
-	zgd->zgd_zilog = zd->zd_zilog;
+	zgd->zgd_lwb = lwb;
 	zgd_private = umem_zalloc(sizeof (ztest_zgd_private_t), UMEM_NOFAIL);
 	zgd_private->z_zd = zd;
 	zgd_private->z_object = object;
@@ -2636,7 +2655,7 @@ ztest_spa_create_destroy(ztest_ds_t *zd, uint64_t id)
 	/*
 	 * Attempt to create using a bad file.
 	 */
-	nvroot = make_vdev_root("/dev/bogus", NULL, NULL, 0, 0, 0, 0, 0, 1);
+	nvroot = make_vdev_root("/dev/bogus", NULL, NULL, 0, 0, NULL, 0, 0, 1);
 	VERIFY3U(ENOENT, ==,
 	    spa_create("ztest_bad_file", nvroot, NULL, NULL, NULL));
 	nvlist_free(nvroot);
@@ -2644,7 +2663,7 @@ ztest_spa_create_destroy(ztest_ds_t *zd, uint64_t id)
 	/*
 	 * Attempt to create using a bad mirror.
 	 */
-	nvroot = make_vdev_root("/dev/bogus", NULL, NULL, 0, 0, 0, 0, 2, 1);
+	nvroot = make_vdev_root("/dev/bogus", NULL, NULL, 0, 0, NULL, 0, 2, 1);
 	VERIFY3U(ENOENT, ==,
 	    spa_create("ztest_bad_mirror", nvroot, NULL, NULL, NULL));
 	nvlist_free(nvroot);
@@ -2654,7 +2673,7 @@ ztest_spa_create_destroy(ztest_ds_t *zd, uint64_t id)
 	 * what's in the nvroot; we should fail with EEXIST.
 	 */
 	(void) rw_rdlock(&ztest_name_lock);
-	nvroot = make_vdev_root("/dev/bogus", NULL, NULL, 0, 0, 0, 0, 0, 1);
+	nvroot = make_vdev_root("/dev/bogus", NULL, NULL, 0, 0, NULL, 0, 0, 1);
 	VERIFY3U(EEXIST, ==,
 	    spa_create(zo->zo_pool, nvroot, NULL, NULL, NULL));
 	nvlist_free(nvroot);
@@ -2728,7 +2747,7 @@ ztest_spa_upgrade(ztest_ds_t *zd, uint64_t id)
 	(void) spa_destroy(name);
 
 	nvroot = make_vdev_root(NULL, NULL, name, ztest_opts.zo_vdev_size, 0,
-	    0, ztest_opts.zo_raidz, ztest_opts.zo_mirrors, 1);
+	    NULL, ztest_opts.zo_raidz, ztest_opts.zo_mirrors, 1);
 
 	/*
 	 * If we're configuring a RAIDZ device then make sure that the
@@ -2875,21 +2894,89 @@ ztest_vdev_add_remove(ztest_ds_t *zd, uint64_t id)
 		 */
 		nvroot = make_vdev_root(NULL, NULL, NULL,
 		    ztest_opts.zo_vdev_size, 0,
-		    ztest_random(4) == 0, ztest_opts.zo_raidz,
+		    (ztest_random(4) == 0) ? VDEV_ALLOC_BIAS_LOG : NULL,
+		    ztest_opts.zo_raidz,
 		    zs->zs_mirrors, 1);
 
 		error = spa_vdev_add(spa, nvroot);
 		nvlist_free(nvroot);
 
+		/*
+		 * A removal resumed at import may be running, which limits
+		 * the vdevs that can be added.
+		 */
 		if (error == ENOSPC)
 			ztest_record_enospc("spa_vdev_add");
-		else if (error != 0)
+		else if (error != 0 && !(spa_vdev_remove_active(spa) &&
+		    (error == ENOTSUP || error == EINVAL)))
 			fatal(0, "spa_vdev_add() = %d", error);
 	}
 
 	mutex_exit(&ztest_vdev_lock);
 }
 
+/*
+ * Verify that adding a special or dedup allocation class vdev works, and
+ * occasionally route small blocks to the special class.
+ */
+void
+ztest_vdev_class_add(ztest_ds_t *zd, uint64_t id)
+{
+	ztest_shared_t *zs = ztest_shared;
+	spa_t *spa = ztest_spa;
+	uint64_t leaves;
+	nvlist_t *nvroot;
+	const char *class = (ztest_random(2) == 0) ?
+	    VDEV_ALLOC_BIAS_SPECIAL : VDEV_ALLOC_BIAS_DEDUP;
+	int error;
+
+	if (ztest_opts.zo_mmp_test)
+		return;
+
+	mutex_enter(&ztest_vdev_lock);
+
+	/*
+	 * Only add class vdevs with redundancy, and only when the pool
+	 * was created with feature@allocation_classes enabled.
+	 */
+	if (zs->zs_mirrors < 2 ||
+	    !spa_feature_is_enabled(spa, SPA_FEATURE_ALLOCATION_CLASSES)) {
+		mutex_exit(&ztest_vdev_lock);
+		return;
+	}
+
+	leaves = MAX(zs->zs_mirrors + zs->zs_splits, 1) * ztest_opts.zo_raidz;
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	ztest_shared->zs_vdev_next_leaf = find_vdev_hole(spa) * leaves;
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	nvroot = make_vdev_root(NULL, NULL, NULL, ztest_opts.zo_vdev_size, 0,
+	    class, ztest_opts.zo_raidz, zs->zs_mirrors, 1);
+
+	error = spa_vdev_add(spa, nvroot);
+	nvlist_free(nvroot);
+
+	if (error == ENOSPC)
+		ztest_record_enospc("spa_vdev_add");
+	else if (error != 0 && !((error == ENOTSUP || error == EINVAL) &&
+	    spa_vdev_remove_active(spa)))
+		fatal(0, "spa_vdev_add() = %d", error);
+
+	/*
+	 * Half of the time allow small blocks in the special class.
+	 */
+	if (error == 0 && spa_special_class(spa)->mc_groups == 1 &&
+	    ztest_random(2) == 0) {
+		if (ztest_opts.zo_verbose >= 3)
+			(void) printf("Enabling special VDEV small blocks\n");
+		(void) ztest_dsl_prop_set_uint64(zd->zd_name,
+		    ZFS_PROP_SPECIAL_SMALL_BLOCKS, 32768, B_FALSE);
+	}
+
+	mutex_exit(&ztest_vdev_lock);
+}
+
 /*
  * Verify that adding/removing aux devices (l2arc, hot spare) works as expected.
  */
@@ -2956,7 +3043,7 @@ ztest_vdev_aux_add_remove(ztest_ds_t *zd, uint64_t id)
 		 * Add a new device.
 		 */
 		nvlist_t *nvroot = make_vdev_root(NULL, aux, NULL,
-		    (ztest_opts.zo_vdev_size * 5) / 4, 0, 0, 0, 0, 1);
+		    (ztest_opts.zo_vdev_size * 5) / 4, 0, NULL, 0, 0, 1);
 		error = spa_vdev_add(spa, nvroot);
 		if (error != 0)
 			fatal(0, "spa_vdev_add(%p) = %d", nvroot, error);
@@ -2980,6 +3067,86 @@ ztest_vdev_aux_add_remove(ztest_ds_t *zd, uint64_t id)
 	umem_free(path, MAXPATHLEN);
 }
 
+/*
+ * ztest_fault_inject() damages any given offset of a top-level vdev on the
+ * same side only.  A removal moves data to other offsets, and with it the
+ * damage, so no damage is injected while a removal is running, nor after
+ * it has finished until a scrub has repaired what was moved.
+ */
+static boolean_t
+ztest_removal_needs_scrub(spa_t *spa)
+{
+	spa_removing_phys_t *srp = &spa->spa_removing_phys;
+	dsl_scan_phys_t *scnp = &spa_get_dsl(spa)->dp_scan->scn_phys;
+
+	if (spa_vdev_remove_active(spa))
+		return (B_TRUE);
+	if (srp->sr_state != DSS_FINISHED)
+		return (B_FALSE);
+
+	return (scnp->scn_func != POOL_SCAN_SCRUB ||
+	    scnp->scn_state != DSS_FINISHED ||
+	    scnp->scn_start_time < srp->sr_end_time);
+}
+
+/*
+ * Verify that a top-level vdev can be removed, and that a removal can be
+ * canceled.  This is only possible in pools without raidz vdevs.
+ */
+/* ARGSUSED */
+void
+ztest_device_removal(ztest_ds_t *zd, uint64_t id)
+{
+	spa_t *spa = ztest_spa;
+	vdev_t *vd;
+	uint64_t guid;
+	int error;
+
+	if (ztest_opts.zo_mmp_test)
+		return;
+
+	mutex_enter(&ztest_vdev_lock);
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	vd = vdev_lookup_top(spa, ztest_random_vdev_top(spa, B_FALSE));
+	guid = vd->vdev_guid;
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	error = spa_vdev_remove(spa, guid, B_FALSE);
+	if (error == 0) {
+		/*
+		 * Cancel half of the removals once they have made some
+		 * progress, and let the others run to completion.
+		 */
+		if (ztest_random(2) == 0) {
+			txg_wait_synced(spa_get_dsl(spa), 0);
+			error = spa_vdev_remove_cancel(spa);
+			if (error != 0 && error != ENOENT)
+				fatal(0, "spa_vdev_remove_cancel() = %d",
+				    error);
+		}
+		while (spa_vdev_remove_active(spa))
+			txg_wait_synced(spa_get_dsl(spa), 0);
+
+		/*
+		 * Hold off other removals, whose start forgets the end time
+		 * of this one, until the moved data has been scrubbed.
+		 */
+		if (ztest_removal_needs_scrub(spa) &&
+		    spa_scan(spa, POOL_SCAN_SCRUB) == 0) {
+			while (dsl_scan_scrubbing(spa_get_dsl(spa)))
+				txg_wait_synced(spa_get_dsl(spa), 0);
+		}
+	} else if (error == ENOSPC) {
+		ztest_record_enospc("spa_vdev_remove");
+	} else if (error != ENOTSUP && error != EBUSY && error != EINVAL &&
+	    error != EEXIST) {
+		fatal(0, "spa_vdev_remove() = %d", error);
+	}
+
+	mutex_exit(&ztest_vdev_lock);
+}
+
 /*
  * split a pool if it has mirror tlvdevs
  */
@@ -3010,6 +3177,17 @@ ztest_split_pool(ztest_ds_t *zd, uint64_t id)
 
 	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
 
+	/* pools with removed or removing devices can't be split */
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *tvd = rvd->vdev_child[c];
+
+		if (tvd->vdev_removing || tvd->vdev_ops == &vdev_indirect_ops) {
+			spa_config_exit(spa, SCL_VDEV, FTAG);
+			mutex_exit(&ztest_vdev_lock);
+			return;
+		}
+	}
+
 	/* generate a config from the existing config */
 	mutex_enter(&spa->spa_props_lock);
 	VERIFY(nvlist_lookup_nvlist(spa->spa_config, ZPOOL_CONFIG_VDEV_TREE,
@@ -3235,7 +3413,7 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 	 * Build the nvlist describing newpath.
 	 */
 	root = make_vdev_root(newpath, NULL, NULL, newvd == NULL ? newsize : 0,
-	    ashift, 0, 0, 0, 1);
+	    ashift, NULL, 0, 0, 1);
 
 	error = spa_vdev_attach(spa, oldguid, root, replacing);
 
@@ -4031,13 +4209,14 @@ ztest_dmu_read_write(ztest_ds_t *zd, uint64_t id)
 	freeit = (ztest_random(100) < free_percent);
 
 	/*
-	 * Read the current contents of our objects.
+	 * Read the current contents of our objects.  Some of the time,
+	 * read bigobj around the ARC.
 	 */
 	error = dmu_read(os, packobj, packoff, packsize, packbuf,
 	    DMU_READ_PREFETCH);
 	ASSERT0(error);
 	error = dmu_read(os, bigobj, bigoff, bigsize, bigbuf,
-	    DMU_READ_PREFETCH);
+	    ztest_random(4) == 0 ? DMU_READ_DIRECT : DMU_READ_PREFETCH);
 	ASSERT0(error);
 
 	/*
@@ -5121,6 +5300,8 @@ ztest_spa_prop_get_set(ztest_ds_t *zd, uint64_t id)
 	(void) ztest_spa_prop_set_uint64(ZPOOL_PROP_DEDUPDITTO,
 	    ZIO_DEDUPDITTO_MIN + ztest_random(ZIO_DEDUPDITTO_MIN));
 
+	(void) ztest_spa_prop_set_uint64(ZPOOL_PROP_AUTOTRIM, ztest_random(2));
+
 	VERIFY0(spa_prop_get(ztest_spa, &props));
 
 	if (ztest_opts.zo_verbose >= 6)
@@ -5301,6 +5482,10 @@ ztest_fault_inject(ztest_ds_t *zd, uint64_t id)
 	pathrand = umem_alloc(MAXPATHLEN, UMEM_NOFAIL);
 
 	mutex_enter(&ztest_vdev_lock);
+	if (ztest_removal_needs_scrub(spa)) {
+		mutex_exit(&ztest_vdev_lock);
+		goto out;
+	}
 	maxfaults = MAXFAULTS();
 	leaves = MAX(zs->zs_mirrors, 1) * ztest_opts.zo_raidz;
 	mirror_save = zs->zs_mirrors;
@@ -5658,6 +5843,53 @@ ztest_scrub(ztest_ds_t *zd, uint64_t id)
 	(void) spa_scan(spa, POOL_SCAN_SCRUB);
 }
 
+/*
+ * Start, suspend or cancel a manual TRIM of a random leaf vdev.
+ */
+/* ARGSUSED */
+void
+ztest_vdev_trim(ztest_ds_t *zd, uint64_t id)
+{
+	spa_t *spa = ztest_spa;
+	vdev_t *vd;
+	uint64_t guid, cmd, rate;
+	int error;
+
+	mutex_enter(&ztest_vdev_lock);
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	vd = spa->spa_root_vdev;
+	while (!vd->vdev_ops->vdev_op_leaf && vd->vdev_children != 0)
+		vd = vd->vdev_child[ztest_random(vd->vdev_children)];
+	guid = vd->vdev_guid;
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	cmd = ztest_random(POOL_TRIM_FUNCS);
+	rate = ztest_random(2) ? 0 : 1ULL << (20 + ztest_random(10));
+
+	error = spa_vdev_trim(spa, guid, cmd, rate);
+	switch (error) {
+	case 0:
+	case ENODEV:
+	case EINVAL:
+	case EROFS:
+	case EBUSY:
+	case ESRCH:
+	case EOPNOTSUPP:
+		break;
+	default:
+		fatal(0, "spa_vdev_trim(%llu, %llu) = %d",
+		    (u_longlong_t)guid, (u_longlong_t)cmd, error);
+	}
+
+	if (ztest_opts.zo_verbose >= 4) {
+		(void) printf("trim cmd %llu on vdev %llu, error %d\n",
+		    (u_longlong_t)cmd, (u_longlong_t)guid, error);
+	}
+
+	mutex_exit(&ztest_vdev_lock);
+}
+
 /*
  * Change the guid for the pool.
  */
@@ -6702,7 +6934,7 @@ ztest_init(ztest_shared_t *zs)
 	zs->zs_splits = 0;
 	zs->zs_mirrors = ztest_opts.zo_mirrors;
 	nvroot = make_vdev_root(NULL, NULL, NULL, ztest_opts.zo_vdev_size, 0,
-	    0, ztest_opts.zo_raidz, zs->zs_mirrors, 1);
+	    NULL, ztest_opts.zo_raidz, zs->zs_mirrors, 1);
 	props = make_random_props();
 	for (i = 0; i < SPA_FEATURES; i++) {
 		char *buf;
@@ -6982,6 +7214,8 @@ main(int argc, char **argv)
 		metaslab_gang_bang = ztest_opts.zo_metaslab_gang_bang;
 		metaslab_df_alloc_threshold =
 		    zs->zs_metaslab_df_alloc_threshold;
+		/* ztest's cache devices are small, make them persistent */
+		l2arc_rebuild_blocks_min_l2size = 0;
 
 		if (zs->zs_do_init)
 			ztest_run_init();
@@ -0,0 +1,24 @@
+dnl #
+dnl # 4.14 API addition
+dnl # The kernel provides zstd compression in lib/zstd when built with
+dnl # CONFIG_ZSTD_COMPRESS and CONFIG_ZSTD_DECOMPRESS.
+dnl #
+AC_DEFUN([ZFS_AC_KERNEL_ZSTD], [
+	AC_MSG_CHECKING([whether zstd compression is available])
+	ZFS_LINUX_TRY_COMPILE_SYMBOL([
+		#include <linux/zstd.h>
+	], [
+		ZSTD_parameters params = ZSTD_getParams(3, 0, 0);
+		size_t ws = ZSTD_CCtxWorkspaceBound(params.cParams);
+		ZSTD_CCtx *cctx = ZSTD_initCCtx(NULL, ws);
+		ZSTD_DCtx *dctx = ZSTD_initDCtx(NULL, ZSTD_DCtxWorkspaceBound());
+
+		(void) ZSTD_compressCCtx(cctx, NULL, 0, NULL, 0, params);
+		(void) ZSTD_decompressDCtx(dctx, NULL, 0, NULL, 0);
+	], [ZSTD_compressCCtx], [lib/zstd/compress.c], [
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_LINUX_ZSTD, 1, [kernel zstd is available])
+	], [
+		AC_MSG_RESULT(no)
+	])
+])
@@ -0,0 +1,18 @@
+dnl #
+dnl # Check for libzstd - needed for zstd compression
+dnl #
+AC_DEFUN([ZFS_AC_CONFIG_USER_ZSTD], [
+	ZSTD=
+
+	AC_CHECK_HEADER([zstd.h], [
+	    AC_CHECK_LIB([zstd], [ZSTD_compressCCtx], [
+		user_zstd=yes
+		AC_SUBST([ZSTD], ["-lzstd"])
+		AC_DEFINE([HAVE_ZSTD], 1, [Define if you have libzstd])
+	    ], [
+		user_zstd=no
+	    ])
+	], [
+	    user_zstd=no
+	])
+])
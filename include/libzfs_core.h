@@ -101,6 +101,8 @@ int lzc_rollback(const char *, char *, int);
 int lzc_rollback_to(const char *, const char *);
 
 int lzc_sync(const char *, nvlist_t *, nvlist_t **);
+int lzc_trim(const char *, pool_trim_func_t, uint64_t, nvlist_t *,
+    nvlist_t **);
 
 #ifdef	__cplusplus
 }
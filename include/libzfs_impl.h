@@ -37,6 +37,7 @@
 #include <libzfs.h>
 #include <libshare.h>
 #include <libzfs_core.h>
+#include <pthread.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -59,7 +60,15 @@ struct libzfs_handle {
 	void *libzfs_sharehdl; /* libshare handle */
 	uint_t libzfs_shareflags;
 	boolean_t libzfs_mnttab_enable;
+	/*
+	 * We need a lock to handle the case where parallel mount
+	 * threads are populating the mnttab cache simultaneously. The
+	 * lock only protects the integrity of the avl tree, and does
+	 * not protect the contents of the mnttab entries themselves.
+	 */
+	pthread_mutex_t libzfs_mnttab_cache_lock;
 	avl_tree_t libzfs_mnttab_cache;
+	pthread_mutex_t libzfs_share_lock; /* libshare is not thread-safe */
 	int libzfs_pool_iter;
 	char libzfs_chassis_id[256];
 };
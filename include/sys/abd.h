@@ -30,6 +30,7 @@
 #include <sys/int_types.h>
 #include <sys/debug.h>
 #include <sys/refcount.h>
+#include <sys/list.h>
 #ifdef _KERNEL
 #include <linux/mm.h>
 #include <linux/bio.h>
@@ -45,7 +46,8 @@ typedef enum abd_flags {
 	ABD_FLAG_OWNER	= 1 << 1,	/* does it own its data buffers? */
 	ABD_FLAG_META	= 1 << 2,	/* does this represent FS metadata? */
 	ABD_FLAG_MULTI_ZONE  = 1 << 3,	/* pages split over memory zones */
-	ABD_FLAG_MULTI_CHUNK = 1 << 4	/* pages split over multiple chunks */
+	ABD_FLAG_MULTI_CHUNK = 1 << 4,	/* pages split over multiple chunks */
+	ABD_FLAG_GANG	= 1 << 5	/* chain of other ABDs */
 } abd_flags_t;
 
 typedef struct abd {
@@ -53,6 +55,7 @@ typedef struct abd {
 	uint_t		abd_size;	/* excludes scattered abd_offset */
 	struct abd	*abd_parent;
 	refcount_t	abd_children;
+	list_node_t	abd_gang_link;	/* entry in the chain of a gang ABD */
 	union {
 		struct abd_scatter {
 			uint_t		abd_offset;
@@ -62,6 +65,9 @@ typedef struct abd {
 		struct abd_linear {
 			void		*abd_buf;
 		} abd_linear;
+		struct abd_gang {
+			list_t		abd_gang_chain;
+		} abd_gang;
 	} abd_u;
 } abd_t;
 
@@ -76,6 +82,12 @@ abd_is_linear(abd_t *abd)
 	return ((abd->abd_flags & ABD_FLAG_LINEAR) != 0 ? B_TRUE : B_FALSE);
 }
 
+static inline boolean_t
+abd_is_gang(abd_t *abd)
+{
+	return ((abd->abd_flags & ABD_FLAG_GANG) != 0 ? B_TRUE : B_FALSE);
+}
+
 /*
  * Allocations and deallocations
  */
@@ -84,10 +96,13 @@ abd_t *abd_alloc(size_t, boolean_t);
 abd_t *abd_alloc_linear(size_t, boolean_t);
 abd_t *abd_alloc_for_io(size_t, boolean_t);
 abd_t *abd_alloc_sametype(abd_t *, size_t);
+abd_t *abd_alloc_gang_abd(void);
+void abd_gang_add(abd_t *, abd_t *);
 void abd_free(abd_t *);
 abd_t *abd_get_offset(abd_t *, size_t);
 abd_t *abd_get_offset_size(abd_t *, size_t, size_t);
 abd_t *abd_get_from_buf(void *, size_t);
+abd_t *abd_get_zeros(size_t);
 void abd_put(abd_t *);
 
 /*
@@ -95,6 +95,11 @@ typedef enum arc_strategy {
 	ARC_STRATEGY_META_BALANCED	= 1, /* Evict data buffers if needed */
 } arc_strategy_t;
 
+typedef enum arc_admission {
+	ARC_ADMISSION_ALL		= 0, /* Admit every buffer read */
+	ARC_ADMISSION_FREQUENCY		= 1, /* Probation for one-time reads */
+} arc_admission_t;
+
 typedef enum arc_flags
 {
 	/*
@@ -144,6 +149,8 @@ typedef enum arc_flags
 	 */
 	ARC_FLAG_COMPRESSED_ARC		= 1 << 19,
 	ARC_FLAG_SHARED_DATA		= 1 << 20,
+	/* Buffer has been read once, see arc_admit() */
+	ARC_FLAG_PROBATION		= 1 << 21,
 
 	/*
 	 * The arc buffer's compression mode is stored in the top 7 bits of the
@@ -304,6 +311,8 @@ void l2arc_init(void);
 void l2arc_fini(void);
 void l2arc_start(void);
 void l2arc_stop(void);
+void l2arc_spa_rebuild_start(spa_t *spa);
+void l2arc_spa_rebuild_stop(spa_t *spa);
 
 #ifndef _KERNEL
 extern boolean_t arc_watch;
@@ -202,18 +202,161 @@ typedef struct arc_buf_hdr_crypt {
 	uint8_t			b_mac[ZIO_DATA_MAC_LEN];
 } arc_buf_hdr_crypt_t;
 
+/*
+ * L2ARC Persistence
+ *
+ * To allow the contents of a cache device to survive an export/import or a
+ * reboot, the L2ARC periodically writes log blocks describing the buffers
+ * it has written.  The log blocks are interleaved with the data buffers in
+ * the normal write stream and are chained together from newest to oldest.
+ * The first SPA_MINBLOCKSIZE (rounded up to the vdev ashift) bytes of the
+ * usable device area hold a device header which points to the most recently
+ * written log block.  On pool import the chain is walked backwards and an
+ * ARC_l2c_only header is restored for every buffer that has not since been
+ * overwritten.
+ *
+ *	 device header      log block          log block
+ *	+-------------+    +---------+        +---------+
+ *	| dh_start_lbp|--->|lb_prev  |--...-->|lb_prev  |--> (older)
+ *	+-------------+    +---------+        +---------+
+ *
+ * Every log block pointer carries the checksum of the block it points to,
+ * so a log block which has been overwritten by later writes terminates the
+ * rebuild.  Restored buffers are verified against their block pointer's
+ * checksum when they are read, exactly as for any other L2ARC buffer.
+ */
+#define	L2ARC_DEV_HDR_MAGIC	0x5a46534341434845LLU	/* ASCII: "ZFSCACHE" */
+#define	L2ARC_LOG_BLK_MAGIC	0x4c4f47424c4b4844LLU	/* ASCII: "LOGBLKHD" */
+#define	L2ARC_PERSISTENT_VERSION	1
+#define	L2ARC_LOG_BLK_MAX_ENTRIES	(1022)
+
+typedef enum l2arc_dev_hdr_flags_t {
+	L2ARC_DEV_HDR_EVICT_FIRST = (1 << 0)	/* mirror of l2ad_first */
+} l2arc_dev_hdr_flags_t;
+
+/*
+ * The lbp_prop and le_prop fields share the following layout:
+ *
+ *	64	56	48	40	32	24	16	8	0
+ *	+-------+-------+-------+-------+-------+-------+-------+-------+
+ *	|      |P|  type  | cksum |F| comp  |     PSIZE     |     LSIZE     |
+ *	+-------+-------+-------+-------+-------+-------+-------+-------+
+ *
+ * P is set for protected (encrypted or authenticated) buffers and F for
+ * buffers which were prefetched.  Sizes are stored like in a blkptr.
+ */
+#define	L2BLK_GET_LSIZE(field)	\
+	BF64_GET_SB((field), 0, SPA_LSIZEBITS, SPA_MINBLOCKSHIFT, 1)
+#define	L2BLK_SET_LSIZE(field, x)	\
+	BF64_SET_SB((field), 0, SPA_LSIZEBITS, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2BLK_GET_PSIZE(field)	\
+	BF64_GET_SB((field), 16, SPA_PSIZEBITS, SPA_MINBLOCKSHIFT, 1)
+#define	L2BLK_SET_PSIZE(field, x)	\
+	BF64_SET_SB((field), 16, SPA_PSIZEBITS, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2BLK_GET_COMPRESS(field)	BF64_GET((field), 32, SPA_COMPRESSBITS)
+#define	L2BLK_SET_COMPRESS(field, x)	\
+	BF64_SET((field), 32, SPA_COMPRESSBITS, x)
+#define	L2BLK_GET_PREFETCH(field)	BF64_GET((field), 39, 1)
+#define	L2BLK_SET_PREFETCH(field, x)	BF64_SET((field), 39, 1, x)
+#define	L2BLK_GET_CHECKSUM(field)	BF64_GET((field), 40, 8)
+#define	L2BLK_SET_CHECKSUM(field, x)	BF64_SET((field), 40, 8, x)
+#define	L2BLK_GET_TYPE(field)		BF64_GET((field), 48, 8)
+#define	L2BLK_SET_TYPE(field, x)	BF64_SET((field), 48, 8, x)
+#define	L2BLK_GET_PROTECTED(field)	BF64_GET((field), 56, 1)
+#define	L2BLK_SET_PROTECTED(field, x)	BF64_SET((field), 56, 1, x)
+
+/*
+ * Points to a log block on the cache device.  The payload is the range of
+ * the device, starting at lbp_payload_start and ending at lbp_daddr, that
+ * holds the buffers described by the log block.
+ */
+typedef struct l2arc_log_blkptr {
+	uint64_t	lbp_daddr;		/* device address of log blk */
+	uint64_t	lbp_payload_asize;	/* allocated size of payload */
+	uint64_t	lbp_payload_start;	/* first payload address */
+	uint64_t	lbp_prop;		/* see L2BLK_* macros */
+	zio_cksum_t	lbp_cksum;		/* checksum of the log block */
+} l2arc_log_blkptr_t;
+
+/*
+ * Describes one buffer written to the cache device.
+ */
+typedef struct l2arc_log_ent_phys {
+	dva_t		le_dva;			/* dva of buffer */
+	uint64_t	le_birth;		/* birth txg of buffer */
+	uint64_t	le_prop;		/* see L2BLK_* macros */
+	uint64_t	le_daddr;		/* buf location on cache dev */
+	uint64_t	le_pad[3];		/* pad to 64 bytes */
+} l2arc_log_ent_phys_t;
+
+/*
+ * A log block, padded so that its uncompressed size is exactly 64k.
+ */
+typedef struct l2arc_log_blk_phys {
+	uint64_t		lb_magic;	/* L2ARC_LOG_BLK_MAGIC */
+	l2arc_log_blkptr_t	lb_prev_lbp;	/* previous (older) log block */
+	uint64_t		lb_pad[7];	/* pad header to 128 bytes */
+	l2arc_log_ent_phys_t	lb_entries[L2ARC_LOG_BLK_MAX_ENTRIES];
+} l2arc_log_blk_phys_t;
+
+/*
+ * The on-disk device header, padded to SPA_MINBLOCKSIZE.
+ */
+typedef struct l2arc_dev_hdr_phys {
+	uint64_t		dh_magic;	/* L2ARC_DEV_HDR_MAGIC */
+	uint64_t		dh_version;	/* L2ARC_PERSISTENT_VERSION */
+	uint64_t		dh_spa_guid;	/* guid of the owning pool */
+	uint64_t		dh_vdev_guid;	/* guid of the cache vdev */
+	uint64_t		dh_log_entries;	/* max entries per log block */
+	uint64_t		dh_hand;	/* mirror of l2ad_hand */
+	uint64_t		dh_evict;	/* mirror of l2ad_evict */
+	uint64_t		dh_flags;	/* l2arc_dev_hdr_flags_t */
+	uint64_t		dh_start;	/* mirror of l2ad_start */
+	uint64_t		dh_end;		/* mirror of l2ad_end */
+	l2arc_log_blkptr_t	dh_start_lbp;	/* most recent log block */
+	uint64_t		dh_lb_count;	/* log blocks written */
+	uint64_t		dh_lb_asize;	/* allocated size of log blks */
+	uint64_t		dh_pad[40];	/* pad to 512 bytes */
+	zio_cksum_t		dh_self_cksum;	/* fletcher4 of the above */
+} l2arc_dev_hdr_phys_t;
+
 typedef struct l2arc_dev {
 	vdev_t			*l2ad_vdev;	/* vdev */
 	spa_t			*l2ad_spa;	/* spa */
 	uint64_t		l2ad_hand;	/* next write location */
 	uint64_t		l2ad_start;	/* first addr on device */
 	uint64_t		l2ad_end;	/* last addr on device */
+	uint64_t		l2ad_evict;	/* last addr eviction reached */
 	boolean_t		l2ad_first;	/* first sweep through */
 	boolean_t		l2ad_writing;	/* currently writing */
 	kmutex_t		l2ad_mtx;	/* lock for buffer list */
 	list_t			l2ad_buflist;	/* buffer list */
 	list_node_t		l2ad_node;	/* device list node */
 	refcount_t		l2ad_alloc;	/* allocated bytes */
+	/*
+	 * Persistence-related fields.  The log block and device header are
+	 * only modified by the feed thread, or by the rebuild thread before
+	 * the feed thread is allowed to use the device.
+	 */
+	l2arc_dev_hdr_phys_t	*l2ad_dev_hdr;	/* persistent device header */
+	uint64_t		l2ad_dev_hdr_asize; /* aligned hdr size */
+	uint64_t		l2ad_log_entries; /* entries per blk, 0 = off */
+	l2arc_log_blk_phys_t	l2ad_log_blk;	/* currently open log block */
+	int			l2ad_log_ent_idx; /* index into cur log blk */
+	uint64_t		l2ad_log_blk_payload_asize; /* payload of blk */
+	uint64_t		l2ad_log_blk_payload_start; /* payload start */
+	/* protected by l2arc_rebuild_thr_lock */
+	boolean_t		l2ad_rebuild;	/* rebuild pending */
+	boolean_t		l2ad_rebuild_began; /* rebuild thread running */
+	boolean_t		l2ad_rebuild_cancel; /* stop rebuild thread */
+	/* protected by l2arc_feed_thr_lock */
+	boolean_t		l2ad_feed_began; /* feed thread running */
+	boolean_t		l2ad_feed_cancel; /* stop feed thread */
+	/* only used by the feed thread */
+	uint64_t		l2ad_write_size; /* adjusted write size */
+	hrtime_t		l2ad_write_latency; /* last write latency */
+	/* protected by l2arc_dev_mtx */
+	int			l2ad_feed_idx;	/* slice of ARC sublists fed */
 } l2arc_dev_t;
 
 typedef struct l2arc_buf_hdr {
@@ -84,6 +84,18 @@ typedef enum dbuf_states {
 	DB_EVICTING
 } dbuf_states_t;
 
+/*
+ * The dbuf cache a dbuf is on while it has no holds. Metadata dbufs, i.e.
+ * dnode and indirect blocks, are kept on a cache of their own so that
+ * streaming through user data does not age them out.
+ */
+typedef enum dbuf_cached_state {
+	DB_NO_CACHE = -1,
+	DB_DBUF_CACHE,
+	DB_DBUF_METADATA_CACHE,
+	DB_CACHE_MAX
+} dbuf_cached_state_t;
+
 struct dnode;
 struct dmu_tx;
 
@@ -232,10 +244,13 @@ typedef struct dmu_buf_impl {
 	avl_node_t db_link;
 
 	/*
-	 * Link in dbuf_cache.
+	 * Link in dbuf_caches[db_caching_status].
 	 */
 	multilist_node_t db_cache_link;
 
+	/* Which dbuf cache this dbuf is on, if any. */
+	dbuf_cached_state_t db_caching_status;
+
 	/* Data which is unique to data (leaf) blocks: */
 
 	/* User callback information. */
@@ -260,15 +275,38 @@ typedef struct dmu_buf_impl {
 	 */
 	uint8_t db_pending_evict;
 
+	/*
+	 * Written by an O_DIRECT write.  Drop this dbuf, and its
+	 * buffer from the ARC, once the refcount drops to 0 rather
+	 * than caching it.
+	 */
+	uint8_t db_uncached;
+
 	uint8_t db_dirtycnt;
 } dmu_buf_impl_t;
 
-/* Note: the dbuf hash table is exposed only for the mdb module */
+/*
+ * Note: the dbuf hash table is exposed only for the mdb module and the
+ * dbufs kstat.
+ *
+ * The table is grown while in use by rehashing it into a table twice its
+ * size, one lock stripe at a time.  Tables are never smaller than
+ * DBUF_MUTEXES buckets, so all of the buckets a hash value may map to, in
+ * either table, are protected by the same mutex.  That mutex also protects
+ * the stripe's entry in hash_stripe_table, which selects the table the
+ * stripe's buckets are currently in.
+ */
 #define	DBUF_MUTEXES 8192
 #define	DBUF_HASH_MUTEX(h, idx) (&(h)->hash_mutexes[(idx) & (DBUF_MUTEXES-1)])
+#define	DBUF_HASH_TABLE(h, idx)	\
+	((h)->hash_stripe_table[(idx) & (DBUF_MUTEXES-1)])
 typedef struct dbuf_hash_table {
-	uint64_t hash_table_mask;
-	dmu_buf_impl_t **hash_table;
+	uint64_t hash_table_mask[2];
+	dmu_buf_impl_t **hash_table[2];
+	uint8_t hash_stripe_table[DBUF_MUTEXES];
+	int hash_table_cur;		/* table in use when not growing */
+	uint64_t hash_table_max;	/* largest size to grow to */
+	boolean_t hash_growing;
 	kmutex_t hash_mutexes[DBUF_MUTEXES];
 } dbuf_hash_table_t;
 
@@ -76,5 +76,7 @@ int dmu_recv_stream(dmu_recv_cookie_t *drc, struct vnode *vp, offset_t *voffp,
     int cleanup_fd, uint64_t *action_handlep);
 int dmu_recv_end(dmu_recv_cookie_t *drc, void *owner);
 boolean_t dmu_objset_is_receiving(objset_t *os);
+void dmu_recv_init(void);
+void dmu_recv_fini(void);
 
 #endif /* _DMU_SEND_H */
@@ -100,6 +100,22 @@ typedef enum dsl_scan_flags {
  *			the scan but have not yet been processed (i.e deferred
  *			frees) are accounted for.
  *
+ * scn_is_sorted -	the scan is running in sorted mode: the traversal
+ *			only collects the block pointers it finds into
+ *			per-vdev queues (see dsl_scan_io_queue_t) and the
+ *			actual reads are issued later in offset order.
+ *
+ * scn_clearing -	the sorted scan has stopped traversing the pool and
+ *			is issuing the queued I/Os, either because the queues
+ *			hit their memory limit or because a checkpoint is in
+ *			progress.
+ *
+ * scn_checkpointing -	the sorted scan is draining all of its queues so
+ *			that the traversal position (scn_phys) can be
+ *			written to disk.  Until the queues are empty only
+ *			scn_phys_cached, the position of the last checkpoint,
+ *			is safe to persist.
+ *
  * This structure also maintains information about deferred frees which are
  * a special kind of traversal. Deferred free can exist in either a bptree or
  * a bpobj structure. The scn_is_bptree flag will indicate the type of
@@ -121,9 +137,26 @@ typedef struct dsl_scan {
 	boolean_t scn_async_stalled;
 	uint64_t scn_visited_this_txg;
 
-	dsl_scan_phys_t scn_phys;
+	/* for sorted scans */
+	boolean_t scn_is_sorted;
+	boolean_t scn_clearing;
+	boolean_t scn_checkpointing;
+	clock_t scn_last_checkpoint;
+	taskq_t *scn_taskq;		/* extent issuing threads */
+	uint64_t scn_bytes_pending;	/* queued but not yet issued */
+	uint64_t scn_issued_before_pass; /* issued bytes at pass start */
+	avl_tree_t scn_queue;		/* in-core queue of datasets to scan */
+
+	/* per txg statistics */
+	uint64_t scn_segs_this_txg;
+	uint64_t scn_zios_this_txg;
+
+	dsl_scan_phys_t scn_phys;	/* current traversal state */
+	dsl_scan_phys_t scn_phys_cached; /* state at the last checkpoint */
 } dsl_scan_t;
 
+typedef struct dsl_scan_io_queue dsl_scan_io_queue_t;
+
 int dsl_scan_init(struct dsl_pool *dp, uint64_t txg);
 void dsl_scan_fini(struct dsl_pool *dp);
 void dsl_scan_sync(struct dsl_pool *, dmu_tx_t *);
@@ -142,6 +175,9 @@ void dsl_scan_ds_clone_swapped(struct dsl_dataset *ds1, struct dsl_dataset *ds2,
     struct dmu_tx *tx);
 boolean_t dsl_scan_active(dsl_scan_t *scn);
 boolean_t dsl_scan_is_paused_scrub(const dsl_scan_t *scn);
+void dsl_scan_freed(spa_t *spa, const blkptr_t *bp);
+void dsl_scan_io_queue_destroy(dsl_scan_io_queue_t *queue);
+void dsl_scan_io_queue_vdev_xfer(vdev_t *svd, vdev_t *tvd);
 
 #ifdef	__cplusplus
 }
@@ -329,9 +329,47 @@ struct metaslab {
 	range_tree_t	*ms_freedtree; /* already freed this syncing txg */
 	range_tree_t	*ms_defertree[TXG_DEFER_SIZE];
 
+	/*
+	 * The ms_trim tree is the set of segments which have been returned
+	 * to the free tree since the last automatic TRIM of this metaslab.
+	 * Segments are removed as they are reallocated, see vdev_trim.c.
+	 */
+	range_tree_t	*ms_trim;
+
+	/*
+	 * While the log_spacemap feature is active the allocs and frees of
+	 * a metaslab are logged in the pool's log space maps and only
+	 * flushed to ms_sm once in a while.  The unflushed trees hold the
+	 * changes logged since the last flush, with the allocs and frees
+	 * of the same space canceling out.  They are applied on top of
+	 * ms_sm by whoever reads it.  ms_unflushed_txg is the txg of the
+	 * oldest log still applying to this metaslab, and ms_flush_txg the
+	 * txg in which spa_log_sm_sync_start() last picked it for a flush.
+	 */
+	range_tree_t	*ms_unflushed_allocs;
+	range_tree_t	*ms_unflushed_frees;
+	uint64_t	ms_unflushed_txg;
+	uint64_t	ms_flush_txg;
+	boolean_t	ms_unflushed_logged;	/* in metaslabs_by_flushed */
+	avl_node_t	ms_unflushed_node;
+
+	/*
+	 * Allocated space of the metaslab, including its unflushed changes.
+	 * The changes synced in the current txg are accumulated in
+	 * ms_allocated_this_txg and added by metaslab_sync_done().
+	 */
+	uint64_t	ms_allocated_space;
+	int64_t		ms_allocated_this_txg;
+
 	boolean_t	ms_condensing;	/* condensing? */
 	boolean_t	ms_condense_wanted;
 
+	/*
+	 * Number of TRIM operations currently working on this metaslab.
+	 * No allocations are made from a disabled metaslab.
+	 */
+	uint64_t	ms_disabled;
+
 	/*
 	 * We must hold both ms_lock and ms_group->mg_lock in order to
 	 * modify ms_loaded.
@@ -44,6 +44,8 @@
 #include <sys/bpobj.h>
 #include <sys/dsl_crypt.h>
 #include <sys/zfeature.h>
+#include <sys/vdev_removal.h>
+#include <sys/spa_log_spacemap.h>
 #include <zfeature_common.h>
 
 #ifdef	__cplusplus
@@ -149,6 +151,8 @@ struct spa {
 	boolean_t	spa_is_initializing;	/* true while opening pool */
 	metaslab_class_t *spa_normal_class;	/* normal data class */
 	metaslab_class_t *spa_log_class;	/* intent log data class */
+	metaslab_class_t *spa_special_class;	/* special allocation class */
+	metaslab_class_t *spa_dedup_class;	/* dedup allocation class */
 	uint64_t	spa_first_txg;		/* first txg after spa_open() */
 	uint64_t	spa_final_txg;		/* txg of export/destroy */
 	uint64_t	spa_freeze_txg;		/* freeze pool at this txg */
@@ -198,6 +202,7 @@ struct spa {
 	uint64_t	spa_scan_pass_scrub_pause; /* scrub pause time */
 	uint64_t	spa_scan_pass_scrub_spent_paused; /* total paused */
 	uint64_t	spa_scan_pass_exam;	/* examined bytes per pass */
+	uint64_t	spa_scan_pass_issued;	/* issued bytes per pass */
 	kmutex_t	spa_async_lock;		/* protect async state */
 	kthread_t	*spa_async_thread;	/* thread doing async task */
 	int		spa_async_suspended;	/* async tasks suspended */
@@ -242,6 +247,7 @@ struct spa {
 	int		spa_mode;		/* FREAD | FWRITE */
 	spa_log_state_t spa_log_state;		/* log state */
 	uint64_t	spa_autoexpand;		/* lun expansion on/off */
+	spa_autotrim_t	spa_autotrim;		/* automatic background trim? */
 	ddt_t		*spa_ddt[ZIO_CHECKSUM_FUNCTIONS]; /* in-core DDTs */
 	uint64_t	spa_ddt_stat_object;	/* DDT statistics */
 	uint64_t	spa_dedup_dspace;	/* Cache get_dedup_dspace() */
@@ -272,6 +278,19 @@ struct spa {
 	uint64_t	spa_deadman_synctime;	/* deadman expiration timer */
 	uint64_t	spa_all_vdev_zaps;	/* ZAP of per-vd ZAP obj #s */
 	spa_avz_action_t	spa_avz_action;	/* destroy/rebuild AVZ? */
+	spa_removing_phys_t	spa_removing_phys; /* last device removal */
+	spa_vdev_removal_t	*spa_vdev_removal; /* active removal */
+
+	/* log space maps, see spa_log_spacemap.c */
+	uint64_t	spa_log_sm_zap;		/* txg -> log object */
+	avl_tree_t	spa_log_sms;		/* spa_log_sm_t, by txg */
+	spa_log_sm_t	*spa_syncing_log_sm;	/* log of the syncing txg */
+	kmutex_t	spa_log_sm_lock;	/* protects the above */
+	avl_tree_t	spa_metaslabs_by_flushed; /* ms w/ logged changes */
+	kmutex_t	spa_flushed_ms_lock;	/* protects the tree */
+	uint64_t	spa_log_unflushed_segs;	/* segs in unflushed trees */
+	uint64_t	spa_log_flushed_ms;	/* metaslabs flushed this txg */
+
 	uint64_t	spa_errata;		/* errata issues detected */
 	spa_stats_t	spa_stats;		/* assorted spa statistics */
 	spa_keystore_t	spa_keystore;		/* loaded crypto keys */
@@ -0,0 +1,91 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_SPA_LOG_SPACEMAP_H
+#define	_SYS_SPA_LOG_SPACEMAP_H
+
+#include <sys/avl.h>
+#include <sys/spa.h>
+#include <sys/space_map.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Each entry of a log space map takes two words:
+ *
+ *    1          24            1                 38
+ *  ,---+------------------+------+---------------------------------.
+ *  | 1 |       vdev       | type |    run (SPA_MINBLOCKSIZE units)  |
+ *  `---+------------------+------+---------------------------------'
+ *   63  62              39   38   37                               0
+ *
+ *                                64
+ *  ,---------------------------------------------------------------.
+ *  |                         offset (bytes)                         |
+ *  `---------------------------------------------------------------'
+ *
+ * The valid bit tells the entries apart from the zeroes which follow the
+ * last one in the object.
+ */
+#define	SLS_VALID_DECODE(x)	BF64_DECODE(x, 63, 1)
+#define	SLS_VALID_ENCODE(x)	BF64_ENCODE(x, 63, 1)
+#define	SLS_VDEV_DECODE(x)	BF64_DECODE(x, 39, 24)
+#define	SLS_VDEV_ENCODE(x)	BF64_ENCODE(x, 39, 24)
+#define	SLS_TYPE_DECODE(x)	BF64_DECODE(x, 38, 1)
+#define	SLS_TYPE_ENCODE(x)	BF64_ENCODE(x, 38, 1)
+#define	SLS_RUN_DECODE(x)	(BF64_DECODE(x, 0, 38) << SPA_MINBLOCKSHIFT)
+#define	SLS_RUN_ENCODE(x)	BF64_ENCODE((x) >> SPA_MINBLOCKSHIFT, 0, 38)
+
+#define	SLS_ENTRY_SIZE		(2 * sizeof (uint64_t))
+
+/*
+ * In-core record of the log space map holding the changes of one txg.
+ * The logs of a pool are listed in the MOS zap DMU_POOL_LOG_SPACEMAP_ZAP,
+ * which maps each txg to its log object.
+ */
+typedef struct spa_log_sm {
+	uint64_t	sls_txg;	/* txg whose changes are logged */
+	uint64_t	sls_object;	/* MOS object of the log */
+	uint64_t	sls_length;	/* bytes of entries in the log */
+	avl_node_t	sls_node;	/* node in spa_log_sms */
+} spa_log_sm_t;
+
+extern boolean_t spa_log_sm_enabled(spa_t *spa);
+extern void spa_log_sm_sync_start(spa_t *spa, dmu_tx_t *tx);
+extern void spa_log_sm_append(spa_t *spa, uint64_t vdev_id, range_tree_t *rt,
+    maptype_t maptype, dmu_tx_t *tx);
+extern int spa_log_sm_compare(const void *a, const void *b);
+extern int spa_log_sm_load(spa_t *spa);
+extern void spa_log_sm_unload(spa_t *spa);
+
+/* tunables */
+extern unsigned long zfs_unflushed_max_mem_amt;
+extern unsigned long zfs_unflushed_max_mem_ppm;
+extern unsigned long zfs_unflushed_log_txg_max;
+extern unsigned long zfs_min_metaslabs_to_flush;
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_SPA_LOG_SPACEMAP_H */
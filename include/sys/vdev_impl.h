@@ -72,6 +72,13 @@ typedef boolean_t vdev_need_resilver_func_t(vdev_t *vd, uint64_t, size_t);
 typedef void	vdev_hold_func_t(vdev_t *vd);
 typedef void	vdev_rele_func_t(vdev_t *vd);
 
+/*
+ * Given a target vdev, translates the logical range "in" to the physical
+ * range "res"
+ */
+typedef void vdev_xlation_func_t(vdev_t *cvd, const range_seg_t *in,
+    range_seg_t *res);
+
 typedef const struct vdev_ops {
 	vdev_open_func_t		*vdev_op_open;
 	vdev_close_func_t		*vdev_op_close;
@@ -82,6 +89,7 @@ typedef const struct vdev_ops {
 	vdev_need_resilver_func_t	*vdev_op_need_resilver;
 	vdev_hold_func_t		*vdev_op_hold;
 	vdev_rele_func_t		*vdev_op_rele;
+	vdev_xlation_func_t		*vdev_op_xlate;
 	char				vdev_op_type[16];
 	boolean_t			vdev_op_leaf;
 } vdev_ops_t;
@@ -89,6 +97,24 @@ typedef const struct vdev_ops {
 /*
  * Virtual device properties
  */
+typedef enum vdev_alloc_bias {
+	VDEV_BIAS_NONE,
+	VDEV_BIAS_LOG,		/* dedicated to ZIL data (SLOG) */
+	VDEV_BIAS_SPECIAL,	/* dedicated to metadata and small blocks */
+	VDEV_BIAS_DEDUP		/* dedicated to dedup metadata */
+} vdev_alloc_bias_t;
+
+/*
+ * Why a mirror child was selected to serve a read, see vdev_mirror.c.
+ */
+typedef enum vdev_mirror_sel {
+	VDEV_MIRROR_SEL_LOAD,		/* lowest pending load */
+	VDEV_MIRROR_SEL_LATENCY,	/* lowest expected latency */
+	VDEV_MIRROR_SEL_SPREAD,		/* offset among equal candidates */
+	VDEV_MIRROR_SEL_RETRY,		/* any child not yet tried */
+	VDEV_MIRROR_SEL_TYPES
+} vdev_mirror_sel_t;
+
 struct vdev_cache_entry {
 	struct abd	*ve_abd;
 	uint64_t	ve_offset;
@@ -122,9 +148,12 @@ struct vdev_queue {
 	avl_tree_t	vq_active_tree;
 	avl_tree_t	vq_read_offset_tree;
 	avl_tree_t	vq_write_offset_tree;
+	avl_tree_t	vq_trim_offset_tree;
 	uint64_t	vq_last_offset;
 	hrtime_t	vq_io_complete_ts; /* time last i/o completed */
 	hrtime_t	vq_io_delta_ts;
+	uint64_t	vq_lat_avg;	/* decaying device latency (ns) */
+	uint64_t	vq_bw_avg;	/* decaying throughput (bytes/s) */
 	zio_t		vq_io_search; /* used as local for stack reduction */
 	kmutex_t	vq_lock;
 };
@@ -170,6 +199,7 @@ struct vdev {
 	uint64_t	vdev_ms_array;	/* metaslab array object	*/
 	uint64_t	vdev_ms_shift;	/* metaslab size shift		*/
 	uint64_t	vdev_ms_count;	/* number of metaslabs		*/
+	uint64_t	vdev_ms_unflushed_object; /* ms unflushed txgs	*/
 	metaslab_group_t *vdev_mg;	/* metaslab group		*/
 	metaslab_t	**vdev_ms;	/* metaslab array		*/
 	uint64_t	vdev_pending_fastwrite; /* allocated fastwrites */
@@ -182,11 +212,20 @@ struct vdev {
 	list_node_t	vdev_state_dirty_node; /* state dirty list	*/
 	uint64_t	vdev_deflate_ratio; /* deflation ratio (x512)	*/
 	uint64_t	vdev_islog;	/* is an intent log device	*/
+	vdev_alloc_bias_t vdev_alloc_bias; /* metaslab allocation bias	*/
 	uint64_t	vdev_removing;	/* device is being removed?	*/
 	boolean_t	vdev_ishole;	/* is a hole in the namespace	*/
 	kmutex_t	vdev_queue_lock; /* protects vdev_queue_depth	*/
 	uint64_t	vdev_top_zap;
 
+	/* indirect mapping of a removed, or removing, top-level vdev */
+	uint64_t	vdev_indirect_object;
+	struct vdev_indirect_mapping *vdev_indirect_mapping;
+
+	/* pool scan I/O sorting queue, see dsl_scan.c */
+	struct dsl_scan_io_queue *vdev_scan_io_queue;
+	kmutex_t	vdev_scan_io_queue_lock;
+
 	/*
 	 * The queue depth parameters determine how many async writes are
 	 * still pending (i.e. allocated by net yet issued to disk) per
@@ -238,6 +277,29 @@ struct vdev {
 	vdev_aux_t	vdev_label_aux;	/* on-disk aux state		*/
 	uint64_t	vdev_leaf_zap;
 	hrtime_t	vdev_mmp_pending; /* 0 if write finished	*/
+	uint64_t	vdev_mirror_reads[VDEV_MIRROR_SEL_TYPES];
+	boolean_t	vdev_has_trim;	/* TRIM is supported		*/
+
+	/*
+	 * Manual TRIM state, see vdev_trim.c.  The last offset, state,
+	 * action time and rate are persisted in the leaf vdev ZAP.
+	 */
+	kthread_t	*vdev_trim_thread;
+	vdev_trim_state_t vdev_trim_state;
+	boolean_t	vdev_trim_exit_wanted;
+	uint64_t	vdev_trim_last_offset;
+	uint64_t	vdev_trim_rate;	/* requested rate (bytes/sec)	*/
+	uint64_t	vdev_trim_bytes_done;
+	uint64_t	vdev_trim_bytes_est;
+	uint64_t	vdev_trim_inflight;
+	time_t		vdev_trim_action_time;	/* start and end time	*/
+
+	/*
+	 * Automatic TRIM state for top-level vdevs, see vdev_trim.c.
+	 */
+	kthread_t	*vdev_autotrim_thread;
+	boolean_t	vdev_autotrim_exit_wanted;
+	uint64_t	vdev_autotrim_txg;	/* last txg kicked	*/
 
 	/*
 	 * For DTrace to work in userland (libzpool) context, these fields must
@@ -249,6 +311,13 @@ struct vdev {
 	kmutex_t	vdev_dtl_lock;	/* vdev_dtl_{map,resilver}	*/
 	kmutex_t	vdev_stat_lock;	/* vdev_stat			*/
 	kmutex_t	vdev_probe_lock; /* protects vdev_probe_zio	*/
+	kmutex_t	vdev_trim_lock;	/* vdev_trim_* state		*/
+	kcondvar_t	vdev_trim_cv;
+	kmutex_t	vdev_trim_io_lock; /* vdev_trim_inflight	*/
+	kcondvar_t	vdev_trim_io_cv;
+	kmutex_t	vdev_autotrim_lock; /* vdev_autotrim_* state	*/
+	kcondvar_t	vdev_autotrim_cv;
+	kcondvar_t	vdev_autotrim_kick_cv;
 
 	/*
 	 * We rate limit ZIO delay and ZIO checksum events, since they
@@ -369,6 +438,7 @@ extern vdev_ops_t vdev_file_ops;
 extern vdev_ops_t vdev_missing_ops;
 extern vdev_ops_t vdev_hole_ops;
 extern vdev_ops_t vdev_spare_ops;
+extern vdev_ops_t vdev_indirect_ops;
 
 /*
  * Common size functions
@@ -377,6 +447,18 @@ extern uint64_t vdev_default_asize(vdev_t *vd, uint64_t psize);
 extern uint64_t vdev_get_min_asize(vdev_t *vd);
 extern void vdev_set_min_asize(vdev_t *vd);
 
+/*
+ * Common translation functions
+ */
+extern void vdev_default_xlate(vdev_t *vd, const range_seg_t *in,
+    range_seg_t *out);
+
+/*
+ * Indirect vdev remapping, see vdev_indirect.c
+ */
+extern void vdev_indirect_remap(vdev_t *vd, uint64_t offset, uint64_t asize,
+    void (*func)(uint64_t, vdev_t *, uint64_t, uint64_t, void *), void *arg);
+
 /*
  * Global variables
  */
@@ -0,0 +1,100 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_VDEV_INDIRECT_MAPPING_H
+#define	_SYS_VDEV_INDIRECT_MAPPING_H
+
+#include <sys/dmu.h>
+#include <sys/list.h>
+#include <sys/spa.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * An indirect mapping translates offsets on a removed (or being removed)
+ * top-level vdev to the locations the data was copied to.  It is stored
+ * in the MOS as an array of entries sorted by source offset, each of
+ * which covers a contiguous range of the source vdev.  The length of the
+ * range is the asize of the destination DVA.  Ranges that were never
+ * allocated on the source are not mapped.
+ */
+typedef struct vdev_indirect_mapping_entry_phys {
+	uint64_t	vimep_src;	/* offset on the source vdev */
+	dva_t		vimep_dst;	/* new location, asize is length */
+} vdev_indirect_mapping_entry_phys_t;
+
+typedef struct vdev_indirect_mapping_phys {
+	uint64_t	vimp_max_offset; /* source offsets below are mapped */
+	uint64_t	vimp_bytes_mapped; /* sum of mapped lengths */
+	uint64_t	vimp_num_entries; /* number of mapping entries */
+} vdev_indirect_mapping_phys_t;
+
+/*
+ * An entry waiting to be appended to the mapping in syncing context.
+ */
+typedef struct vdev_indirect_mapping_entry {
+	vdev_indirect_mapping_entry_phys_t	vime_mapping;
+	list_node_t				vime_node;
+} vdev_indirect_mapping_entry_t;
+
+typedef struct vdev_indirect_mapping {
+	uint64_t	vim_object;	/* MOS object holding the entries */
+	objset_t	*vim_objset;
+	dmu_buf_t	*vim_dbuf;	/* bonus buffer */
+	vdev_indirect_mapping_phys_t *vim_phys;
+
+	/*
+	 * All entries are kept in core, sorted by source offset.  The
+	 * array is only ever appended to, in syncing context, and the
+	 * lock protects readers against it being reallocated.
+	 */
+	krwlock_t	vim_lock;
+	vdev_indirect_mapping_entry_phys_t *vim_entries;
+	uint64_t	vim_entries_alloc; /* capacity of vim_entries */
+} vdev_indirect_mapping_t;
+
+extern uint64_t vdev_indirect_mapping_alloc(objset_t *os, dmu_tx_t *tx);
+extern void vdev_indirect_mapping_free(objset_t *os, uint64_t obj,
+    dmu_tx_t *tx);
+extern int vdev_indirect_mapping_open(objset_t *os, uint64_t obj,
+    vdev_indirect_mapping_t **vimp);
+extern void vdev_indirect_mapping_close(vdev_indirect_mapping_t *vim);
+
+extern void vdev_indirect_mapping_add_entries(vdev_indirect_mapping_t *vim,
+    list_t *vime_list, uint64_t max_offset, dmu_tx_t *tx);
+extern int vdev_indirect_mapping_entries_in_range(vdev_indirect_mapping_t *vim,
+    uint64_t offset, uint64_t size, vdev_indirect_mapping_entry_phys_t **out);
+
+extern uint64_t vdev_indirect_mapping_object(vdev_indirect_mapping_t *vim);
+extern uint64_t vdev_indirect_mapping_num_entries(
+    vdev_indirect_mapping_t *vim);
+extern uint64_t vdev_indirect_mapping_max_offset(vdev_indirect_mapping_t *vim);
+extern uint64_t vdev_indirect_mapping_bytes_mapped(
+    vdev_indirect_mapping_t *vim);
+extern uint64_t vdev_indirect_mapping_size(vdev_indirect_mapping_t *vim);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_VDEV_INDIRECT_MAPPING_H */
@@ -0,0 +1,108 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_VDEV_REMOVAL_H
+#define	_SYS_VDEV_REMOVAL_H
+
+#include <sys/spa.h>
+#include <sys/range_tree.h>
+#include <sys/vdev_indirect_mapping.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Removal state, stored in the MOS directory under DMU_POOL_REMOVING as
+ * an array of uint64s.  The state reuses the dsl_scan_state_t values.
+ */
+typedef struct spa_removing_phys {
+	uint64_t	sr_state;	/* dsl_scan_state_t */
+	uint64_t	sr_removing_vdev; /* top-level vdev id */
+	uint64_t	sr_start_time;	/* removal start time */
+	uint64_t	sr_end_time;	/* removal end time */
+	uint64_t	sr_to_copy;	/* bytes allocated when started */
+	uint64_t	sr_copied;	/* bytes copied, or freed uncopied */
+} spa_removing_phys_t;
+
+/*
+ * In-core state of an active removal.  The copy thread walks the
+ * metaslabs of the removing vdev in offset order.  svr_allocd_segs holds
+ * the segments of the current metaslab which remain to be copied, and
+ * copies are assigned to the open txg; the mapping entries for them are
+ * appended to the indirect mapping when that txg syncs.  Frees of the
+ * removing vdev's space (see metaslab_free_dva()) consult these fields,
+ * under svr_lock, to decide whether the freed range must be removed from
+ * svr_allocd_segs, or whether its new location must be freed as well.
+ */
+typedef struct spa_vdev_removal {
+	uint64_t	svr_vdev_id;
+	kthread_t	*svr_thread;
+	boolean_t	svr_thread_exit;
+	kmutex_t	svr_lock;
+	kcondvar_t	svr_cv;
+
+	/* Segments of the current metaslab left to copy. */
+	range_tree_t	*svr_allocd_segs;
+
+	/* Source offsets below this are copied in txg (i & TXG_MASK). */
+	uint64_t	svr_max_offset_to_sync[TXG_SIZE];
+	/* Mapping entries to append when the txg syncs. */
+	list_t		svr_new_segments[TXG_SIZE];
+	/* Copied ranges freed before their mapping was synced. */
+	range_tree_t	*svr_frees[TXG_SIZE];
+	/* Bytes copied or freed uncopied in the txg. */
+	uint64_t	svr_bytes_done[TXG_SIZE];
+	/* Parent of the copy I/Os issued in the txg. */
+	zio_t		*svr_zio[TXG_SIZE];
+
+	uint64_t	svr_bytes_inflight; /* copy I/O outstanding */
+	boolean_t	svr_copy_done;	/* sources freed, use the mapping */
+	int		svr_error;	/* first copy error */
+	hrtime_t	svr_pass_start;	/* thread (re)start, for the rate */
+	uint64_t	svr_pass_copied; /* bytes copied since then */
+} spa_vdev_removal_t;
+
+extern int spa_remove_init(spa_t *spa);
+extern void spa_restart_removal(spa_t *spa);
+extern void spa_vdev_remove_suspend(spa_t *spa);
+extern void spa_vdev_remove_fini(spa_t *spa);
+extern int spa_vdev_remove_top(vdev_t *vd, uint64_t *txg);
+extern int spa_vdev_remove_cancel(spa_t *spa);
+extern void spa_vdev_remove_complete(spa_t *spa);
+extern boolean_t spa_vdev_remove_active(spa_t *spa);
+extern int spa_removal_get_stats(spa_t *spa, pool_removal_stat_t *prs);
+extern void spa_removal_kstat_update(spa_t *spa, uint64_t *rate,
+    uint64_t *entries, uint64_t *memory);
+
+extern boolean_t vdev_contains_raidz(vdev_t *vd);
+extern void free_from_removing_vdev(vdev_t *vd, uint64_t offset,
+    uint64_t size, uint64_t txg);
+
+/* Global tuning */
+extern int zfs_remove_max_segment;
+extern int zfs_remove_max_copy_bytes;
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_VDEV_REMOVAL_H */
@@ -552,13 +552,19 @@ typedef struct vsecattr {
 
 #define	CRCREAT		0
 
+#ifndef F_FREESP
+#define	F_FREESP	11
+#endif
+
 extern int fop_getattr(vnode_t *vp, vattr_t *vap);
+extern int fop_space(vnode_t *vp, int cmd, struct flock *bfp);
 
 #define	VOP_CLOSE(vp, f, c, o, cr, ct)	vn_close(vp)
 #define	VOP_PUTPAGE(vp, of, sz, fl, cr, ct)	0
 #define	VOP_GETATTR(vp, vap, fl, cr, ct)  fop_getattr((vp), (vap));
 
 #define	VOP_FSYNC(vp, f, cr, ct)	fsync((vp)->v_fd)
+#define	VOP_SPACE(vp, cmd, a, f, o, cr, ct)	fop_space((vp), (cmd), (a))
 
 #define	VN_RELE(vp)	vn_close(vp)
 
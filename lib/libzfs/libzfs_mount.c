@@ -61,17 +61,26 @@
  *
  * 	zpool_enable_datasets()
  * 	zpool_disable_datasets()
+ *
+ * Both of these, as well as 'zfs mount -a' and 'zfs unmount -a', process
+ * filesystems in parallel while respecting the mountpoint hierarchy using:
+ *
+ * 	zfs_foreach_mountpoint()
+ * 	zfs_foreach_mounted()
  */
 
+#include <assert.h>
 #include <dirent.h>
 #include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
 #include <libintl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
+#include <thread_pool.h>
 #include <unistd.h>
 #include <zone.h>
 #include <sys/mntent.h>
@@ -846,7 +855,7 @@ zfs_parse_options(char *options, zfs_share_proto_t proto)
  * on "libshare" to do the dirty work for us.
  */
 static int
-zfs_share_proto(zfs_handle_t *zhp, zfs_share_proto_t *proto)
+zfs_share_proto_impl(zfs_handle_t *zhp, zfs_share_proto_t *proto)
 {
 	char mountpoint[ZFS_MAXPROPLEN];
 	char shareopts[ZFS_MAXPROPLEN];
@@ -935,6 +944,23 @@ zfs_share_proto(zfs_handle_t *zhp, zfs_share_proto_t *proto)
 	return (0);
 }
 
+/*
+ * Filesystems may be mounted, and thus shared, from several threads at
+ * once (see zfs_foreach_mountpoint()), so serialize access to libshare.
+ */
+static int
+zfs_share_proto(zfs_handle_t *zhp, zfs_share_proto_t *proto)
+{
+	libzfs_handle_t *hdl = zhp->zfs_hdl;
+	int ret;
+
+	(void) pthread_mutex_lock(&hdl->libzfs_share_lock);
+	ret = zfs_share_proto_impl(zhp, proto);
+	(void) pthread_mutex_unlock(&hdl->libzfs_share_lock);
+
+	return (ret);
+}
+
 
 int
 zfs_share_nfs(zfs_handle_t *zhp)
@@ -998,11 +1024,8 @@ unshare_one(libzfs_handle_t *hdl, const char *name, const char *mountpoint,
 	return (0);
 }
 
-/*
- * Unshare the given filesystem.
- */
-int
-zfs_unshare_proto(zfs_handle_t *zhp, const char *mountpoint,
+static int
+zfs_unshare_proto_impl(zfs_handle_t *zhp, const char *mountpoint,
     zfs_share_proto_t *proto)
 {
 	libzfs_handle_t *hdl = zhp->zfs_hdl;
@@ -1038,6 +1061,23 @@ zfs_unshare_proto(zfs_handle_t *zhp, const char *mountpoint,
 	return (0);
 }
 
+/*
+ * Unshare the given filesystem.
+ */
+int
+zfs_unshare_proto(zfs_handle_t *zhp, const char *mountpoint,
+    zfs_share_proto_t *proto)
+{
+	libzfs_handle_t *hdl = zhp->zfs_hdl;
+	int ret;
+
+	(void) pthread_mutex_lock(&hdl->libzfs_share_lock);
+	ret = zfs_unshare_proto_impl(zhp, mountpoint, proto);
+	(void) pthread_mutex_unlock(&hdl->libzfs_share_lock);
+
+	return (ret);
+}
+
 int
 zfs_unshare_nfs(zfs_handle_t *zhp, const char *mountpoint)
 {
@@ -1224,21 +1264,416 @@ libzfs_dataset_cmp(const void *a, const void *b)
 	return (strcmp(zfs_get_name(*za), zfs_get_name(*zb)));
 }
 
+/*
+ * Mounting and unmounting every filesystem in a pool one at a time is
+ * dominated by the latency of the mount helper, so a pool with many
+ * thousands of filesystems can take a very long time to import or export.
+ * The routines below walk a set of mountpoints as a hierarchy instead and
+ * hand independent subtrees to a thread pool:
+ *
+ *	- in mount order, a filesystem is only dispatched once the
+ *	  filesystem whose mountpoint contains it has been processed, so
+ *	  parent directories are always mounted before their children.
+ *
+ *	- in unmount order, a filesystem is only dispatched once every
+ *	  filesystem mounted beneath it has been processed.  If any of
+ *	  those could not be unmounted, its ancestors are skipped since
+ *	  they would be busy anyway.
+ *
+ * Setting ZFS_SERIAL_MOUNT in the environment processes the filesystems
+ * one at a time, in the same order.
+ */
+#define	MOUNT_TP_SIZE	512
+
+typedef struct mnt_walk mnt_walk_t;
+
+typedef struct mnt_node {
+	mnt_walk_t	*mn_walk;
+	char		*mn_mountpoint;
+	size_t		mn_idx;		/* index in the caller's arrays */
+	ssize_t		mn_parent;	/* nearest containing mountpoint */
+	ssize_t		mn_child;	/* first contained mountpoint */
+	ssize_t		mn_sibling;	/* next mountpoint with same parent */
+	uint_t		mn_pending;	/* children not yet unmounted */
+	boolean_t	mn_failed;	/* a child could not be unmounted */
+} mnt_node_t;
+
+struct mnt_walk {
+	mnt_node_t	*mw_nodes;
+	size_t		mw_count;
+	boolean_t	mw_reverse;
+	int		(*mw_func)(size_t, void *);
+	void		*mw_data;
+	tpool_t		*mw_tp;
+	pthread_mutex_t	mw_lock;
+	int		mw_error;
+};
+
+/*
+ * Compare two mountpoints such that every mountpoint contained in another
+ * sorts directly after it, i.e. "/" compares lower than any other character.
+ */
+static int
+mountpoint_cmp(const void *a, const void *b)
+{
+	const unsigned char *ma =
+	    (const unsigned char *)((const mnt_node_t *)a)->mn_mountpoint;
+	const unsigned char *mb =
+	    (const unsigned char *)((const mnt_node_t *)b)->mn_mountpoint;
+
+	while (*ma != '\0' && *ma == *mb) {
+		ma++;
+		mb++;
+	}
+
+	if (*ma == *mb)
+		return (0);
+	if (*ma == '\0')
+		return (-1);
+	if (*mb == '\0')
+		return (1);
+	if (*ma == '/')
+		return (-1);
+	if (*mb == '/')
+		return (1);
+	return (*ma < *mb ? -1 : 1);
+}
+
+/*
+ * Returns true if 'child' is 'parent' or lies beneath it.
+ */
+static boolean_t
+mountpoint_contains(const char *parent, const char *child)
+{
+	size_t len = strlen(parent);
+
+	/* "legacy", "none" and the like are not part of the hierarchy */
+	if (parent[0] != '/')
+		return (B_FALSE);
+
+	if (strncmp(parent, child, len) != 0)
+		return (B_FALSE);
+
+	return (child[len] == '\0' || child[len] == '/' ||
+	    (len > 0 && parent[len - 1] == '/'));
+}
+
+static void mnt_walk_task(void *);
+
+static void
+mnt_walk_dispatch(mnt_walk_t *mw, ssize_t pos)
+{
+	mnt_node_t *mn = &mw->mw_nodes[pos];
+
+	if (mw->mw_tp == NULL ||
+	    tpool_dispatch(mw->mw_tp, mnt_walk_task, mn) != 0)
+		mnt_walk_task(mn);
+}
+
+static void
+mnt_walk_task(void *arg)
+{
+	mnt_node_t *mn = arg;
+	mnt_walk_t *mw = mn->mn_walk;
+	mnt_node_t *parent;
+	boolean_t failed = mn->mn_failed;
+	ssize_t pos;
+
+	if (!failed && mw->mw_func(mn->mn_idx, mw->mw_data) != 0) {
+		failed = B_TRUE;
+		(void) pthread_mutex_lock(&mw->mw_lock);
+		mw->mw_error = -1;
+		(void) pthread_mutex_unlock(&mw->mw_lock);
+	}
+
+	if (!mw->mw_reverse) {
+		for (pos = mn->mn_child; pos != -1;
+		    pos = mw->mw_nodes[pos].mn_sibling)
+			mnt_walk_dispatch(mw, pos);
+		return;
+	}
+
+	if (mn->mn_parent == -1)
+		return;
+
+	parent = &mw->mw_nodes[mn->mn_parent];
+	(void) pthread_mutex_lock(&mw->mw_lock);
+	if (failed)
+		parent->mn_failed = B_TRUE;
+	assert(parent->mn_pending > 0);
+	if (--parent->mn_pending != 0)
+		parent = NULL;
+	(void) pthread_mutex_unlock(&mw->mw_lock);
+
+	if (parent != NULL)
+		mnt_walk_dispatch(mw, mn->mn_parent);
+}
+
+/*
+ * Call func(idx, data) for every entry of mountpoints[], in mount order or,
+ * if 'reverse' is set, in unmount order.  Independent subtrees are processed
+ * concurrently unless 'parallel' is false.  Returns -1 if any call failed or
+ * was skipped, 0 otherwise.
+ */
+static int
+mnt_walk(libzfs_handle_t *hdl, char **mountpoints, size_t count,
+    int (*func)(size_t, void *), void *data, boolean_t reverse,
+    boolean_t parallel)
+{
+	mnt_walk_t mw = { 0 };
+	ssize_t *stack;
+	size_t depth = 0;
+	ssize_t i;
+
+	if (count == 0)
+		return (0);
+
+	mw.mw_nodes = zfs_alloc(hdl, count * sizeof (mnt_node_t));
+	stack = zfs_alloc(hdl, count * sizeof (ssize_t));
+	mw.mw_count = count;
+	mw.mw_reverse = reverse;
+	mw.mw_func = func;
+	mw.mw_data = data;
+	(void) pthread_mutex_init(&mw.mw_lock, NULL);
+
+	for (i = 0; i < (ssize_t)count; i++) {
+		mw.mw_nodes[i].mn_walk = &mw;
+		mw.mw_nodes[i].mn_mountpoint = mountpoints[i];
+		mw.mw_nodes[i].mn_idx = i;
+	}
+	qsort(mw.mw_nodes, count, sizeof (mnt_node_t), mountpoint_cmp);
+
+	/*
+	 * Every mountpoint now directly follows the mountpoint containing
+	 * it, so the nearest containing mountpoint is found on a stack of
+	 * the mountpoints leading up to it.
+	 */
+	for (i = 0; i < (ssize_t)count; i++) {
+		mnt_node_t *mn = &mw.mw_nodes[i];
+
+		while (depth > 0 && !mountpoint_contains(
+		    mw.mw_nodes[stack[depth - 1]].mn_mountpoint,
+		    mn->mn_mountpoint))
+			depth--;
+
+		mn->mn_parent = (depth > 0) ? stack[depth - 1] : -1;
+		mn->mn_child = -1;
+		stack[depth++] = i;
+	}
+
+	/* Link children in reverse so they are visited in sorted order. */
+	for (i = count - 1; i >= 0; i--) {
+		mnt_node_t *mn = &mw.mw_nodes[i];
+
+		if (mn->mn_parent == -1) {
+			mn->mn_sibling = -1;
+		} else {
+			mnt_node_t *parent = &mw.mw_nodes[mn->mn_parent];
+
+			mn->mn_sibling = parent->mn_child;
+			parent->mn_child = i;
+			parent->mn_pending++;
+		}
+	}
+	free(stack);
+
+	if (parallel && getenv("ZFS_SERIAL_MOUNT") == NULL && count > 1)
+		mw.mw_tp = tpool_create(1, MOUNT_TP_SIZE, 0, NULL);
+
+	if (reverse) {
+		for (i = count - 1; i >= 0; i--) {
+			if (mw.mw_nodes[i].mn_child == -1)
+				mnt_walk_dispatch(&mw, i);
+		}
+	} else {
+		for (i = 0; i < (ssize_t)count; i++) {
+			if (mw.mw_nodes[i].mn_parent == -1)
+				mnt_walk_dispatch(&mw, i);
+		}
+	}
+
+	if (mw.mw_tp != NULL) {
+		tpool_wait(mw.mw_tp);
+		tpool_destroy(mw.mw_tp);
+	}
+
+	(void) pthread_mutex_destroy(&mw.mw_lock);
+	free(mw.mw_nodes);
+
+	return (mw.mw_error);
+}
+
+/*
+ * Return the mountpoint property of each of the given handles, for
+ * mnt_walk().  Free the result with mountpoints_free().
+ */
+static char **
+mountpoints_get(libzfs_handle_t *hdl, zfs_handle_t **handles, size_t count)
+{
+	char **mountpoints;
+	size_t i;
+
+	mountpoints = zfs_alloc(hdl, (count + 1) * sizeof (char *));
+	for (i = 0; i < count; i++) {
+		char mountpoint[ZFS_MAXPROPLEN];
+
+		if (zfs_get_type(handles[i]) != ZFS_TYPE_FILESYSTEM ||
+		    zfs_prop_get(handles[i], ZFS_PROP_MOUNTPOINT, mountpoint,
+		    sizeof (mountpoint), NULL, NULL, 0, B_FALSE) != 0)
+			mountpoint[0] = '\0';
+		mountpoints[i] = zfs_strdup(hdl, mountpoint);
+
+		/*
+		 * zfs_mount() checks whether the pool is read-only.  Load
+		 * the pool properties now, rather than racing to load them
+		 * from several threads at once.
+		 */
+		(void) zpool_get_prop_int(zfs_get_pool_handle(handles[i]),
+		    ZPOOL_PROP_READONLY, NULL);
+	}
+
+	return (mountpoints);
+}
+
+static void
+mountpoints_free(char **mountpoints, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		free(mountpoints[i]);
+	free(mountpoints);
+}
+
+typedef struct mount_handles_cb {
+	zfs_handle_t	**mh_handles;
+	zfs_iter_f	mh_func;
+	void		*mh_data;
+} mount_handles_cb_t;
+
+static int
+mount_handles_func(size_t idx, void *data)
+{
+	mount_handles_cb_t *mh = data;
+
+	return (mh->mh_func(mh->mh_handles[idx], mh->mh_data));
+}
+
+/*
+ * Call func(handle, data) for each of the given filesystems, in parallel
+ * but never before the filesystem whose mountpoint contains it has been
+ * processed.  This is the ordering zfs_mount() requires.  Callers that
+ * interact with the user, e.g. to prompt for keys, should pass 'parallel'
+ * as false.  Returns -1 if any call failed.
+ */
+int
+zfs_foreach_mountpoint(libzfs_handle_t *hdl, zfs_handle_t **handles,
+    size_t count, zfs_iter_f func, void *data, boolean_t parallel)
+{
+	mount_handles_cb_t mh;
+	char **mountpoints;
+	int ret;
+
+	mountpoints = mountpoints_get(hdl, handles, count);
+
+	mh.mh_handles = handles;
+	mh.mh_func = func;
+	mh.mh_data = data;
+	ret = mnt_walk(hdl, mountpoints, count, mount_handles_func, &mh,
+	    B_FALSE, parallel);
+
+	mountpoints_free(mountpoints, count);
+
+	return (ret);
+}
+
+typedef struct unmount_handles_cb {
+	zfs_handle_t	**uh_handles;
+	char		**uh_mountpoints;
+	zfs_unmount_iter_f uh_func;
+	void		*uh_data;
+} unmount_handles_cb_t;
+
+static int
+unmount_handles_func(size_t idx, void *data)
+{
+	unmount_handles_cb_t *uh = data;
+
+	return (uh->uh_func(uh->uh_handles[idx], uh->uh_mountpoints[idx],
+	    uh->uh_data));
+}
+
+/*
+ * Call func(handle, mountpoint, data) for each of the given mounted
+ * filesystems, in parallel but never before everything mounted beneath
+ * its mountpoint has been processed successfully.  This is the ordering
+ * zfs_unmount() requires.  Returns -1 if any call failed or was skipped.
+ */
+int
+zfs_foreach_mounted(libzfs_handle_t *hdl, zfs_handle_t **handles,
+    char **mountpoints, size_t count, zfs_unmount_iter_f func, void *data)
+{
+	unmount_handles_cb_t uh;
+
+	uh.uh_handles = handles;
+	uh.uh_mountpoints = mountpoints;
+	uh.uh_func = func;
+	uh.uh_data = data;
+
+	return (mnt_walk(hdl, mountpoints, count, unmount_handles_func, &uh,
+	    B_TRUE, B_TRUE));
+}
+
+typedef struct enable_datasets_cb {
+	zfs_handle_t	**ed_handles;
+	int		*ed_good;
+	const char	*ed_mntopts;
+	int		ed_flags;
+} enable_datasets_cb_t;
+
+/*
+ * Mount one dataset on behalf of zpool_enable_datasets(), remembering
+ * which ones succeeded so that they can be shared afterwards.
+ */
+static int
+enable_dataset_cb(size_t idx, void *data)
+{
+	enable_datasets_cb_t *ed = data;
+	zfs_handle_t *zhp = ed->ed_handles[idx];
+
+	/*
+	 * don't attempt to mount encrypted datasets with
+	 * unloaded keys
+	 */
+	if (zfs_prop_get_int(zhp, ZFS_PROP_KEYSTATUS) ==
+	    ZFS_KEYSTATUS_UNAVAILABLE)
+		return (0);
+
+	if (zfs_mount(zhp, ed->ed_mntopts, ed->ed_flags) != 0)
+		return (-1);
+
+	ed->ed_good[idx] = 1;
+	return (0);
+}
+
 /*
  * Mount and share all datasets within the given pool.  This assumes that no
  * datasets within the pool are currently mounted.  Because users can create
  * complicated nested hierarchies of mountpoints, we first gather all the
- * datasets and mountpoints within the pool, and sort them by mountpoint.  Once
- * we have the list of all filesystems, we iterate over them in order and mount
- * and/or share each one.
+ * datasets and mountpoints within the pool.  Once we have the list of all
+ * filesystems, they are mounted in parallel by mnt_walk(), which never
+ * mounts a filesystem before the one containing its mountpoint, and then
+ * shared.
  */
 #pragma weak zpool_mount_datasets = zpool_enable_datasets
 int
 zpool_enable_datasets(zpool_handle_t *zhp, const char *mntopts, int flags)
 {
 	get_all_cb_t cb = { 0 };
+	enable_datasets_cb_t ed;
 	libzfs_handle_t *hdl = zhp->zpool_hdl;
 	zfs_handle_t *zfsp;
+	char **mountpoints;
 	int i, ret = -1;
 	int *good;
 
@@ -1251,11 +1686,6 @@ zpool_enable_datasets(zpool_handle_t *zhp, const char *mntopts, int flags)
 	libzfs_add_handle(&cb, zfsp);
 	if (zfs_iter_filesystems(zfsp, mount_cb, &cb) != 0)
 		goto out;
-	/*
-	 * Sort the datasets by mountpoint.
-	 */
-	qsort(cb.cb_handles, cb.cb_used, sizeof (void *),
-	    libzfs_dataset_cmp);
 
 	/*
 	 * And mount all the datasets, keeping track of which ones
@@ -1265,27 +1695,21 @@ zpool_enable_datasets(zpool_handle_t *zhp, const char *mntopts, int flags)
 	    cb.cb_used * sizeof (int))) == NULL)
 		goto out;
 
-	ret = 0;
-	for (i = 0; i < cb.cb_used; i++) {
-		/*
-		 * don't attempt to mount encrypted datasets with
-		 * unloaded keys
-		 */
-		if (zfs_prop_get_int(cb.cb_handles[i], ZFS_PROP_KEYSTATUS) ==
-		    ZFS_KEYSTATUS_UNAVAILABLE)
-			continue;
-
-		if (zfs_mount(cb.cb_handles[i], mntopts, flags) != 0)
-			ret = -1;
-		else
-			good[i] = 1;
-	}
+	mountpoints = mountpoints_get(hdl, cb.cb_handles, cb.cb_used);
+	ed.ed_handles = cb.cb_handles;
+	ed.ed_good = good;
+	ed.ed_mntopts = mntopts;
+	ed.ed_flags = flags;
+	ret = mnt_walk(hdl, mountpoints, cb.cb_used, enable_dataset_cb, &ed,
+	    B_FALSE, B_TRUE);
+	mountpoints_free(mountpoints, cb.cb_used);
 
 	/*
 	 * Then share all the ones that need to be shared. This needs
 	 * to be a separate pass in order to avoid excessive reloading
-	 * of the configuration. Good should never be NULL since
-	 * zfs_alloc is supposed to exit if memory isn't available.
+	 * of the configuration, and is done serially since libshare is
+	 * not thread-safe. Good should never be NULL since zfs_alloc is
+	 * supposed to exit if memory isn't available.
 	 */
 	for (i = 0; i < cb.cb_used; i++) {
 		if (good[i] && zfs_share(cb.cb_handles[i]) != 0)
@@ -1302,13 +1726,19 @@ out:
 	return (ret);
 }
 
+typedef struct disable_datasets_cb {
+	libzfs_handle_t	*dd_hdl;
+	char		**dd_mountpoints;
+	int		dd_flags;
+} disable_datasets_cb_t;
+
 static int
-mountpoint_compare(const void *a, const void *b)
+disable_dataset_cb(size_t idx, void *data)
 {
-	const char *mounta = *((char **)a);
-	const char *mountb = *((char **)b);
+	disable_datasets_cb_t *dd = data;
 
-	return (strcmp(mountb, mounta));
+	return (unmount_one(dd->dd_hdl, dd->dd_mountpoints[idx],
+	    dd->dd_flags));
 }
 
 /* alias for 2002/240 */
@@ -1328,6 +1758,7 @@ zpool_disable_datasets(zpool_handle_t *zhp, boolean_t force)
 	size_t namelen;
 	char **mountpoints = NULL;
 	zfs_handle_t **datasets = NULL;
+	disable_datasets_cb_t dd;
 	libzfs_handle_t *hdl = zhp->zpool_hdl;
 	int i;
 	int ret = -1;
@@ -1406,13 +1837,8 @@ zpool_disable_datasets(zpool_handle_t *zhp, boolean_t force)
 	}
 
 	/*
-	 * At this point, we have the entire list of filesystems, so sort it by
-	 * mountpoint.
-	 */
-	qsort(mountpoints, used, sizeof (char *), mountpoint_compare);
-
-	/*
-	 * Walk through and first unshare everything.
+	 * At this point, we have the entire list of filesystems.  Walk
+	 * through and first unshare everything.
 	 */
 	for (i = 0; i < used; i++) {
 		zfs_share_proto_t *curr_proto;
@@ -1426,13 +1852,15 @@ zpool_disable_datasets(zpool_handle_t *zhp, boolean_t force)
 	}
 
 	/*
-	 * Now unmount everything, removing the underlying directories as
-	 * appropriate.
+	 * Now unmount everything, children before their parents, and
+	 * remove the underlying directories as appropriate.
 	 */
-	for (i = 0; i < used; i++) {
-		if (unmount_one(hdl, mountpoints[i], flags) != 0)
-			goto out;
-	}
+	dd.dd_hdl = hdl;
+	dd.dd_mountpoints = mountpoints;
+	dd.dd_flags = flags;
+	if (mnt_walk(hdl, mountpoints, used, disable_dataset_cb, &dd,
+	    B_TRUE, B_TRUE) != 0)
+		goto out;
 
 	for (i = 0; i < used; i++) {
 		if (datasets[i])
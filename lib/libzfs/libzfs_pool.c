@@ -1682,13 +1682,20 @@ print_vdev_tree(libzfs_handle_t *hdl, const char *name, nvlist_t *nv,
 	uint_t c, children;
 	char *vname;
 	uint64_t is_log = 0;
+	char *bias = NULL;
 
 	(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_LOG,
 	    &is_log);
+	(void) nvlist_lookup_string(nv, ZPOOL_CONFIG_ALLOCATION_BIAS, &bias);
 
-	if (name != NULL)
-		(void) printf("\t%*s%s%s\n", indent, "", name,
-		    is_log ? " [log]" : "");
+	if (name != NULL) {
+		if (bias != NULL)
+			(void) printf("\t%*s%s [%s]\n", indent, "", name,
+			    bias);
+		else
+			(void) printf("\t%*s%s%s\n", indent, "", name,
+			    is_log ? " [log]" : "");
+	}
 
 	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN,
 	    &child, &children) != 0)
@@ -2505,6 +2512,112 @@ zpool_vdev_path_to_guid(zpool_handle_t *zhp, const char *path)
 	return (zpool_vdev_path_to_guid_impl(zhp, path, NULL, NULL, NULL));
 }
 
+/*
+ * Start, cancel or suspend a manual TRIM of the named leaf vdevs.  The keys
+ * of the 'vds' nvlist are the vdev names.  A non-zero 'rate' limits the
+ * TRIM to that many bytes per second.
+ */
+int
+zpool_trim(zpool_handle_t *zhp, pool_trim_func_t cmd_type, nvlist_t *vds,
+    uint64_t rate)
+{
+	char msg[1024];
+	libzfs_handle_t *hdl = zhp->zpool_hdl;
+	nvlist_t *vdev_guids = fnvlist_alloc();
+	nvlist_t *guids_to_paths = fnvlist_alloc();
+	nvlist_t *errlist = NULL;
+	nvlist_t *vdev_errlist;
+	nvpair_t *elem;
+	boolean_t spare, cache;
+	int err;
+
+	for (elem = nvlist_next_nvpair(vds, NULL); elem != NULL;
+	    elem = nvlist_next_nvpair(vds, elem)) {
+		char *vd_path = nvpair_name(elem);
+		nvlist_t *tgt;
+		uint64_t guid;
+
+		if ((tgt = zpool_find_vdev(zhp, vd_path, &spare, &cache,
+		    NULL)) == NULL || spare || cache) {
+			(void) snprintf(msg, sizeof (msg),
+			    dgettext(TEXT_DOMAIN, "cannot trim '%s'"), vd_path);
+			fnvlist_free(vdev_guids);
+			fnvlist_free(guids_to_paths);
+			if (tgt == NULL)
+				return (zfs_error(hdl, EZFS_NODEVICE, msg));
+			return (zfs_error(hdl, spare ? EZFS_ISSPARE :
+			    EZFS_ISL2CACHE, msg));
+		}
+
+		verify(nvlist_lookup_uint64(tgt, ZPOOL_CONFIG_GUID,
+		    &guid) == 0);
+		fnvlist_add_uint64(vdev_guids, vd_path, guid);
+		(void) snprintf(msg, sizeof (msg), "%llu",
+		    (unsigned long long)guid);
+		fnvlist_add_string(guids_to_paths, msg, vd_path);
+	}
+
+	err = lzc_trim(zhp->zpool_name, cmd_type, rate, vdev_guids, &errlist);
+	fnvlist_free(vdev_guids);
+
+	if (err == 0) {
+		fnvlist_free(guids_to_paths);
+		nvlist_free(errlist);
+		return (0);
+	}
+
+	if (errlist != NULL && nvlist_lookup_nvlist(errlist,
+	    ZPOOL_TRIM_VDEVS, &vdev_errlist) == 0) {
+		for (elem = nvlist_next_nvpair(vdev_errlist, NULL);
+		    elem != NULL;
+		    elem = nvlist_next_nvpair(vdev_errlist, elem)) {
+			int64_t vd_error = fnvpair_value_int64(elem);
+			char *path = fnvlist_lookup_string(guids_to_paths,
+			    nvpair_name(elem));
+
+			(void) snprintf(msg, sizeof (msg),
+			    dgettext(TEXT_DOMAIN, "cannot %s '%s'"),
+			    cmd_type == POOL_TRIM_CANCEL ? "cancel trimming" :
+			    cmd_type == POOL_TRIM_SUSPEND ? "suspend trimming" :
+			    "trim", path);
+
+			switch (vd_error) {
+			case EBUSY:
+				(void) zfs_error(hdl, EZFS_TRIMMING, msg);
+				break;
+			case ESRCH:
+				(void) zfs_error(hdl, EZFS_NO_TRIM, msg);
+				break;
+			case EOPNOTSUPP:
+				(void) zfs_error(hdl, EZFS_TRIM_NOTSUP, msg);
+				break;
+			case ENODEV:
+				(void) zfs_error(hdl, EZFS_NODEVICE, msg);
+				break;
+			case EINVAL:
+				zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+				    "only leaf vdevs can be trimmed"));
+				(void) zfs_error(hdl, EZFS_INVALCONFIG, msg);
+				break;
+			default:
+				(void) zpool_standard_error(hdl, vd_error,
+				    msg);
+				break;
+			}
+		}
+	} else {
+		(void) snprintf(msg, sizeof (msg),
+		    dgettext(TEXT_DOMAIN, "cannot trim '%s'"),
+		    zhp->zpool_name);
+		(void) zpool_standard_error(hdl, err, msg);
+	}
+
+	fnvlist_free(guids_to_paths);
+	nvlist_free(errlist);
+
+	return (-1);
+}
+
 /*
  * Bring the specified vdev online.   The 'flags' parameter is a set of the
  * ZFS_ONLINE_* flags.
@@ -3201,8 +3314,9 @@ out:
 }
 
 /*
- * Remove the given device.  Currently, this is supported only for hot spares,
- * cache, and log devices.
+ * Remove the given device.  Hot spares, cache, and log devices are removed
+ * immediately.  Top-level mirror and disk vdevs have their data copied to
+ * the rest of the pool in the background.
  */
 int
 zpool_vdev_remove(zpool_handle_t *zhp, const char *path)
@@ -3221,15 +3335,6 @@ zpool_vdev_remove(zpool_handle_t *zhp, const char *path)
 	if ((tgt = zpool_find_vdev(zhp, path, &avail_spare, &l2cache,
 	    &islog)) == 0)
 		return (zfs_error(hdl, EZFS_NODEVICE, msg));
-	/*
-	 * XXX - this should just go away.
-	 */
-	if (!avail_spare && !l2cache && !islog) {
-		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
-		    "only inactive hot spares, cache, "
-		    "or log devices can be removed"));
-		return (zfs_error(hdl, EZFS_NODEVICE, msg));
-	}
 
 	version = zpool_get_prop_int(zhp, ZPOOL_PROP_VERSION, NULL);
 	if (islog && version < SPA_VERSION_HOLES) {
@@ -3243,6 +3348,61 @@ zpool_vdev_remove(zpool_handle_t *zhp, const char *path)
 	if (zfs_ioctl(hdl, ZFS_IOC_VDEV_REMOVE, &zc) == 0)
 		return (0);
 
+	switch (errno) {
+
+	case ENOTSUP:
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "only inactive hot spares, cache, log, and top-level "
+		    "mirror or disk devices can be removed; top-level "
+		    "removal requires the device_removal feature and a pool "
+		    "without raidz vdevs"));
+		return (zfs_error(hdl, EZFS_NODEVICE, msg));
+
+	case EINVAL:
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "invalid config; all top-level vdevs must "
+		    "have the same sector size"));
+		return (zfs_error(hdl, EZFS_INVALCONFIG, msg));
+
+	case EBUSY:
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "pool busy; removal or resilver in progress"));
+		return (zfs_error(hdl, EZFS_BUSY, msg));
+
+	case ENOSPC:
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "out of space; the other vdevs cannot hold the data"));
+		return (zfs_error(hdl, EZFS_NOSPC, msg));
+	}
+
+	return (zpool_standard_error(hdl, errno, msg));
+}
+
+/*
+ * Cancel the in-progress removal of a top-level vdev.
+ */
+int
+zpool_vdev_remove_cancel(zpool_handle_t *zhp)
+{
+	zfs_cmd_t zc = {"\0"};
+	char msg[1024];
+	libzfs_handle_t *hdl = zhp->zpool_hdl;
+
+	(void) snprintf(msg, sizeof (msg),
+	    dgettext(TEXT_DOMAIN, "cannot cancel removal"));
+
+	(void) strlcpy(zc.zc_name, zhp->zpool_name, sizeof (zc.zc_name));
+	zc.zc_cookie = 1;
+
+	if (zfs_ioctl(hdl, ZFS_IOC_VDEV_REMOVE, &zc) == 0)
+		return (0);
+
+	if (errno == ENOENT) {
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "no removal in progress"));
+		return (zfs_error(hdl, EZFS_NOENT, msg));
+	}
+
 	return (zpool_standard_error(hdl, errno, msg));
 }
 
@@ -266,6 +266,13 @@ libzfs_error_description(libzfs_handle_t *hdl)
 		    "different host"));
 	case EZFS_CRYPTOFAILED:
 		return (dgettext(TEXT_DOMAIN, "encryption failure"));
+	case EZFS_TRIMMING:
+		return (dgettext(TEXT_DOMAIN, "currently trimming"));
+	case EZFS_NO_TRIM:
+		return (dgettext(TEXT_DOMAIN, "there is no active trim"));
+	case EZFS_TRIM_NOTSUP:
+		return (dgettext(TEXT_DOMAIN, "trim operations are not "
+		    "supported by this device"));
 	case EZFS_UNKNOWN:
 		return (dgettext(TEXT_DOMAIN, "unknown error"));
 	default:
@@ -1051,6 +1058,8 @@ libzfs_init(void)
 	zpool_prop_init();
 	zpool_feature_init();
 	libzfs_mnttab_init(hdl);
+	(void) pthread_mutex_init(&hdl->libzfs_mnttab_cache_lock, NULL);
+	(void) pthread_mutex_init(&hdl->libzfs_share_lock, NULL);
 	fletcher_4_init();
 
 	return (hdl);
@@ -1072,6 +1081,8 @@ libzfs_fini(libzfs_handle_t *hdl)
 	zpool_free_handles(hdl);
 	namespace_clear(hdl);
 	libzfs_mnttab_fini(hdl);
+	(void) pthread_mutex_destroy(&hdl->libzfs_mnttab_cache_lock);
+	(void) pthread_mutex_destroy(&hdl->libzfs_share_lock);
 	libzfs_core_fini();
 	fletcher_4_fini();
 	free(hdl);
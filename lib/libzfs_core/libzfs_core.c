@@ -394,6 +394,33 @@ lzc_sync(const char *pool_name, nvlist_t *innvl, nvlist_t **outnvl)
 	return (lzc_ioctl(ZFS_IOC_POOL_SYNC, pool_name, innvl, NULL));
 }
 
+/*
+ * Changes the manual TRIM state of the leaf vdevs in the pool.
+ *
+ * The keys in the vdevs nvlist are the vdev names and the values are
+ * their guids.  A non-zero rate limits the TRIM to that many bytes per
+ * second.  If any of the vdevs could not be acted upon, errlist is set
+ * to an nvlist mapping the guid of each failed vdev to its errno.
+ */
+int
+lzc_trim(const char *poolname, pool_trim_func_t cmd_type, uint64_t rate,
+    nvlist_t *vdevs, nvlist_t **errlist)
+{
+	int error;
+	nvlist_t *args = fnvlist_alloc();
+
+	fnvlist_add_uint64(args, ZPOOL_TRIM_COMMAND, (uint64_t)cmd_type);
+	fnvlist_add_nvlist(args, ZPOOL_TRIM_VDEVS, vdevs);
+	if (rate != 0)
+		fnvlist_add_uint64(args, ZPOOL_TRIM_RATE, rate);
+
+	error = lzc_ioctl(ZFS_IOC_POOL_TRIM, poolname, args, errlist);
+
+	fnvlist_free(args);
+
+	return (error);
+}
+
 /*
  * Create "user holds" on snapshots.  If there is a hold on a snapshot,
  * the snapshot can not be destroyed.  (However, it can be marked for deletion
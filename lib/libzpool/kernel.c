@@ -647,6 +647,27 @@ fop_getattr(vnode_t *vp, vattr_t *vap)
 	return (0);
 }
 
+/*
+ * Only F_FREESP is supported, which is implemented by punching a hole
+ * in the backing file.  This is used by file vdevs to handle TRIM.
+ */
+int
+fop_space(vnode_t *vp, int cmd, struct flock *bfp)
+{
+	if (cmd != F_FREESP || bfp->l_whence != SEEK_SET)
+		return (EOPNOTSUPP);
+
+#if defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+	if (fallocate(vp->v_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+	    bfp->l_start, bfp->l_len) == -1)
+		return (errno);
+
+	return (0);
+#else
+	return (EOPNOTSUPP);
+#endif
+}
+
 /*
  * =========================================================================
  * Figure out which debugging statements to print
@@ -352,6 +352,166 @@ nvp_buf_free(nvlist_t *nvl, nvpair_t *nvp)
 	nv_mem_free(priv, NVPAIR2I_NVP(nvp), nvsize);
 }
 
+/*
+ * Name index
+ *
+ * Looking up a pair by name means walking the list, which makes building
+ * or querying an nvlist with many pairs quadratic.  Once a list holds more
+ * than NVP_HASH_MIN_ENTRIES pairs, an index hashing the pair names into
+ * nvp_hashtable is built, with the pairs of a bucket chained through
+ * nvi_hashnext.  The table is resized to keep about one pair per bucket,
+ * and dropped again if the list shrinks back below half the threshold.
+ *
+ * Pairs are appended to their bucket, so pairs with the same name appear
+ * in a bucket in list order and a lookup finds the same pair a walk of the
+ * list would.  The list itself, and so iteration and encoding order, is
+ * left untouched.  The index is only an accelerator: if it cannot be
+ * allocated the list is walked as before.  Lists using the fixed-buffer
+ * allocator are never indexed, so the index cannot eat into their buffer.
+ */
+#define	NVP_HASH_MIN_ENTRIES	16
+#define	NVP_HASH_MIN_BUCKETS	32
+
+static uint32_t
+nvt_hash(const char *name)
+{
+	const uint8_t *p;
+	uint32_t hash = 2166136261U;
+
+	for (p = (const uint8_t *)name; *p != '\0'; p++) {
+		hash ^= *p;
+		hash *= 16777619U;
+	}
+
+	return (hash);
+}
+
+static i_nvp_t **
+nvt_bucket(nvpriv_t *priv, const char *name)
+{
+	return (&priv->nvp_hashtable[nvt_hash(name) &
+	    (priv->nvp_nbuckets - 1)]);
+}
+
+static void
+nvt_insert(nvpriv_t *priv, i_nvp_t *curr)
+{
+	i_nvp_t **prevp = nvt_bucket(priv, NVP_NAME(&curr->nvi_nvp));
+
+	while (*prevp != NULL)
+		prevp = &(*prevp)->nvi_hashnext;
+
+	curr->nvi_hashnext = NULL;
+	*prevp = curr;
+}
+
+static void
+nvt_remove(nvpriv_t *priv, i_nvp_t *curr)
+{
+	i_nvp_t **prevp = nvt_bucket(priv, NVP_NAME(&curr->nvi_nvp));
+
+	while (*prevp != curr)
+		prevp = &(*prevp)->nvi_hashnext;
+
+	*prevp = curr->nvi_hashnext;
+	curr->nvi_hashnext = NULL;
+}
+
+static void
+nvt_destroy(nvpriv_t *priv)
+{
+	if (priv->nvp_hashtable == NULL)
+		return;
+
+	nv_mem_free(priv, priv->nvp_hashtable,
+	    priv->nvp_nbuckets * sizeof (i_nvp_t *));
+	priv->nvp_hashtable = NULL;
+	priv->nvp_nbuckets = 0;
+}
+
+/*
+ * (Re)build the index with the given number of buckets, a power of two.
+ * Walking the list keeps pairs of the same name in list order.  If the
+ * new table cannot be allocated the current index, if any, is kept.
+ */
+static void
+nvt_resize(nvpriv_t *priv, uint32_t nbuckets)
+{
+	i_nvp_t **table;
+	i_nvp_t *curr;
+
+	if ((table = nv_mem_zalloc(priv, nbuckets * sizeof (i_nvp_t *))) ==
+	    NULL)
+		return;
+
+	nvt_destroy(priv);
+	priv->nvp_hashtable = table;
+	priv->nvp_nbuckets = nbuckets;
+
+	for (curr = priv->nvp_list; curr != NULL; curr = curr->nvi_next)
+		nvt_insert(priv, curr);
+}
+
+/*
+ * Keep the index sized to the number of pairs in the list.
+ */
+static void
+nvt_update(nvpriv_t *priv)
+{
+	uint32_t n = priv->nvp_nentries;
+	uint32_t nbuckets;
+
+	if (priv->nvp_hashtable == NULL) {
+		if (n <= NVP_HASH_MIN_ENTRIES ||
+		    priv->nvp_nva->nva_ops == nv_fixed_ops)
+			return;
+		for (nbuckets = NVP_HASH_MIN_BUCKETS; nbuckets < n;
+		    nbuckets <<= 1)
+			;
+		nvt_resize(priv, nbuckets);
+	} else if (n < NVP_HASH_MIN_ENTRIES / 2) {
+		nvt_destroy(priv);
+	} else if (n > priv->nvp_nbuckets) {
+		nvt_resize(priv, priv->nvp_nbuckets << 1);
+	} else if (n < priv->nvp_nbuckets / 4 &&
+	    priv->nvp_nbuckets > NVP_HASH_MIN_BUCKETS) {
+		nvt_resize(priv, priv->nvp_nbuckets >> 1);
+	}
+}
+
+/*
+ * Find the first pair in the list with the given name and, unless
+ * 'anytype' is set, type.
+ */
+static i_nvp_t *
+nvt_lookup(nvpriv_t *priv, const char *name, data_type_t type,
+    boolean_t anytype)
+{
+	i_nvp_t *curr;
+
+	if (priv->nvp_hashtable != NULL) {
+		for (curr = *nvt_bucket(priv, name); curr != NULL;
+		    curr = curr->nvi_hashnext) {
+			nvpair_t *nvp = &curr->nvi_nvp;
+
+			if (strcmp(name, NVP_NAME(nvp)) == 0 &&
+			    (anytype || NVP_TYPE(nvp) == type))
+				return (curr);
+		}
+		return (NULL);
+	}
+
+	for (curr = priv->nvp_list; curr != NULL; curr = curr->nvi_next) {
+		nvpair_t *nvp = &curr->nvi_nvp;
+
+		if (strcmp(name, NVP_NAME(nvp)) == 0 &&
+		    (anytype || NVP_TYPE(nvp) == type))
+			return (curr);
+	}
+
+	return (NULL);
+}
+
 /*
  * nvp_buf_link - link a new nv pair into the nvlist.
  */
@@ -369,6 +529,11 @@ nvp_buf_link(nvlist_t *nvl, nvpair_t *nvp)
 		priv->nvp_last->nvi_next = curr;
 		priv->nvp_last = curr;
 	}
+
+	priv->nvp_nentries++;
+	if (priv->nvp_hashtable != NULL)
+		nvt_insert(priv, curr);
+	nvt_update(priv);
 }
 
 /*
@@ -395,6 +560,11 @@ nvp_buf_unlink(nvlist_t *nvl, nvpair_t *nvp)
 		priv->nvp_last = curr->nvi_prev;
 	else
 		curr->nvi_next->nvi_prev = curr->nvi_prev;
+
+	priv->nvp_nentries--;
+	if (priv->nvp_hashtable != NULL)
+		nvt_remove(priv, curr);
+	nvt_update(priv);
 }
 
 /*
@@ -589,6 +759,7 @@ nvlist_free(nvlist_t *nvl)
 		nvpair_free(nvp);
 		nvp_buf_free(nvl, nvp);
 	}
+	nvt_destroy(priv);
 
 	if (!(priv->nvp_stat & NV_STAT_EMBEDDED))
 		nv_mem_free(priv, nvl, NV_ALIGN(sizeof (nvlist_t)));
@@ -657,14 +828,10 @@ nvlist_remove_all(nvlist_t *nvl, const char *name)
 	    (priv = (nvpriv_t *)(uintptr_t)nvl->nvl_priv) == NULL)
 		return (EINVAL);
 
-	curr = priv->nvp_list;
-	while (curr != NULL) {
+	while ((curr = nvt_lookup(priv, name, DATA_TYPE_UNKNOWN,
+	    B_TRUE)) != NULL) {
 		nvpair_t *nvp = &curr->nvi_nvp;
 
-		curr = curr->nvi_next;
-		if (strcmp(name, NVP_NAME(nvp)) != 0)
-			continue;
-
 		nvp_buf_unlink(nvl, nvp);
 		nvpair_free(nvp);
 		nvp_buf_free(nvl, nvp);
@@ -688,18 +855,14 @@ nvlist_remove(nvlist_t *nvl, const char *name, data_type_t type)
 	    (priv = (nvpriv_t *)(uintptr_t)nvl->nvl_priv) == NULL)
 		return (EINVAL);
 
-	curr = priv->nvp_list;
-	while (curr != NULL) {
+	if ((curr = nvt_lookup(priv, name, type, B_FALSE)) != NULL) {
 		nvpair_t *nvp = &curr->nvi_nvp;
 
-		if (strcmp(name, NVP_NAME(nvp)) == 0 && NVP_TYPE(nvp) == type) {
-			nvp_buf_unlink(nvl, nvp);
-			nvpair_free(nvp);
-			nvp_buf_free(nvl, nvp);
+		nvp_buf_unlink(nvl, nvp);
+		nvpair_free(nvp);
+		nvp_buf_free(nvl, nvp);
 
-			return (0);
-		}
-		curr = curr->nvi_next;
+		return (0);
 	}
 
 	return (ENOENT);
@@ -1351,14 +1514,11 @@ nvlist_lookup_common(nvlist_t *nvl, const char *name, data_type_t type,
 	if (!(nvl->nvl_nvflag & (NV_UNIQUE_NAME | NV_UNIQUE_NAME_TYPE)))
 		return (ENOTSUP);
 
-	for (curr = priv->nvp_list; curr != NULL; curr = curr->nvi_next) {
-		nvp = &curr->nvi_nvp;
-
-		if (strcmp(name, NVP_NAME(nvp)) == 0 && NVP_TYPE(nvp) == type)
-			return (nvpair_value_common(nvp, type, nelem, data));
-	}
+	if ((curr = nvt_lookup(priv, name, type, B_FALSE)) == NULL)
+		return (ENOENT);
 
-	return (ENOENT);
+	nvp = &curr->nvi_nvp;
+	return (nvpair_value_common(nvp, type, nelem, data));
 }
 
 int
@@ -1809,21 +1969,12 @@ boolean_t
 nvlist_exists(nvlist_t *nvl, const char *name)
 {
 	nvpriv_t *priv;
-	nvpair_t *nvp;
-	i_nvp_t *curr;
 
 	if (name == NULL || nvl == NULL ||
 	    (priv = (nvpriv_t *)(uintptr_t)nvl->nvl_priv) == NULL)
 		return (B_FALSE);
 
-	for (curr = priv->nvp_list; curr != NULL; curr = curr->nvi_next) {
-		nvp = &curr->nvi_nvp;
-
-		if (strcmp(name, NVP_NAME(nvp)) == 0)
-			return (B_TRUE);
-	}
-
-	return (B_FALSE);
+	return (nvt_lookup(priv, name, DATA_TYPE_UNKNOWN, B_TRUE) != NULL);
 }
 
 int
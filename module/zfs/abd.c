@@ -59,6 +59,19 @@
  *                                      +----------------->| chunk N-1 |
  *                                                         +-----------+
  *
+ * (c) Gang buffer. In this case, the ABD is a chain of other linear or
+ *     scattered ABDs, which it owns and frees along with itself.  Its data is
+ *     the concatenation of the data of those ABDs.  A gang ABD lets several
+ *     buffers be handed to a single I/O without copying them, see
+ *     vdev_queue_aggregate().
+ *
+ *         +-------------------+
+ *         | ABD (gang)        |
+ *         |   abd_flags = ... |     +-------+     +-------+     +-------+
+ *         |   abd_size = ...  |     | ABD 0 |     | ABD 1 |     | ABD N |
+ *         |   abd_gang_chain ------>|   ------->|   ... ----->|       |
+ *         +-------------------+     +-------+     +-------+     +-------+
+ *
  * Linear buffers act exactly like normal buffers and are always mapped into the
  * kernel's virtual memory space, while scattered ABD data chunks are allocated
  * as physical pages and then mapped in only while they are actually being
@@ -202,6 +215,7 @@ static abd_stats_t abd_stats = {
 
 #define	ABD_SCATTER(abd)	(abd->abd_u.abd_scatter)
 #define	ABD_BUF(abd)		(abd->abd_u.abd_linear.abd_buf)
+#define	ABD_GANG(abd)		(abd->abd_u.abd_gang)
 #define	abd_for_each_sg(abd, sg, n, i)	\
 	for_each_sg(ABD_SCATTER(abd).abd_sgl, sg, n, i)
 
@@ -212,6 +226,13 @@ unsigned zfs_abd_scatter_max_order = MAX_ORDER - 1;
 static kmem_cache_t *abd_cache = NULL;
 static kstat_t *abd_ksp;
 
+/*
+ * A scattered ABD of SPA_MAXBLOCKSIZE bytes whose every page is the same
+ * zero-filled page, see abd_get_zeros().
+ */
+static abd_t *abd_zero_scatter = NULL;
+static struct page *abd_zero_page = NULL;
+
 static inline size_t
 abd_chunkcnt_for_bytes(size_t size)
 {
@@ -395,6 +416,39 @@ abd_free_pages(abd_t *abd)
 	sg_free_table(&table);
 }
 
+static void
+abd_alloc_zero_scatter(abd_t *abd, size_t size)
+{
+	struct scatterlist *sg;
+	struct sg_table table;
+	int nr_pages = abd_chunkcnt_for_bytes(size);
+	int i;
+
+	abd_zero_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	VERIFY3P(abd_zero_page, !=, NULL);
+	VERIFY0(sg_alloc_table(&table, nr_pages, GFP_KERNEL));
+
+	ABD_SCATTER(abd).abd_sgl = table.sgl;
+	ABD_SCATTER(abd).abd_nents = nr_pages;
+
+	abd_for_each_sg(abd, sg, nr_pages, i) {
+		sg_set_page(sg, abd_zero_page, PAGESIZE, 0);
+	}
+}
+
+static void
+abd_free_zero_scatter(abd_t *abd)
+{
+	struct sg_table table;
+
+	table.sgl = ABD_SCATTER(abd).abd_sgl;
+	table.nents = table.orig_nents = ABD_SCATTER(abd).abd_nents;
+	sg_free_table(&table);
+
+	__free_page(abd_zero_page);
+	abd_zero_page = NULL;
+}
+
 #else /* _KERNEL */
 
 #ifndef PAGE_SHIFT
@@ -490,8 +544,57 @@ abd_free_pages(abd_t *abd)
 	vmem_free(ABD_SCATTER(abd).abd_sgl, n * sizeof (struct scatterlist));
 }
 
+static void
+abd_alloc_zero_scatter(abd_t *abd, size_t size)
+{
+	unsigned nr_pages = abd_chunkcnt_for_bytes(size);
+	struct scatterlist *sg;
+	int i;
+
+	abd_zero_page = abd_alloc_chunk(0);
+	memset((void *)abd_zero_page, 0, PAGESIZE);
+
+	ABD_SCATTER(abd).abd_sgl = vmem_alloc(nr_pages *
+	    sizeof (struct scatterlist), KM_SLEEP);
+	sg_init_table(ABD_SCATTER(abd).abd_sgl, nr_pages);
+
+	abd_for_each_sg(abd, sg, nr_pages, i) {
+		sg_set_page(sg, abd_zero_page, PAGESIZE, 0);
+	}
+	ABD_SCATTER(abd).abd_nents = nr_pages;
+}
+
+static void
+abd_free_zero_scatter(abd_t *abd)
+{
+	vmem_free(ABD_SCATTER(abd).abd_sgl,
+	    ABD_SCATTER(abd).abd_nents * sizeof (struct scatterlist));
+
+	abd_free_chunk(abd_zero_page, 0);
+	abd_zero_page = NULL;
+}
+
 #endif /* _KERNEL */
 
+static inline abd_t *
+abd_alloc_struct(void)
+{
+	abd_t *abd = kmem_cache_alloc(abd_cache, KM_PUSHPAGE);
+
+	ASSERT3P(abd, !=, NULL);
+	list_link_init(&abd->abd_gang_link);
+	ABDSTAT_INCR(abdstat_struct_size, sizeof (abd_t));
+
+	return (abd);
+}
+
+static inline void
+abd_free_struct(abd_t *abd)
+{
+	kmem_cache_free(abd_cache, abd);
+	ABDSTAT_INCR(abdstat_struct_size, -sizeof (abd_t));
+}
+
 void
 abd_init(void)
 {
@@ -500,6 +603,14 @@ abd_init(void)
 	abd_cache = kmem_cache_create("abd_t", sizeof (abd_t),
 	    0, NULL, NULL, NULL, NULL, NULL, 0);
 
+	abd_zero_scatter = abd_alloc_struct();
+	abd_zero_scatter->abd_flags = 0;
+	abd_zero_scatter->abd_size = SPA_MAXBLOCKSIZE;
+	abd_zero_scatter->abd_parent = NULL;
+	refcount_create(&abd_zero_scatter->abd_children);
+	ABD_SCATTER(abd_zero_scatter).abd_offset = 0;
+	abd_alloc_zero_scatter(abd_zero_scatter, SPA_MAXBLOCKSIZE);
+
 	abd_ksp = kstat_create("zfs", 0, "abdstats", "misc", KSTAT_TYPE_NAMED,
 	    sizeof (abd_stats) / sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
 	if (abd_ksp != NULL) {
@@ -523,6 +634,13 @@ abd_fini(void)
 		abd_ksp = NULL;
 	}
 
+	if (abd_zero_scatter) {
+		abd_free_zero_scatter(abd_zero_scatter);
+		refcount_destroy(&abd_zero_scatter->abd_children);
+		abd_free_struct(abd_zero_scatter);
+		abd_zero_scatter = NULL;
+	}
+
 	if (abd_cache) {
 		kmem_cache_destroy(abd_cache);
 		abd_cache = NULL;
@@ -536,11 +654,20 @@ abd_verify(abd_t *abd)
 	ASSERT3U(abd->abd_size, <=, SPA_MAXBLOCKSIZE);
 	ASSERT3U(abd->abd_flags, ==, abd->abd_flags & (ABD_FLAG_LINEAR |
 	    ABD_FLAG_OWNER | ABD_FLAG_META | ABD_FLAG_MULTI_ZONE |
-	    ABD_FLAG_MULTI_CHUNK));
+	    ABD_FLAG_MULTI_CHUNK | ABD_FLAG_GANG));
 	IMPLY(abd->abd_parent != NULL, !(abd->abd_flags & ABD_FLAG_OWNER));
 	IMPLY(abd->abd_flags & ABD_FLAG_META, abd->abd_flags & ABD_FLAG_OWNER);
 	if (abd_is_linear(abd)) {
 		ASSERT3P(abd->abd_u.abd_linear.abd_buf, !=, NULL);
+	} else if (abd_is_gang(abd)) {
+		abd_t *cabd;
+
+		for (cabd = list_head(&ABD_GANG(abd).abd_gang_chain);
+		    cabd != NULL;
+		    cabd = list_next(&ABD_GANG(abd).abd_gang_chain, cabd)) {
+			ASSERT(!abd_is_gang(cabd));
+			abd_verify(cabd);
+		}
 	} else {
 		size_t n;
 		int i;
@@ -556,24 +683,6 @@ abd_verify(abd_t *abd)
 	}
 }
 
-static inline abd_t *
-abd_alloc_struct(void)
-{
-	abd_t *abd = kmem_cache_alloc(abd_cache, KM_PUSHPAGE);
-
-	ASSERT3P(abd, !=, NULL);
-	ABDSTAT_INCR(abdstat_struct_size, sizeof (abd_t));
-
-	return (abd);
-}
-
-static inline void
-abd_free_struct(abd_t *abd)
-{
-	kmem_cache_free(abd_cache, abd);
-	ABDSTAT_INCR(abdstat_struct_size, -sizeof (abd_t));
-}
-
 /*
  * Allocate an ABD, along with its own underlying data buffers. Use this if you
  * don't care whether the ABD is linear or not.
@@ -672,8 +781,92 @@ abd_free_linear(abd_t *abd)
 }
 
 /*
- * Free an ABD. Only use this on ABDs allocated with abd_alloc() or
- * abd_alloc_linear().
+ * Allocate an empty gang ABD.  ABDs chained to it with abd_gang_add() are
+ * owned by the gang from then on and released along with it.
+ */
+abd_t *
+abd_alloc_gang_abd(void)
+{
+	abd_t *abd = abd_alloc_struct();
+
+	abd->abd_flags = ABD_FLAG_GANG | ABD_FLAG_OWNER;
+	abd->abd_size = 0;
+	abd->abd_parent = NULL;
+	refcount_create(&abd->abd_children);
+	list_create(&ABD_GANG(abd).abd_gang_chain, sizeof (abd_t),
+	    offsetof(abd_t, abd_gang_link));
+
+	return (abd);
+}
+
+/*
+ * Append cabd to the data of the gang ABD pabd.  The gang takes over cabd:
+ * it is freed with abd_free() if it owns its data, and with abd_put()
+ * otherwise, when the gang is released.
+ */
+void
+abd_gang_add(abd_t *pabd, abd_t *cabd)
+{
+	ASSERT(abd_is_gang(pabd));
+	ASSERT(!abd_is_gang(cabd));
+	ASSERT(!list_link_active(&cabd->abd_gang_link));
+	abd_verify(cabd);
+
+	list_insert_tail(&ABD_GANG(pabd).abd_gang_chain, cabd);
+	pabd->abd_size += cabd->abd_size;
+}
+
+/*
+ * Release the ABDs chained to a gang ABD.
+ */
+static void
+abd_free_gang_chain(abd_t *abd)
+{
+	abd_t *cabd;
+
+	while ((cabd = list_remove_head(&ABD_GANG(abd).abd_gang_chain)) !=
+	    NULL) {
+		if (cabd->abd_flags & ABD_FLAG_OWNER)
+			abd_free(cabd);
+		else
+			abd_put(cabd);
+	}
+	list_destroy(&ABD_GANG(abd).abd_gang_chain);
+}
+
+static void
+abd_free_gang(abd_t *abd)
+{
+	abd_free_gang_chain(abd);
+	refcount_destroy(&abd->abd_children);
+	abd_free_struct(abd);
+}
+
+/*
+ * Return the ABD chained to the gang ABD abd which holds offset *off of the
+ * gang, and make *off relative to it.
+ */
+static abd_t *
+abd_gang_get_offset(abd_t *abd, size_t *off)
+{
+	abd_t *cabd;
+
+	ASSERT(abd_is_gang(abd));
+	ASSERT3U(*off, <=, abd->abd_size);
+
+	for (cabd = list_head(&ABD_GANG(abd).abd_gang_chain); cabd != NULL;
+	    cabd = list_next(&ABD_GANG(abd).abd_gang_chain, cabd)) {
+		if (*off < cabd->abd_size)
+			break;
+		*off -= cabd->abd_size;
+	}
+
+	return (cabd);
+}
+
+/*
+ * Free an ABD. Only use this on ABDs allocated with abd_alloc(),
+ * abd_alloc_linear() or abd_alloc_gang_abd().
  */
 void
 abd_free(abd_t *abd)
@@ -683,6 +876,8 @@ abd_free(abd_t *abd)
 	ASSERT(abd->abd_flags & ABD_FLAG_OWNER);
 	if (abd_is_linear(abd))
 		abd_free_linear(abd);
+	else if (abd_is_gang(abd))
+		abd_free_gang(abd);
 	else
 		abd_free_scatter(abd);
 }
@@ -712,10 +907,10 @@ abd_alloc_sametype(abd_t *sabd, size_t size)
  * using a scatter/gather list we should switch to that and replace this call
  * with vanilla abd_alloc().
  *
- * On Linux the optimal thing to do would be to use abd_get_offset() and
- * construct a new ABD which shares the original pages thereby eliminating
- * the copy.  But for the moment a new linear ABD is allocated until this
- * performance optimization can be implemented.
+ * On Linux the optimal thing to do is to use abd_get_offset() and construct
+ * a new ABD which shares the original pages thereby eliminating the copy.
+ * Aggregated I/O does so by chaining the buffers of the aggregated zios to
+ * a gang ABD, and only allocates ABDs with this function for the gaps.
  */
 abd_t *
 abd_alloc_for_io(size_t size, boolean_t is_metadata)
@@ -748,7 +943,7 @@ abd_get_offset_impl(abd_t *sabd, size_t off, size_t size)
 
 		abd->abd_u.abd_linear.abd_buf =
 		    (char *)sabd->abd_u.abd_linear.abd_buf + off;
-	} else {
+	} else if (!abd_is_gang(sabd)) {
 		int i;
 		struct scatterlist *sg;
 		size_t new_offset = sabd->abd_u.abd_scatter.abd_offset + off;
@@ -771,6 +966,32 @@ abd_get_offset_impl(abd_t *sabd, size_t off, size_t size)
 		ABD_SCATTER(abd).abd_sgl = sg;
 		ABD_SCATTER(abd).abd_offset = new_offset;
 		ABD_SCATTER(abd).abd_nents = ABD_SCATTER(sabd).abd_nents - i;
+	} else {
+		abd_t *cabd;
+		size_t left = size;
+
+		ASSERT(abd_is_gang(sabd));
+
+		/*
+		 * The new gang ABD chains offset ABDs for the part of each
+		 * ABD of sabd that it covers.
+		 */
+		abd = abd_alloc_struct();
+		abd->abd_flags = ABD_FLAG_GANG;
+		abd->abd_size = 0;
+		list_create(&ABD_GANG(abd).abd_gang_chain, sizeof (abd_t),
+		    offsetof(abd_t, abd_gang_link));
+
+		cabd = abd_gang_get_offset(sabd, &off);
+		while (left > 0) {
+			size_t csize = MIN(left, cabd->abd_size - off);
+
+			abd_gang_add(abd,
+			    abd_get_offset_size(cabd, off, csize));
+			left -= csize;
+			off = 0;
+			cabd = list_next(&ABD_GANG(sabd).abd_gang_chain, cabd);
+		}
 	}
 
 	abd->abd_size = size;
@@ -825,6 +1046,20 @@ abd_get_from_buf(void *buf, size_t size)
 	return (abd);
 }
 
+/*
+ * Allocate an ABD of size bytes which reads as zeros.  All of its pages are
+ * one shared zero-filled page, so it must never be written to.  Free it with
+ * abd_put().
+ */
+abd_t *
+abd_get_zeros(size_t size)
+{
+	ASSERT3P(abd_zero_scatter, !=, NULL);
+	ASSERT3U(size, <=, SPA_MAXBLOCKSIZE);
+
+	return (abd_get_offset_size(abd_zero_scatter, 0, size));
+}
+
 /*
  * Free an ABD allocated from abd_get_offset() or abd_get_from_buf(). Will not
  * free the underlying scatterlist or buffer.
@@ -835,6 +1070,9 @@ abd_put(abd_t *abd)
 	abd_verify(abd);
 	ASSERT(!(abd->abd_flags & ABD_FLAG_OWNER));
 
+	if (abd_is_gang(abd))
+		abd_free_gang_chain(abd);
+
 	if (abd->abd_parent != NULL) {
 		(void) refcount_remove_many(&abd->abd_parent->abd_children,
 		    abd->abd_size, abd);
@@ -989,6 +1227,7 @@ struct abd_iter {
 static void
 abd_iter_init(struct abd_iter *aiter, abd_t *abd, int km_type)
 {
+	ASSERT(!abd_is_gang(abd));
 	abd_verify(abd);
 	aiter->iter_abd = abd;
 	aiter->iter_mapaddr = NULL;
@@ -1094,18 +1333,62 @@ abd_iter_unmap(struct abd_iter *aiter)
 	aiter->iter_mapsize = 0;
 }
 
+/*
+ * Initialize the abd_iter at offset off of abd.  The iterator of a gang ABD
+ * walks one of its chained ABDs at a time: the one holding off is returned
+ * for abd_gang_iter_advance() to move past.
+ */
+static abd_t *
+abd_gang_iter_init(struct abd_iter *aiter, abd_t *abd, size_t off,
+    int km_type)
+{
+	abd_t *cabd = NULL;
+
+	if (abd_is_gang(abd)) {
+		cabd = abd_gang_get_offset(abd, &off);
+		if (cabd == NULL)
+			return (NULL);
+		abd = cabd;
+	}
+
+	abd_iter_init(aiter, abd, km_type);
+	abd_iter_advance(aiter, off);
+
+	return (cabd);
+}
+
+/*
+ * Advance the abd_iter of abd by amount, moving on to the next chained ABD
+ * once the current one is exhausted if abd is a gang ABD.
+ */
+static abd_t *
+abd_gang_iter_advance(struct abd_iter *aiter, abd_t *abd, abd_t *cabd,
+    size_t amount, int km_type)
+{
+	abd_iter_advance(aiter, amount);
+
+	if (abd_is_gang(abd) &&
+	    aiter->iter_pos == aiter->iter_abd->abd_size) {
+		cabd = list_next(&ABD_GANG(abd).abd_gang_chain, cabd);
+		if (cabd != NULL)
+			abd_iter_init(aiter, cabd, km_type);
+	}
+
+	return (cabd);
+}
+
 int
 abd_iterate_func(abd_t *abd, size_t off, size_t size,
     abd_iter_func_t *func, void *private)
 {
 	int ret = 0;
 	struct abd_iter aiter;
+	abd_t *cabd;
 
 	abd_verify(abd);
 	ASSERT3U(off + size, <=, abd->abd_size);
 
-	abd_iter_init(&aiter, abd, 0);
-	abd_iter_advance(&aiter, off);
+	cabd = abd_gang_iter_init(&aiter, abd, off, 0);
 
 	while (size > 0) {
 		size_t len;
@@ -1122,7 +1405,7 @@ abd_iterate_func(abd_t *abd, size_t off, size_t size,
 			break;
 
 		size -= len;
-		abd_iter_advance(&aiter, len);
+		cabd = abd_gang_iter_advance(&aiter, abd, cabd, len, 0);
 	}
 
 	return (ret);
@@ -1229,6 +1512,7 @@ abd_iterate_func2(abd_t *dabd, abd_t *sabd, size_t doff, size_t soff,
 {
 	int ret = 0;
 	struct abd_iter daiter, saiter;
+	abd_t *dcabd, *scabd;
 
 	abd_verify(dabd);
 	abd_verify(sabd);
@@ -1236,10 +1520,8 @@ abd_iterate_func2(abd_t *dabd, abd_t *sabd, size_t doff, size_t soff,
 	ASSERT3U(doff + size, <=, dabd->abd_size);
 	ASSERT3U(soff + size, <=, sabd->abd_size);
 
-	abd_iter_init(&daiter, dabd, 0);
-	abd_iter_init(&saiter, sabd, 1);
-	abd_iter_advance(&daiter, doff);
-	abd_iter_advance(&saiter, soff);
+	dcabd = abd_gang_iter_init(&daiter, dabd, doff, 0);
+	scabd = abd_gang_iter_init(&saiter, sabd, soff, 1);
 
 	while (size > 0) {
 		size_t dlen, slen, len;
@@ -1261,8 +1543,8 @@ abd_iterate_func2(abd_t *dabd, abd_t *sabd, size_t doff, size_t soff,
 			break;
 
 		size -= len;
-		abd_iter_advance(&daiter, len);
-		abd_iter_advance(&saiter, len);
+		dcabd = abd_gang_iter_advance(&daiter, dabd, dcabd, len, 0);
+		scabd = abd_gang_iter_advance(&saiter, sabd, scabd, len, 1);
 	}
 
 	return (ret);
@@ -1480,6 +1762,23 @@ abd_nr_pages_off(abd_t *abd, unsigned int size, size_t off)
 {
 	unsigned long pos;
 
+	if (abd_is_gang(abd)) {
+		unsigned long count = 0;
+		abd_t *cabd;
+
+		for (cabd = abd_gang_get_offset(abd, &off);
+		    cabd != NULL && size != 0;
+		    cabd = list_next(&ABD_GANG(abd).abd_gang_chain, cabd)) {
+			unsigned int csize = MIN(size, cabd->abd_size - off);
+
+			count += abd_nr_pages_off(cabd, csize, off);
+			size -= csize;
+			off = 0;
+		}
+
+		return (count);
+	}
+
 	if (abd_is_linear(abd))
 		pos = (unsigned long)abd_to_buf(abd) + off;
 	else
@@ -1490,7 +1789,42 @@ abd_nr_pages_off(abd_t *abd, unsigned int size, size_t off)
 }
 
 /*
- * bio_map for scatter ABD.
+ * bio_map for a linear ABD chained to a gang ABD.
+ * @off is the offset in @abd
+ * Remaining IO size is returned
+ */
+static unsigned int
+abd_linear_bio_map_off(struct bio *bio, abd_t *abd,
+    unsigned int io_size, size_t off)
+{
+	char *buf = (char *)abd_to_buf(abd) + off;
+
+	ASSERT3U(io_size, <=, abd->abd_size - off);
+
+	while (io_size > 0) {
+		struct page *pg;
+		size_t len, pgoff;
+
+		pgoff = offset_in_page(buf);
+		len = MIN(io_size, PAGESIZE - pgoff);
+
+		if (is_vmalloc_addr(buf))
+			pg = vmalloc_to_page(buf);
+		else
+			pg = virt_to_page(buf);
+
+		if (bio_add_page(bio, pg, len, pgoff) != len)
+			break;
+
+		buf += len;
+		io_size -= len;
+	}
+
+	return (io_size);
+}
+
+/*
+ * bio_map for scatter or gang ABD.
  * @off is the offset in @abd
  * Remaining IO size is returned
  */
@@ -1504,6 +1838,32 @@ abd_scatter_bio_map_off(struct bio *bio, abd_t *abd,
 	ASSERT(!abd_is_linear(abd));
 	ASSERT3U(io_size, <=, abd->abd_size - off);
 
+	if (abd_is_gang(abd)) {
+		abd_t *cabd;
+
+		for (cabd = abd_gang_get_offset(abd, &off);
+		    cabd != NULL && io_size != 0;
+		    cabd = list_next(&ABD_GANG(abd).abd_gang_chain, cabd)) {
+			unsigned int csize = MIN(io_size, cabd->abd_size - off);
+			unsigned int left;
+
+			if (abd_is_linear(cabd)) {
+				left = abd_linear_bio_map_off(bio, cabd,
+				    csize, off);
+			} else {
+				left = abd_scatter_bio_map_off(bio, cabd,
+				    csize, off);
+			}
+
+			io_size -= csize - left;
+			if (left != 0)
+				break;
+			off = 0;
+		}
+
+		return (io_size);
+	}
+
 	abd_iter_init(&aiter, abd, 0);
 	abd_iter_advance(&aiter, off);
 
@@ -324,6 +324,16 @@ static kcondvar_t	arc_reclaim_waiters_cv;
  */
 int zfs_arc_evict_batch_limit = 10;
 
+/*
+ * The maximum number of threads arc_evict_state() may split a single
+ * eviction across. Each thread evicts from its own range of the state's
+ * sublists. Zero selects a limit based on the number of CPUs.
+ */
+int zfs_arc_evict_threads = 0;
+
+/* shift of arc_c for the least eviction worth handing to a worker thread */
+static int		arc_evict_worker_shift = 6;
+
 /* number of seconds before growing cache again */
 static int		arc_grow_retry = 5;
 
@@ -412,6 +422,7 @@ int zfs_arc_p_aggressive_disable = 1;
 int zfs_arc_p_dampener_disable = 1;
 int zfs_arc_meta_prune = 10000;
 int zfs_arc_meta_strategy = ARC_STRATEGY_META_BALANCED;
+int zfs_arc_admission = ARC_ADMISSION_ALL;
 int zfs_arc_meta_adjust_restarts = 4096;
 int zfs_arc_lotsfree_percent = 10;
 
@@ -438,6 +449,12 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_mru_ghost_hits;
 	kstat_named_t arcstat_mfu_hits;
 	kstat_named_t arcstat_mfu_ghost_hits;
+	/*
+	 * Buffers read into the cache which were admitted to the MRU state,
+	 * or put on probation at its tail, by the admission policy.
+	 */
+	kstat_named_t arcstat_admission_accepted;
+	kstat_named_t arcstat_admission_rejected;
 	kstat_named_t arcstat_deleted;
 	/*
 	 * Number of buffers that could not be evicted because the hash lock
@@ -457,6 +474,25 @@ typedef struct arc_stats {
 	 * buffers to reach its target amount.
 	 */
 	kstat_named_t arcstat_evict_not_enough;
+	/*
+	 * Number of times arc_evict_state() split its work across the
+	 * eviction threads, and the total number of threads used.
+	 */
+	kstat_named_t arcstat_evict_parallel;
+	kstat_named_t arcstat_evict_workers;
+	/*
+	 * Bytes evicted by arc_evict_state() and the time spent doing so
+	 * in nanoseconds; their ratio gives the eviction throughput.
+	 */
+	kstat_named_t arcstat_evict_bytes;
+	kstat_named_t arcstat_evict_time;
+	/*
+	 * Number of allocations which blocked in arc_get_data_impl()
+	 * waiting for eviction, and the total time they spent blocked
+	 * in nanoseconds.
+	 */
+	kstat_named_t arcstat_evict_waits;
+	kstat_named_t arcstat_evict_wait_time;
 	kstat_named_t arcstat_evict_l2_cached;
 	kstat_named_t arcstat_evict_l2_eligible;
 	kstat_named_t arcstat_evict_l2_ineligible;
@@ -646,6 +682,30 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_l2_lsize;
 	kstat_named_t arcstat_l2_psize;
 	kstat_named_t arcstat_l2_hdr_size;
+	/*
+	 * Number and total allocated size of the log blocks written to
+	 * the cache devices to make the L2ARC persistent.
+	 */
+	kstat_named_t arcstat_l2_log_blk_writes;
+	kstat_named_t arcstat_l2_log_blk_asize;
+	/*
+	 * L2ARC rebuild statistics.  l2_rebuild_active is the number of
+	 * cache devices currently being rebuilt; the log block, buffer and
+	 * size counters advance while a rebuild is in progress and can be
+	 * used to follow its progress.
+	 */
+	kstat_named_t arcstat_l2_rebuild_active;
+	kstat_named_t arcstat_l2_rebuild_success;
+	kstat_named_t arcstat_l2_rebuild_unsupported;
+	kstat_named_t arcstat_l2_rebuild_io_errors;
+	kstat_named_t arcstat_l2_rebuild_dh_errors;
+	kstat_named_t arcstat_l2_rebuild_cksum_lb_errors;
+	kstat_named_t arcstat_l2_rebuild_lowmem;
+	kstat_named_t arcstat_l2_rebuild_log_blks;
+	kstat_named_t arcstat_l2_rebuild_bufs;
+	kstat_named_t arcstat_l2_rebuild_bufs_precached;
+	kstat_named_t arcstat_l2_rebuild_size;
+	kstat_named_t arcstat_l2_rebuild_asize;
 	kstat_named_t arcstat_memory_throttle_count;
 	kstat_named_t arcstat_memory_direct_count;
 	kstat_named_t arcstat_memory_indirect_count;
@@ -680,10 +740,18 @@ static arc_stats_t arc_stats = {
 	{ "mru_ghost_hits",		KSTAT_DATA_UINT64 },
 	{ "mfu_hits",			KSTAT_DATA_UINT64 },
 	{ "mfu_ghost_hits",		KSTAT_DATA_UINT64 },
+	{ "admission_accepted",		KSTAT_DATA_UINT64 },
+	{ "admission_rejected",		KSTAT_DATA_UINT64 },
 	{ "deleted",			KSTAT_DATA_UINT64 },
 	{ "mutex_miss",			KSTAT_DATA_UINT64 },
 	{ "evict_skip",			KSTAT_DATA_UINT64 },
 	{ "evict_not_enough",		KSTAT_DATA_UINT64 },
+	{ "evict_parallel",		KSTAT_DATA_UINT64 },
+	{ "evict_workers",		KSTAT_DATA_UINT64 },
+	{ "evict_bytes",		KSTAT_DATA_UINT64 },
+	{ "evict_time",			KSTAT_DATA_UINT64 },
+	{ "evict_waits",		KSTAT_DATA_UINT64 },
+	{ "evict_wait_time",		KSTAT_DATA_UINT64 },
 	{ "evict_l2_cached",		KSTAT_DATA_UINT64 },
 	{ "evict_l2_eligible",		KSTAT_DATA_UINT64 },
 	{ "evict_l2_ineligible",	KSTAT_DATA_UINT64 },
@@ -742,6 +810,20 @@ static arc_stats_t arc_stats = {
 	{ "l2_size",			KSTAT_DATA_UINT64 },
 	{ "l2_asize",			KSTAT_DATA_UINT64 },
 	{ "l2_hdr_size",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_writes",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_asize",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_active",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_success",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_unsupported",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_io_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_dh_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_cksum_lb_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_lowmem",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_log_blks",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs_precached",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_size",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_asize",		KSTAT_DATA_UINT64 },
 	{ "memory_throttle_count",	KSTAT_DATA_UINT64 },
 	{ "memory_direct_count",	KSTAT_DATA_UINT64 },
 	{ "memory_indirect_count",	KSTAT_DATA_UINT64 },
@@ -846,6 +928,7 @@ static arc_state_t	*arc_l2c_only;
 static list_t arc_prune_list;
 static kmutex_t arc_prune_mtx;
 static taskq_t *arc_prune_taskq;
+static taskq_t *arc_evict_taskq;
 
 #define	GHOST_STATE(state)	\
 	((state) == arc_mru_ghost || (state) == arc_mfu_ghost ||	\
@@ -868,6 +951,7 @@ static taskq_t *arc_prune_taskq;
 #define	HDR_PROTECTED(hdr)	((hdr)->b_flags & ARC_FLAG_PROTECTED)
 #define	HDR_NOAUTH(hdr)		((hdr)->b_flags & ARC_FLAG_NOAUTH)
 #define	HDR_SHARED_DATA(hdr)	((hdr)->b_flags & ARC_FLAG_SHARED_DATA)
+#define	HDR_PROBATION(hdr)	((hdr)->b_flags & ARC_FLAG_PROBATION)
 
 #define	HDR_ISTYPE_METADATA(hdr)	\
 	((hdr)->b_flags & ARC_FLAG_BUFC_METADATA)
@@ -970,6 +1054,21 @@ unsigned long l2arc_feed_min_ms = L2ARC_FEED_MIN_MS;	/* min interval msecs */
 int l2arc_noprefetch = B_TRUE;			/* don't cache prefetch bufs */
 int l2arc_feed_again = B_TRUE;			/* turbo warmup */
 int l2arc_norw = B_FALSE;			/* no reads during writes */
+int l2arc_rebuild_enabled = B_TRUE;		/* rebuild L2ARC on import */
+
+/*
+ * Each cache device's write size is adjusted so that its writes complete
+ * within this many milliseconds, starting from l2arc_write_max and staying
+ * between 1/8th and 64 times that. Zero always writes l2arc_write_max.
+ */
+unsigned long l2arc_write_latency_ms = 50;
+
+/*
+ * Cache devices smaller than this are not made persistent.  Log blocks and
+ * the device header would take up a disproportionate share of a small
+ * device, and a small device is quickly warmed up again anyway.
+ */
+unsigned long l2arc_rebuild_blocks_min_l2size = 1024 * 1024 * 1024;
 
 /*
  * L2ARC Internals
@@ -977,7 +1076,6 @@ int l2arc_norw = B_FALSE;			/* no reads during writes */
 static list_t L2ARC_dev_list;			/* device list */
 static list_t *l2arc_dev_list;			/* device list pointer */
 static kmutex_t l2arc_dev_mtx;			/* device list mutex */
-static l2arc_dev_t *l2arc_dev_last;		/* last device used */
 static list_t L2ARC_free_on_write;		/* free after write buf list */
 static list_t *l2arc_free_on_write;		/* free after write list ptr */
 static kmutex_t l2arc_free_on_write_mtx;	/* mutex for list */
@@ -996,6 +1094,7 @@ typedef struct l2arc_data_free {
 	abd_t		*l2df_abd;
 	size_t		l2df_size;
 	arc_buf_contents_t l2df_type;
+	l2arc_dev_t	*l2df_dev;	/* device being written to */
 	list_node_t	l2df_list_node;
 } l2arc_data_free_t;
 
@@ -1009,7 +1108,10 @@ typedef enum arc_fill_flags {
 
 static kmutex_t l2arc_feed_thr_lock;
 static kcondvar_t l2arc_feed_thr_cv;
-static uint8_t l2arc_thread_exit;
+static boolean_t l2arc_feed_enabled;
+
+static kmutex_t l2arc_rebuild_thr_lock;
+static kcondvar_t l2arc_rebuild_thr_cv;
 
 static abd_t *arc_get_data_abd(arc_buf_hdr_t *, uint64_t, void *);
 static void *arc_get_data_buf(arc_buf_hdr_t *, uint64_t, void *);
@@ -1034,6 +1136,16 @@ static inline void arc_hdr_clear_flags(arc_buf_hdr_t *hdr, arc_flags_t flags);
 static boolean_t l2arc_write_eligible(uint64_t, arc_buf_hdr_t *);
 static void l2arc_read_done(zio_t *);
 
+static void l2arc_dev_hdr_update(l2arc_dev_t *);
+static void l2arc_rebuild_vdev(l2arc_dev_t *);
+static int l2arc_dev_hdr_read(l2arc_dev_t *);
+static int l2arc_rebuild(l2arc_dev_t *);
+static void l2arc_dev_rebuild_thread(void *);
+static boolean_t l2arc_log_blk_insert(l2arc_dev_t *, const arc_buf_hdr_t *,
+    uint64_t);
+static void l2arc_log_blk_commit(l2arc_dev_t *, zio_t *);
+static uint64_t l2arc_log_blk_overhead(uint64_t, l2arc_dev_t *);
+
 static uint64_t
 buf_hash(uint64_t spa, const dva_t *dva, uint64_t birth)
 {
@@ -1167,6 +1279,130 @@ buf_hash_remove(arc_buf_hdr_t *hdr)
 		ARCSTAT_BUMPDOWN(arcstat_hash_chains);
 }
 
+/*
+ * Access frequency sketch used by the ARC_ADMISSION_FREQUENCY policy.
+ *
+ * This is a count-min sketch of 4-bit counters, packed 16 to a word: each
+ * access increments one counter in each of ARC_SKETCH_DEPTH rows, and the
+ * frequency of a block is estimated by the smallest of its counters.  The
+ * counters are halved once as many accesses as a quarter of the counters
+ * have been recorded, so the estimate reflects recent accesses only.  The
+ * sketch has two counters per zfs_arc_average_blocksize of arc_c_max.
+ */
+#define	ARC_SKETCH_DEPTH	4
+#define	ARC_SKETCH_COUNTER_MAX	15ULL
+#define	ARC_SKETCH_HALF_MASK	0x7777777777777777ULL
+
+static uint64_t *arc_sketch;
+static uint64_t arc_sketch_mask;	/* Number of counters - 1 */
+static uint64_t arc_sketch_samples;
+static uint64_t arc_sketch_reset;
+
+static void
+arc_sketch_age(void)
+{
+	uint64_t i, old;
+
+	for (i = 0; i <= arc_sketch_mask / 16; i++) {
+		do {
+			old = arc_sketch[i];
+		} while (atomic_cas_64(&arc_sketch[i], old,
+		    (old >> 1) & ARC_SKETCH_HALF_MASK) != old);
+	}
+	atomic_add_64(&arc_sketch_samples, -(int64_t)(arc_sketch_reset / 2));
+}
+
+/*
+ * Record an access to the block with the given hash, and return its
+ * estimated frequency including this access.
+ */
+static uint64_t
+arc_sketch_increment(uint64_t hash)
+{
+	uint64_t h2 = (hash >> 32) | 1;
+	uint64_t freq = ARC_SKETCH_COUNTER_MAX;
+	int i;
+
+	for (i = 0; i < ARC_SKETCH_DEPTH; i++) {
+		uint64_t idx = (hash + i * h2) & arc_sketch_mask;
+		uint64_t *wp = &arc_sketch[idx / 16];
+		int shift = (idx % 16) * 4;
+		uint64_t old, cnt;
+
+		do {
+			old = *wp;
+			cnt = (old >> shift) & ARC_SKETCH_COUNTER_MAX;
+			if (cnt == ARC_SKETCH_COUNTER_MAX)
+				break;
+		} while (atomic_cas_64(wp, old, old + (1ULL << shift)) != old);
+		freq = MIN(freq, MIN(cnt + 1, ARC_SKETCH_COUNTER_MAX));
+	}
+
+	if (atomic_inc_64_nv(&arc_sketch_samples) == arc_sketch_reset)
+		arc_sketch_age();
+
+	return (freq);
+}
+
+static void
+arc_sketch_init(void)
+{
+	uint64_t counters = 2 * arc_c_max / zfs_arc_average_blocksize;
+
+	counters = 1ULL << highbit64(MAX(counters, 1ULL << 16) - 1);
+	arc_sketch_mask = counters - 1;
+	arc_sketch_reset = counters / 4;
+	arc_sketch_samples = 0;
+	arc_sketch = vmem_zalloc(counters / 2, KM_SLEEP);
+}
+
+static void
+arc_sketch_fini(void)
+{
+	vmem_free(arc_sketch, (arc_sketch_mask + 1) / 2);
+	arc_sketch = NULL;
+}
+
+/*
+ * Decide whether a buffer just read into the cache is admitted to the MRU
+ * state, or put on probation at the tail of the MRU lists where it will be
+ * the first to be evicted.  With ARC_ADMISSION_FREQUENCY, buffers whose
+ * block has not been read recently are put on probation, so that a scan
+ * reading many blocks once does not push out buffers which are reused.
+ */
+static void
+arc_admit(arc_buf_hdr_t *hdr)
+{
+	if (zfs_arc_admission != ARC_ADMISSION_FREQUENCY)
+		return;
+
+	if (arc_sketch_increment(buf_hash(hdr->b_spa, &hdr->b_dva,
+	    hdr->b_birth)) < 2) {
+		arc_hdr_set_flags(hdr, ARC_FLAG_PROBATION);
+		ARCSTAT_BUMP(arcstat_admission_rejected);
+	} else {
+		ARCSTAT_BUMP(arcstat_admission_accepted);
+	}
+}
+
+/*
+ * Add an evictable buffer to the list of its state.  The most recently
+ * used buffers are at the head, except for those on probation.
+ */
+static void
+arc_state_list_insert(arc_state_t *state, arc_buf_hdr_t *hdr)
+{
+	multilist_t *ml = state->arcs_list[arc_buf_type(hdr)];
+
+	if (HDR_PROBATION(hdr) && state == arc_mru) {
+		multilist_sublist_t *mls = multilist_sublist_lock_obj(ml, hdr);
+		multilist_sublist_insert_tail(mls, hdr);
+		multilist_sublist_unlock(mls);
+	} else {
+		multilist_insert(ml, hdr);
+	}
+}
+
 /*
  * Global data structures and functions for the buf kmem cache.
  */
@@ -2387,7 +2623,7 @@ remove_reference(arc_buf_hdr_t *hdr, kmutex_t *hash_lock, void *tag)
 	 */
 	if (((cnt = refcount_remove(&hdr->b_l1hdr.b_refcnt, tag)) == 0) &&
 	    (state != arc_anon)) {
-		multilist_insert(state->arcs_list[arc_buf_type(hdr)], hdr);
+		arc_state_list_insert(state, hdr);
 		ASSERT3U(hdr->b_l1hdr.b_bufcnt, >, 0);
 		arc_evictable_space_increment(hdr, state);
 	}
@@ -2483,6 +2719,10 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *hdr,
 	ASSERT(!GHOST_STATE(new_state) || bufcnt == 0);
 	ASSERT(old_state != arc_anon || bufcnt <= 1);
 
+	/* Probation only lasts until the buffer leaves the MRU state. */
+	if (HDR_PROBATION(hdr) && new_state != arc_mru)
+		arc_hdr_clear_flags(hdr, ARC_FLAG_PROBATION);
+
 	/*
 	 * If this buffer is evictable, transfer it from the
 	 * old state list to the new state list.
@@ -2507,7 +2747,7 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *hdr,
 			 * beforehand.
 			 */
 			ASSERT(HDR_HAS_L1HDR(hdr));
-			multilist_insert(new_state->arcs_list[buftype], hdr);
+			arc_state_list_insert(new_state, hdr);
 
 			if (GHOST_STATE(new_state)) {
 				ASSERT0(bufcnt);
@@ -2964,13 +3204,15 @@ arc_loan_inuse_buf(arc_buf_t *buf, void *tag)
 }
 
 static void
-l2arc_free_abd_on_write(abd_t *abd, size_t size, arc_buf_contents_t type)
+l2arc_free_abd_on_write(abd_t *abd, size_t size, arc_buf_contents_t type,
+    l2arc_dev_t *dev)
 {
 	l2arc_data_free_t *df = kmem_alloc(sizeof (*df), KM_SLEEP);
 
 	df->l2df_abd = abd;
 	df->l2df_size = size;
 	df->l2df_type = type;
+	df->l2df_dev = dev;
 	mutex_enter(&l2arc_free_on_write_mtx);
 	list_insert_head(l2arc_free_on_write, df);
 	mutex_exit(&l2arc_free_on_write_mtx);
@@ -2999,10 +3241,17 @@ arc_hdr_free_on_write(arc_buf_hdr_t *hdr, boolean_t free_rdata)
 		arc_space_return(size, ARC_SPACE_DATA);
 	}
 
+	/*
+	 * The data is freed once the device it is being written to has
+	 * finished the write. b_dev was set when the write was issued and
+	 * is left in place even if the L2 portion has since been destroyed.
+	 */
 	if (free_rdata) {
-		l2arc_free_abd_on_write(hdr->b_crypt_hdr.b_rabd, size, type);
+		l2arc_free_abd_on_write(hdr->b_crypt_hdr.b_rabd, size, type,
+		    hdr->b_l2hdr.b_dev);
 	} else {
-		l2arc_free_abd_on_write(hdr->b_l1hdr.b_pabd, size, type);
+		l2arc_free_abd_on_write(hdr->b_l1hdr.b_pabd, size, type,
+		    hdr->b_l2hdr.b_dev);
 	}
 }
 
@@ -3994,6 +4243,131 @@ arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
 	return (bytes_evicted);
 }
 
+/*
+ * Evict up to the specified number of bytes from the sublists of the given
+ * multilist in the range [first, first + count), resuming from each
+ * sublist's marker. Returns once the target is reached, or once a full
+ * scan over the range fails to evict anything.
+ */
+static uint64_t
+arc_evict_sublists(multilist_t *ml, uint64_t spa, int64_t bytes,
+    arc_buf_contents_t type, arc_buf_hdr_t **markers, int first, int count)
+{
+	uint64_t total_evicted = 0;
+	int i;
+
+	/*
+	 * While we haven't hit our target number of bytes to evict, or
+	 * we're evicting all available buffers.
+	 */
+	while (total_evicted < bytes || bytes == ARC_EVICT_ALL) {
+		int sublist_idx = first + spa_get_random(count);
+		uint64_t scan_evicted = 0;
+
+		/*
+		 * Try to reduce pinned dnodes with a floor of arc_dnode_limit.
+		 * Request that 10% of the LRUs be scanned by the superblock
+		 * shrinker. Only the first range asks, so parallel eviction
+		 * doesn't multiply the request.
+		 */
+		if (first == 0 && type == ARC_BUFC_DATA &&
+		    arc_dnode_size > arc_dnode_limit)
+			arc_prune_async((arc_dnode_size - arc_dnode_limit) /
+			    sizeof (dnode_t) / zfs_arc_dnode_reduce_percent);
+
+		/*
+		 * Start eviction using a randomly selected sublist,
+		 * this is to try and evenly balance eviction across all
+		 * sublists. Always starting at the same sublist
+		 * (e.g. index 0) would cause evictions to favor certain
+		 * sublists over others.
+		 */
+		for (i = 0; i < count; i++) {
+			uint64_t bytes_remaining;
+			uint64_t bytes_evicted;
+
+			if (bytes == ARC_EVICT_ALL)
+				bytes_remaining = ARC_EVICT_ALL;
+			else if (total_evicted < bytes)
+				bytes_remaining = bytes - total_evicted;
+			else
+				break;
+
+			bytes_evicted = arc_evict_state_impl(ml, sublist_idx,
+			    markers[sublist_idx], spa, bytes_remaining);
+
+			scan_evicted += bytes_evicted;
+			total_evicted += bytes_evicted;
+
+			/* we've reached the end, wrap to the beginning */
+			if (++sublist_idx >= first + count)
+				sublist_idx = first;
+		}
+
+		/*
+		 * If we didn't evict anything during this scan, we have
+		 * no reason to believe we'll evict more during another
+		 * scan, so break the loop.
+		 */
+		if (scan_evicted == 0) {
+			/* This isn't possible, let's make that obvious */
+			ASSERT3S(bytes, !=, 0);
+			break;
+		}
+	}
+
+	return (total_evicted);
+}
+
+typedef struct arc_evict_arg {
+	multilist_t		*eva_ml;
+	uint64_t		eva_spa;
+	int64_t			eva_bytes;
+	arc_buf_contents_t	eva_type;
+	arc_buf_hdr_t		**eva_markers;
+	int			eva_first;
+	int			eva_count;
+	uint64_t		eva_evicted;
+} arc_evict_arg_t;
+
+static void
+arc_evict_task(void *arg)
+{
+	arc_evict_arg_t *eva = arg;
+	fstrans_cookie_t cookie = spl_fstrans_mark();
+
+	eva->eva_evicted = arc_evict_sublists(eva->eva_ml, eva->eva_spa,
+	    eva->eva_bytes, eva->eva_type, eva->eva_markers, eva->eva_first,
+	    eva->eva_count);
+
+	spl_fstrans_unmark(cookie);
+}
+
+/*
+ * Return the number of threads to split an eviction of the given number
+ * of bytes across. One thread is used for every 1/64th of arc_c being
+ * evicted (arc_evict_worker_shift), so the further the ARC is over its
+ * target the more threads are put to work, up to zfs_arc_evict_threads.
+ */
+static int
+arc_evict_nthreads(int64_t bytes, int num_sublists)
+{
+	uint64_t chunk = MAX(arc_c >> arc_evict_worker_shift,
+	    SPA_MAXBLOCKSIZE);
+	int limit;
+
+	if (bytes == ARC_EVICT_ALL || arc_evict_taskq == NULL)
+		return (1);
+
+	if (zfs_arc_evict_threads > 0)
+		limit = MIN(zfs_arc_evict_threads, max_ncpus);
+	else
+		limit = MAX(max_ncpus / 4, 1);
+	limit = MIN(limit, num_sublists);
+
+	return (MAX(MIN(bytes / chunk, limit), 1));
+}
+
 /*
  * Evict buffers from the given arc state, until we've removed the
  * specified number of bytes. Move the removed buffers to the
@@ -4003,6 +4377,11 @@ arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
  * it can't get a hash_lock on, and so, may not catch all candidates.
  * It may also return without evicting as much space as requested.
  *
+ * Large evictions are split across the arc_evict taskq, each thread
+ * working through its own range of the state's sublists, see
+ * arc_evict_nthreads(). Whatever the threads leave behind is then
+ * evicted from the whole state by the calling thread.
+ *
  * If bytes is specified using the special value ARC_EVICT_ALL, this
  * will evict all available (i.e. unlocked and evictable) buffers from
  * the given arc state; which is used by arc_flush().
@@ -4015,6 +4394,8 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 	multilist_t *ml = state->arcs_list[type];
 	int num_sublists;
 	arc_buf_hdr_t **markers;
+	hrtime_t start = gethrtime();
+	int nthreads;
 	int i;
 
 	IMPLY(bytes < 0, bytes == ARC_EVICT_ALL);
@@ -4046,76 +4427,64 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 		multilist_sublist_unlock(mls);
 	}
 
-	/*
-	 * While we haven't hit our target number of bytes to evict, or
-	 * we're evicting all available buffers.
-	 */
-	while (total_evicted < bytes || bytes == ARC_EVICT_ALL) {
-		int sublist_idx = multilist_get_random_index(ml);
-		uint64_t scan_evicted = 0;
+	nthreads = arc_evict_nthreads(bytes, num_sublists);
+	if (nthreads > 1) {
+		arc_evict_arg_t *args;
+		taskqid_t *ids;
 
-		/*
-		 * Try to reduce pinned dnodes with a floor of arc_dnode_limit.
-		 * Request that 10% of the LRUs be scanned by the superblock
-		 * shrinker.
-		 */
-		if (type == ARC_BUFC_DATA && arc_dnode_size > arc_dnode_limit)
-			arc_prune_async((arc_dnode_size - arc_dnode_limit) /
-			    sizeof (dnode_t) / zfs_arc_dnode_reduce_percent);
+		args = kmem_zalloc(sizeof (*args) * nthreads, KM_SLEEP);
+		ids = kmem_zalloc(sizeof (*ids) * nthreads, KM_SLEEP);
 
 		/*
-		 * Start eviction using a randomly selected sublist,
-		 * this is to try and evenly balance eviction across all
-		 * sublists. Always starting at the same sublist
-		 * (e.g. index 0) would cause evictions to favor certain
-		 * sublists over others.
+		 * Give each thread an even share of the sublists and of
+		 * the bytes to evict. The last range is evicted by this
+		 * thread rather than being dispatched.
 		 */
-		for (i = 0; i < num_sublists; i++) {
-			uint64_t bytes_remaining;
-			uint64_t bytes_evicted;
-
-			if (bytes == ARC_EVICT_ALL)
-				bytes_remaining = ARC_EVICT_ALL;
-			else if (total_evicted < bytes)
-				bytes_remaining = bytes - total_evicted;
-			else
-				break;
-
-			bytes_evicted = arc_evict_state_impl(ml, sublist_idx,
-			    markers[sublist_idx], spa, bytes_remaining);
-
-			scan_evicted += bytes_evicted;
-			total_evicted += bytes_evicted;
+		for (i = 0; i < nthreads; i++) {
+			arc_evict_arg_t *eva = &args[i];
+
+			eva->eva_ml = ml;
+			eva->eva_spa = spa;
+			eva->eva_bytes = bytes / nthreads;
+			eva->eva_type = type;
+			eva->eva_markers = markers;
+			eva->eva_first = i * num_sublists / nthreads;
+			eva->eva_count = (i + 1) * num_sublists / nthreads -
+			    eva->eva_first;
+
+			if (i < nthreads - 1)
+				ids[i] = taskq_dispatch(arc_evict_taskq,
+				    arc_evict_task, eva, TQ_SLEEP);
+			if (i == nthreads - 1 || ids[i] == TASKQID_INVALID)
+				arc_evict_task(eva);
+		}
 
-			/* we've reached the end, wrap to the beginning */
-			if (++sublist_idx >= num_sublists)
-				sublist_idx = 0;
+		for (i = 0; i < nthreads; i++) {
+			if (ids[i] != TASKQID_INVALID)
+				taskq_wait_id(arc_evict_taskq, ids[i]);
+			total_evicted += args[i].eva_evicted;
 		}
 
-		/*
-		 * If we didn't evict anything during this scan, we have
-		 * no reason to believe we'll evict more during another
-		 * scan, so break the loop.
-		 */
-		if (scan_evicted == 0) {
-			/* This isn't possible, let's make that obvious */
-			ASSERT3S(bytes, !=, 0);
+		kmem_free(ids, sizeof (*ids) * nthreads);
+		kmem_free(args, sizeof (*args) * nthreads);
 
-			/*
-			 * When bytes is ARC_EVICT_ALL, the only way to
-			 * break the loop is when scan_evicted is zero.
-			 * In that case, we actually have evicted enough,
-			 * so we don't want to increment the kstat.
-			 */
-			if (bytes != ARC_EVICT_ALL) {
-				ASSERT3S(total_evicted, <, bytes);
-				ARCSTAT_BUMP(arcstat_evict_not_enough);
-			}
+		ARCSTAT_BUMP(arcstat_evict_parallel);
+		ARCSTAT_INCR(arcstat_evict_workers, nthreads);
+	}
 
-			break;
-		}
+	if (total_evicted < bytes || bytes == ARC_EVICT_ALL) {
+		total_evicted += arc_evict_sublists(ml, spa,
+		    bytes == ARC_EVICT_ALL ? ARC_EVICT_ALL :
+		    bytes - total_evicted, type, markers, 0, num_sublists);
 	}
 
+	/*
+	 * When bytes is ARC_EVICT_ALL, we've evicted everything we
+	 * could, so we don't want to increment the kstat.
+	 */
+	if (bytes != ARC_EVICT_ALL && total_evicted < bytes)
+		ARCSTAT_BUMP(arcstat_evict_not_enough);
+
 	for (i = 0; i < num_sublists; i++) {
 		multilist_sublist_t *mls = multilist_sublist_lock(ml, i);
 		multilist_sublist_remove(mls, markers[i]);
@@ -4125,6 +4494,9 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 	}
 	kmem_free(markers, sizeof (*markers) * num_sublists);
 
+	ARCSTAT_INCR(arcstat_evict_bytes, total_evicted);
+	ARCSTAT_INCR(arcstat_evict_time, gethrtime() - start);
+
 	return (total_evicted);
 }
 
@@ -5334,8 +5706,14 @@ arc_get_data_impl(arc_buf_hdr_t *hdr, uint64_t size, void *tag)
 		 * shouldn't cause any harm.
 		 */
 		if (arc_is_overflowing()) {
+			hrtime_t start = gethrtime();
+
 			cv_signal(&arc_reclaim_thread_cv);
 			cv_wait(&arc_reclaim_waiters_cv, &arc_reclaim_lock);
+
+			ARCSTAT_BUMP(arcstat_evict_waits);
+			ARCSTAT_INCR(arcstat_evict_wait_time,
+			    gethrtime() - start);
 		}
 
 		mutex_exit(&arc_reclaim_lock);
@@ -5443,6 +5821,13 @@ arc_access(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
 	ASSERT(MUTEX_HELD(hash_lock));
 	ASSERT(HDR_HAS_L1HDR(hdr));
 
+	/* Reads of new buffers are recorded by arc_admit(). */
+	if (zfs_arc_admission == ARC_ADMISSION_FREQUENCY &&
+	    hdr->b_l1hdr.b_state != arc_anon) {
+		(void) arc_sketch_increment(buf_hash(hdr->b_spa, &hdr->b_dva,
+		    hdr->b_birth));
+	}
+
 	if (hdr->b_l1hdr.b_state == arc_anon) {
 		/*
 		 * This buffer is not in the cache, and does not
@@ -5701,6 +6086,7 @@ arc_read_done(zio_t *zio)
 		 * called arc_access (to prevent any simultaneous readers from
 		 * getting confused).
 		 */
+		arc_admit(hdr);
 		arc_access(hdr, hash_lock);
 	}
 
@@ -7394,6 +7780,7 @@ arc_init(void)
 
 	arc_state_init();
 	buf_init();
+	arc_sketch_init();
 
 	list_create(&arc_prune_list, sizeof (arc_prune_t),
 	    offsetof(arc_prune_t, p_node));
@@ -7402,6 +7789,9 @@ arc_init(void)
 	arc_prune_taskq = taskq_create("arc_prune", max_ncpus, defclsyspri,
 	    max_ncpus, INT_MAX, TASKQ_PREPOPULATE | TASKQ_DYNAMIC);
 
+	arc_evict_taskq = taskq_create("arc_evict", max_ncpus, defclsyspri,
+	    max_ncpus, INT_MAX, TASKQ_PREPOPULATE | TASKQ_DYNAMIC);
+
 	arc_reclaim_thread_exit = B_FALSE;
 
 	arc_ksp = kstat_create("zfs", 0, "arcstats", "misc", KSTAT_TYPE_NAMED,
@@ -7473,6 +7863,10 @@ arc_fini(void)
 	taskq_wait(arc_prune_taskq);
 	taskq_destroy(arc_prune_taskq);
 
+	taskq_wait(arc_evict_taskq);
+	taskq_destroy(arc_evict_taskq);
+	arc_evict_taskq = NULL;
+
 	mutex_enter(&arc_prune_mtx);
 	while ((p = list_head(&arc_prune_list)) != NULL) {
 		list_remove(&arc_prune_list, p);
@@ -7489,6 +7883,7 @@ arc_fini(void)
 	cv_destroy(&arc_reclaim_waiters_cv);
 
 	arc_state_fini();
+	arc_sketch_fini();
 	buf_fini();
 
 	ASSERT0(arc_loaned_bytes);
@@ -7554,9 +7949,11 @@ arc_fini(void)
  * found during scanning and selected for writing to an L2ARC device, we
  * temporarily boost scanning headroom during the next scan cycle to make
  * sure we adapt to compression effects (which might significantly reduce
- * the data volume we write to L2ARC). The thread that does this is
- * l2arc_feed_thread(), illustrated below; example sizes are included to
- * provide a better sense of ratio than this diagram:
+ * the data volume we write to L2ARC). Each L2ARC device has its own
+ * l2arc_feed_thread() doing this, scanning its own slice of the ARC
+ * sublists so the threads don't contend on the same sublist locks, as
+ * illustrated below; example sizes are included to provide a better sense
+ * of ratio than this diagram:
  *
  *	       head -->                        tail
  *	        +---------------------+----------+
@@ -7604,7 +8001,9 @@ arc_fini(void)
  * 6. Writes to the L2ARC devices are grouped and sent in-sequence, so that
  * the vdev queue can aggregate them into larger and fewer writes.  Each
  * device is written to in a rotor fashion, sweeping writes through
- * available space then repeating.
+ * available space then repeating.  How much is written per interval is
+ * adjusted per device, growing while the device completes its writes
+ * within l2arc_write_latency_ms and shrinking when it does not.
  *
  * 7. The L2ARC does not store dirty content.  It never needs to flush
  * write buffers back to disk based storage.
@@ -7615,7 +8014,8 @@ arc_fini(void)
  * The performance of the L2ARC can be tweaked by a number of tunables, which
  * may be necessary for different workloads:
  *
- *	l2arc_write_max		max write bytes per interval
+ *	l2arc_write_max		initial write bytes per interval
+ *	l2arc_write_latency_ms	target latency of each device's writes
  *	l2arc_write_boost	extra write bytes during device warmup
  *	l2arc_noprefetch	skip caching prefetched buffers
  *	l2arc_headroom		number of max device writes to precache
@@ -7657,22 +8057,37 @@ l2arc_write_eligible(uint64_t spa_guid, arc_buf_hdr_t *hdr)
 }
 
 static uint64_t
-l2arc_write_size(void)
+l2arc_write_size(l2arc_dev_t *dev)
 {
-	uint64_t size;
+	uint64_t size, min_size, max_size;
 
 	/*
 	 * Make sure our globals have meaningful values in case the user
 	 * altered them.
 	 */
-	size = l2arc_write_max;
-	if (size == 0) {
+	if (l2arc_write_max == 0) {
 		cmn_err(CE_NOTE, "Bad value for l2arc_write_max, value must "
 		    "be greater than zero, resetting it to the default (%d)",
 		    L2ARC_WRITE_SIZE);
-		size = l2arc_write_max = L2ARC_WRITE_SIZE;
+		l2arc_write_max = L2ARC_WRITE_SIZE;
 	}
 
+	/*
+	 * Keep the device's write size within bounds of l2arc_write_max,
+	 * which may have changed since it was last adjusted, and well short
+	 * of the size of the device itself.
+	 */
+	min_size = MAX(l2arc_write_max >> 3, SPA_MINBLOCKSIZE);
+	max_size = MAX(MIN(l2arc_write_max << 6,
+	    (dev->l2ad_end - dev->l2ad_start) >> 4), min_size);
+
+	if (l2arc_write_latency_ms == 0 || dev->l2ad_write_size == 0)
+		size = l2arc_write_max;
+	else
+		size = dev->l2ad_write_size;
+	size = MIN(MAX(size, min_size), max_size);
+	dev->l2ad_write_size = size;
+
 	if (arc_warm == B_FALSE)
 		size += l2arc_write_boost;
 
@@ -7680,6 +8095,24 @@ l2arc_write_size(void)
 
 }
 
+/*
+ * Adjust the device's write size by how long its last write took.  The
+ * size is halved when the write exceeded l2arc_write_latency_ms, and grown
+ * by a quarter when it completed in time and there was enough eligible
+ * data to fill at least half of it.
+ */
+static void
+l2arc_write_adjust(l2arc_dev_t *dev, uint64_t wanted, uint64_t wrote)
+{
+	if (l2arc_write_latency_ms == 0 || wrote == 0)
+		return;
+
+	if (dev->l2ad_write_latency > MSEC2NSEC(l2arc_write_latency_ms))
+		dev->l2ad_write_size >>= 1;
+	else if (wrote > (wanted / 2))
+		dev->l2ad_write_size += dev->l2ad_write_size >> 2;
+}
+
 static clock_t
 l2arc_write_interval(clock_t began, uint64_t wanted, uint64_t wrote)
 {
@@ -7703,88 +8136,31 @@ l2arc_write_interval(clock_t began, uint64_t wanted, uint64_t wrote)
 }
 
 /*
- * Cycle through L2ARC devices.  This is how L2ARC load balances.
- * If a device is returned, this also returns holding the spa config lock.
+ * Free buffers that were tagged for destruction once the given device's
+ * write completed, or all of them if no device is given.  Other devices
+ * may still be writing theirs.
  */
-static l2arc_dev_t *
-l2arc_dev_get_next(void)
+static void
+l2arc_do_free_on_write(l2arc_dev_t *dev)
 {
-	l2arc_dev_t *first, *next = NULL;
-
-	/*
-	 * Lock out the removal of spas (spa_namespace_lock), then removal
-	 * of cache devices (l2arc_dev_mtx).  Once a device has been selected,
-	 * both locks will be dropped and a spa config lock held instead.
-	 */
-	mutex_enter(&spa_namespace_lock);
-	mutex_enter(&l2arc_dev_mtx);
-
-	/* if there are no vdevs, there is nothing to do */
-	if (l2arc_ndev == 0)
-		goto out;
+	list_t *buflist;
+	l2arc_data_free_t *df, *df_prev;
 
-	first = NULL;
-	next = l2arc_dev_last;
-	do {
-		/* loop around the list looking for a non-faulted vdev */
-		if (next == NULL) {
-			next = list_head(l2arc_dev_list);
-		} else {
-			next = list_next(l2arc_dev_list, next);
-			if (next == NULL)
-				next = list_head(l2arc_dev_list);
-		}
+	mutex_enter(&l2arc_free_on_write_mtx);
+	buflist = l2arc_free_on_write;
 
-		/* if we have come back to the start, bail out */
-		if (first == NULL)
-			first = next;
-		else if (next == first)
-			break;
+	for (df = list_tail(buflist); df; df = df_prev) {
+		df_prev = list_prev(buflist, df);
+		if (dev != NULL && df->l2df_dev != dev)
+			continue;
+		ASSERT3P(df->l2df_abd, !=, NULL);
+		abd_free(df->l2df_abd);
+		list_remove(buflist, df);
+		kmem_free(df, sizeof (l2arc_data_free_t));
+	}
 
-	} while (vdev_is_dead(next->l2ad_vdev));
-
-	/* if we were unable to find any usable vdevs, return NULL */
-	if (vdev_is_dead(next->l2ad_vdev))
-		next = NULL;
-
-	l2arc_dev_last = next;
-
-out:
-	mutex_exit(&l2arc_dev_mtx);
-
-	/*
-	 * Grab the config lock to prevent the 'next' device from being
-	 * removed while we are writing to it.
-	 */
-	if (next != NULL)
-		spa_config_enter(next->l2ad_spa, SCL_L2ARC, next, RW_READER);
-	mutex_exit(&spa_namespace_lock);
-
-	return (next);
-}
-
-/*
- * Free buffers that were tagged for destruction.
- */
-static void
-l2arc_do_free_on_write(void)
-{
-	list_t *buflist;
-	l2arc_data_free_t *df, *df_prev;
-
-	mutex_enter(&l2arc_free_on_write_mtx);
-	buflist = l2arc_free_on_write;
-
-	for (df = list_tail(buflist); df; df = df_prev) {
-		df_prev = list_prev(buflist, df);
-		ASSERT3P(df->l2df_abd, !=, NULL);
-		abd_free(df->l2df_abd);
-		list_remove(buflist, df);
-		kmem_free(df, sizeof (l2arc_data_free_t));
-	}
-
-	mutex_exit(&l2arc_free_on_write_mtx);
-}
+	mutex_exit(&l2arc_free_on_write_mtx);
+}
 
 /*
  * A write to a cache device has completed.  Update all headers to allow
@@ -7901,7 +8277,7 @@ top:
 
 	vdev_space_update(dev->l2ad_vdev, -bytes_dropped, 0, 0);
 
-	l2arc_do_free_on_write();
+	l2arc_do_free_on_write(dev);
 
 	kmem_free(cb, sizeof (l2arc_write_callback_t));
 }
@@ -8128,12 +8504,16 @@ l2arc_read_done(zio_t *zio)
  * Currently the metadata lists are hit first, MFU then MRU, followed by
  * the data lists.  This function returns a locked list, and also returns
  * the lock pointer.
+ *
+ * Each device's feed thread only takes sublists from its own slice of the
+ * list, so that feed threads for different devices don't contend on the
+ * same sublist locks.
  */
 static multilist_sublist_t *
-l2arc_sublist_lock(int list_num)
+l2arc_sublist_lock(int list_num, l2arc_dev_t *dev)
 {
 	multilist_t *ml = NULL;
-	unsigned int idx;
+	unsigned int idx, first, count, num_sublists, ndev, slice;
 
 	ASSERT(list_num >= 0 && list_num < L2ARC_FEED_TYPES);
 
@@ -8154,13 +8534,24 @@ l2arc_sublist_lock(int list_num)
 		return (NULL);
 	}
 
+	num_sublists = multilist_get_num_sublists(ml);
+	ndev = MAX(l2arc_ndev, 1);
+	slice = dev->l2ad_feed_idx % ndev;
+	if (num_sublists >= ndev) {
+		first = slice * num_sublists / ndev;
+		count = (slice + 1) * num_sublists / ndev - first;
+	} else {
+		first = slice % num_sublists;
+		count = 1;
+	}
+
 	/*
-	 * Return a randomly-selected sublist. This is acceptable
-	 * because the caller feeds only a little bit of data for each
-	 * call (8MB). Subsequent calls will result in different
+	 * Return a randomly-selected sublist from the slice. This is
+	 * acceptable because the caller feeds only a little bit of data
+	 * for each call. Subsequent calls will result in different
 	 * sublists being selected.
 	 */
-	idx = multilist_get_random_index(ml);
+	idx = first + spa_get_random(count);
 	return (multilist_sublist_lock(ml, idx));
 }
 
@@ -8180,14 +8571,6 @@ l2arc_evict(l2arc_dev_t *dev, uint64_t distance, boolean_t all)
 
 	buflist = &dev->l2ad_buflist;
 
-	if (!all && dev->l2ad_first) {
-		/*
-		 * This is the first sweep through the device.  There is
-		 * nothing to evict.
-		 */
-		return;
-	}
-
 	if (dev->l2ad_hand >= (dev->l2ad_end - (2 * distance))) {
 		/*
 		 * When nearing the end of the device, evict to the end
@@ -8197,6 +8580,23 @@ l2arc_evict(l2arc_dev_t *dev, uint64_t distance, boolean_t all)
 	} else {
 		taddr = dev->l2ad_hand + distance;
 	}
+
+	/*
+	 * Record how far ahead of the write hand the device is about to be
+	 * overwritten.  The persistent device header uses this to tell
+	 * which log blocks are still valid on rebuild.
+	 */
+	if (!all)
+		dev->l2ad_evict = taddr;
+
+	if (!all && dev->l2ad_first) {
+		/*
+		 * This is the first sweep through the device.  There is
+		 * nothing to evict.
+		 */
+		return;
+	}
+
 	DTRACE_PROBE4(l2arc__evict, l2arc_dev_t *, dev, list_t *, buflist,
 	    uint64_t, taddr, boolean_t, all);
 
@@ -8398,7 +8798,7 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 {
 	arc_buf_hdr_t *hdr, *hdr_prev, *head;
 	uint64_t write_asize, write_psize, write_lsize, headroom;
-	boolean_t full;
+	boolean_t full, commit;
 	l2arc_write_callback_t *cb;
 	zio_t *pio, *wzio;
 	uint64_t guid = spa_load_guid(spa);
@@ -8416,7 +8816,7 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	 * Copy buffers for L2ARC writing.
 	 */
 	for (try = 0; try < L2ARC_FEED_TYPES; try++) {
-		multilist_sublist_t *mls = l2arc_sublist_lock(try);
+		multilist_sublist_t *mls = l2arc_sublist_lock(try, dev);
 		uint64_t passed_sz = 0;
 
 		VERIFY3P(mls, !=, NULL);
@@ -8537,7 +8937,8 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 					continue;
 				}
 
-				l2arc_free_abd_on_write(to_write, asize, type);
+				l2arc_free_abd_on_write(to_write, asize, type,
+				    dev);
 			}
 
 			if (pio == NULL) {
@@ -8585,9 +8986,18 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			write_asize += asize;
 			dev->l2ad_hand += asize;
 
+			/*
+			 * Describe the buffer in the open log block so it
+			 * can be restored after a reboot.
+			 */
+			commit = l2arc_log_blk_insert(dev, hdr, asize);
+
 			mutex_exit(hash_lock);
 
 			(void) zio_nowait(wzio);
+
+			if (commit)
+				l2arc_log_blk_commit(dev, pio);
 		}
 
 		multilist_sublist_unlock(mls);
@@ -8613,32 +9023,48 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 
 	/*
 	 * Bump device hand to the device start if it is approaching the end.
-	 * l2arc_evict() will already have evicted ahead for this case.
-	 */
-	if (dev->l2ad_hand >= (dev->l2ad_end - target_sz)) {
+	 * l2arc_evict() will already have evicted ahead for this case.  The
+	 * open log block is committed first so that the payload of a log
+	 * block never wraps around the end of the device.
+	 */
+	if (dev->l2ad_hand >= (dev->l2ad_end - (target_sz +
+	    l2arc_log_blk_overhead(target_sz, dev)))) {
+		if (dev->l2ad_log_ent_idx > 0)
+			l2arc_log_blk_commit(dev, pio);
 		dev->l2ad_hand = dev->l2ad_start;
+		dev->l2ad_evict = dev->l2ad_start;
 		dev->l2ad_first = B_FALSE;
 	}
 
 	dev->l2ad_writing = B_TRUE;
+	dev->l2ad_write_latency = gethrtime();
 	(void) zio_wait(pio);
+	dev->l2ad_write_latency = gethrtime() - dev->l2ad_write_latency;
 	dev->l2ad_writing = B_FALSE;
 
+	/*
+	 * Only update the device header once the buffers and log blocks it
+	 * refers to are on stable storage.
+	 */
+	if (dev->l2ad_log_entries > 0)
+		l2arc_dev_hdr_update(dev);
+
 	return (write_asize);
 }
 
 /*
- * This thread feeds the L2ARC at regular intervals.  This is the beating
- * heart of the L2ARC.
+ * This thread feeds an L2ARC device at regular intervals.  This is the
+ * beating heart of the L2ARC.  There is one for each device.
  */
 static void
-l2arc_feed_thread(void *unused)
+l2arc_feed_thread(void *arg)
 {
+	l2arc_dev_t *dev = arg;
+	spa_t *spa = dev->l2ad_spa;
 	callb_cpr_t cpr;
-	l2arc_dev_t *dev;
-	spa_t *spa;
 	uint64_t size, wrote;
 	clock_t begin, next = ddi_get_lbolt();
+	boolean_t rebuild;
 	fstrans_cookie_t cookie;
 
 	CALLB_CPR_INIT(&cpr, &l2arc_feed_thr_lock, callb_generic_cpr, FTAG);
@@ -8646,39 +9072,41 @@ l2arc_feed_thread(void *unused)
 	mutex_enter(&l2arc_feed_thr_lock);
 
 	cookie = spl_fstrans_mark();
-	while (l2arc_thread_exit == 0) {
-		CALLB_CPR_SAFE_BEGIN(&cpr);
-		(void) cv_timedwait_sig(&l2arc_feed_thr_cv,
-		    &l2arc_feed_thr_lock, next);
-		CALLB_CPR_SAFE_END(&cpr, &l2arc_feed_thr_lock);
-		next = ddi_get_lbolt() + hz;
-
+	while (!dev->l2ad_feed_cancel) {
 		/*
-		 * Quick check for L2ARC devices.
+		 * The cv is shared by the feed threads of all devices, so
+		 * go back to sleep when woken before our next write.
 		 */
-		mutex_enter(&l2arc_dev_mtx);
-		if (l2arc_ndev == 0) {
-			mutex_exit(&l2arc_dev_mtx);
+		if (ddi_get_lbolt() < next) {
+			CALLB_CPR_SAFE_BEGIN(&cpr);
+			(void) cv_timedwait_sig(&l2arc_feed_thr_cv,
+			    &l2arc_feed_thr_lock, next);
+			CALLB_CPR_SAFE_END(&cpr, &l2arc_feed_thr_lock);
 			continue;
 		}
-		mutex_exit(&l2arc_dev_mtx);
+		mutex_exit(&l2arc_feed_thr_lock);
+
 		begin = ddi_get_lbolt();
+		next = begin + hz;
 
 		/*
-		 * This selects the next l2arc device to write to, and in
-		 * doing so the next spa to feed from: dev->l2ad_spa.   This
-		 * will return NULL if there are now no l2arc devices or if
-		 * they are all faulted.
-		 *
-		 * If a device is returned, its spa's config lock is also
-		 * held to prevent device removal.  l2arc_dev_get_next()
-		 * will grab and release l2arc_dev_mtx.
+		 * Skip the device while it is faulted or still being
+		 * rebuilt.
 		 */
-		if ((dev = l2arc_dev_get_next()) == NULL)
-			continue;
+		mutex_enter(&l2arc_rebuild_thr_lock);
+		rebuild = dev->l2ad_rebuild;
+		mutex_exit(&l2arc_rebuild_thr_lock);
+		if (rebuild || vdev_is_dead(dev->l2ad_vdev))
+			goto skip;
 
-		spa = dev->l2ad_spa;
-		ASSERT3P(spa, !=, NULL);
+		/*
+		 * The spa's config lock prevents the device from being
+		 * removed while we are writing to it.  It is only tried,
+		 * since l2arc_remove_vdev() may be waiting for this thread
+		 * while holding it.
+		 */
+		if (!spa_config_tryenter(spa, SCL_L2ARC, dev, RW_READER))
+			goto skip;
 
 		/*
 		 * If the pool is read-only then force the feed thread to
@@ -8687,7 +9115,7 @@ l2arc_feed_thread(void *unused)
 		if (!spa_writeable(spa)) {
 			next = ddi_get_lbolt() + 5 * l2arc_feed_secs * hz;
 			spa_config_exit(spa, SCL_L2ARC, dev);
-			continue;
+			goto skip;
 		}
 
 		/*
@@ -8696,17 +9124,20 @@ l2arc_feed_thread(void *unused)
 		if (arc_reclaim_needed()) {
 			ARCSTAT_BUMP(arcstat_l2_abort_lowmem);
 			spa_config_exit(spa, SCL_L2ARC, dev);
-			continue;
+			goto skip;
 		}
 
 		ARCSTAT_BUMP(arcstat_l2_feeds);
 
-		size = l2arc_write_size();
+		size = l2arc_write_size(dev);
 
 		/*
-		 * Evict L2ARC buffers that will be overwritten.
+		 * Evict L2ARC buffers that will be overwritten, including
+		 * the space needed for any log blocks written along with
+		 * them.
 		 */
-		l2arc_evict(dev, size, B_FALSE);
+		l2arc_evict(dev, size + l2arc_log_blk_overhead(size, dev),
+		    B_FALSE);
 
 		/*
 		 * Write ARC buffers.
@@ -8714,19 +9145,70 @@ l2arc_feed_thread(void *unused)
 		wrote = l2arc_write_buffers(spa, dev, size);
 
 		/*
-		 * Calculate interval between writes.
+		 * Adjust the write size to the device's latency and
+		 * calculate interval between writes.
 		 */
+		l2arc_write_adjust(dev, size, wrote);
 		next = l2arc_write_interval(begin, size, wrote);
 		spa_config_exit(spa, SCL_L2ARC, dev);
+skip:
+		mutex_enter(&l2arc_feed_thr_lock);
 	}
 	spl_fstrans_unmark(cookie);
 
-	l2arc_thread_exit = 0;
+	dev->l2ad_feed_began = B_FALSE;
 	cv_broadcast(&l2arc_feed_thr_cv);
 	CALLB_CPR_EXIT(&cpr);		/* drops l2arc_feed_thr_lock */
 	thread_exit();
 }
 
+/*
+ * Starts the feed thread of a device, if feeding has been enabled by
+ * l2arc_start().
+ */
+static void
+l2arc_feed_start(l2arc_dev_t *dev)
+{
+	mutex_enter(&l2arc_feed_thr_lock);
+	if (l2arc_feed_enabled && !dev->l2ad_feed_began) {
+		dev->l2ad_feed_began = B_TRUE;
+		dev->l2ad_feed_cancel = B_FALSE;
+		(void) thread_create(NULL, 0, l2arc_feed_thread, dev, 0, &p0,
+		    TS_RUN, defclsyspri);
+	}
+	mutex_exit(&l2arc_feed_thr_lock);
+}
+
+/*
+ * Stops the feed thread of a device and waits for it to exit.
+ */
+static void
+l2arc_feed_stop(l2arc_dev_t *dev)
+{
+	mutex_enter(&l2arc_feed_thr_lock);
+	dev->l2ad_feed_cancel = B_TRUE;
+	cv_broadcast(&l2arc_feed_thr_cv);
+	while (dev->l2ad_feed_began)
+		cv_wait(&l2arc_feed_thr_cv, &l2arc_feed_thr_lock);
+	mutex_exit(&l2arc_feed_thr_lock);
+}
+
+/*
+ * Assigns each device the slice of the ARC sublists its feed thread scans.
+ */
+static void
+l2arc_feed_renumber(void)
+{
+	l2arc_dev_t *dev;
+	int idx = 0;
+
+	ASSERT(MUTEX_HELD(&l2arc_dev_mtx));
+
+	for (dev = list_head(l2arc_dev_list); dev != NULL;
+	    dev = list_next(l2arc_dev_list, dev))
+		dev->l2ad_feed_idx = idx++;
+}
+
 boolean_t
 l2arc_vdev_present(vdev_t *vd)
 {
@@ -8751,20 +9233,31 @@ void
 l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 {
 	l2arc_dev_t *adddev;
+	uint64_t l2dhdr_asize;
 
 	ASSERT(!l2arc_vdev_present(vd));
 
 	/*
-	 * Create a new l2arc device entry.
+	 * Create a new l2arc device entry.  The device header is stored
+	 * right after the front vdev labels, ahead of the buffers.
 	 */
-	adddev = kmem_zalloc(sizeof (l2arc_dev_t), KM_SLEEP);
+	l2dhdr_asize = MAX(sizeof (l2arc_dev_hdr_phys_t),
+	    1ULL << vd->vdev_ashift);
+	adddev = vmem_zalloc(sizeof (l2arc_dev_t), KM_SLEEP);
 	adddev->l2ad_spa = spa;
 	adddev->l2ad_vdev = vd;
-	adddev->l2ad_start = VDEV_LABEL_START_SIZE;
+	adddev->l2ad_dev_hdr = kmem_zalloc(l2dhdr_asize, KM_SLEEP);
+	adddev->l2ad_dev_hdr_asize = l2dhdr_asize;
+	adddev->l2ad_start = VDEV_LABEL_START_SIZE + l2dhdr_asize;
 	adddev->l2ad_end = VDEV_LABEL_START_SIZE + vdev_get_min_asize(vd);
+	ASSERT3U(adddev->l2ad_start, <, adddev->l2ad_end);
 	adddev->l2ad_hand = adddev->l2ad_start;
+	adddev->l2ad_evict = adddev->l2ad_start;
 	adddev->l2ad_first = B_TRUE;
 	adddev->l2ad_writing = B_FALSE;
+	if (adddev->l2ad_end - adddev->l2ad_start >=
+	    l2arc_rebuild_blocks_min_l2size)
+		adddev->l2ad_log_entries = L2ARC_LOG_BLK_MAX_ENTRIES;
 	list_link_init(&adddev->l2ad_node);
 
 	mutex_init(&adddev->l2ad_mtx, NULL, MUTEX_DEFAULT, NULL);
@@ -8775,16 +9268,32 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	list_create(&adddev->l2ad_buflist, sizeof (arc_buf_hdr_t),
 	    offsetof(arc_buf_hdr_t, b_l2hdr.b_l2node));
 
-	vdev_space_update(vd, 0, 0, adddev->l2ad_end - adddev->l2ad_hand);
+	vdev_space_update(vd, 0, 0, adddev->l2ad_end - adddev->l2ad_start);
 	refcount_create(&adddev->l2ad_alloc);
 
+	/*
+	 * Pick up where the device left off if it holds a valid header
+	 * from a previous import of this pool.
+	 */
+	l2arc_rebuild_vdev(adddev);
+
 	/*
 	 * Add device to global list
 	 */
 	mutex_enter(&l2arc_dev_mtx);
 	list_insert_head(l2arc_dev_list, adddev);
 	atomic_inc_64(&l2arc_ndev);
+	l2arc_feed_renumber();
+	l2arc_feed_start(adddev);
 	mutex_exit(&l2arc_dev_mtx);
+
+	/*
+	 * A device added to an already imported pool, e.g. when it is
+	 * reopened, is rebuilt right away.  Otherwise the rebuild is
+	 * started once the pool has finished loading.
+	 */
+	if (adddev->l2ad_rebuild && spa->spa_load_state == SPA_LOAD_NONE)
+		l2arc_spa_rebuild_start(spa);
 }
 
 /*
@@ -8808,14 +9317,27 @@ l2arc_remove_vdev(vdev_t *vd)
 	}
 	ASSERT3P(remdev, !=, NULL);
 
+	/*
+	 * Cancel any ongoing rebuild, and make sure a pending one is
+	 * never started.
+	 */
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	remdev->l2ad_rebuild_cancel = B_TRUE;
+	while (remdev->l2ad_rebuild_began)
+		cv_wait(&l2arc_rebuild_thr_cv, &l2arc_rebuild_thr_lock);
+	mutex_exit(&l2arc_rebuild_thr_lock);
+
 	/*
 	 * Remove device from global list
 	 */
 	list_remove(l2arc_dev_list, remdev);
-	l2arc_dev_last = NULL;		/* may have been invalidated */
 	atomic_dec_64(&l2arc_ndev);
+	l2arc_feed_renumber();
 	mutex_exit(&l2arc_dev_mtx);
 
+	l2arc_feed_stop(remdev);
+	l2arc_do_free_on_write(remdev);
+
 	/*
 	 * Clear all buflists and ARC references.  L2ARC device flush.
 	 */
@@ -8823,19 +9345,22 @@ l2arc_remove_vdev(vdev_t *vd)
 	list_destroy(&remdev->l2ad_buflist);
 	mutex_destroy(&remdev->l2ad_mtx);
 	refcount_destroy(&remdev->l2ad_alloc);
-	kmem_free(remdev, sizeof (l2arc_dev_t));
+	kmem_free(remdev->l2ad_dev_hdr, remdev->l2ad_dev_hdr_asize);
+	vmem_free(remdev, sizeof (l2arc_dev_t));
 }
 
 void
 l2arc_init(void)
 {
-	l2arc_thread_exit = 0;
+	l2arc_feed_enabled = B_FALSE;
 	l2arc_ndev = 0;
 	l2arc_writes_sent = 0;
 	l2arc_writes_done = 0;
 
 	mutex_init(&l2arc_feed_thr_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&l2arc_feed_thr_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&l2arc_rebuild_thr_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&l2arc_rebuild_thr_cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&l2arc_dev_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&l2arc_free_on_write_mtx, NULL, MUTEX_DEFAULT, NULL);
 
@@ -8856,10 +9381,12 @@ l2arc_fini(void)
 	 * already been removed when the pools themselves were removed.
 	 */
 
-	l2arc_do_free_on_write();
+	l2arc_do_free_on_write(NULL);
 
 	mutex_destroy(&l2arc_feed_thr_lock);
 	cv_destroy(&l2arc_feed_thr_cv);
+	mutex_destroy(&l2arc_rebuild_thr_lock);
+	cv_destroy(&l2arc_rebuild_thr_cv);
 	mutex_destroy(&l2arc_dev_mtx);
 	mutex_destroy(&l2arc_free_on_write_mtx);
 
@@ -8867,28 +9394,724 @@ l2arc_fini(void)
 	list_destroy(l2arc_free_on_write);
 }
 
+/*
+ * Enables feeding of L2ARC devices, starting a feed thread for each device
+ * as it is added.
+ */
 void
 l2arc_start(void)
 {
+	l2arc_dev_t *dev;
+
 	if (!(spa_mode_global & FWRITE))
 		return;
 
-	(void) thread_create(NULL, 0, l2arc_feed_thread, NULL, 0, &p0,
-	    TS_RUN, defclsyspri);
+	mutex_enter(&l2arc_dev_mtx);
+	mutex_enter(&l2arc_feed_thr_lock);
+	l2arc_feed_enabled = B_TRUE;
+	mutex_exit(&l2arc_feed_thr_lock);
+	for (dev = list_head(l2arc_dev_list); dev != NULL;
+	    dev = list_next(l2arc_dev_list, dev))
+		l2arc_feed_start(dev);
+	mutex_exit(&l2arc_dev_mtx);
 }
 
 void
 l2arc_stop(void)
 {
+	l2arc_dev_t *dev;
+
 	if (!(spa_mode_global & FWRITE))
 		return;
 
+	mutex_enter(&l2arc_dev_mtx);
 	mutex_enter(&l2arc_feed_thr_lock);
-	cv_signal(&l2arc_feed_thr_cv);	/* kick thread out of startup */
-	l2arc_thread_exit = 1;
-	while (l2arc_thread_exit != 0)
-		cv_wait(&l2arc_feed_thr_cv, &l2arc_feed_thr_lock);
+	l2arc_feed_enabled = B_FALSE;
 	mutex_exit(&l2arc_feed_thr_lock);
+	for (dev = list_head(l2arc_dev_list); dev != NULL;
+	    dev = list_next(l2arc_dev_list, dev))
+		l2arc_feed_stop(dev);
+	mutex_exit(&l2arc_dev_mtx);
+}
+
+/*
+ * Starts the rebuild threads for all cache devices of a pool which were
+ * found to hold a valid persistent L2ARC.  Called once the pool has been
+ * loaded, or when a cache device is added to an imported pool.
+ */
+void
+l2arc_spa_rebuild_start(spa_t *spa)
+{
+	l2arc_dev_t *dev;
+
+	mutex_enter(&l2arc_dev_mtx);
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	for (dev = list_head(l2arc_dev_list); dev != NULL;
+	    dev = list_next(l2arc_dev_list, dev)) {
+		if (dev->l2ad_spa != spa || !dev->l2ad_rebuild ||
+		    dev->l2ad_rebuild_began || dev->l2ad_rebuild_cancel)
+			continue;
+
+		dev->l2ad_rebuild_began = B_TRUE;
+		(void) thread_create(NULL, 0, l2arc_dev_rebuild_thread,
+		    dev, 0, &p0, TS_RUN, minclsyspri);
+	}
+	mutex_exit(&l2arc_rebuild_thr_lock);
+	mutex_exit(&l2arc_dev_mtx);
+}
+
+/*
+ * Cancels the rebuild threads of a pool's cache devices and waits for
+ * them to exit.  Must be called before the pool is unloaded.
+ */
+void
+l2arc_spa_rebuild_stop(spa_t *spa)
+{
+	l2arc_dev_t *dev;
+
+	mutex_enter(&l2arc_dev_mtx);
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	for (dev = list_head(l2arc_dev_list); dev != NULL;
+	    dev = list_next(l2arc_dev_list, dev)) {
+		if (dev->l2ad_spa == spa)
+			dev->l2ad_rebuild_cancel = B_TRUE;
+	}
+	for (dev = list_head(l2arc_dev_list); dev != NULL;
+	    dev = list_next(l2arc_dev_list, dev)) {
+		while (dev->l2ad_spa == spa && dev->l2ad_rebuild_began)
+			cv_wait(&l2arc_rebuild_thr_cv, &l2arc_rebuild_thr_lock);
+	}
+	mutex_exit(&l2arc_rebuild_thr_lock);
+	mutex_exit(&l2arc_dev_mtx);
+}
+
+/*
+ * Main entry point for L2ARC rebuilding.
+ */
+static void
+l2arc_dev_rebuild_thread(void *arg)
+{
+	l2arc_dev_t *dev = arg;
+	fstrans_cookie_t cookie;
+
+	VERIFY(dev->l2ad_rebuild);
+
+	cookie = spl_fstrans_mark();
+	(void) l2arc_rebuild(dev);
+	spl_fstrans_unmark(cookie);
+
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	dev->l2ad_rebuild_began = B_FALSE;
+	dev->l2ad_rebuild = B_FALSE;
+	cv_broadcast(&l2arc_rebuild_thr_cv);
+	mutex_exit(&l2arc_rebuild_thr_lock);
+
+	thread_exit();
+}
+
+/*
+ * Reads the device header of a newly added cache device and, if it is
+ * valid, restores the write hand from it so that the buffers it describes
+ * are not overwritten before they have been restored.
+ */
+static void
+l2arc_rebuild_vdev(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	spa_t *spa = dev->l2ad_spa;
+
+	/*
+	 * A pool being created can't have anything to rebuild and a pool
+	 * being probed for import is discarded right afterwards.
+	 */
+	if (dev->l2ad_log_entries == 0 || vdev_is_dead(dev->l2ad_vdev) ||
+	    spa->spa_load_state == SPA_LOAD_CREATE ||
+	    spa->spa_load_state == SPA_LOAD_TRYIMPORT)
+		return;
+
+	if (l2arc_dev_hdr_read(dev) != 0 || !l2arc_rebuild_enabled) {
+		/*
+		 * Start over with an empty device.  The first header
+		 * written will overwrite whatever was found here.
+		 */
+		bzero(l2dhdr, dev->l2ad_dev_hdr_asize);
+		return;
+	}
+
+	dev->l2ad_hand = l2dhdr->dh_hand;
+	dev->l2ad_evict = l2dhdr->dh_evict;
+	dev->l2ad_first = !!(l2dhdr->dh_flags & L2ARC_DEV_HDR_EVICT_FIRST);
+	dev->l2ad_rebuild = B_TRUE;
+}
+
+/*
+ * Reads and validates the device header.  Returns 0 if the header is
+ * valid for this device and pool.
+ */
+static int
+l2arc_dev_hdr_read(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	const uint64_t l2dhdr_asize = dev->l2ad_dev_hdr_asize;
+	vdev_t *vd = dev->l2ad_vdev;
+	zio_cksum_t cksum;
+	abd_t *abd;
+	int err;
+
+	abd = abd_alloc_linear(l2dhdr_asize, B_TRUE);
+	err = zio_wait(zio_read_phys(NULL, vd, VDEV_LABEL_START_SIZE,
+	    l2dhdr_asize, abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY, B_FALSE));
+	abd_copy_to_buf(l2dhdr, abd, l2dhdr_asize);
+	abd_free(abd);
+
+	if (err != 0) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+		zfs_dbgmsg("L2ARC IO error (%d) while reading device header, "
+		    "vdev guid: %llu", err, (u_longlong_t)vd->vdev_guid);
+		return (err);
+	}
+
+	if (l2dhdr->dh_magic == BSWAP_64(L2ARC_DEV_HDR_MAGIC)) {
+		/* Written on a host of the other endianness. */
+		ARCSTAT_BUMP(arcstat_l2_rebuild_unsupported);
+		return (SET_ERROR(ENOTSUP));
+	}
+	if (l2dhdr->dh_magic != L2ARC_DEV_HDR_MAGIC) {
+		/* Never used for a persistent L2ARC. */
+		return (SET_ERROR(ENOTSUP));
+	}
+
+	fletcher_4_native(l2dhdr, offsetof(l2arc_dev_hdr_phys_t,
+	    dh_self_cksum), NULL, &cksum);
+	if (!ZIO_CHECKSUM_EQUAL(cksum, l2dhdr->dh_self_cksum)) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_dh_errors);
+		return (SET_ERROR(ECKSUM));
+	}
+
+	if (l2dhdr->dh_version != L2ARC_PERSISTENT_VERSION ||
+	    l2dhdr->dh_spa_guid != spa_guid(vd->vdev_spa) ||
+	    l2dhdr->dh_vdev_guid != vd->vdev_guid ||
+	    l2dhdr->dh_log_entries != dev->l2ad_log_entries ||
+	    l2dhdr->dh_start != dev->l2ad_start ||
+	    l2dhdr->dh_end != dev->l2ad_end ||
+	    l2dhdr->dh_hand < dev->l2ad_start ||
+	    l2dhdr->dh_hand > dev->l2ad_end ||
+	    l2dhdr->dh_evict < dev->l2ad_start ||
+	    l2dhdr->dh_evict > dev->l2ad_end) {
+		/*
+		 * The header is intact but belongs to another pool, or the
+		 * device has changed size since it was written.
+		 */
+		ARCSTAT_BUMP(arcstat_l2_rebuild_unsupported);
+		return (SET_ERROR(ENOTSUP));
+	}
+
+	return (0);
+}
+
+/*
+ * Writes the device header, which points at the most recently committed
+ * log block.  Called by the feed thread after each write pass.
+ */
+static void
+l2arc_dev_hdr_update(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	const uint64_t l2dhdr_asize = dev->l2ad_dev_hdr_asize;
+	vdev_t *vd = dev->l2ad_vdev;
+	abd_t *abd;
+	int err;
+
+	l2dhdr->dh_magic = L2ARC_DEV_HDR_MAGIC;
+	l2dhdr->dh_version = L2ARC_PERSISTENT_VERSION;
+	l2dhdr->dh_spa_guid = spa_guid(vd->vdev_spa);
+	l2dhdr->dh_vdev_guid = vd->vdev_guid;
+	l2dhdr->dh_log_entries = dev->l2ad_log_entries;
+	l2dhdr->dh_hand = dev->l2ad_hand;
+	l2dhdr->dh_evict = dev->l2ad_evict;
+	l2dhdr->dh_start = dev->l2ad_start;
+	l2dhdr->dh_end = dev->l2ad_end;
+	l2dhdr->dh_flags = 0;
+	if (dev->l2ad_first)
+		l2dhdr->dh_flags |= L2ARC_DEV_HDR_EVICT_FIRST;
+	fletcher_4_native(l2dhdr, offsetof(l2arc_dev_hdr_phys_t,
+	    dh_self_cksum), NULL, &l2dhdr->dh_self_cksum);
+
+	abd = abd_get_from_buf(l2dhdr, l2dhdr_asize);
+	err = zio_wait(zio_write_phys(NULL, vd, VDEV_LABEL_START_SIZE,
+	    l2dhdr_asize, abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE));
+	abd_put(abd);
+
+	if (err != 0) {
+		zfs_dbgmsg("L2ARC IO error (%d) while writing device header, "
+		    "vdev guid: %llu", err, (u_longlong_t)vd->vdev_guid);
+	}
+}
+
+/*
+ * Returns how far back, in bytes of device space written, addr lies from
+ * the current write hand.  Log blocks further down the chain must always
+ * lie further back.
+ */
+static uint64_t
+l2arc_hand_distance(const l2arc_dev_t *dev, uint64_t addr)
+{
+	if (addr <= dev->l2ad_hand)
+		return (dev->l2ad_hand - addr);
+	return ((dev->l2ad_hand - dev->l2ad_start) + (dev->l2ad_end - addr));
+}
+
+/*
+ * Checks that a log block pointer is sane and that neither the log block
+ * nor its payload can have been overwritten since the device header was
+ * written.  The checksum of the log block itself is verified once it has
+ * been read.
+ */
+static boolean_t
+l2arc_log_blkptr_valid(l2arc_dev_t *dev, const l2arc_log_blkptr_t *lbp)
+{
+	uint64_t psize = L2BLK_GET_PSIZE(lbp->lbp_prop);
+	uint64_t end = lbp->lbp_daddr +
+	    vdev_psize_to_asize(dev->l2ad_vdev, psize);
+
+	if (lbp->lbp_payload_start < dev->l2ad_start ||
+	    lbp->lbp_payload_start > lbp->lbp_daddr ||
+	    end > dev->l2ad_end ||
+	    psize > sizeof (l2arc_log_blk_phys_t) ||
+	    L2BLK_GET_LSIZE(lbp->lbp_prop) != sizeof (l2arc_log_blk_phys_t))
+		return (B_FALSE);
+
+	/*
+	 * During the first sweep only the space behind the write hand has
+	 * been written.  Afterwards everything but the stretch the hand is
+	 * about to overwrite is valid.
+	 */
+	if (dev->l2ad_first)
+		return (end <= dev->l2ad_hand);
+
+	return (end <= dev->l2ad_hand ||
+	    lbp->lbp_payload_start >= dev->l2ad_evict);
+}
+
+/*
+ * Issues the read of a log block.  The caller waits on the returned zio.
+ */
+static zio_t *
+l2arc_log_blk_fetch(vdev_t *vd, const l2arc_log_blkptr_t *lbp, abd_t *abd)
+{
+	uint64_t asize = vdev_psize_to_asize(vd,
+	    L2BLK_GET_PSIZE(lbp->lbp_prop));
+	zio_t *pio;
+
+	pio = zio_root(vd->vdev_spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	(void) zio_nowait(zio_read_phys(pio, vd, lbp->lbp_daddr, asize, abd,
+	    ZIO_CHECKSUM_OFF, NULL, NULL, ZIO_PRIORITY_ASYNC_READ,
+	    ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_RETRY,
+	    B_FALSE));
+
+	return (pio);
+}
+
+/*
+ * Verifies a log block read from the device and decompresses it into lb.
+ */
+static int
+l2arc_log_blk_decode(const l2arc_log_blkptr_t *lbp, abd_t *abd,
+    l2arc_log_blk_phys_t *lb)
+{
+	uint64_t psize = L2BLK_GET_PSIZE(lbp->lbp_prop);
+	void *buf = abd_to_buf(abd);
+	zio_cksum_t cksum;
+	int err = 0;
+
+	fletcher_4_native(buf, psize, NULL, &cksum);
+	if (!ZIO_CHECKSUM_EQUAL(cksum, lbp->lbp_cksum)) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_cksum_lb_errors);
+		return (SET_ERROR(ECKSUM));
+	}
+
+	switch (L2BLK_GET_COMPRESS(lbp->lbp_prop)) {
+	case ZIO_COMPRESS_OFF:
+		if (psize != sizeof (*lb))
+			err = SET_ERROR(EINVAL);
+		else
+			bcopy(buf, lb, sizeof (*lb));
+		break;
+	case ZIO_COMPRESS_LZ4:
+		if (zio_decompress_data_buf(ZIO_COMPRESS_LZ4, buf, lb,
+		    psize, sizeof (*lb)) != 0)
+			err = SET_ERROR(EINVAL);
+		break;
+	default:
+		err = SET_ERROR(EINVAL);
+		break;
+	}
+
+	if (err == 0 && lb->lb_magic != L2ARC_LOG_BLK_MAGIC)
+		err = SET_ERROR(EINVAL);
+	if (err != 0)
+		ARCSTAT_BUMP(arcstat_l2_rebuild_cksum_lb_errors);
+
+	return (err);
+}
+
+/*
+ * Restores an ARC_l2c_only header for a buffer described by a log entry,
+ * unless the buffer is already cached.
+ */
+static void
+l2arc_hdr_restore(const l2arc_log_ent_phys_t *le, l2arc_dev_t *dev)
+{
+	arc_buf_contents_t type = L2BLK_GET_TYPE(le->le_prop);
+	arc_buf_hdr_t *hdr, *exists;
+	kmutex_t *hash_lock;
+	uint64_t psize;
+
+	hdr = kmem_cache_alloc(hdr_l2only_cache, KM_SLEEP);
+	hdr->b_flags = 0;
+	hdr->b_type = type;
+
+	/* The header is still HDR_EMPTY() here, so no lock is needed. */
+	arc_hdr_set_flags(hdr, arc_bufc_to_flags(type));
+	HDR_SET_LSIZE(hdr, L2BLK_GET_LSIZE(le->le_prop));
+	HDR_SET_PSIZE(hdr, L2BLK_GET_PSIZE(le->le_prop));
+	arc_hdr_set_compress(hdr, L2BLK_GET_COMPRESS(le->le_prop));
+	if (L2BLK_GET_PROTECTED(le->le_prop))
+		arc_hdr_set_flags(hdr, ARC_FLAG_PROTECTED);
+	if (L2BLK_GET_PREFETCH(le->le_prop))
+		arc_hdr_set_flags(hdr, ARC_FLAG_PREFETCH);
+
+	hdr->b_spa = spa_load_guid(dev->l2ad_spa);
+	hdr->b_dva = le->le_dva;
+	hdr->b_birth = le->le_birth;
+	hdr->b_l2hdr.b_dev = dev;
+	hdr->b_l2hdr.b_daddr = le->le_daddr;
+	hdr->b_l2hdr.b_hits = 0;
+
+	exists = buf_hash_insert(hdr, &hash_lock);
+	if (exists != NULL) {
+		/* The buffer is already cached, nothing to restore. */
+		mutex_exit(hash_lock);
+		arc_hdr_destroy(hdr);
+		ARCSTAT_BUMP(arcstat_l2_rebuild_bufs_precached);
+		return;
+	}
+
+	arc_hdr_set_flags(hdr, ARC_FLAG_HAS_L2HDR);
+	psize = arc_hdr_size(hdr);
+
+	/*
+	 * Log blocks are restored from newest to oldest, so appending keeps
+	 * the buffer list sorted the way l2arc_evict() expects.
+	 */
+	mutex_enter(&dev->l2ad_mtx);
+	list_insert_tail(&dev->l2ad_buflist, hdr);
+	(void) refcount_add_many(&dev->l2ad_alloc, psize, hdr);
+	mutex_exit(&dev->l2ad_mtx);
+
+	ARCSTAT_INCR(arcstat_l2_lsize, HDR_GET_LSIZE(hdr));
+	ARCSTAT_INCR(arcstat_l2_psize, psize);
+	vdev_space_update(dev->l2ad_vdev, psize, 0, 0);
+
+	mutex_exit(hash_lock);
+}
+
+/*
+ * Restores the buffers described by a log block, newest first.  Entries
+ * which can't have been written as part of the log block's payload are
+ * skipped, which includes the unused tail of the entry array.
+ */
+static void
+l2arc_log_blk_restore(l2arc_dev_t *dev, const l2arc_log_blk_phys_t *lb,
+    const l2arc_log_blkptr_t *lbp)
+{
+	uint64_t size = 0, asize = 0, count = 0;
+	int i;
+
+	for (i = dev->l2ad_log_entries - 1; i >= 0; i--) {
+		const l2arc_log_ent_phys_t *le = &lb->lb_entries[i];
+		uint64_t le_asize = vdev_psize_to_asize(dev->l2ad_vdev,
+		    L2BLK_GET_PSIZE(le->le_prop));
+
+		if (le->le_daddr < lbp->lbp_payload_start ||
+		    le->le_daddr + le_asize > lbp->lbp_daddr ||
+		    L2BLK_GET_TYPE(le->le_prop) >= ARC_BUFC_NUMTYPES ||
+		    L2BLK_GET_COMPRESS(le->le_prop) >= ZIO_COMPRESS_FUNCTIONS ||
+		    DVA_IS_EMPTY(&le->le_dva))
+			continue;
+
+		l2arc_hdr_restore(le, dev);
+		size += L2BLK_GET_LSIZE(le->le_prop);
+		asize += le_asize;
+		count++;
+	}
+
+	ARCSTAT_BUMP(arcstat_l2_rebuild_log_blks);
+	ARCSTAT_INCR(arcstat_l2_rebuild_bufs, count);
+	ARCSTAT_INCR(arcstat_l2_rebuild_size, size);
+	ARCSTAT_INCR(arcstat_l2_rebuild_asize, asize);
+}
+
+/*
+ * Walks the chain of log blocks from the newest to the oldest and restores
+ * the buffers they describe.  The read of the next log block is issued
+ * before the current one is restored so that the two overlap.
+ */
+static int
+l2arc_rebuild(l2arc_dev_t *dev)
+{
+	vdev_t *vd = dev->l2ad_vdev;
+	spa_t *spa = vd->vdev_spa;
+	l2arc_log_blk_phys_t *lb;
+	l2arc_log_blkptr_t lbps[2];
+	abd_t *this_abd = NULL, *next_abd = NULL;
+	zio_t *next_io;
+	uint64_t lb_asize_max, dist, prev_dist = 0, lb_count = 0;
+	boolean_t first = B_TRUE;
+	int locked, err = 0, next_err = 0;
+
+	lb = vmem_zalloc(sizeof (*lb), KM_SLEEP);
+	lb_asize_max = vdev_psize_to_asize(vd, sizeof (*lb));
+	lbps[0] = dev->l2ad_dev_hdr->dh_start_lbp;
+
+	ARCSTAT_BUMP(arcstat_l2_rebuild_active);
+
+	for (;;) {
+		/*
+		 * The chain ends at the first log block which is gone, or
+		 * which is not older than the one that pointed to it.
+		 */
+		if (!l2arc_log_blkptr_valid(dev, &lbps[0]))
+			break;
+		dist = l2arc_hand_distance(dev, lbps[0].lbp_daddr +
+		    vdev_psize_to_asize(vd, L2BLK_GET_PSIZE(lbps[0].lbp_prop)));
+		if (!first && dist < prev_dist)
+			break;
+		prev_dist = l2arc_hand_distance(dev,
+		    lbps[0].lbp_payload_start);
+		first = B_FALSE;
+
+		/*
+		 * Don't make memory pressure worse to restore buffers which
+		 * would only be evicted again.
+		 */
+		if (arc_reclaim_needed()) {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_lowmem);
+			err = SET_ERROR(ENOMEM);
+			break;
+		}
+
+		/*
+		 * Hold off device removal while reading from the device.
+		 * Don't block on the config lock, removal first needs to
+		 * cancel this thread.
+		 */
+		locked = 0;
+		while (!dev->l2ad_rebuild_cancel && !(locked =
+		    spa_config_tryenter(spa, SCL_L2ARC, vd, RW_READER)))
+			delay(1);
+		if (!locked) {
+			err = SET_ERROR(ECANCELED);
+			break;
+		}
+
+		if (this_abd == NULL) {
+			this_abd = abd_alloc_linear(lb_asize_max, B_TRUE);
+			err = zio_wait(l2arc_log_blk_fetch(vd, &lbps[0],
+			    this_abd));
+		} else {
+			err = next_err;
+		}
+		if (err != 0)
+			ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+		else
+			err = l2arc_log_blk_decode(&lbps[0], this_abd, lb);
+		if (err != 0) {
+			spa_config_exit(spa, SCL_L2ARC, vd);
+			break;
+		}
+
+		lbps[1] = lb->lb_prev_lbp;
+		next_io = NULL;
+		if (l2arc_log_blkptr_valid(dev, &lbps[1])) {
+			next_abd = abd_alloc_linear(lb_asize_max, B_TRUE);
+			next_io = l2arc_log_blk_fetch(vd, &lbps[1], next_abd);
+		}
+
+		l2arc_log_blk_restore(dev, lb, &lbps[0]);
+		lb_count++;
+
+		if (next_io != NULL)
+			next_err = zio_wait(next_io);
+		spa_config_exit(spa, SCL_L2ARC, vd);
+
+		abd_free(this_abd);
+		this_abd = next_abd;
+		next_abd = NULL;
+		lbps[0] = lbps[1];
+	}
+
+	if (this_abd != NULL)
+		abd_free(this_abd);
+	vmem_free(lb, sizeof (*lb));
+
+	ARCSTAT_BUMPDOWN(arcstat_l2_rebuild_active);
+	if (err == 0)
+		ARCSTAT_BUMP(arcstat_l2_rebuild_success);
+
+	zfs_dbgmsg("L2ARC rebuild of vdev guid %llu restored %llu log "
+	    "blocks, error %d", (u_longlong_t)vd->vdev_guid,
+	    (u_longlong_t)lb_count, err);
+
+	return (err);
+}
+
+/*
+ * Adds a buffer just written by l2arc_write_buffers() to the open log
+ * block.  Returns B_TRUE once the log block is full and must be committed.
+ */
+static boolean_t
+l2arc_log_blk_insert(l2arc_dev_t *dev, const arc_buf_hdr_t *hdr,
+    uint64_t asize)
+{
+	l2arc_log_ent_phys_t *le;
+	int index;
+
+	if (dev->l2ad_log_entries == 0)
+		return (B_FALSE);
+
+	ASSERT(HDR_HAS_L2HDR(hdr));
+	ASSERT3S(dev->l2ad_log_ent_idx, <, dev->l2ad_log_entries);
+
+	index = dev->l2ad_log_ent_idx++;
+	le = &dev->l2ad_log_blk.lb_entries[index];
+	bzero(le, sizeof (*le));
+	le->le_dva = hdr->b_dva;
+	le->le_birth = hdr->b_birth;
+	le->le_daddr = hdr->b_l2hdr.b_daddr;
+	L2BLK_SET_LSIZE(le->le_prop, HDR_GET_LSIZE(hdr));
+	L2BLK_SET_PSIZE(le->le_prop, HDR_GET_PSIZE(hdr));
+	L2BLK_SET_COMPRESS(le->le_prop, HDR_GET_COMPRESS(hdr));
+	L2BLK_SET_TYPE(le->le_prop, hdr->b_type);
+	L2BLK_SET_PROTECTED(le->le_prop, !!HDR_PROTECTED(hdr));
+	L2BLK_SET_PREFETCH(le->le_prop, !!HDR_PREFETCH(hdr));
+
+	if (index == 0)
+		dev->l2ad_log_blk_payload_start = le->le_daddr;
+	dev->l2ad_log_blk_payload_asize += asize;
+
+	return (dev->l2ad_log_ent_idx == dev->l2ad_log_entries);
+}
+
+/*
+ * Writes out the open log block at the write hand, chains it to the
+ * previous one and points the in-core device header at it.  The device
+ * header itself is written once pio has completed.
+ */
+static void
+l2arc_log_blk_commit(l2arc_dev_t *dev, zio_t *pio)
+{
+	l2arc_log_blk_phys_t *lb = &dev->l2ad_log_blk;
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	l2arc_log_blkptr_t *lbp = &l2dhdr->dh_start_lbp;
+	vdev_t *vd = dev->l2ad_vdev;
+	enum zio_compress compress = ZIO_COMPRESS_LZ4;
+	uint64_t psize, asize;
+	abd_t *abd;
+	void *buf;
+	zio_cksum_t cksum;
+
+	ASSERT3S(dev->l2ad_log_ent_idx, >, 0);
+
+	/* Unused entries must not be mistaken for buffers on rebuild. */
+	bzero(&lb->lb_entries[dev->l2ad_log_ent_idx],
+	    (L2ARC_LOG_BLK_MAX_ENTRIES - dev->l2ad_log_ent_idx) *
+	    sizeof (l2arc_log_ent_phys_t));
+	lb->lb_magic = L2ARC_LOG_BLK_MAGIC;
+	lb->lb_prev_lbp = *lbp;
+
+	buf = zio_buf_alloc(sizeof (*lb));
+	abd = abd_get_from_buf(lb, sizeof (*lb));
+	psize = zio_compress_data(compress, abd, buf, sizeof (*lb));
+	abd_put(abd);
+	if (psize >= sizeof (*lb)) {
+		compress = ZIO_COMPRESS_OFF;
+		psize = sizeof (*lb);
+		bcopy(lb, buf, psize);
+	} else {
+		uint64_t rounded = P2ROUNDUP(psize, SPA_MINBLOCKSIZE);
+		bzero((char *)buf + psize, rounded - psize);
+		psize = rounded;
+	}
+	asize = vdev_psize_to_asize(vd, psize);
+	fletcher_4_native(buf, psize, NULL, &cksum);
+
+	if (dev->l2ad_hand + asize > dev->l2ad_end) {
+		/*
+		 * Can only happen if the write size tunables changed
+		 * since eviction.  The buffers stay cached, they just
+		 * won't survive a reboot.
+		 */
+		zio_buf_free(buf, sizeof (*lb));
+		goto out;
+	}
+
+	abd = abd_alloc_for_io(asize, B_TRUE);
+	abd_copy_from_buf(abd, buf, psize);
+	if (asize > psize)
+		abd_zero_off(abd, psize, asize - psize);
+	zio_buf_free(buf, sizeof (*lb));
+
+	lbp->lbp_daddr = dev->l2ad_hand;
+	lbp->lbp_payload_asize = dev->l2ad_log_blk_payload_asize;
+	lbp->lbp_payload_start = dev->l2ad_log_blk_payload_start;
+	lbp->lbp_prop = 0;
+	L2BLK_SET_LSIZE(lbp->lbp_prop, sizeof (*lb));
+	L2BLK_SET_PSIZE(lbp->lbp_prop, psize);
+	L2BLK_SET_COMPRESS(lbp->lbp_prop, compress);
+	L2BLK_SET_CHECKSUM(lbp->lbp_prop, ZIO_CHECKSUM_FLETCHER_4);
+	L2BLK_SET_TYPE(lbp->lbp_prop, ARC_BUFC_METADATA);
+	lbp->lbp_cksum = cksum;
+
+	(void) zio_nowait(zio_write_phys(pio, vd, dev->l2ad_hand, asize, abd,
+	    ZIO_CHECKSUM_OFF, NULL, NULL, ZIO_PRIORITY_ASYNC_WRITE,
+	    ZIO_FLAG_CANFAIL, B_FALSE));
+	l2arc_free_abd_on_write(abd, asize, ARC_BUFC_METADATA, dev);
+
+	dev->l2ad_hand += asize;
+	l2dhdr->dh_lb_count++;
+	l2dhdr->dh_lb_asize += asize;
+	ARCSTAT_BUMP(arcstat_l2_log_blk_writes);
+	ARCSTAT_INCR(arcstat_l2_log_blk_asize, asize);
+
+out:
+	dev->l2ad_log_ent_idx = 0;
+	dev->l2ad_log_blk_payload_asize = 0;
+	dev->l2ad_log_blk_payload_start = 0;
+}
+
+/*
+ * Returns the worst case amount of device space taken up by the log
+ * blocks committed while writing write_sz bytes of buffers.  Every buffer
+ * takes up at least SPA_MINBLOCKSIZE, one more log block may be left open
+ * from the previous write, and one is committed when the hand wraps.
+ */
+static uint64_t
+l2arc_log_blk_overhead(uint64_t write_sz, l2arc_dev_t *dev)
+{
+	uint64_t log_blocks;
+
+	if (dev->l2ad_log_entries == 0)
+		return (0);
+
+	log_blocks = (write_sz >> SPA_MINBLOCKSHIFT) /
+	    dev->l2ad_log_entries + 2;
+
+	return (log_blocks * vdev_psize_to_asize(dev->l2ad_vdev,
+	    sizeof (l2arc_log_blk_phys_t)));
 }
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
@@ -8949,6 +10172,14 @@ MODULE_PARM_DESC(zfs_arc_p_min_shift, "arc_c shift to calc min/max arc_p");
 module_param(zfs_arc_average_blocksize, int, 0444);
 MODULE_PARM_DESC(zfs_arc_average_blocksize, "Target average block size");
 
+module_param(zfs_arc_evict_threads, int, 0644);
+MODULE_PARM_DESC(zfs_arc_evict_threads,
+	"Max threads to split a single eviction across (0=auto)");
+
+module_param(zfs_arc_admission, int, 0644);
+MODULE_PARM_DESC(zfs_arc_admission,
+	"Admission policy for buffers read (0=all, 1=frequency)");
+
 module_param(zfs_compressed_arc_enabled, int, 0644);
 MODULE_PARM_DESC(zfs_compressed_arc_enabled, "Disable compressed arc buffers");
 
@@ -8956,7 +10187,11 @@ module_param(zfs_arc_min_prefetch_lifespan, int, 0644);
 MODULE_PARM_DESC(zfs_arc_min_prefetch_lifespan, "Min life of prefetch block");
 
 module_param(l2arc_write_max, ulong, 0644);
-MODULE_PARM_DESC(l2arc_write_max, "Max write bytes per interval");
+MODULE_PARM_DESC(l2arc_write_max, "Initial write bytes per interval");
+
+module_param(l2arc_write_latency_ms, ulong, 0644);
+MODULE_PARM_DESC(l2arc_write_latency_ms,
+	"Target latency of each cache device's writes (0=fixed size)");
 
 module_param(l2arc_write_boost, ulong, 0644);
 MODULE_PARM_DESC(l2arc_write_boost, "Extra write bytes during device warmup");
@@ -8982,6 +10217,14 @@ MODULE_PARM_DESC(l2arc_feed_again, "Turbo L2ARC warmup");
 module_param(l2arc_norw, int, 0644);
 MODULE_PARM_DESC(l2arc_norw, "No reads during writes");
 
+module_param(l2arc_rebuild_enabled, int, 0644);
+MODULE_PARM_DESC(l2arc_rebuild_enabled,
+	"Rebuild the L2ARC when importing a pool");
+
+module_param(l2arc_rebuild_blocks_min_l2size, ulong, 0644);
+MODULE_PARM_DESC(l2arc_rebuild_blocks_min_l2size,
+	"Min size in bytes to write rebuild log blocks in L2ARC");
+
 module_param(zfs_arc_lotsfree_percent, int, 0644);
 MODULE_PARM_DESC(zfs_arc_lotsfree_percent,
 	"System free memory I/O throttle in bytes");
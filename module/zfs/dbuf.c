@@ -88,6 +88,7 @@ extern inline void dmu_buf_init_user(dmu_buf_user_t *dbu,
  */
 static kmem_cache_t *dbuf_kmem_cache;
 static taskq_t *dbu_evict_taskq;
+static taskq_t *dbuf_hash_taskq;
 
 static kthread_t *dbuf_cache_evict_thread;
 static kmutex_t dbuf_evict_lock;
@@ -95,21 +96,100 @@ static kcondvar_t dbuf_evict_cv;
 static boolean_t dbuf_evict_thread_exit;
 
 /*
- * LRU cache of dbufs. The dbuf cache maintains a list of dbufs that
+ * LRU caches of dbufs. A dbuf cache maintains a list of dbufs that
  * are not currently held but have been recently released. These dbufs
  * are not eligible for arc eviction until they are aged out of the cache.
- * Dbufs are added to the dbuf cache once the last hold is released. If a
+ * Dbufs are added to a dbuf cache once the last hold is released. If a
  * dbuf is later accessed and still exists in the dbuf cache, then it will
  * be removed from the cache and later re-added to the head of the cache.
  * Dbufs that are aged out of the cache will be immediately destroyed and
  * become eligible for arc eviction.
+ *
+ * Metadata dbufs (see dbuf_is_metadata()) go to a separate cache with its
+ * own size limit, so that large streaming reads of user data, which cycle
+ * quickly through the dbuf cache, don't age out the dnode and indirect
+ * blocks needed for random access.
  */
-static multilist_t *dbuf_cache;
-static refcount_t dbuf_cache_size;
+typedef struct dbuf_cache {
+	multilist_t *cache;
+	refcount_t size;
+} dbuf_cache_t;
+static dbuf_cache_t dbuf_caches[DB_CACHE_MAX];
+
 unsigned long  dbuf_cache_max_bytes = 100 * 1024 * 1024;
+unsigned long  dbuf_metadata_cache_max_bytes = 100 * 1024 * 1024;
 
-/* Cap the size of the dbuf cache to log2 fraction of arc size. */
+/* Cap the size of the dbuf caches to log2 fraction of arc size. */
 int dbuf_cache_max_shift = 5;
+int dbuf_metadata_cache_shift = 6;
+
+/* Chains of 1, 2-3, 4-7, 8-15 and 16 or more dbufs. */
+#define	DBUF_HASH_CHAIN_BINS	5
+
+typedef struct dbuf_stats {
+	kstat_named_t cache_count;
+	kstat_named_t cache_size_bytes;
+	kstat_named_t cache_target_bytes;
+	kstat_named_t cache_hits;
+	kstat_named_t cache_evicts;
+	kstat_named_t metadata_cache_count;
+	kstat_named_t metadata_cache_size_bytes;
+	kstat_named_t metadata_cache_target_bytes;
+	kstat_named_t metadata_cache_hits;
+	kstat_named_t metadata_cache_evicts;
+	kstat_named_t hash_elements;
+	kstat_named_t hash_elements_max;
+	kstat_named_t hash_collisions;
+	kstat_named_t hash_chain_max;
+	kstat_named_t hash_table_size;
+	kstat_named_t hash_table_grows;
+	/*
+	 * Number of hash buckets by length of their chain of dbufs, in
+	 * power of two ranges.
+	 */
+	kstat_named_t hash_chains[DBUF_HASH_CHAIN_BINS];
+} dbuf_stats_t;
+
+static dbuf_stats_t dbuf_stats = {
+	{ "cache_count",			KSTAT_DATA_UINT64 },
+	{ "cache_size_bytes",			KSTAT_DATA_UINT64 },
+	{ "cache_target_bytes",			KSTAT_DATA_UINT64 },
+	{ "cache_hits",				KSTAT_DATA_UINT64 },
+	{ "cache_evicts",			KSTAT_DATA_UINT64 },
+	{ "metadata_cache_count",		KSTAT_DATA_UINT64 },
+	{ "metadata_cache_size_bytes",		KSTAT_DATA_UINT64 },
+	{ "metadata_cache_target_bytes",	KSTAT_DATA_UINT64 },
+	{ "metadata_cache_hits",		KSTAT_DATA_UINT64 },
+	{ "metadata_cache_evicts",		KSTAT_DATA_UINT64 },
+	{ "hash_elements",			KSTAT_DATA_UINT64 },
+	{ "hash_elements_max",			KSTAT_DATA_UINT64 },
+	{ "hash_collisions",			KSTAT_DATA_UINT64 },
+	{ "hash_chain_max",			KSTAT_DATA_UINT64 },
+	{ "hash_table_size",			KSTAT_DATA_UINT64 },
+	{ "hash_table_grows",			KSTAT_DATA_UINT64 },
+	{
+		{ "hash_chains_1",		KSTAT_DATA_UINT64 },
+		{ "hash_chains_2_3",		KSTAT_DATA_UINT64 },
+		{ "hash_chains_4_7",		KSTAT_DATA_UINT64 },
+		{ "hash_chains_8_15",		KSTAT_DATA_UINT64 },
+		{ "hash_chains_16_plus",	KSTAT_DATA_UINT64 },
+	},
+};
+
+#define	DBUF_STAT_BUMP(stat)	\
+	atomic_inc_64(&dbuf_stats.stat.value.ui64)
+#define	DBUF_STAT_BUMPDOWN(stat)	\
+	atomic_dec_64(&dbuf_stats.stat.value.ui64)
+#define	DBUF_STAT_INCR(stat, val)	\
+	atomic_add_64(&dbuf_stats.stat.value.ui64, (val))
+#define	DBUF_STAT_MAX(stat, val) {					\
+	uint64_t m;							\
+	while ((val) > (m = dbuf_stats.stat.value.ui64) &&		\
+	    (m != atomic_cas_64(&dbuf_stats.stat.value.ui64, m, (val))))\
+		continue;						\
+}
+
+static kstat_t *dbuf_ksp;
 
 /*
  * The dbuf cache uses a three-stage eviction policy:
@@ -166,6 +246,7 @@ dbuf_cons(void *vdb, void *unused, int kmflag)
 	mutex_init(&db->db_mtx, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&db->db_changed, NULL, CV_DEFAULT, NULL);
 	multilist_link_init(&db->db_cache_link);
+	db->db_caching_status = DB_NO_CACHE;
 	refcount_create(&db->db_holds);
 
 	return (0);
@@ -179,6 +260,7 @@ dbuf_dest(void *vdb, void *unused)
 	mutex_destroy(&db->db_mtx);
 	cv_destroy(&db->db_changed);
 	ASSERT(!multilist_link_active(&db->db_cache_link));
+	ASSERT3S(db->db_caching_status, ==, DB_NO_CACHE);
 	refcount_destroy(&db->db_holds);
 }
 
@@ -189,6 +271,12 @@ static dbuf_hash_table_t dbuf_hash_table;
 
 static uint64_t dbuf_hash_count;
 
+/*
+ * The hash table is grown to twice its size once it holds more than this
+ * many dbufs per bucket on average.
+ */
+int dbuf_hash_load_max = 2;
+
 static uint64_t
 dbuf_hash(void *os, uint64_t obj, uint8_t lvl, uint64_t blkid)
 {
@@ -208,6 +296,52 @@ dbuf_hash(void *os, uint64_t obj, uint8_t lvl, uint64_t blkid)
 	return (crc);
 }
 
+#define	DBUF_EQUAL(dbuf, os, obj, level, blkid)		\
+	((dbuf)->db.db_object == (obj) &&		\
+	(dbuf)->db_objset == (os) &&			\
+	(dbuf)->db_level == (level) &&			\
+	(dbuf)->db_blkid == (blkid))
+
+/*
+ * Return the bucket a hash value maps to.  The caller must hold the hash
+ * value's DBUF_HASH_MUTEX().
+ */
+static inline dmu_buf_impl_t **
+dbuf_hash_bucket(dbuf_hash_table_t *h, uint64_t hv)
+{
+	int t = DBUF_HASH_TABLE(h, hv);
+
+	ASSERT(MUTEX_HELD(DBUF_HASH_MUTEX(h, hv)));
+
+	return (&h->hash_table[t][hv & h->hash_table_mask[t]]);
+}
+
+/*
+ * Account for a bucket's chain of dbufs having grown or shrunk from
+ * 'from' to 'to' dbufs in the chain length histogram.
+ */
+static void
+dbuf_hash_chain_update(uint64_t from, uint64_t to)
+{
+	if (from > 0)
+		DBUF_STAT_BUMPDOWN(hash_chains[MIN(highbit64(from) - 1,
+		    DBUF_HASH_CHAIN_BINS - 1)]);
+	if (to > 0)
+		DBUF_STAT_BUMP(hash_chains[MIN(highbit64(to) - 1,
+		    DBUF_HASH_CHAIN_BINS - 1)]);
+}
+
+static uint64_t
+dbuf_hash_chain_length(dmu_buf_impl_t *db)
+{
+	uint64_t len = 0;
+
+	for (; db != NULL; db = db->db_hash_next)
+		len++;
+
+	return (len);
+}
+
 #define	DBUF_EQUAL(dbuf, os, obj, level, blkid)		\
 	((dbuf)->db.db_object == (obj) &&		\
 	(dbuf)->db_objset == (os) &&			\
@@ -219,24 +353,22 @@ dbuf_find(objset_t *os, uint64_t obj, uint8_t level, uint64_t blkid)
 {
 	dbuf_hash_table_t *h = &dbuf_hash_table;
 	uint64_t hv;
-	uint64_t idx;
 	dmu_buf_impl_t *db;
 
 	hv = dbuf_hash(os, obj, level, blkid);
-	idx = hv & h->hash_table_mask;
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	for (db = h->hash_table[idx]; db != NULL; db = db->db_hash_next) {
+	mutex_enter(DBUF_HASH_MUTEX(h, hv));
+	for (db = *dbuf_hash_bucket(h, hv); db != NULL; db = db->db_hash_next) {
 		if (DBUF_EQUAL(db, os, obj, level, blkid)) {
 			mutex_enter(&db->db_mtx);
 			if (db->db_state != DB_EVICTING) {
-				mutex_exit(DBUF_HASH_MUTEX(h, idx));
+				mutex_exit(DBUF_HASH_MUTEX(h, hv));
 				return (db);
 			}
 			mutex_exit(&db->db_mtx);
 		}
 	}
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
+	mutex_exit(DBUF_HASH_MUTEX(h, hv));
 	return (NULL);
 }
 
@@ -258,6 +390,127 @@ dbuf_find_bonus(objset_t *os, uint64_t object)
 	return (db);
 }
 
+/*
+ * Rehash the buckets of one lock stripe from the current table into the
+ * new one, and switch the stripe over to the new table.  Lookups in other
+ * stripes carry on meanwhile.
+ */
+static void
+dbuf_hash_grow_stripe(dbuf_hash_table_t *h, int stripe, int from, int to)
+{
+	uint64_t idx;
+
+	mutex_enter(DBUF_HASH_MUTEX(h, stripe));
+	ASSERT3S(DBUF_HASH_TABLE(h, stripe), ==, from);
+
+	for (idx = stripe; idx <= h->hash_table_mask[from];
+	    idx += DBUF_MUTEXES) {
+		dmu_buf_impl_t *db, *db_next;
+
+		db = h->hash_table[from][idx];
+		dbuf_hash_chain_update(dbuf_hash_chain_length(db), 0);
+		for (; db != NULL; db = db_next) {
+			uint64_t hv = dbuf_hash(db->db_objset,
+			    db->db.db_object, db->db_level, db->db_blkid);
+			dmu_buf_impl_t **dbp =
+			    &h->hash_table[to][hv & h->hash_table_mask[to]];
+
+			db_next = db->db_hash_next;
+			db->db_hash_next = *dbp;
+			*dbp = db;
+		}
+		h->hash_table[from][idx] = NULL;
+	}
+
+	for (idx = stripe; idx <= h->hash_table_mask[to];
+	    idx += DBUF_MUTEXES) {
+		uint64_t len = dbuf_hash_chain_length(h->hash_table[to][idx]);
+
+		dbuf_hash_chain_update(0, len);
+		DBUF_STAT_MAX(hash_chain_max, len);
+	}
+
+	DBUF_HASH_TABLE(h, stripe) = to;
+	mutex_exit(DBUF_HASH_MUTEX(h, stripe));
+}
+
+/*
+ * Grow the hash table to twice its size.  The new table is filled one
+ * lock stripe at a time, so only lookups in the stripe being rehashed
+ * have to wait, and only briefly.
+ */
+static void
+dbuf_hash_grow(void *arg)
+{
+	dbuf_hash_table_t *h = arg;
+	int from = h->hash_table_cur;
+	int to = !from;
+	uint64_t hsize = (h->hash_table_mask[from] + 1) * 2;
+	int stripe;
+
+	ASSERT(h->hash_growing);
+	ASSERT3P(h->hash_table[to], ==, NULL);
+
+	/*
+	 * Growing is only an optimization, don't push for the memory.
+	 */
+#if defined(_KERNEL) && defined(HAVE_SPL)
+	h->hash_table[to] = vmem_zalloc(hsize * sizeof (void *), KM_NOSLEEP);
+#else
+	h->hash_table[to] = kmem_zalloc(hsize * sizeof (void *), KM_NOSLEEP);
+#endif
+	if (h->hash_table[to] == NULL) {
+		h->hash_growing = B_FALSE;
+		return;
+	}
+	h->hash_table_mask[to] = hsize - 1;
+
+	for (stripe = 0; stripe < DBUF_MUTEXES; stripe++)
+		dbuf_hash_grow_stripe(h, stripe, from, to);
+
+	/*
+	 * Every stripe has moved to the new table, so nothing can be
+	 * looking at the old one anymore.
+	 */
+#if defined(_KERNEL) && defined(HAVE_SPL)
+	vmem_free(h->hash_table[from],
+	    (h->hash_table_mask[from] + 1) * sizeof (void *));
+#else
+	kmem_free(h->hash_table[from],
+	    (h->hash_table_mask[from] + 1) * sizeof (void *));
+#endif
+	h->hash_table[from] = NULL;
+	h->hash_table_mask[from] = 0;
+	h->hash_table_cur = to;
+	DBUF_STAT_BUMP(hash_table_grows);
+
+	h->hash_growing = B_FALSE;
+}
+
+/*
+ * Start growing the hash table in the background once it is loaded with
+ * more than dbuf_hash_load_max dbufs per bucket on average.
+ */
+static void
+dbuf_hash_grow_check(uint64_t count)
+{
+	dbuf_hash_table_t *h = &dbuf_hash_table;
+	uint64_t hsize = h->hash_table_mask[h->hash_table_cur] + 1;
+
+	if (h->hash_growing || dbuf_hash_load_max <= 0 ||
+	    count <= hsize * dbuf_hash_load_max ||
+	    hsize * 2 > h->hash_table_max)
+		return;
+
+	if (atomic_cas_32((uint32_t *)&h->hash_growing, B_FALSE, B_TRUE) !=
+	    B_FALSE)
+		return;
+
+	if (taskq_dispatch(dbuf_hash_taskq, dbuf_hash_grow, h,
+	    TQ_NOSLEEP) == TASKQID_INVALID)
+		h->hash_growing = B_FALSE;
+}
+
 /*
  * Insert an entry into the hash table.  If there is already an element
  * equal to elem in the hash table, then the already existing element
@@ -271,19 +524,19 @@ dbuf_hash_insert(dmu_buf_impl_t *db)
 	objset_t *os = db->db_objset;
 	uint64_t obj = db->db.db_object;
 	int level = db->db_level;
-	uint64_t blkid, hv, idx;
-	dmu_buf_impl_t *dbf;
+	uint64_t blkid, hv, i, count;
+	dmu_buf_impl_t *dbf, **dbp;
 
 	blkid = db->db_blkid;
 	hv = dbuf_hash(os, obj, level, blkid);
-	idx = hv & h->hash_table_mask;
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	for (dbf = h->hash_table[idx]; dbf != NULL; dbf = dbf->db_hash_next) {
+	mutex_enter(DBUF_HASH_MUTEX(h, hv));
+	dbp = dbuf_hash_bucket(h, hv);
+	for (dbf = *dbp, i = 0; dbf != NULL; dbf = dbf->db_hash_next, i++) {
 		if (DBUF_EQUAL(dbf, os, obj, level, blkid)) {
 			mutex_enter(&dbf->db_mtx);
 			if (dbf->db_state != DB_EVICTING) {
-				mutex_exit(DBUF_HASH_MUTEX(h, idx));
+				mutex_exit(DBUF_HASH_MUTEX(h, hv));
 				return (dbf);
 			}
 			mutex_exit(&dbf->db_mtx);
@@ -291,10 +544,18 @@ dbuf_hash_insert(dmu_buf_impl_t *db)
 	}
 
 	mutex_enter(&db->db_mtx);
-	db->db_hash_next = h->hash_table[idx];
-	h->hash_table[idx] = db;
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
-	atomic_inc_64(&dbuf_hash_count);
+	db->db_hash_next = *dbp;
+	*dbp = db;
+	dbuf_hash_chain_update(i, i + 1);
+	mutex_exit(DBUF_HASH_MUTEX(h, hv));
+	count = atomic_inc_64_nv(&dbuf_hash_count);
+
+	if (i > 0) {
+		DBUF_STAT_BUMP(hash_collisions);
+		DBUF_STAT_MAX(hash_chain_max, i + 1);
+	}
+	DBUF_STAT_MAX(hash_elements_max, count);
+	dbuf_hash_grow_check(count);
 
 	return (NULL);
 }
@@ -306,12 +567,11 @@ static void
 dbuf_hash_remove(dmu_buf_impl_t *db)
 {
 	dbuf_hash_table_t *h = &dbuf_hash_table;
-	uint64_t hv, idx;
+	uint64_t hv, len;
 	dmu_buf_impl_t *dbf, **dbp;
 
 	hv = dbuf_hash(db->db_objset, db->db.db_object,
 	    db->db_level, db->db_blkid);
-	idx = hv & h->hash_table_mask;
 
 	/*
 	 * We mustn't hold db_mtx to maintain lock ordering:
@@ -321,15 +581,17 @@ dbuf_hash_remove(dmu_buf_impl_t *db)
 	ASSERT(db->db_state == DB_EVICTING);
 	ASSERT(!MUTEX_HELD(&db->db_mtx));
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	dbp = &h->hash_table[idx];
+	mutex_enter(DBUF_HASH_MUTEX(h, hv));
+	dbp = dbuf_hash_bucket(h, hv);
+	len = dbuf_hash_chain_length(*dbp);
 	while ((dbf = *dbp) != db) {
 		dbp = &dbf->db_hash_next;
 		ASSERT(dbf != NULL);
 	}
 	*dbp = db->db_hash_next;
 	db->db_hash_next = NULL;
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
+	dbuf_hash_chain_update(len, len - 1);
+	mutex_exit(DBUF_HASH_MUTEX(h, hv));
 	atomic_dec_64(&dbuf_hash_count);
 }
 
@@ -463,34 +725,91 @@ dbuf_cache_multilist_index_func(multilist_t *ml, void *obj)
 	    multilist_get_num_sublists(ml));
 }
 
+static inline uint64_t
+dbuf_cache_target_bytes(dbuf_cached_state_t dcs)
+{
+	if (dcs == DB_DBUF_METADATA_CACHE)
+		return (dbuf_metadata_cache_max_bytes);
+	return (dbuf_cache_max_bytes);
+}
+
 static inline boolean_t
-dbuf_cache_above_hiwater(void)
+dbuf_cache_above_hiwater(dbuf_cached_state_t dcs)
 {
+	uint64_t dbuf_cache_target = dbuf_cache_target_bytes(dcs);
 	uint64_t dbuf_cache_hiwater_bytes =
-	    (dbuf_cache_max_bytes * dbuf_cache_hiwater_pct) / 100;
+	    (dbuf_cache_target * dbuf_cache_hiwater_pct) / 100;
 
-	return (refcount_count(&dbuf_cache_size) >
-	    dbuf_cache_max_bytes + dbuf_cache_hiwater_bytes);
+	return (refcount_count(&dbuf_caches[dcs].size) >
+	    dbuf_cache_target + dbuf_cache_hiwater_bytes);
 }
 
 static inline boolean_t
-dbuf_cache_above_lowater(void)
+dbuf_cache_above_lowater(dbuf_cached_state_t dcs)
 {
+	uint64_t dbuf_cache_target = dbuf_cache_target_bytes(dcs);
 	uint64_t dbuf_cache_lowater_bytes =
-	    (dbuf_cache_max_bytes * dbuf_cache_lowater_pct) / 100;
+	    (dbuf_cache_target * dbuf_cache_lowater_pct) / 100;
+
+	return (refcount_count(&dbuf_caches[dcs].size) >
+	    dbuf_cache_target - dbuf_cache_lowater_bytes);
+}
 
-	return (refcount_count(&dbuf_cache_size) >
-	    dbuf_cache_max_bytes - dbuf_cache_lowater_bytes);
+/*
+ * Add a dbuf without holds to the head of the dbuf cache it belongs to.
+ */
+static void
+dbuf_cache_insert(dmu_buf_impl_t *db)
+{
+	dbuf_cached_state_t dcs = dbuf_is_metadata(db) ?
+	    DB_DBUF_METADATA_CACHE : DB_DBUF_CACHE;
+
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+	ASSERT3S(db->db_caching_status, ==, DB_NO_CACHE);
+
+	db->db_caching_status = dcs;
+	multilist_insert(dbuf_caches[dcs].cache, db);
+	(void) refcount_add_many(&dbuf_caches[dcs].size, db->db.db_size, db);
+	if (dcs == DB_DBUF_METADATA_CACHE)
+		DBUF_STAT_BUMP(metadata_cache_count);
+	else
+		DBUF_STAT_BUMP(cache_count);
+}
+
+/*
+ * Remove a dbuf from the dbuf cache it is on, if any.
+ */
+static void
+dbuf_cache_remove(dmu_buf_impl_t *db)
+{
+	dbuf_cached_state_t dcs = db->db_caching_status;
+
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+
+	if (dcs == DB_NO_CACHE) {
+		ASSERT(!multilist_link_active(&db->db_cache_link));
+		return;
+	}
+
+	multilist_remove(dbuf_caches[dcs].cache, db);
+	(void) refcount_remove_many(&dbuf_caches[dcs].size,
+	    db->db.db_size, db);
+	db->db_caching_status = DB_NO_CACHE;
+	if (dcs == DB_DBUF_METADATA_CACHE)
+		DBUF_STAT_BUMPDOWN(metadata_cache_count);
+	else
+		DBUF_STAT_BUMPDOWN(cache_count);
 }
 
 /*
- * Evict the oldest eligible dbuf from the dbuf cache.
+ * Evict the oldest eligible dbuf from the given dbuf cache.
  */
 static void
-dbuf_evict_one(void)
+dbuf_evict_one(dbuf_cached_state_t dcs)
 {
-	int idx = multilist_get_random_index(dbuf_cache);
-	multilist_sublist_t *mls = multilist_sublist_lock(dbuf_cache, idx);
+	multilist_t *ml = dbuf_caches[dcs].cache;
+	int idx = multilist_get_random_index(ml);
+	multilist_sublist_t *mls = multilist_sublist_lock(ml, idx);
 	dmu_buf_impl_t *db;
 	ASSERT(!MUTEX_HELD(&dbuf_evict_lock));
 
@@ -511,10 +830,19 @@ dbuf_evict_one(void)
 	    multilist_sublist_t *, mls);
 
 	if (db != NULL) {
+		ASSERT3S(db->db_caching_status, ==, dcs);
 		multilist_sublist_remove(mls, db);
 		multilist_sublist_unlock(mls);
-		(void) refcount_remove_many(&dbuf_cache_size,
+		(void) refcount_remove_many(&dbuf_caches[dcs].size,
 		    db->db.db_size, db);
+		db->db_caching_status = DB_NO_CACHE;
+		if (dcs == DB_DBUF_METADATA_CACHE) {
+			DBUF_STAT_BUMPDOWN(metadata_cache_count);
+			DBUF_STAT_BUMP(metadata_cache_evicts);
+		} else {
+			DBUF_STAT_BUMPDOWN(cache_count);
+			DBUF_STAT_BUMP(cache_evicts);
+		}
 		dbuf_destroy(db);
 	} else {
 		multilist_sublist_unlock(mls);
@@ -522,11 +850,18 @@ dbuf_evict_one(void)
 	(void) tsd_set(zfs_dbuf_evict_key, NULL);
 }
 
+static inline boolean_t
+dbuf_caches_above_lowater(void)
+{
+	return (dbuf_cache_above_lowater(DB_DBUF_CACHE) ||
+	    dbuf_cache_above_lowater(DB_DBUF_METADATA_CACHE));
+}
+
 /*
  * The dbuf evict thread is responsible for aging out dbufs from the
- * cache. Once the cache has reached it's maximum size, dbufs are removed
+ * caches. Once a cache has reached it's maximum size, dbufs are removed
  * and destroyed. The eviction thread will continue running until the size
- * of the dbuf cache is at or below the maximum size. Once the dbuf is aged
+ * of each dbuf cache is at or below its maximum size. Once the dbuf is aged
  * out of the cache it is destroyed and becomes eligible for arc eviction.
  */
 static void
@@ -538,7 +873,8 @@ dbuf_evict_thread(void *unused)
 
 	mutex_enter(&dbuf_evict_lock);
 	while (!dbuf_evict_thread_exit) {
-		while (!dbuf_cache_above_lowater() && !dbuf_evict_thread_exit) {
+		while (!dbuf_caches_above_lowater() &&
+		    !dbuf_evict_thread_exit) {
 			CALLB_CPR_SAFE_BEGIN(&cpr);
 			(void) cv_timedwait_sig_hires(&dbuf_evict_cv,
 			    &dbuf_evict_lock, SEC2NSEC(1), MSEC2NSEC(1), 0);
@@ -548,11 +884,14 @@ dbuf_evict_thread(void *unused)
 
 		/*
 		 * Keep evicting as long as we're above the low water mark
-		 * for the cache. We do this without holding the locks to
+		 * for either cache. We do this without holding the locks to
 		 * minimize lock contention.
 		 */
-		while (dbuf_cache_above_lowater() && !dbuf_evict_thread_exit) {
-			dbuf_evict_one();
+		while (dbuf_caches_above_lowater() && !dbuf_evict_thread_exit) {
+			if (dbuf_cache_above_lowater(DB_DBUF_CACHE))
+				dbuf_evict_one(DB_DBUF_CACHE);
+			if (dbuf_cache_above_lowater(DB_DBUF_METADATA_CACHE))
+				dbuf_evict_one(DB_DBUF_METADATA_CACHE);
 		}
 
 		mutex_enter(&dbuf_evict_lock);
@@ -565,12 +904,12 @@ dbuf_evict_thread(void *unused)
 }
 
 /*
- * Wake up the dbuf eviction thread if the dbuf cache is at its max size.
- * If the dbuf cache is at its high water mark, then evict a dbuf from the
- * dbuf cache using the callers context.
+ * Wake up the dbuf eviction thread if the given dbuf cache is at its max
+ * size. If the dbuf cache is at its high water mark, then evict a dbuf from
+ * the dbuf cache using the callers context.
  */
 static void
-dbuf_evict_notify(void)
+dbuf_evict_notify(dbuf_cached_state_t dcs)
 {
 
 	/*
@@ -600,13 +939,37 @@ dbuf_evict_notify(void)
 	 * because it's OK to occasionally make the wrong decision here,
 	 * and grabbing the lock results in massive lock contention.
 	 */
-	if (refcount_count(&dbuf_cache_size) > dbuf_cache_max_bytes) {
-		if (dbuf_cache_above_hiwater())
-			dbuf_evict_one();
+	if (refcount_count(&dbuf_caches[dcs].size) >
+	    dbuf_cache_target_bytes(dcs)) {
+		if (dbuf_cache_above_hiwater(dcs))
+			dbuf_evict_one(dcs);
 		cv_signal(&dbuf_evict_cv);
 	}
 }
 
+static int
+dbuf_kstat_update(kstat_t *ksp, int rw)
+{
+	dbuf_stats_t *ds = ksp->ks_data;
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	ds->cache_size_bytes.value.ui64 =
+	    refcount_count(&dbuf_caches[DB_DBUF_CACHE].size);
+	ds->hash_elements.value.ui64 = dbuf_hash_count;
+	ds->hash_table_size.value.ui64 =
+	    dbuf_hash_table.hash_table_mask[dbuf_hash_table.hash_table_cur] + 1;
+	ds->cache_target_bytes.value.ui64 =
+	    dbuf_cache_target_bytes(DB_DBUF_CACHE);
+	ds->metadata_cache_size_bytes.value.ui64 =
+	    refcount_count(&dbuf_caches[DB_DBUF_METADATA_CACHE].size);
+	ds->metadata_cache_target_bytes.value.ui64 =
+	    dbuf_cache_target_bytes(DB_DBUF_METADATA_CACHE);
+
+	return (0);
+}
+
 
 
 void
@@ -614,6 +977,7 @@ dbuf_init(void)
 {
 	uint64_t hsize = 1ULL << 16;
 	dbuf_hash_table_t *h = &dbuf_hash_table;
+	dbuf_cached_state_t dcs;
 	int i;
 
 	/*
@@ -625,23 +989,35 @@ dbuf_init(void)
 	while (hsize * zfs_arc_average_blocksize < physmem * PAGESIZE)
 		hsize <<= 1;
 
+	/*
+	 * The table may later grow in the background, up to eight times its
+	 * initial size, should the number of cached dbufs call for it.
+	 */
+	h->hash_table_max = hsize << 3;
+
 retry:
-	h->hash_table_mask = hsize - 1;
+	h->hash_table_mask[0] = hsize - 1;
 #if defined(_KERNEL) && defined(HAVE_SPL)
 	/*
 	 * Large allocations which do not require contiguous pages
 	 * should be using vmem_alloc() in the linux kernel
 	 */
-	h->hash_table = vmem_zalloc(hsize * sizeof (void *), KM_SLEEP);
+	h->hash_table[0] = vmem_zalloc(hsize * sizeof (void *), KM_SLEEP);
 #else
-	h->hash_table = kmem_zalloc(hsize * sizeof (void *), KM_NOSLEEP);
+	h->hash_table[0] = kmem_zalloc(hsize * sizeof (void *), KM_NOSLEEP);
 #endif
-	if (h->hash_table == NULL) {
+	if (h->hash_table[0] == NULL) {
 		/* XXX - we should really return an error instead of assert */
-		ASSERT(hsize > (1ULL << 10));
+		ASSERT(hsize > DBUF_MUTEXES);
 		hsize >>= 1;
 		goto retry;
 	}
+	h->hash_table_mask[1] = 0;
+	h->hash_table[1] = NULL;
+	h->hash_table_cur = 0;
+	h->hash_growing = B_FALSE;
+	for (i = 0; i < DBUF_MUTEXES; i++)
+		h->hash_stripe_table[i] = 0;
 
 	dbuf_kmem_cache = kmem_cache_create("dmu_buf_impl_t",
 	    sizeof (dmu_buf_impl_t),
@@ -653,22 +1029,30 @@ retry:
 	dbuf_stats_init(h);
 
 	/*
-	 * Setup the parameters for the dbuf cache. We cap the size of the
-	 * dbuf cache to 1/32nd (default) of the size of the ARC.
+	 * Setup the parameters for the dbuf caches. We cap the size of the
+	 * dbuf cache to 1/32nd and the metadata dbuf cache to 1/64th
+	 * (default) of the size of the ARC.
 	 */
 	dbuf_cache_max_bytes = MIN(dbuf_cache_max_bytes,
 	    arc_max_bytes() >> dbuf_cache_max_shift);
+	dbuf_metadata_cache_max_bytes = MIN(dbuf_metadata_cache_max_bytes,
+	    arc_max_bytes() >> dbuf_metadata_cache_shift);
 
 	/*
 	 * All entries are queued via taskq_dispatch_ent(), so min/maxalloc
 	 * configuration is not required.
 	 */
 	dbu_evict_taskq = taskq_create("dbu_evict", 1, defclsyspri, 0, 0, 0);
-
-	dbuf_cache = multilist_create(sizeof (dmu_buf_impl_t),
-	    offsetof(dmu_buf_impl_t, db_cache_link),
-	    dbuf_cache_multilist_index_func);
-	refcount_create(&dbuf_cache_size);
+	dbuf_hash_taskq = taskq_create("dbuf_hash", 1, minclsyspri, 0, 1,
+	    TASKQ_PREPOPULATE);
+
+	for (dcs = 0; dcs < DB_CACHE_MAX; dcs++) {
+		dbuf_caches[dcs].cache =
+		    multilist_create(sizeof (dmu_buf_impl_t),
+		    offsetof(dmu_buf_impl_t, db_cache_link),
+		    dbuf_cache_multilist_index_func);
+		refcount_create(&dbuf_caches[dcs].size);
+	}
 
 	tsd_create(&zfs_dbuf_evict_key, NULL);
 	dbuf_evict_thread_exit = B_FALSE;
@@ -676,27 +1060,47 @@ retry:
 	cv_init(&dbuf_evict_cv, NULL, CV_DEFAULT, NULL);
 	dbuf_cache_evict_thread = thread_create(NULL, 0, dbuf_evict_thread,
 	    NULL, 0, &p0, TS_RUN, minclsyspri);
+
+	dbuf_ksp = kstat_create("zfs", 0, "dbufstats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (dbuf_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (dbuf_ksp != NULL) {
+		dbuf_ksp->ks_data = &dbuf_stats;
+		dbuf_ksp->ks_update = dbuf_kstat_update;
+		kstat_install(dbuf_ksp);
+	}
 }
 
 void
 dbuf_fini(void)
 {
 	dbuf_hash_table_t *h = &dbuf_hash_table;
+	dbuf_cached_state_t dcs;
 	int i;
 
 	dbuf_stats_destroy();
 
+	/* Let any growth in progress finish before tearing the table down. */
+	taskq_wait(dbuf_hash_taskq);
+	taskq_destroy(dbuf_hash_taskq);
+
 	for (i = 0; i < DBUF_MUTEXES; i++)
 		mutex_destroy(&h->hash_mutexes[i]);
+	for (i = 0; i < 2; i++) {
+		if (h->hash_table[i] == NULL)
+			continue;
 #if defined(_KERNEL) && defined(HAVE_SPL)
-	/*
-	 * Large allocations which do not require contiguous pages
-	 * should be using vmem_free() in the linux kernel
-	 */
-	vmem_free(h->hash_table, (h->hash_table_mask + 1) * sizeof (void *));
+		/*
+		 * Large allocations which do not require contiguous pages
+		 * should be using vmem_free() in the linux kernel
+		 */
+		vmem_free(h->hash_table[i],
+		    (h->hash_table_mask[i] + 1) * sizeof (void *));
 #else
-	kmem_free(h->hash_table, (h->hash_table_mask + 1) * sizeof (void *));
+		kmem_free(h->hash_table[i],
+		    (h->hash_table_mask[i] + 1) * sizeof (void *));
 #endif
+	}
 	kmem_cache_destroy(dbuf_kmem_cache);
 	taskq_destroy(dbu_evict_taskq);
 
@@ -712,8 +1116,15 @@ dbuf_fini(void)
 	mutex_destroy(&dbuf_evict_lock);
 	cv_destroy(&dbuf_evict_cv);
 
-	refcount_destroy(&dbuf_cache_size);
-	multilist_destroy(dbuf_cache);
+	for (dcs = 0; dcs < DB_CACHE_MAX; dcs++) {
+		refcount_destroy(&dbuf_caches[dcs].size);
+		multilist_destroy(dbuf_caches[dcs].cache);
+	}
+
+	if (dbuf_ksp != NULL) {
+		kstat_delete(dbuf_ksp);
+		dbuf_ksp = NULL;
+	}
 }
 
 /*
@@ -2205,11 +2616,7 @@ dbuf_destroy(dmu_buf_impl_t *db)
 
 	dbuf_clear_data(db);
 
-	if (multilist_link_active(&db->db_cache_link)) {
-		multilist_remove(dbuf_cache, db);
-		(void) refcount_remove_many(&dbuf_cache_size,
-		    db->db.db_size, db);
-	}
+	dbuf_cache_remove(db);
 
 	ASSERT(db->db_state == DB_UNCACHED || db->db_state == DB_NOFILL);
 	ASSERT(db->db_data_pending == NULL);
@@ -2403,6 +2810,7 @@ dbuf_create(dnode_t *dn, uint8_t level, uint64_t blkid,
 	db->db_user_immediate_evict = FALSE;
 	db->db_freed_in_flight = FALSE;
 	db->db_pending_evict = FALSE;
+	db->db_uncached = FALSE;
 
 	if (blkid == DMU_BONUS_BLKID) {
 		ASSERT3P(parent, ==, dn->dn_dbuf);
@@ -2775,11 +3183,13 @@ __dbuf_hold_impl(struct dbuf_hold_impl_data *dh)
 		}
 	}
 
-	if (multilist_link_active(&dh->dh_db->db_cache_link)) {
+	if (dh->dh_db->db_caching_status != DB_NO_CACHE) {
 		ASSERT(refcount_is_zero(&dh->dh_db->db_holds));
-		multilist_remove(dbuf_cache, dh->dh_db);
-		(void) refcount_remove_many(&dbuf_cache_size,
-		    dh->dh_db->db.db_size, dh->dh_db);
+		if (dh->dh_db->db_caching_status == DB_DBUF_METADATA_CACHE)
+			DBUF_STAT_BUMP(metadata_cache_hits);
+		else
+			DBUF_STAT_BUMP(cache_hits);
+		dbuf_cache_remove(dh->dh_db);
 	}
 	(void) refcount_add(&dh->dh_db->db_holds, dh->dh_tag);
 	DBUF_VERIFY(dh->dh_db);
@@ -3037,7 +3447,7 @@ dbuf_rele_and_unlock(dmu_buf_impl_t *db, void *tag)
 			blkptr_t bp;
 			spa_t *spa = dmu_objset_spa(db->db_objset);
 
-			if (!DBUF_IS_CACHEABLE(db) &&
+			if ((!DBUF_IS_CACHEABLE(db) || db->db_uncached) &&
 			    db->db_blkptr != NULL &&
 			    !BP_IS_HOLE(db->db_blkptr) &&
 			    !BP_IS_EMBEDDED(db->db_blkptr)) {
@@ -3045,16 +3455,17 @@ dbuf_rele_and_unlock(dmu_buf_impl_t *db, void *tag)
 				bp = *db->db_blkptr;
 			}
 
-			if (!DBUF_IS_CACHEABLE(db) ||
+			if (!DBUF_IS_CACHEABLE(db) || db->db_uncached ||
 			    db->db_pending_evict) {
 				dbuf_destroy(db);
-			} else if (!multilist_link_active(&db->db_cache_link)) {
-				multilist_insert(dbuf_cache, db);
-				(void) refcount_add_many(&dbuf_cache_size,
-				    db->db.db_size, db);
+			} else if (db->db_caching_status == DB_NO_CACHE) {
+				dbuf_cached_state_t dcs;
+
+				dbuf_cache_insert(db);
+				dcs = db->db_caching_status;
 				mutex_exit(&db->db_mtx);
 
-				dbuf_evict_notify();
+				dbuf_evict_notify(dcs);
 			}
 
 			if (do_arc_evict)
@@ -3984,6 +4395,19 @@ MODULE_PARM_DESC(dbuf_cache_lowater_pct,
 	"Percentage below dbuf_cache_max_bytes when the evict thread stops "
 	"evicting dbufs.");
 
+module_param(dbuf_metadata_cache_max_bytes, ulong, 0644);
+MODULE_PARM_DESC(dbuf_metadata_cache_max_bytes,
+	"Maximum size in bytes of the metadata dbuf cache.");
+
+module_param(dbuf_metadata_cache_shift, int, 0644);
+MODULE_PARM_DESC(dbuf_metadata_cache_shift,
+	"Set the size of the metadata dbuf cache to a log2 fraction of "
+	"arc size.");
+
+module_param(dbuf_hash_load_max, int, 0644);
+MODULE_PARM_DESC(dbuf_hash_load_max,
+	"Average dbufs per hash bucket before the hash table is grown.");
+
 module_param(dbuf_cache_max_shift, int, 0644);
 MODULE_PARM_DESC(dbuf_cache_max_shift,
 	"Cap the size of the dbuf cache to a log2 fraction of arc size.");
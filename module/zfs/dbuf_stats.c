@@ -129,14 +129,23 @@ dbuf_stats_hash_table_data(char *buf, size_t size, void *data)
 	dbuf_stats_t *dsh = (dbuf_stats_t *)data;
 	dbuf_hash_table_t *h = dsh->hash;
 	dmu_buf_impl_t *db;
-	int length, error = 0;
+	int length, t, error = 0;
 
 	ASSERT3S(dsh->idx, >=, 0);
-	ASSERT3S(dsh->idx, <=, h->hash_table_mask);
 	memset(buf, 0, size);
 
+	/*
+	 * While the table is growing, a bucket index may not exist yet
+	 * in the table this bucket's lock stripe is still in.
+	 */
 	mutex_enter(DBUF_HASH_MUTEX(h, dsh->idx));
-	for (db = h->hash_table[dsh->idx]; db != NULL; db = db->db_hash_next) {
+	t = DBUF_HASH_TABLE(h, dsh->idx);
+	if (dsh->idx > h->hash_table_mask[t]) {
+		mutex_exit(DBUF_HASH_MUTEX(h, dsh->idx));
+		return (0);
+	}
+	for (db = h->hash_table[t][dsh->idx]; db != NULL;
+	    db = db->db_hash_next) {
 		/*
 		 * Returning ENOMEM will cause the data and header functions
 		 * to be called with a larger scratch buffers.
@@ -168,7 +177,8 @@ dbuf_stats_hash_table_addr(kstat_t *ksp, loff_t n)
 
 	ASSERT(MUTEX_HELD(&dsh->lock));
 
-	if (n <= dsh->hash->hash_table_mask) {
+	if (n <= MAX(dsh->hash->hash_table_mask[0],
+	    dsh->hash->hash_table_mask[1])) {
 		dsh->idx = n;
 		return (dsh);
 	}
@@ -30,6 +30,7 @@
 #include <sys/dmu.h>
 #include <sys/dmu_impl.h>
 #include <sys/dmu_tx.h>
+#include <sys/dmu_send.h>
 #include <sys/dbuf.h>
 #include <sys/dnode.h>
 #include <sys/zfs_context.h>
@@ -916,6 +917,121 @@ dmu_free_range(objset_t *os, uint64_t object, uint64_t offset,
 	return (0);
 }
 
+/*
+ * Hold the level 0 block of dn at offset for an O_DIRECT read.  If the
+ * block only exists on disk it is read straight into a new ABD, returned
+ * in *abdp, without entering the ARC.  Blocks that are cached or dirty,
+ * holes, embedded blocks and encrypted blocks are read through their
+ * dbuf as usual instead, and *abdp is set to NULL.
+ */
+static int
+dmu_buf_hold_direct(dnode_t *dn, uint64_t offset, uint32_t flags,
+    void *tag, dmu_buf_impl_t **dbp, abd_t **abdp)
+{
+	dmu_buf_impl_t *db;
+	zbookmark_phys_t zb;
+	blkptr_t bp;
+	zio_t *zio;
+	abd_t *abd;
+	int err;
+
+	*dbp = NULL;
+	*abdp = NULL;
+
+	rw_enter(&dn->dn_struct_rwlock, RW_READER);
+	db = dbuf_hold(dn, dbuf_whichblock(dn, 0, offset), tag);
+	if (db == NULL) {
+		rw_exit(&dn->dn_struct_rwlock);
+		return (SET_ERROR(EIO));
+	}
+
+	/*
+	 * As in dbuf_read_impl(), recheck BP_IS_HOLE() after
+	 * dnode_block_freed() in case dnode_sync() cleared the bp meanwhile.
+	 */
+	{ static uint64_t dbgc; if ((atomic_inc_64_nv(&dbgc) % 200) == 1) if (db->db_blkptr) fprintf(stderr, "DBG call %llu hole %d emb %d prot %d freed %d\n", (u_longlong_t)dbgc, BP_IS_HOLE(db->db_blkptr), BP_IS_EMBEDDED(db->db_blkptr), BP_IS_PROTECTED(db->db_blkptr), dnode_block_freed(dn, db->db_blkid)); } /*DBG*/
+	mutex_enter(&db->db_mtx);
+	if ((db->db_state != DB_UNCACHED && db->db_state != DB_CACHED) /*DBG*/ || db->db_last_dirty != NULL ||
+	    db->db_blkptr == NULL || BP_IS_HOLE(db->db_blkptr) ||
+	    dnode_block_freed(dn, db->db_blkid) || BP_IS_HOLE(db->db_blkptr) ||
+	    BP_IS_EMBEDDED(db->db_blkptr) || BP_IS_PROTECTED(db->db_blkptr)) {
+		uint32_t dbuf_flags = DB_RF_CANFAIL | DB_RF_NOPREFETCH;
+
+		mutex_exit(&db->db_mtx);
+		rw_exit(&dn->dn_struct_rwlock);
+
+		if (flags & DMU_READ_NO_DECRYPT)
+			dbuf_flags |= DB_RF_NO_DECRYPT;
+		err = dbuf_read(db, NULL, dbuf_flags);
+		if (err != 0) {
+			dbuf_rele(db, tag);
+			return (err);
+		}
+		*dbp = db;
+		return (0);
+	}
+	bp = *db->db_blkptr;
+	mutex_exit(&db->db_mtx);
+	rw_exit(&dn->dn_struct_rwlock);
+
+	SET_BOOKMARK(&zb, dn->dn_objset->os_dsl_dataset ?
+	    dn->dn_objset->os_dsl_dataset->ds_object : DMU_META_OBJSET,
+	    dn->dn_object, 0, db->db_blkid);
+
+	/*
+	 * The zio verifies the checksum and decompresses the block.
+	 */
+	abd = abd_alloc_for_io(db->db.db_size, B_FALSE);
+	zio = zio_read(NULL, dn->dn_objset->os_spa, &bp, abd, db->db.db_size,
+	    NULL, NULL, ZIO_PRIORITY_SYNC_READ, ZIO_FLAG_CANFAIL, &zb);
+	err = zio_wait(zio);
+	if (err != 0) {
+		abd_free(abd);
+		dbuf_rele(db, tag);
+		return (err);
+	}
+
+	{ static uint64_t dbgn; if ((atomic_inc_64_nv(&dbgn) % 200) == 1) fprintf(stderr, "DBG direct %llu\n", (u_longlong_t)dbgn); } /*DBG*/
+	*dbp = db;
+	*abdp = abd;
+	return (0);
+}
+
+static int
+dmu_read_direct_impl(dnode_t *dn, uint64_t offset, uint64_t size,
+    void *buf, uint32_t flags)
+{
+	int err = 0;
+
+	while (size > 0) {
+		dmu_buf_impl_t *db;
+		uint64_t tocpy;
+		int64_t bufoff;
+		abd_t *abd;
+
+		err = dmu_buf_hold_direct(dn, offset, flags, FTAG, &db, &abd);
+		if (err)
+			break;
+
+		bufoff = offset - db->db.db_offset;
+		tocpy = MIN(db->db.db_size - bufoff, size);
+
+		if (abd != NULL) {
+			abd_copy_to_buf_off(buf, abd, bufoff, tocpy);
+			abd_free(abd);
+		} else {
+			(void) memcpy(buf, (char *)db->db.db_data + bufoff,
+			    tocpy);
+		}
+		dbuf_rele(db, FTAG);
+
+		offset += tocpy;
+		size -= tocpy;
+		buf = (char *)buf + tocpy;
+	}
+	return (err);
+}
+
 static int
 dmu_read_impl(dnode_t *dn, uint64_t offset, uint64_t size,
     void *buf, uint32_t flags)
@@ -935,6 +1051,9 @@ dmu_read_impl(dnode_t *dn, uint64_t offset, uint64_t size,
 		size = newsz;
 	}
 
+	if (flags & DMU_READ_DIRECT)
+		return (dmu_read_direct_impl(dn, offset, size, buf, flags));
+
 	while (size > 0) {
 		uint64_t mylen = MIN(size, DMU_MAX_ACCESS / 2);
 		int i;
@@ -1333,6 +1452,57 @@ dmu_read_uio_dbuf(dmu_buf_t *zdb, uio_t *uio, uint64_t size)
 	return (err);
 }
 
+/*
+ * Read 'size' bytes into the uio buffer for an O_DIRECT read, without
+ * caching the data in the ARC; see dmu_buf_hold_direct().
+ * From object zdb->db_object.
+ * Starting at offset uio->uio_loffset.
+ */
+int
+dmu_read_uio_direct(dmu_buf_t *zdb, uio_t *uio, uint64_t size)
+{
+	dmu_buf_impl_t *zdbi = (dmu_buf_impl_t *)zdb;
+	dnode_t *dn;
+	int err = 0;
+
+	DB_DNODE_ENTER(zdbi);
+	dn = DB_DNODE(zdbi);
+	while (size > 0) {
+		dmu_buf_impl_t *db;
+		uint64_t tocpy;
+		int64_t bufoff;
+		abd_t *abd;
+
+		err = dmu_buf_hold_direct(dn, uio->uio_loffset, 0, FTAG,
+		    &db, &abd);
+		if (err)
+			break;
+
+		bufoff = uio->uio_loffset - db->db.db_offset;
+		tocpy = MIN(db->db.db_size - bufoff, size);
+
+		if (abd != NULL) {
+			void *buf = abd_borrow_buf_copy(abd, db->db.db_size);
+
+			err = uiomove((char *)buf + bufoff, tocpy,
+			    UIO_READ, uio);
+			abd_return_buf(abd, buf, db->db.db_size);
+			abd_free(abd);
+		} else {
+			err = uiomove((char *)db->db.db_data + bufoff, tocpy,
+			    UIO_READ, uio);
+		}
+		dbuf_rele(db, FTAG);
+		if (err)
+			break;
+
+		size -= tocpy;
+	}
+	DB_DNODE_EXIT(zdbi);
+
+	return (err);
+}
+
 /*
  * Read 'size' bytes into the uio buffer.
  * From the specified object
@@ -1568,9 +1738,9 @@ dmu_copy_from_buf(objset_t *os, uint64_t object, uint64_t offset,
  * If this is not possible copy the contents of passed arc buf via
  * dmu_write().
  */
-void
-dmu_assign_arcbuf(dmu_buf_t *handle, uint64_t offset, arc_buf_t *buf,
-    dmu_tx_t *tx)
+static void
+dmu_assign_arcbuf_common(dmu_buf_t *handle, uint64_t offset, arc_buf_t *buf,
+    dmu_tx_t *tx, boolean_t direct)
 {
 	dmu_buf_impl_t *dbuf = (dmu_buf_impl_t *)handle;
 	dnode_t *dn;
@@ -1592,6 +1762,11 @@ dmu_assign_arcbuf(dmu_buf_t *handle, uint64_t offset, arc_buf_t *buf,
 	 */
 	if (offset == db->db.db_offset && blksz == db->db.db_size) {
 		dbuf_assign_arcbuf(db, buf, tx);
+		if (direct) {
+			mutex_enter(&db->db_mtx);
+			db->db_uncached = TRUE;
+			mutex_exit(&db->db_mtx);
+		}
 		dbuf_rele(db, FTAG);
 	} else {
 		objset_t *os;
@@ -1614,6 +1789,25 @@ dmu_assign_arcbuf(dmu_buf_t *handle, uint64_t offset, arc_buf_t *buf,
 	}
 }
 
+void
+dmu_assign_arcbuf(dmu_buf_t *handle, uint64_t offset, arc_buf_t *buf,
+    dmu_tx_t *tx)
+{
+	dmu_assign_arcbuf_common(handle, offset, buf, tx, B_FALSE);
+}
+
+/*
+ * As dmu_assign_arcbuf(), for an O_DIRECT write: once the block has been
+ * written out in syncing context, it is dropped from the dbuf cache and
+ * the ARC instead of being cached.
+ */
+void
+dmu_assign_arcbuf_direct(dmu_buf_t *handle, uint64_t offset, arc_buf_t *buf,
+    dmu_tx_t *tx)
+{
+	dmu_assign_arcbuf_common(handle, offset, buf, tx, B_TRUE);
+}
+
 typedef struct {
 	dbuf_dirty_record_t	*dsa_dr;
 	dmu_sync_cb_t		*dsa_done;
@@ -2171,6 +2365,8 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp, zio_prop_t *zp)
 	zp->zp_type = (wp & WP_SPILL) ? dn->dn_bonustype : type;
 	zp->zp_level = level;
 	zp->zp_copies = MIN(copies, spa_max_replication(os->os_spa));
+	zp->zp_zpl_smallblk = DMU_OT_IS_FILE(zp->zp_type) ?
+	    os->os_zpl_special_smallblock : 0;
 	zp->zp_dedup = dedup;
 	zp->zp_dedup_verify = dedup && dedup_verify;
 	zp->zp_nopwrite = nopwrite;
@@ -2396,6 +2592,7 @@ dmu_init(void)
 	dnode_init();
 	zfetch_init();
 	dmu_tx_init();
+	dmu_recv_init();
 	l2arc_init();
 	arc_init();
 	dbuf_init();
@@ -2406,6 +2603,7 @@ dmu_fini(void)
 {
 	arc_fini(); /* arc depends on l2arc, so arc must go first */
 	l2arc_fini();
+	dmu_recv_fini();
 	dmu_tx_fini();
 	zfetch_fini();
 	dbuf_fini();
@@ -2444,6 +2642,7 @@ EXPORT_SYMBOL(dmu_sync);
 EXPORT_SYMBOL(dmu_request_arcbuf);
 EXPORT_SYMBOL(dmu_return_arcbuf);
 EXPORT_SYMBOL(dmu_assign_arcbuf);
+EXPORT_SYMBOL(dmu_assign_arcbuf_direct);
 EXPORT_SYMBOL(dmu_buf_hold);
 EXPORT_SYMBOL(dmu_ot);
 
@@ -62,7 +62,19 @@
 /* Set this tunable to TRUE to replace corrupt data with 0x2f5baddb10c */
 int zfs_send_corrupt_data = B_FALSE;
 int zfs_send_queue_length = 16 * 1024 * 1024;
+/*
+ * Number of threads traversing a dataset being sent, each covering a range
+ * of its objects.  Ranges are at least zfs_send_traverse_min_objects long.
+ */
+int zfs_send_traverse_threads = 4;
+unsigned long zfs_send_traverse_min_objects = 16384;
 int zfs_recv_queue_length = 16 * 1024 * 1024;
+/*
+ * Number of threads applying the records of a receive stream.  Records for
+ * different objects are applied concurrently; with 1 the records are
+ * applied in stream order by a single thread.
+ */
+int zfs_recv_writer_threads = 4;
 /* Set this tunable to FALSE to disable setting of DRR_FLAG_FREERECORDS */
 int zfs_send_set_freerecords_bit = B_TRUE;
 
@@ -83,6 +95,8 @@ struct send_thread_arg {
 	int		error_code;
 	boolean_t	cancel;
 	zbookmark_phys_t resume;
+	uint64_t	start_object;	/* Skip blocks before this object */
+	uint64_t	end_object;	/* Stop at this object, 0 for none */
 };
 
 struct send_block_record {
@@ -638,6 +652,29 @@ backup_do_embed(dmu_sendarg_t *dsp, const blkptr_t *bp)
 	return (B_FALSE);
 }
 
+/*
+ * Return the first object covered by a block, in the order the blocks are
+ * visited by the traversal.  Blocks of the meta-dnode which start past the
+ * last possible object are visited last.
+ */
+static uint64_t
+send_block_object(const zbookmark_phys_t *zb, const struct dnode_phys *dnp)
+{
+	int shift;
+
+	if (zb->zb_object != DMU_META_DNODE_OBJECT)
+		return (zb->zb_object);
+	if (zb->zb_blkid == 0)
+		return (0);
+
+	shift = highbit64(dnp->dn_datablkszsec) - 1 + SPA_MINBLOCKSHIFT -
+	    DNODE_SHIFT + zb->zb_level *
+	    (dnp->dn_indblkshift - SPA_BLKPTRSHIFT);
+	if (shift >= 64 || zb->zb_blkid > (UINT64_MAX >> shift))
+		return (UINT64_MAX);
+	return (zb->zb_blkid << shift);
+}
+
 /*
  * This is the callback function to traverse_dataset that acts as the worker
  * thread for dmu_send_impl.
@@ -666,6 +703,22 @@ send_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 		return (0);
 	}
 
+	/*
+	 * Blocks are visited in order of the first object they cover, so
+	 * the range of objects this thread sends ends at the first block
+	 * past it; like cancellation, stopping there is not an error.
+	 * Blocks of the meta-dnode which start in an earlier range are sent
+	 * by that range's thread.
+	 */
+	if (sta->start_object != 0 || sta->end_object != 0) {
+		uint64_t object = send_block_object(zb, dnp);
+
+		if (sta->end_object != 0 && object >= sta->end_object)
+			return (SET_ERROR(EINTR));
+		if (object < sta->start_object)
+			return (0);
+	}
+
 	record = kmem_zalloc(sizeof (struct send_block_record), KM_SLEEP);
 	record->eos_marker = B_FALSE;
 	record->bp = *bp;
@@ -942,10 +995,13 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 	int err;
 	uint64_t fromtxg = 0;
 	uint64_t featureflags = 0;
-	struct send_thread_arg to_arg;
+	struct send_thread_arg *to_args;
+	zbookmark_phys_t resume_zb;
 	void *payload = NULL;
 	size_t payload_len = 0;
 	struct send_block_record *to_data;
+	uint64_t maxobj, nobjs, span;
+	int i, nranges;
 
 	err = dmu_objset_from_ds(to_ds, &os);
 	if (err != 0) {
@@ -977,7 +1033,7 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 	DMU_SET_STREAM_HDRTYPE(drr->drr_u.drr_begin.drr_versioninfo,
 	    DMU_SUBSTREAM);
 
-	bzero(&to_arg, sizeof (to_arg));
+	bzero(&resume_zb, sizeof (resume_zb));
 
 #ifdef _KERNEL
 	if (dmu_objset_type(os) == DMU_OST_ZFS) {
@@ -1019,6 +1075,13 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 		featureflags |= DMU_BACKUP_FEATURE_LZ4;
 	}
 
+	if ((featureflags &
+	    (DMU_BACKUP_FEATURE_EMBED_DATA | DMU_BACKUP_FEATURE_COMPRESSED |
+	    DMU_BACKUP_FEATURE_RAW)) != 0 &&
+	    to_ds->ds_feature_inuse[SPA_FEATURE_ZSTD_COMPRESS]) {
+		featureflags |= DMU_BACKUP_FEATURE_ZSTD;
+	}
+
 	if (resumeobj != 0 || resumeoff != 0) {
 		featureflags |= DMU_BACKUP_FEATURE_RESUMING;
 	}
@@ -1083,7 +1146,7 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 				goto out;
 			}
 
-			SET_BOOKMARK(&to_arg.resume, to_ds->ds_object,
+			SET_BOOKMARK(&resume_zb, to_ds->ds_object,
 			    resumeobj, 0,
 			    resumeoff / to_doi.doi_data_block_size);
 
@@ -1116,39 +1179,80 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 		goto out;
 	}
 
-	err = bqueue_init(&to_arg.q, zfs_send_queue_length,
-	    offsetof(struct send_block_record, ln));
-	to_arg.error_code = 0;
-	to_arg.cancel = B_FALSE;
-	to_arg.ds = to_ds;
-	to_arg.fromtxg = fromtxg;
-	to_arg.flags = TRAVERSE_PRE | TRAVERSE_PREFETCH;
-	if (rawok)
-		to_arg.flags |= TRAVERSE_NO_DECRYPT;
-	(void) thread_create(NULL, 0, send_traverse_thread, &to_arg, 0, curproc,
-	    TS_RUN, minclsyspri);
+	/*
+	 * Split the objects from the resume point on into ranges, each
+	 * traversed (and prefetched) by its own thread.  The ranges start on
+	 * dnode block boundaries, so the blocks of each object and the dnode
+	 * block describing it belong to the same range, and the records of
+	 * the ranges are dumped one range after the other to produce the
+	 * same stream as a single traversal would.
+	 */
+	maxobj = (DMU_META_DNODE(os)->dn_maxblkid + 1) * DNODES_PER_BLOCK;
+	nobjs = maxobj - MIN(resumeobj, maxobj);
+	nranges = MAX(zfs_send_traverse_threads, 1);
+	span = MAX(zfs_send_traverse_min_objects, nobjs / nranges);
+	span = P2ROUNDUP(MAX(span, 1), DNODES_PER_BLOCK);
+	nranges = MAX(MIN(nranges, howmany(nobjs, span)), 1);
+
+	to_args = kmem_zalloc(nranges * sizeof (struct send_thread_arg),
+	    KM_SLEEP);
+	for (i = 0; i < nranges; i++) {
+		struct send_thread_arg *sta = &to_args[i];
+
+		(void) bqueue_init(&sta->q, zfs_send_queue_length,
+		    offsetof(struct send_block_record, ln));
+		sta->error_code = 0;
+		sta->cancel = B_FALSE;
+		sta->ds = to_ds;
+		sta->fromtxg = fromtxg;
+		sta->flags = TRAVERSE_PRE | TRAVERSE_PREFETCH;
+		if (rawok)
+			sta->flags |= TRAVERSE_NO_DECRYPT;
+		if (i == 0) {
+			sta->resume = resume_zb;
+		} else {
+			sta->start_object =
+			    P2ALIGN(resumeobj, DNODES_PER_BLOCK) + i * span;
+			SET_BOOKMARK(&sta->resume, to_ds->ds_object,
+			    DMU_META_DNODE_OBJECT, 0,
+			    sta->start_object / DNODES_PER_BLOCK);
+			to_args[i - 1].end_object = sta->start_object;
+		}
+	}
+	for (i = 0; i < nranges; i++) {
+		(void) thread_create(NULL, 0, send_traverse_thread,
+		    &to_args[i], 0, curproc, TS_RUN, minclsyspri);
+	}
 
-	to_data = bqueue_dequeue(&to_arg.q);
+	for (i = 0; i < nranges; i++) {
+		struct send_thread_arg *sta = &to_args[i];
 
-	while (!to_data->eos_marker && err == 0) {
-		err = do_dump(dsp, to_data);
-		to_data = get_next_record(&to_arg.q, to_data);
-		if (issig(JUSTLOOKING) && issig(FORREAL))
-			err = EINTR;
-	}
+		to_data = bqueue_dequeue(&sta->q);
 
-	if (err != 0) {
-		to_arg.cancel = B_TRUE;
-		while (!to_data->eos_marker) {
-			to_data = get_next_record(&to_arg.q, to_data);
+		while (!to_data->eos_marker && err == 0) {
+			err = do_dump(dsp, to_data);
+			to_data = get_next_record(&sta->q, to_data);
+			if (issig(JUSTLOOKING) && issig(FORREAL))
+				err = EINTR;
 		}
-	}
-	kmem_free(to_data, sizeof (*to_data));
 
-	bqueue_destroy(&to_arg.q);
+		if (err != 0) {
+			int j;
+
+			for (j = i; j < nranges; j++)
+				to_args[j].cancel = B_TRUE;
+			while (!to_data->eos_marker) {
+				to_data = get_next_record(&sta->q, to_data);
+			}
+		}
+		kmem_free(to_data, sizeof (*to_data));
 
-	if (err == 0 && to_arg.error_code != 0)
-		err = to_arg.error_code;
+		bqueue_destroy(&sta->q);
+
+		if (err == 0 && sta->error_code != 0)
+			err = sta->error_code;
+	}
+	kmem_free(to_args, nranges * sizeof (struct send_thread_arg));
 
 	if (err != 0)
 		goto out;
@@ -1624,7 +1728,8 @@ dmu_recv_begin_check(void *arg, dmu_tx_t *tx)
 	 * The receiving code doesn't know how to translate a WRITE_EMBEDDED
 	 * record to a plain WRITE record, so the pool must have the
 	 * EMBEDDED_DATA feature enabled if the stream has WRITE_EMBEDDED
-	 * records.  Same with WRITE_EMBEDDED records that use LZ4 compression.
+	 * records.  Same with WRITE_EMBEDDED records that use LZ4 or zstd
+	 * compression.
 	 */
 	if ((featureflags & DMU_BACKUP_FEATURE_EMBED_DATA) &&
 	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_EMBEDDED_DATA))
@@ -1632,6 +1737,9 @@ dmu_recv_begin_check(void *arg, dmu_tx_t *tx)
 	if ((featureflags & DMU_BACKUP_FEATURE_LZ4) &&
 	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_LZ4_COMPRESS))
 		return (SET_ERROR(ENOTSUP));
+	if ((featureflags & DMU_BACKUP_FEATURE_ZSTD) &&
+	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_ZSTD_COMPRESS))
+		return (SET_ERROR(ENOTSUP));
 
 	/*
 	 * The receiving code doesn't know how to translate large blocks
@@ -1915,7 +2023,8 @@ dmu_recv_resume_begin_check(void *arg, dmu_tx_t *tx)
 	 * The receiving code doesn't know how to translate a WRITE_EMBEDDED
 	 * record to a plain WRITE record, so the pool must have the
 	 * EMBEDDED_DATA feature enabled if the stream has WRITE_EMBEDDED
-	 * records.  Same with WRITE_EMBEDDED records that use LZ4 compression.
+	 * records.  Same with WRITE_EMBEDDED records that use LZ4 or zstd
+	 * compression.
 	 */
 	if ((featureflags & DMU_BACKUP_FEATURE_EMBED_DATA) &&
 	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_EMBEDDED_DATA))
@@ -1923,6 +2032,9 @@ dmu_recv_resume_begin_check(void *arg, dmu_tx_t *tx)
 	if ((featureflags & DMU_BACKUP_FEATURE_LZ4) &&
 	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_LZ4_COMPRESS))
 		return (SET_ERROR(ENOTSUP));
+	if ((featureflags & DMU_BACKUP_FEATURE_ZSTD) &&
+	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_ZSTD_COMPRESS))
+		return (SET_ERROR(ENOTSUP));
 
 	/*
 	 * The receiving code doesn't know how to translate large blocks
@@ -2113,6 +2225,48 @@ struct receive_record_arg {
 	uint64_t bytes_read; /* bytes read from stream when record created */
 	boolean_t eos_marker; /* Marks the end of the stream */
 	bqueue_node_t node;
+
+	/*
+	 * Position saved as the resume state by this record, see
+	 * receive_resume_snapshot().  A resume_bytes of 0 means none.
+	 */
+	uint64_t resume_object, resume_offset, resume_bytes;
+	boolean_t done; /* Record has been applied (or discarded) */
+	list_node_t pending_node;
+};
+
+/*
+ * Statistics for the receive writer threads.
+ */
+typedef struct dmu_recv_stats {
+	kstat_named_t dmu_recv_writers;
+	kstat_named_t dmu_recv_queued;
+	kstat_named_t dmu_recv_dispatched;
+	kstat_named_t dmu_recv_barriers;
+} dmu_recv_stats_t;
+
+static dmu_recv_stats_t dmu_recv_stats = {
+	{ "writers",		KSTAT_DATA_UINT64 },
+	{ "queued",		KSTAT_DATA_UINT64 },
+	{ "dispatched",		KSTAT_DATA_UINT64 },
+	{ "barriers",		KSTAT_DATA_UINT64 },
+};
+
+static kstat_t *dmu_recv_ksp;
+
+#define	DMU_RECV_STAT_INCR(stat, val) \
+	atomic_add_64(&dmu_recv_stats.stat.value.ui64, (val));
+#define	DMU_RECV_STAT_BUMP(stat) \
+	DMU_RECV_STAT_INCR(stat, 1);
+#define	DMU_RECV_STAT_BUMPDOWN(stat) \
+	DMU_RECV_STAT_INCR(stat, -1);
+
+/*
+ * A writer thread applying the records of a subset of the stream's objects.
+ */
+struct receive_writer_worker {
+	struct receive_writer_arg *rww_rwa;
+	bqueue_t rww_q;
 };
 
 struct receive_writer_arg {
@@ -2134,7 +2288,20 @@ struct receive_writer_arg {
 	boolean_t resumable;
 	boolean_t raw;
 	uint64_t last_object, last_offset;
-	uint64_t bytes_read; /* bytes read when current record created */
+
+	/*
+	 * Records are handed from the thread pulling them off the queue to
+	 * nworkers writer threads, see receive_writer_thread(); with none
+	 * they are applied by that thread itself.  The fields below are
+	 * protected by the mutex.
+	 */
+	int nworkers;
+	struct receive_writer_worker *workers;
+	int workers_live;
+	kcondvar_t pending_cv;
+	list_t pending; /* Records not yet done, in stream order */
+	/* Last resumable record of the done prefix of the stream. */
+	uint64_t resume_object, resume_offset, resume_bytes;
 };
 
 struct objlist {
@@ -2353,41 +2520,103 @@ deduce_nblkptr(dmu_object_type_t bonus_type, uint64_t bonus_size)
 	}
 }
 
+/*
+ * Returns B_TRUE if the record is one the stream can be resumed from, and
+ * sets *object and *offset to its position.
+ */
+static boolean_t
+receive_record_resume_point(struct receive_record_arg *rrd,
+    uint64_t *object, uint64_t *offset)
+{
+	switch (rrd->header.drr_type) {
+	case DRR_WRITE:
+		*object = rrd->header.drr_u.drr_write.drr_object;
+		*offset = rrd->header.drr_u.drr_write.drr_offset;
+		return (B_TRUE);
+	case DRR_WRITE_BYREF:
+		*object = rrd->header.drr_u.drr_write_byref.drr_object;
+		*offset = rrd->header.drr_u.drr_write_byref.drr_offset;
+		return (B_TRUE);
+	case DRR_WRITE_EMBEDDED:
+		*object = rrd->header.drr_u.drr_write_embedded.drr_object;
+		*offset = rrd->header.drr_u.drr_write_embedded.drr_offset;
+		return (B_TRUE);
+	default:
+		return (B_FALSE);
+	}
+}
+
+/*
+ * Pick the position the record will save as the resume state.  This must be
+ * called before the record's tx is assigned: every record up to and
+ * including the chosen position is then done, and so is in a txg no later
+ * than the record's own.  When all earlier records are done, that is the
+ * record itself; otherwise it is the last resumable record of the done
+ * prefix of the stream.
+ */
+static void
+receive_resume_snapshot(struct receive_writer_arg *rwa,
+    struct receive_record_arg *rrd)
+{
+	uint64_t object, offset;
+
+	mutex_enter(&rwa->mutex);
+	if (list_head(&rwa->pending) == rrd &&
+	    receive_record_resume_point(rrd, &object, &offset)) {
+		rrd->resume_object = object;
+		rrd->resume_offset = offset;
+		rrd->resume_bytes = rrd->bytes_read;
+	} else {
+		rrd->resume_object = rwa->resume_object;
+		rrd->resume_offset = rwa->resume_offset;
+		rrd->resume_bytes = rwa->resume_bytes;
+	}
+	mutex_exit(&rwa->mutex);
+}
+
 static void
 save_resume_state(struct receive_writer_arg *rwa,
-    uint64_t object, uint64_t offset, dmu_tx_t *tx)
+    struct receive_record_arg *rrd, dmu_tx_t *tx)
 {
 	int txgoff = dmu_tx_get_txg(tx) & TXG_MASK;
-
-	if (!rwa->resumable)
-		return;
+	dsl_dataset_t *ds = rwa->os->os_dsl_dataset;
 
 	/*
 	 * We use ds_resume_bytes[] != 0 to indicate that we need to
-	 * update this on disk, so it must not be 0.
+	 * update this on disk, so the state of a record which has no
+	 * position to save yet is skipped.
 	 */
-	ASSERT(rwa->bytes_read != 0);
+	if (!rwa->resumable || rrd->resume_bytes == 0)
+		return;
 
 	/*
 	 * We only resume from write records, which have a valid
 	 * (non-meta-dnode) object number.
 	 */
-	ASSERT(object != 0);
+	ASSERT(rrd->resume_object != 0);
 
 	/*
-	 * For resuming to work correctly, we must receive records in order,
-	 * sorted by object,offset.  This is checked by the callers, but
-	 * assert it here for good measure.
+	 * Records of the same txg may save their state out of order when
+	 * applied by several writer threads; keep the furthest position.
 	 */
-	ASSERT3U(object, >=, rwa->os->os_dsl_dataset->ds_resume_object[txgoff]);
-	ASSERT(object != rwa->os->os_dsl_dataset->ds_resume_object[txgoff] ||
-	    offset >= rwa->os->os_dsl_dataset->ds_resume_offset[txgoff]);
-	ASSERT3U(rwa->bytes_read, >=,
-	    rwa->os->os_dsl_dataset->ds_resume_bytes[txgoff]);
+	mutex_enter(&rwa->mutex);
+	if (rrd->resume_bytes > ds->ds_resume_bytes[txgoff]) {
+		/*
+		 * For resuming to work correctly, we must receive records
+		 * in order, sorted by object,offset.  This is checked by
+		 * receive_writer_dispatch(), but assert it here for good
+		 * measure.
+		 */
+		ASSERT3U(rrd->resume_object, >=,
+		    ds->ds_resume_object[txgoff]);
+		ASSERT(rrd->resume_object != ds->ds_resume_object[txgoff] ||
+		    rrd->resume_offset >= ds->ds_resume_offset[txgoff]);
 
-	rwa->os->os_dsl_dataset->ds_resume_object[txgoff] = object;
-	rwa->os->os_dsl_dataset->ds_resume_offset[txgoff] = offset;
-	rwa->os->os_dsl_dataset->ds_resume_bytes[txgoff] = rwa->bytes_read;
+		ds->ds_resume_object[txgoff] = rrd->resume_object;
+		ds->ds_resume_offset[txgoff] = rrd->resume_offset;
+		ds->ds_resume_bytes[txgoff] = rrd->resume_bytes;
+	}
+	mutex_exit(&rwa->mutex);
 }
 
 noinline static int
@@ -2580,8 +2809,8 @@ receive_freeobjects(struct receive_writer_arg *rwa,
 }
 
 noinline static int
-receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
-    arc_buf_t *abuf)
+receive_write(struct receive_writer_arg *rwa, struct receive_record_arg *rrd,
+    struct drr_write *drrw, arc_buf_t *abuf)
 {
 	dmu_tx_t *tx;
 	dmu_buf_t *bonus;
@@ -2591,18 +2820,6 @@ receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
 	    !DMU_OT_IS_VALID(drrw->drr_type))
 		return (SET_ERROR(EINVAL));
 
-	/*
-	 * For resuming to work, records must be in increasing order
-	 * by (object, offset).
-	 */
-	if (drrw->drr_object < rwa->last_object ||
-	    (drrw->drr_object == rwa->last_object &&
-	    drrw->drr_offset < rwa->last_offset)) {
-		return (SET_ERROR(EINVAL));
-	}
-	rwa->last_object = drrw->drr_object;
-	rwa->last_offset = drrw->drr_offset;
-
 	if (dmu_object_info(rwa->os, drrw->drr_object, NULL) != 0)
 		return (SET_ERROR(EINVAL));
 
@@ -2638,7 +2855,7 @@ receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
 	 * to the next record), so that we can verify that we are
 	 * resuming from the correct location.
 	 */
-	save_resume_state(rwa, drrw->drr_object, drrw->drr_offset, tx);
+	save_resume_state(rwa, rrd, tx);
 	dmu_tx_commit(tx);
 	dmu_buf_rele(bonus, FTAG);
 
@@ -2654,7 +2871,7 @@ receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
  */
 static int
 receive_write_byref(struct receive_writer_arg *rwa,
-    struct drr_write_byref *drrwbr)
+    struct receive_record_arg *rrd, struct drr_write_byref *drrwbr)
 {
 	dmu_tx_t *tx;
 	int err;
@@ -2714,14 +2931,15 @@ receive_write_byref(struct receive_writer_arg *rwa,
 	dmu_buf_rele(dbp, FTAG);
 
 	/* See comment in restore_write. */
-	save_resume_state(rwa, drrwbr->drr_object, drrwbr->drr_offset, tx);
+	save_resume_state(rwa, rrd, tx);
 	dmu_tx_commit(tx);
 	return (0);
 }
 
 static int
 receive_write_embedded(struct receive_writer_arg *rwa,
-    struct drr_write_embedded *drrwe, void *data)
+    struct receive_record_arg *rrd, struct drr_write_embedded *drrwe,
+    void *data)
 {
 	dmu_tx_t *tx;
 	int err;
@@ -2753,7 +2971,7 @@ receive_write_embedded(struct receive_writer_arg *rwa,
 	    rwa->byteswap ^ ZFS_HOST_BYTEORDER, tx);
 
 	/* See comment in restore_write. */
-	save_resume_state(rwa, drrwe->drr_object, drrwe->drr_offset, tx);
+	save_resume_state(rwa, rrd, tx);
 	dmu_tx_commit(tx);
 	return (0);
 }
@@ -3362,9 +3580,7 @@ receive_process_record(struct receive_writer_arg *rwa,
 {
 	int err;
 
-	/* Processing in order, therefore bytes_read should be increasing. */
-	ASSERT3U(rrd->bytes_read, >=, rwa->bytes_read);
-	rwa->bytes_read = rrd->bytes_read;
+	receive_resume_snapshot(rwa, rrd);
 
 	switch (rrd->header.drr_type) {
 	case DRR_OBJECT:
@@ -3385,7 +3601,7 @@ receive_process_record(struct receive_writer_arg *rwa,
 	case DRR_WRITE:
 	{
 		struct drr_write *drrw = &rrd->header.drr_u.drr_write;
-		err = receive_write(rwa, drrw, rrd->arc_buf);
+		err = receive_write(rwa, rrd, drrw, rrd->arc_buf);
 		/* if receive_write() is successful, it consumes the arc_buf */
 		if (err != 0)
 			dmu_return_arcbuf(rrd->arc_buf);
@@ -3397,14 +3613,14 @@ receive_process_record(struct receive_writer_arg *rwa,
 	{
 		struct drr_write_byref *drrwbr =
 		    &rrd->header.drr_u.drr_write_byref;
-		err = receive_write_byref(rwa, drrwbr);
+		err = receive_write_byref(rwa, rrd, drrwbr);
 		break;
 	}
 	case DRR_WRITE_EMBEDDED:
 	{
 		struct drr_write_embedded *drrwe =
 		    &rrd->header.drr_u.drr_write_embedded;
-		err = receive_write_embedded(rwa, drrwe, rrd->payload);
+		err = receive_write_embedded(rwa, rrd, drrwe, rrd->payload);
 		kmem_free(rrd->payload, rrd->payload_size);
 		rrd->payload = NULL;
 		break;
@@ -3443,8 +3659,181 @@ receive_process_record(struct receive_writer_arg *rwa,
 }
 
 /*
- * dmu_recv_stream's worker thread; pull records off the queue, and then call
- * receive_process_record  When we're done, signal the main thread and exit.
+ * Returns B_TRUE if the record only changes the object it names, and
+ * sets *object to that object.  Such records may be applied concurrently
+ * with the records of other objects.  All others (object creation and
+ * frees, object ranges, and dedup'd writes referring to data earlier in
+ * the same stream) are barriers, applied once all earlier records are.
+ */
+static boolean_t
+receive_record_object(struct receive_record_arg *rrd, uint64_t *object)
+{
+	struct drr_write_byref *drrwbr;
+
+	switch (rrd->header.drr_type) {
+	case DRR_WRITE:
+		*object = rrd->header.drr_u.drr_write.drr_object;
+		break;
+	case DRR_WRITE_BYREF:
+		drrwbr = &rrd->header.drr_u.drr_write_byref;
+		if (drrwbr->drr_toguid == drrwbr->drr_refguid)
+			return (B_FALSE);
+		*object = drrwbr->drr_object;
+		break;
+	case DRR_WRITE_EMBEDDED:
+		*object = rrd->header.drr_u.drr_write_embedded.drr_object;
+		break;
+	case DRR_FREE:
+		*object = rrd->header.drr_u.drr_free.drr_object;
+		break;
+	case DRR_SPILL:
+		*object = rrd->header.drr_u.drr_spill.drr_object;
+		break;
+	default:
+		return (B_FALSE);
+	}
+
+	return (*object != DMU_META_DNODE_OBJECT);
+}
+
+/*
+ * Apply the record, or discard it if the receive has already failed, and
+ * retire it from the pending list.
+ */
+static void
+receive_writer_process(struct receive_writer_arg *rwa,
+    struct receive_record_arg *rrd)
+{
+	uint64_t object, offset;
+	int err;
+
+	/*
+	 * If there's an error, the main thread will stop putting things
+	 * on the queue, but we need to clear everything in it before we
+	 * can exit.
+	 */
+	if (rwa->err == 0) {
+		err = receive_process_record(rwa, rrd);
+		if (err != 0) {
+			mutex_enter(&rwa->mutex);
+			if (rwa->err == 0)
+				rwa->err = err;
+			mutex_exit(&rwa->mutex);
+		}
+	} else if (rrd->arc_buf != NULL) {
+		dmu_return_arcbuf(rrd->arc_buf);
+		rrd->arc_buf = NULL;
+		rrd->payload = NULL;
+	} else if (rrd->payload != NULL) {
+		kmem_free(rrd->payload, rrd->payload_size);
+		rrd->payload = NULL;
+	}
+
+	/*
+	 * Free the done prefix of the pending list, advancing the resume
+	 * position over it.  Once a record has failed the position is left
+	 * alone, since later records may have been discarded.
+	 */
+	mutex_enter(&rwa->mutex);
+	rrd->done = B_TRUE;
+	while ((rrd = list_head(&rwa->pending)) != NULL && rrd->done) {
+		list_remove(&rwa->pending, rrd);
+		if (rwa->err == 0 &&
+		    receive_record_resume_point(rrd, &object, &offset)) {
+			rwa->resume_object = object;
+			rwa->resume_offset = offset;
+			rwa->resume_bytes = rrd->bytes_read;
+		}
+		kmem_free(rrd, sizeof (*rrd));
+	}
+	cv_broadcast(&rwa->pending_cv);
+	mutex_exit(&rwa->mutex);
+}
+
+/*
+ * A writer thread; apply the records handed to it until the end of the
+ * stream, then exit.
+ */
+static void
+receive_writer_worker_thread(void *arg)
+{
+	struct receive_writer_worker *rww = arg;
+	struct receive_writer_arg *rwa = rww->rww_rwa;
+	struct receive_record_arg *rrd;
+	fstrans_cookie_t cookie = spl_fstrans_mark();
+
+	for (rrd = bqueue_dequeue(&rww->rww_q); !rrd->eos_marker;
+	    rrd = bqueue_dequeue(&rww->rww_q)) {
+		DMU_RECV_STAT_BUMPDOWN(dmu_recv_queued);
+		receive_writer_process(rwa, rrd);
+	}
+	kmem_free(rrd, sizeof (*rrd));
+
+	mutex_enter(&rwa->mutex);
+	rwa->workers_live--;
+	cv_broadcast(&rwa->pending_cv);
+	mutex_exit(&rwa->mutex);
+	DMU_RECV_STAT_BUMPDOWN(dmu_recv_writers);
+	spl_fstrans_unmark(cookie);
+	thread_exit();
+}
+
+/*
+ * Hand a record to the writer thread of its object, so that the records of
+ * each object are applied in stream order.  Barriers are applied here once
+ * all earlier records are done.
+ */
+static void
+receive_writer_dispatch(struct receive_writer_arg *rwa,
+    struct receive_record_arg *rrd)
+{
+	struct receive_writer_worker *rww;
+	uint64_t object;
+
+	mutex_enter(&rwa->mutex);
+	list_insert_tail(&rwa->pending, rrd);
+
+	/*
+	 * For resuming to work, records must be in increasing order
+	 * by (object, offset).  This can only be checked in stream order.
+	 */
+	if (rrd->header.drr_type == DRR_WRITE) {
+		struct drr_write *drrw = &rrd->header.drr_u.drr_write;
+
+		if (drrw->drr_object < rwa->last_object ||
+		    (drrw->drr_object == rwa->last_object &&
+		    drrw->drr_offset < rwa->last_offset)) {
+			if (rwa->err == 0)
+				rwa->err = SET_ERROR(EINVAL);
+		}
+		rwa->last_object = drrw->drr_object;
+		rwa->last_offset = drrw->drr_offset;
+	}
+
+	if (rwa->nworkers > 0 && receive_record_object(rrd, &object)) {
+		mutex_exit(&rwa->mutex);
+		rww = &rwa->workers[object % rwa->nworkers];
+		DMU_RECV_STAT_BUMP(dmu_recv_dispatched);
+		DMU_RECV_STAT_BUMP(dmu_recv_queued);
+		bqueue_enqueue(&rww->rww_q, rrd,
+		    sizeof (struct receive_record_arg) + rrd->payload_size);
+		return;
+	}
+
+	if (rwa->nworkers > 0) {
+		DMU_RECV_STAT_BUMP(dmu_recv_barriers);
+		while (list_head(&rwa->pending) != rrd)
+			cv_wait(&rwa->pending_cv, &rwa->mutex);
+	}
+	mutex_exit(&rwa->mutex);
+
+	receive_writer_process(rwa, rrd);
+}
+
+/*
+ * dmu_recv_stream's writer thread; pull records off the queue, and then hand
+ * them to the writer threads, or call receive_process_record directly if
+ * there are none.  When we're done, signal the main thread and exit.
  */
 static void
 receive_writer_thread(void *arg)
@@ -3452,26 +3841,41 @@ receive_writer_thread(void *arg)
 	struct receive_writer_arg *rwa = arg;
 	struct receive_record_arg *rrd;
 	fstrans_cookie_t cookie = spl_fstrans_mark();
+	int i;
+
+	for (i = 0; i < rwa->nworkers; i++) {
+		struct receive_writer_worker *rww = &rwa->workers[i];
+
+		rww->rww_rwa = rwa;
+		(void) bqueue_init(&rww->rww_q, zfs_recv_queue_length,
+		    offsetof(struct receive_record_arg, node));
+		rwa->workers_live++;
+		DMU_RECV_STAT_BUMP(dmu_recv_writers);
+		(void) thread_create(NULL, 0, receive_writer_worker_thread,
+		    rww, 0, curproc, TS_RUN, minclsyspri);
+	}
 
 	for (rrd = bqueue_dequeue(&rwa->q); !rrd->eos_marker;
 	    rrd = bqueue_dequeue(&rwa->q)) {
-		/*
-		 * If there's an error, the main thread will stop putting things
-		 * on the queue, but we need to clear everything in it before we
-		 * can exit.
-		 */
-		if (rwa->err == 0) {
-			rwa->err = receive_process_record(rwa, rrd);
-		} else if (rrd->arc_buf != NULL) {
-			dmu_return_arcbuf(rrd->arc_buf);
-			rrd->arc_buf = NULL;
-			rrd->payload = NULL;
-		} else if (rrd->payload != NULL) {
-			kmem_free(rrd->payload, rrd->payload_size);
-			rrd->payload = NULL;
-		}
-		kmem_free(rrd, sizeof (*rrd));
+		receive_writer_dispatch(rwa, rrd);
 	}
+
+	/* Pass the end of the stream on to the writer threads. */
+	for (i = 0; i < rwa->nworkers; i++) {
+		struct receive_record_arg *eos =
+		    kmem_zalloc(sizeof (*eos), KM_SLEEP);
+
+		eos->eos_marker = B_TRUE;
+		bqueue_enqueue(&rwa->workers[i].rww_q, eos, 1);
+	}
+	mutex_enter(&rwa->mutex);
+	while (rwa->workers_live > 0)
+		cv_wait(&rwa->pending_cv, &rwa->mutex);
+	mutex_exit(&rwa->mutex);
+	for (i = 0; i < rwa->nworkers; i++)
+		bqueue_destroy(&rwa->workers[i].rww_q);
+	ASSERT(list_is_empty(&rwa->pending));
+
 	kmem_free(rrd, sizeof (*rrd));
 	mutex_enter(&rwa->mutex);
 	rwa->done = B_TRUE;
@@ -3650,7 +4054,15 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, vnode_t *vp, offset_t *voffp,
 	(void) bqueue_init(&rwa->q, zfs_recv_queue_length,
 	    offsetof(struct receive_record_arg, node));
 	cv_init(&rwa->cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&rwa->pending_cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&rwa->mutex, NULL, MUTEX_DEFAULT, NULL);
+	list_create(&rwa->pending, sizeof (struct receive_record_arg),
+	    offsetof(struct receive_record_arg, pending_node));
+	if (zfs_recv_writer_threads > 1) {
+		rwa->nworkers = zfs_recv_writer_threads;
+		rwa->workers = kmem_zalloc(rwa->nworkers *
+		    sizeof (struct receive_writer_worker), KM_SLEEP);
+	}
 	rwa->os = ra->os;
 	rwa->byteswap = drc->drc_byteswap;
 	rwa->resumable = drc->drc_resumable;
@@ -3660,7 +4072,7 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, vnode_t *vp, offset_t *voffp,
 	    TS_RUN, minclsyspri);
 	/*
 	 * We're reading rwa->err without locks, which is safe since we are the
-	 * only reader, and the worker thread is the only writer.  It's ok if we
+	 * only reader, and the writer threads set it only once.  It's ok if we
 	 * miss a write for an iteration or two of the loop, since the writer
 	 * thread will keep freeing records we send it until we send it an eos
 	 * marker.
@@ -3707,7 +4119,13 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, vnode_t *vp, offset_t *voffp,
 	mutex_exit(&rwa->mutex);
 
 	cv_destroy(&rwa->cv);
+	cv_destroy(&rwa->pending_cv);
 	mutex_destroy(&rwa->mutex);
+	list_destroy(&rwa->pending);
+	if (rwa->workers != NULL) {
+		kmem_free(rwa->workers, rwa->nworkers *
+		    sizeof (struct receive_writer_worker));
+	}
 	bqueue_destroy(&rwa->q);
 	if (err == 0)
 		err = rwa->err;
@@ -4007,7 +4425,42 @@ dmu_objset_is_receiving(objset_t *os)
 	    os->os_dsl_dataset->ds_owner == dmu_recv_tag);
 }
 
+void
+dmu_recv_init(void)
+{
+	dmu_recv_ksp = kstat_create("zfs", 0, "dmu_recv", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (dmu_recv_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (dmu_recv_ksp != NULL) {
+		dmu_recv_ksp->ks_data = &dmu_recv_stats;
+		kstat_install(dmu_recv_ksp);
+	}
+}
+
+void
+dmu_recv_fini(void)
+{
+	if (dmu_recv_ksp != NULL) {
+		kstat_delete(dmu_recv_ksp);
+		dmu_recv_ksp = NULL;
+	}
+}
+
 #if defined(_KERNEL)
 module_param(zfs_send_corrupt_data, int, 0644);
 MODULE_PARM_DESC(zfs_send_corrupt_data, "Allow sending corrupt data");
+
+module_param(zfs_send_traverse_threads, int, 0644);
+MODULE_PARM_DESC(zfs_send_traverse_threads,
+	"Number of threads traversing a dataset being sent");
+
+/* CSTYLED */
+module_param(zfs_send_traverse_min_objects, ulong, 0644);
+MODULE_PARM_DESC(zfs_send_traverse_min_objects,
+	"Minimum number of objects traversed by each send thread");
+
+module_param(zfs_recv_writer_threads, int, 0644);
+MODULE_PARM_DESC(zfs_recv_writer_threads,
+	"Number of threads applying the records of a receive stream");
 #endif
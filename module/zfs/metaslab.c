@@ -262,7 +262,7 @@ metaslab_class_validate(metaslab_class_t *mc)
 		ASSERT(vd->vdev_mg != NULL);
 		ASSERT3P(vd->vdev_top, ==, vd);
 		ASSERT3P(mg->mg_class, ==, mc);
-		ASSERT3P(vd->vdev_ops, !=, &vdev_hole_ops);
+		ASSERT(vdev_is_concrete(vd));
 	} while ((mg = mg->mg_next) != mc->mc_rotor);
 
 	return (0);
@@ -467,8 +467,8 @@ metaslab_verify_space(metaslab_t *msp, uint64_t txg)
 	    !msp->ms_loaded)
 		return;
 
-	sm_free_space = msp->ms_size - space_map_allocated(msp->ms_sm) -
-	    space_map_alloc_delta(msp->ms_sm);
+	sm_free_space = msp->ms_size - msp->ms_allocated_space -
+	    msp->ms_allocated_this_txg;
 
 	/*
 	 * Account for future allocations since we would have already
@@ -873,11 +873,14 @@ metaslab_group_allocatable(metaslab_group_t *mg, metaslab_group_t *rotor,
 
 	/*
 	 * We can only consider skipping this metaslab group if it's
-	 * in the normal metaslab class and there are other metaslab
-	 * groups to select from. Otherwise, we always consider it eligible
-	 * for allocations.
+	 * in the normal, special or dedup metaslab class and there are
+	 * other metaslab groups to select from. Otherwise, we always
+	 * consider it eligible for allocations.
 	 */
-	if (mc != spa_normal_class(spa) || mc->mc_groups <= 1)
+	if ((mc != spa_normal_class(spa) &&
+	    mc != spa_special_class(spa) &&
+	    mc != spa_dedup_class(spa)) ||
+	    mc->mc_groups <= 1)
 		return (B_TRUE);
 
 	/*
@@ -1343,6 +1346,159 @@ metaslab_load_wait(metaslab_t *msp)
 	}
 }
 
+/*
+ * Order the metaslabs with unflushed changes by the txg of their oldest
+ * logged change, see spa_log_spacemap.c.
+ */
+int
+metaslab_unflushed_compare(const void *x1, const void *x2)
+{
+	const metaslab_t *m1 = (const metaslab_t *)x1;
+	const metaslab_t *m2 = (const metaslab_t *)x2;
+
+	int cmp = AVL_CMP(m1->ms_unflushed_txg, m2->ms_unflushed_txg);
+	if (likely(cmp))
+		return (cmp);
+
+	cmp = AVL_CMP(m1->ms_group->mg_vd->vdev_id,
+	    m2->ms_group->mg_vd->vdev_id);
+	if (likely(cmp))
+		return (cmp);
+
+	return (AVL_CMP(m1->ms_id, m2->ms_id));
+}
+
+uint64_t
+metaslab_unflushed_segs(metaslab_t *msp)
+{
+	return (avl_numnodes(&msp->ms_unflushed_allocs->rt_root) +
+	    avl_numnodes(&msp->ms_unflushed_frees->rt_root));
+}
+
+/*
+ * Add the segments of rt, allocated or freed as given by maptype, to the
+ * unflushed changes of the metaslab.
+ */
+static void
+metaslab_unflushed_add(metaslab_t *msp, range_tree_t *rt, maptype_t maptype)
+{
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+	uint64_t segs = metaslab_unflushed_segs(msp);
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (maptype == SM_ALLOC) {
+		range_tree_remove_xor_add(rt, msp->ms_unflushed_frees,
+		    msp->ms_unflushed_allocs);
+	} else {
+		range_tree_remove_xor_add(rt, msp->ms_unflushed_allocs,
+		    msp->ms_unflushed_frees);
+	}
+	atomic_add_64(&spa->spa_log_unflushed_segs,
+	    metaslab_unflushed_segs(msp) - segs);
+}
+
+/*
+ * Make the metaslab known to spa_log_sm_sync_start() as one with changes
+ * to flush.
+ */
+static void
+metaslab_unflushed_insert(metaslab_t *msp)
+{
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (msp->ms_unflushed_logged)
+		return;
+
+	mutex_enter(&spa->spa_flushed_ms_lock);
+	avl_add(&spa->spa_metaslabs_by_flushed, msp);
+	mutex_exit(&spa->spa_flushed_ms_lock);
+	msp->ms_unflushed_logged = B_TRUE;
+}
+
+/*
+ * Forget the unflushed changes, once they have been written to the space
+ * map or when the metaslab goes away.
+ */
+void
+metaslab_unflushed_drop(metaslab_t *msp)
+{
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (!msp->ms_unflushed_logged)
+		return;
+
+	mutex_enter(&spa->spa_flushed_ms_lock);
+	avl_remove(&spa->spa_metaslabs_by_flushed, msp);
+	mutex_exit(&spa->spa_flushed_ms_lock);
+	msp->ms_unflushed_logged = B_FALSE;
+
+	atomic_add_64(&spa->spa_log_unflushed_segs,
+	    -metaslab_unflushed_segs(msp));
+	range_tree_vacate(msp->ms_unflushed_allocs, NULL, NULL);
+	range_tree_vacate(msp->ms_unflushed_frees, NULL, NULL);
+}
+
+/*
+ * Apply an entry of a log space map to the metaslab while the pool is
+ * being loaded.
+ */
+void
+metaslab_unflushed_replay(metaslab_t *msp, uint64_t offset, uint64_t size,
+    maptype_t maptype)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	int64_t delta = (maptype == SM_ALLOC) ? size : -size;
+
+	mutex_enter(&msp->ms_lock);
+	if (maptype == SM_ALLOC) {
+		range_tree_remove_xor_add_segment(offset, offset + size,
+		    msp->ms_unflushed_frees, msp->ms_unflushed_allocs);
+		if (msp->ms_loaded)
+			range_tree_remove(msp->ms_tree, offset, size);
+	} else {
+		range_tree_remove_xor_add_segment(offset, offset + size,
+		    msp->ms_unflushed_allocs, msp->ms_unflushed_frees);
+		if (msp->ms_loaded)
+			range_tree_add(msp->ms_tree, offset, size);
+	}
+	msp->ms_allocated_space += delta;
+	metaslab_unflushed_insert(msp);
+	mutex_exit(&msp->ms_lock);
+
+	vdev_space_update(vd, delta, 0, 0);
+}
+
+/*
+ * Apply the unflushed changes to rt, which has been loaded from the
+ * metaslab's space map with the given maptype.  Both the metaslab's lock
+ * and the lock of rt must be held.
+ */
+void
+metaslab_unflushed_load(metaslab_t *msp, range_tree_t *rt, maptype_t maptype)
+{
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (maptype == SM_ALLOC) {
+		range_tree_walk(msp->ms_unflushed_allocs, range_tree_add, rt);
+		range_tree_walk(msp->ms_unflushed_frees, range_tree_remove, rt);
+	} else {
+		range_tree_walk(msp->ms_unflushed_frees, range_tree_add, rt);
+		range_tree_walk(msp->ms_unflushed_allocs,
+		    range_tree_remove, rt);
+	}
+}
+
+static void
+metaslab_clear_cb(void *arg, uint64_t start, uint64_t size)
+{
+	range_tree_clear(arg, start, size);
+}
+
 int
 metaslab_load(metaslab_t *msp)
 {
@@ -1373,10 +1529,20 @@ metaslab_load(metaslab_t *msp)
 		ASSERT3P(msp->ms_group, !=, NULL);
 		msp->ms_loaded = B_TRUE;
 
+		metaslab_unflushed_load(msp, msp->ms_tree, SM_FREE);
+
 		for (t = 0; t < TXG_DEFER_SIZE; t++) {
 			range_tree_walk(msp->ms_defertree[t],
 			    range_tree_remove, msp->ms_tree);
 		}
+
+		/*
+		 * The frees synced in this txg are already in the unflushed
+		 * trees of a logging metaslab, but they only become usable
+		 * after they have been deferred.
+		 */
+		range_tree_walk(msp->ms_freedtree, metaslab_clear_cb,
+		    msp->ms_tree);
 		msp->ms_max_size = metaslab_block_maxsize(msp);
 	}
 	cv_broadcast(&msp->ms_load_cv);
@@ -1393,6 +1559,29 @@ metaslab_unload(metaslab_t *msp)
 	msp->ms_max_size = 0;
 }
 
+/*
+ * Disable allocations from this metaslab while it is being trimmed.
+ * An active metaslab is passivated by the allocator the next time it
+ * is selected.  Calls may be nested and must be balanced by
+ * metaslab_enable().
+ */
+void
+metaslab_disable(metaslab_t *msp)
+{
+	mutex_enter(&msp->ms_lock);
+	msp->ms_disabled++;
+	mutex_exit(&msp->ms_lock);
+}
+
+void
+metaslab_enable(metaslab_t *msp)
+{
+	mutex_enter(&msp->ms_lock);
+	ASSERT3U(msp->ms_disabled, >, 0);
+	msp->ms_disabled--;
+	mutex_exit(&msp->ms_lock);
+}
+
 int
 metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
     metaslab_t **msp)
@@ -1433,6 +1622,10 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
 	 * data fault on any attempt to use this metaslab before it's ready.
 	 */
 	ms->ms_tree = range_tree_create(&metaslab_rt_ops, ms, &ms->ms_lock);
+	ms->ms_trim = range_tree_create(NULL, NULL, &ms->ms_lock);
+	ms->ms_unflushed_allocs = range_tree_create(NULL, NULL, &ms->ms_lock);
+	ms->ms_unflushed_frees = range_tree_create(NULL, NULL, &ms->ms_lock);
+	ms->ms_allocated_this_txg = space_map_alloc_delta(ms->ms_sm);
 	metaslab_group_add(mg, ms);
 
 	metaslab_set_fragmentation(ms);
@@ -1477,16 +1670,24 @@ metaslab_fini(metaslab_t *msp)
 
 	metaslab_group_t *mg = msp->ms_group;
 
+	mutex_enter(&msp->ms_lock);
+	metaslab_unflushed_drop(msp);
+	mutex_exit(&msp->ms_lock);
+
 	metaslab_group_remove(mg, msp);
 
 	mutex_enter(&msp->ms_lock);
 	VERIFY(msp->ms_group == NULL);
-	vdev_space_update(mg->mg_vd, -space_map_allocated(msp->ms_sm),
+	vdev_space_update(mg->mg_vd, -msp->ms_allocated_space,
 	    0, -msp->ms_size);
 	space_map_close(msp->ms_sm);
 
 	metaslab_unload(msp);
 	range_tree_destroy(msp->ms_tree);
+	range_tree_vacate(msp->ms_trim, NULL, NULL);
+	range_tree_destroy(msp->ms_trim);
+	range_tree_destroy(msp->ms_unflushed_allocs);
+	range_tree_destroy(msp->ms_unflushed_frees);
 	range_tree_destroy(msp->ms_freeingtree);
 	range_tree_destroy(msp->ms_freedtree);
 
@@ -1645,7 +1846,7 @@ metaslab_space_weight(metaslab_t *msp)
 	/*
 	 * The baseline weight is the metaslab's free space.
 	 */
-	space = msp->ms_size - space_map_allocated(msp->ms_sm);
+	space = msp->ms_size - msp->ms_allocated_space;
 
 	if (metaslab_fragmentation_factor_enabled &&
 	    msp->ms_fragmentation != ZFS_FRAG_INVALID) {
@@ -1782,7 +1983,7 @@ metaslab_segment_weight(metaslab_t *msp)
 	/*
 	 * The metaslab is completely free.
 	 */
-	if (space_map_allocated(msp->ms_sm) == 0) {
+	if (msp->ms_allocated_space == 0) {
 		int idx = highbit64(msp->ms_size) - 1;
 		int max_idx = SPACE_MAP_HISTOGRAM_SIZE + shift - 1;
 
@@ -1804,7 +2005,7 @@ metaslab_segment_weight(metaslab_t *msp)
 	/*
 	 * If the metaslab is fully allocated then just make the weight 0.
 	 */
-	if (space_map_allocated(msp->ms_sm) == msp->ms_size)
+	if (msp->ms_allocated_space == msp->ms_size)
 		return (0);
 	/*
 	 * If the metaslab is already loaded, then use the range tree to
@@ -1872,11 +2073,8 @@ metaslab_weight(metaslab_t *msp)
 	 * This vdev is in the process of being removed so there is nothing
 	 * for us to do here.
 	 */
-	if (vd->vdev_removing) {
-		ASSERT0(space_map_allocated(msp->ms_sm));
-		ASSERT0(vd->vdev_ms_shift);
+	if (vd->vdev_removing)
 		return (0);
-	}
 
 	metaslab_set_fragmentation(msp);
 
@@ -2193,6 +2391,41 @@ metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
 	msp->ms_condensing = B_FALSE;
 }
 
+/*
+ * Log the changes of this sync pass to the log space map of the txg and
+ * add them to the unflushed changes of the metaslab.
+ */
+static void
+metaslab_sync_log(metaslab_t *msp, range_tree_t *alloctree, dmu_tx_t *tx)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	spa_t *spa = vd->vdev_spa;
+
+	mutex_enter(&msp->ms_lock);
+
+	spa_log_sm_append(spa, vd->vdev_id, alloctree, SM_ALLOC, tx);
+	spa_log_sm_append(spa, vd->vdev_id, msp->ms_freeingtree, SM_FREE, tx);
+
+	msp->ms_allocated_this_txg += range_tree_space(alloctree) -
+	    range_tree_space(msp->ms_freeingtree);
+
+	if (!msp->ms_unflushed_logged)
+		msp->ms_unflushed_txg = dmu_tx_get_txg(tx);
+	metaslab_unflushed_add(msp, alloctree, SM_ALLOC);
+	metaslab_unflushed_add(msp, msp->ms_freeingtree, SM_FREE);
+	metaslab_unflushed_insert(msp);
+
+	if (spa_sync_pass(spa) == 1) {
+		range_tree_swap(&msp->ms_freeingtree, &msp->ms_freedtree);
+	} else {
+		range_tree_vacate(msp->ms_freeingtree,
+		    range_tree_add, msp->ms_freedtree);
+	}
+	range_tree_vacate(alloctree, NULL, NULL);
+
+	mutex_exit(&msp->ms_lock);
+}
+
 /*
  * Write a metaslab to disk in the context of the specified transaction group.
  */
@@ -2206,6 +2439,7 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	range_tree_t *alloctree = msp->ms_alloctree[txg & TXG_MASK];
 	dmu_tx_t *tx;
 	uint64_t object = space_map_object(msp->ms_sm);
+	boolean_t logging, flushing;
 
 	ASSERT(!vd->vdev_ishole);
 
@@ -2221,15 +2455,33 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	ASSERT3P(msp->ms_freeingtree, !=, NULL);
 	ASSERT3P(msp->ms_freedtree, !=, NULL);
 
+	/*
+	 * A metaslab with unflushed changes which is being forced to
+	 * condense is flushed, as condensing writes out all of its state.
+	 */
+	if (spa_sync_pass(spa) == 1 && msp->ms_unflushed_logged &&
+	    msp->ms_loaded && msp->ms_condense_wanted)
+		msp->ms_flush_txg = txg;
+
+	/*
+	 * While the log_spacemap feature is active, the changes are appended
+	 * to the log space map of this txg instead of the metaslab's space
+	 * map, unless the metaslab is being flushed.
+	 */
+	flushing = (msp->ms_unflushed_logged && msp->ms_flush_txg == txg);
+	logging = (!flushing && spa_log_sm_enabled(spa) &&
+	    vd->vdev_ms_unflushed_object != 0 && msp->ms_sm != NULL);
+
 	/*
 	 * Normally, we don't want to process a metaslab if there
 	 * are no allocations or frees to perform. However, if the metaslab
-	 * is being forced to condense and it's loaded, we need to let it
-	 * through.
+	 * is being forced to condense and it's loaded, or is being flushed,
+	 * we need to let it through.
 	 */
 	if (range_tree_space(alloctree) == 0 &&
 	    range_tree_space(msp->ms_freeingtree) == 0 &&
-	    !(msp->ms_loaded && msp->ms_condense_wanted))
+	    !(msp->ms_loaded && msp->ms_condense_wanted) &&
+	    !(flushing && spa_sync_pass(spa) == 1))
 		return;
 
 
@@ -2247,6 +2499,12 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 
 	tx = dmu_tx_create_assigned(spa_get_dsl(spa), txg);
 
+	if (logging) {
+		metaslab_sync_log(msp, alloctree, tx);
+		dmu_tx_commit(tx);
+		return;
+	}
+
 	if (msp->ms_sm == NULL) {
 		uint64_t new_object;
 
@@ -2261,6 +2519,19 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 
 	mutex_enter(&msp->ms_lock);
 
+	msp->ms_allocated_this_txg += range_tree_space(alloctree) -
+	    range_tree_space(msp->ms_freeingtree);
+
+	/*
+	 * The unflushed trees of a metaslab being flushed take this txg's
+	 * changes as well, so that they stay consistent with the space map
+	 * until metaslab_sync_done() drops them.
+	 */
+	if (flushing) {
+		metaslab_unflushed_add(msp, alloctree, SM_ALLOC);
+		metaslab_unflushed_add(msp, msp->ms_freeingtree, SM_FREE);
+	}
+
 	/*
 	 * Note: metaslab_condense() clears the space map's histogram.
 	 * Therefore we must verify and remove this histogram before
@@ -2273,6 +2544,11 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	if (msp->ms_loaded && spa_sync_pass(spa) == 1 &&
 	    metaslab_should_condense(msp)) {
 		metaslab_condense(msp, txg, tx);
+	} else if (flushing && spa_sync_pass(spa) == 1) {
+		space_map_write(msp->ms_sm, msp->ms_unflushed_allocs,
+		    SM_ALLOC, tx);
+		space_map_write(msp->ms_sm, msp->ms_unflushed_frees,
+		    SM_FREE, tx);
 	} else {
 		space_map_write(msp->ms_sm, alloctree, SM_ALLOC, tx);
 		space_map_write(msp->ms_sm, msp->ms_freeingtree, SM_FREE, tx);
@@ -2317,9 +2593,15 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	 * map histogram. We want to make sure that the on-disk histogram
 	 * accounts for all free space. If the space map is not loaded,
 	 * then we will lose some accuracy but will correct it the next
-	 * time we load the space map.
+	 * time we load the space map.  The same goes for the unflushed
+	 * frees of a metaslab being flushed.
 	 */
-	space_map_histogram_add(msp->ms_sm, msp->ms_freeingtree, tx);
+	if (flushing && spa_sync_pass(spa) == 1 && !msp->ms_loaded) {
+		space_map_histogram_add(msp->ms_sm, msp->ms_unflushed_frees,
+		    tx);
+	} else {
+		space_map_histogram_add(msp->ms_sm, msp->ms_freeingtree, tx);
+	}
 
 	metaslab_group_histogram_add(mg, msp);
 	metaslab_group_histogram_verify(mg);
@@ -2350,6 +2632,19 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 		dmu_write(mos, vd->vdev_ms_array, sizeof (uint64_t) *
 		    msp->ms_id, sizeof (uint64_t), &object, tx);
 	}
+
+	/*
+	 * The logs of this txg and earlier no longer apply to a metaslab
+	 * flushed in this txg.
+	 */
+	if (flushing && spa_sync_pass(spa) == 1 &&
+	    vd->vdev_ms_unflushed_object != 0) {
+		uint64_t unflushed_txg = txg + 1;
+
+		dmu_write(mos, vd->vdev_ms_unflushed_object,
+		    sizeof (uint64_t) * msp->ms_id, sizeof (uint64_t),
+		    &unflushed_txg, tx);
+	}
 	dmu_tx_commit(tx);
 }
 
@@ -2412,7 +2707,7 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	}
 
 	defer_delta = 0;
-	alloc_delta = space_map_alloc_delta(msp->ms_sm);
+	alloc_delta = msp->ms_allocated_this_txg;
 	if (defer_allowed) {
 		defer_delta = range_tree_space(msp->ms_freedtree) -
 		    range_tree_space(*defer_tree);
@@ -2428,6 +2723,24 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	 */
 	metaslab_load_wait(msp);
 
+	/*
+	 * When auto-trimming is enabled, free ranges which get added to
+	 * ms_tree are added to ms_trim as well.  The ms_trim tree is
+	 * periodically consumed by the vdev_autotrim_thread() which issues
+	 * TRIMs for all ranges and then vacates the tree.  The ms_trim tree
+	 * can be discarded at any time with the sole consequence of recent
+	 * frees not being trimmed.
+	 */
+	if (spa_get_autotrim(spa) == SPA_AUTOTRIM_ON) {
+		range_tree_walk(*defer_tree, range_tree_add, msp->ms_trim);
+		if (!defer_allowed) {
+			range_tree_walk(msp->ms_freedtree, range_tree_add,
+			    msp->ms_trim);
+		}
+	} else {
+		range_tree_vacate(msp->ms_trim, NULL, NULL);
+	}
+
 	/*
 	 * Move the frees from the defer_tree back to the free
 	 * range tree (if it's loaded). Swap the freed_tree and the
@@ -2444,6 +2757,17 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	}
 
 	space_map_update(msp->ms_sm);
+	msp->ms_allocated_space += msp->ms_allocated_this_txg;
+	msp->ms_allocated_this_txg = 0;
+
+	/*
+	 * Now that the space map of a flushed metaslab has caught up with
+	 * its unflushed changes, drop them.
+	 */
+	if (msp->ms_unflushed_logged && msp->ms_flush_txg == txg) {
+		metaslab_unflushed_drop(msp);
+		msp->ms_unflushed_txg = txg + 1;
+	}
 
 	msp->ms_deferspace += defer_delta;
 	ASSERT3S(msp->ms_deferspace, >=, 0);
@@ -2716,6 +3040,7 @@ metaslab_block_alloc(metaslab_t *msp, uint64_t size, uint64_t txg)
 		VERIFY0(P2PHASE(size, 1ULL << vd->vdev_ashift));
 		VERIFY3U(range_tree_space(rt) - size, <=, msp->ms_size);
 		range_tree_remove(rt, start, size);
+		range_tree_clear(msp->ms_trim, start, size);
 
 		if (range_tree_space(msp->ms_alloctree[txg & TXG_MASK]) == 0)
 			vdev_dirty(mg->mg_vd, VDD_METASLAB, msp, txg);
@@ -2790,9 +3115,10 @@ metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
 			}
 
 			/*
-			 * If the selected metaslab is condensing, skip it.
+			 * If the selected metaslab is condensing or disabled,
+			 * skip it.
 			 */
-			if (msp->ms_condensing)
+			if (msp->ms_condensing || msp->ms_disabled > 0)
 				continue;
 
 			was_active = msp->ms_weight & METASLAB_ACTIVE_MASK;
@@ -2800,7 +3126,7 @@ metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
 				break;
 
 			target_distance = min_distance +
-			    (space_map_allocated(msp->ms_sm) != 0 ? 0 :
+			    (msp->ms_allocated_space != 0 ? 0 :
 			    min_distance >> 1);
 
 			for (i = 0; i < d; i++) {
@@ -2866,13 +3192,21 @@ metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
 		/*
 		 * If this metaslab is currently condensing then pick again as
 		 * we can't manipulate this metaslab until it's committed
-		 * to disk.
+		 * to disk.  If this metaslab is being trimmed then passivate
+		 * it and pick again; it is reactivated once the TRIM is done.
 		 */
 		if (msp->ms_condensing) {
 			metaslab_trace_add(zal, mg, msp, asize, d,
 			    TRACE_CONDENSING);
 			mutex_exit(&msp->ms_lock);
 			continue;
+		} else if (msp->ms_disabled > 0) {
+			metaslab_trace_add(zal, mg, msp, asize, d,
+			    TRACE_CONDENSING);
+			metaslab_passivate(msp,
+			    msp->ms_weight & ~METASLAB_ACTIVE_MASK);
+			mutex_exit(&msp->ms_lock);
+			continue;
 		}
 
 		offset = metaslab_block_alloc(msp, asize, txg);
@@ -2976,7 +3310,7 @@ int ditto_same_vdev_distance_shift = 3;
 /*
  * Allocate a block for the specified i/o.
  */
-static int
+int
 metaslab_alloc_dva(spa_t *spa, metaslab_class_t *mc, uint64_t psize,
     dva_t *dva, int d, dva_t *hintdva, uint64_t txg, int flags,
     zio_alloc_list_t *zal)
@@ -3219,6 +3553,69 @@ next:
 	return (SET_ERROR(ENOSPC));
 }
 
+/*
+ * Free the range [offset, offset + size) of the concrete vdev vd in the
+ * context of the syncing transaction group.
+ */
+void
+metaslab_free_concrete(vdev_t *vd, uint64_t offset, uint64_t size,
+    uint64_t txg)
+{
+	spa_t *spa = vd->vdev_spa;
+	metaslab_t *msp;
+
+	ASSERT(vdev_is_concrete(vd));
+	ASSERT3U(spa_config_held(spa, SCL_ALL, RW_READER), !=, 0);
+	VERIFY3U(offset >> vd->vdev_ms_shift, <, vd->vdev_ms_count);
+
+	msp = vd->vdev_ms[offset >> vd->vdev_ms_shift];
+
+	VERIFY3U(txg, ==, spa->spa_syncing_txg);
+	VERIFY0(P2PHASE(offset, 1ULL << vd->vdev_ashift));
+	VERIFY0(P2PHASE(size, 1ULL << vd->vdev_ashift));
+
+	mutex_enter(&msp->ms_lock);
+	if (range_tree_space(msp->ms_freeingtree) == 0)
+		vdev_dirty(vd, VDD_METASLAB, msp, txg);
+	range_tree_add(msp->ms_freeingtree, offset, size);
+	mutex_exit(&msp->ms_lock);
+}
+
+/* ARGSUSED */
+void
+metaslab_free_impl_cb(uint64_t inner_offset, vdev_t *vd, uint64_t offset,
+    uint64_t size, void *arg)
+{
+	uint64_t *txgp = arg;
+
+	metaslab_free_impl(vd, offset, size, *txgp);
+}
+
+/*
+ * Free a range of any top-level vdev.  Ranges of removed vdevs are
+ * translated through their indirect mapping, and ranges of the vdev being
+ * removed are handed to the removal code, which may also have to free the
+ * copy of the data.
+ */
+void
+metaslab_free_impl(vdev_t *vd, uint64_t offset, uint64_t size, uint64_t txg)
+{
+	spa_t *spa = vd->vdev_spa;
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+
+	if (txg > spa_freeze_txg(spa))
+		return;
+
+	if (vd->vdev_ops == &vdev_indirect_ops) {
+		vdev_indirect_remap(vd, offset, size, metaslab_free_impl_cb,
+		    &txg);
+	} else if (svr != NULL && svr->svr_vdev_id == vd->vdev_id) {
+		free_from_removing_vdev(vd, offset, size, txg);
+	} else {
+		metaslab_free_concrete(vd, offset, size, txg);
+	}
+}
+
 /*
  * Free the block represented by DVA in the context of the specified
  * transaction group.
@@ -3236,39 +3633,42 @@ metaslab_free_dva(spa_t *spa, const dva_t *dva, uint64_t txg, boolean_t now)
 		return;
 
 	if ((vd = vdev_lookup_top(spa, vdev)) == NULL || !DVA_IS_VALID(dva) ||
-	    (offset >> vd->vdev_ms_shift) >= vd->vdev_ms_count) {
+	    (vd->vdev_ops == &vdev_indirect_ops ?
+	    offset + size > vd->vdev_asize :
+	    (offset >> vd->vdev_ms_shift) >= vd->vdev_ms_count)) {
 		zfs_panic_recover("metaslab_free_dva(): bad DVA %llu:%llu:%llu",
 		    (u_longlong_t)vdev, (u_longlong_t)offset,
 		    (u_longlong_t)size);
 		return;
 	}
 
-	msp = vd->vdev_ms[offset >> vd->vdev_ms_shift];
-
 	if (DVA_GET_GANG(dva))
 		size = vdev_psize_to_asize(vd, SPA_GANGBLOCKSIZE);
 
+	if (!now) {
+		metaslab_free_impl(vd, offset, size, txg);
+		return;
+	}
+
+	/*
+	 * Undoing an allocation of the syncing txg.  Nothing is allocated
+	 * from indirect or removing vdevs, so this is always concrete.
+	 */
+	ASSERT(vdev_is_concrete(vd));
+	msp = vd->vdev_ms[offset >> vd->vdev_ms_shift];
+
 	mutex_enter(&msp->ms_lock);
 
-	if (now) {
-		range_tree_remove(msp->ms_alloctree[txg & TXG_MASK],
-		    offset, size);
+	range_tree_remove(msp->ms_alloctree[txg & TXG_MASK], offset, size);
 
-		VERIFY(!msp->ms_condensing);
-		VERIFY3U(offset, >=, msp->ms_start);
-		VERIFY3U(offset + size, <=, msp->ms_start + msp->ms_size);
-		VERIFY3U(range_tree_space(msp->ms_tree) + size, <=,
-		    msp->ms_size);
-		VERIFY0(P2PHASE(offset, 1ULL << vd->vdev_ashift));
-		VERIFY0(P2PHASE(size, 1ULL << vd->vdev_ashift));
-		range_tree_add(msp->ms_tree, offset, size);
-		msp->ms_max_size = metaslab_block_maxsize(msp);
-	} else {
-		VERIFY3U(txg, ==, spa->spa_syncing_txg);
-		if (range_tree_space(msp->ms_freeingtree) == 0)
-			vdev_dirty(vd, VDD_METASLAB, msp, txg);
-		range_tree_add(msp->ms_freeingtree, offset, size);
-	}
+	VERIFY(!msp->ms_condensing);
+	VERIFY3U(offset, >=, msp->ms_start);
+	VERIFY3U(offset + size, <=, msp->ms_start + msp->ms_size);
+	VERIFY3U(range_tree_space(msp->ms_tree) + size, <=, msp->ms_size);
+	VERIFY0(P2PHASE(offset, 1ULL << vd->vdev_ashift));
+	VERIFY0(P2PHASE(size, 1ULL << vd->vdev_ashift));
+	range_tree_add(msp->ms_tree, offset, size);
+	msp->ms_max_size = metaslab_block_maxsize(msp);
 
 	mutex_exit(&msp->ms_lock);
 }
@@ -3280,26 +3680,18 @@ metaslab_free_dva(spa_t *spa, const dva_t *dva, uint64_t txg, boolean_t now)
  * group didn't commit yet.
  */
 static int
-metaslab_claim_dva(spa_t *spa, const dva_t *dva, uint64_t txg)
+metaslab_claim_concrete(vdev_t *vd, uint64_t offset, uint64_t size,
+    uint64_t txg)
 {
-	uint64_t vdev = DVA_GET_VDEV(dva);
-	uint64_t offset = DVA_GET_OFFSET(dva);
-	uint64_t size = DVA_GET_ASIZE(dva);
-	vdev_t *vd;
+	spa_t *spa = vd->vdev_spa;
 	metaslab_t *msp;
 	int error = 0;
 
-	ASSERT(DVA_IS_VALID(dva));
-
-	if ((vd = vdev_lookup_top(spa, vdev)) == NULL ||
-	    (offset >> vd->vdev_ms_shift) >= vd->vdev_ms_count)
+	if ((offset >> vd->vdev_ms_shift) >= vd->vdev_ms_count)
 		return (SET_ERROR(ENXIO));
 
 	msp = vd->vdev_ms[offset >> vd->vdev_ms_shift];
 
-	if (DVA_GET_GANG(dva))
-		size = vdev_psize_to_asize(vd, SPA_GANGBLOCKSIZE);
-
 	mutex_enter(&msp->ms_lock);
 
 	if ((txg != 0 && spa_writeable(spa)) || !msp->ms_loaded)
@@ -3330,6 +3722,67 @@ metaslab_claim_dva(spa_t *spa, const dva_t *dva, uint64_t txg)
 	return (0);
 }
 
+typedef struct metaslab_claim_cb_arg {
+	uint64_t	mcca_txg;
+	int		mcca_error;
+} metaslab_claim_cb_arg_t;
+
+/* ARGSUSED */
+static void
+metaslab_claim_impl_cb(uint64_t inner_offset, vdev_t *vd, uint64_t offset,
+    uint64_t size, void *arg)
+{
+	metaslab_claim_cb_arg_t *mcca_arg = arg;
+
+	if (mcca_arg->mcca_error == 0) {
+		mcca_arg->mcca_error = metaslab_claim_impl(vd, offset, size,
+		    mcca_arg->mcca_txg);
+	}
+}
+
+/*
+ * Claim a range of any top-level vdev.  Once the data of a removing vdev
+ * has been copied and its sources freed, it is claimed through the
+ * mapping just like that of an indirect vdev.
+ */
+int
+metaslab_claim_impl(vdev_t *vd, uint64_t offset, uint64_t size, uint64_t txg)
+{
+	spa_vdev_removal_t *svr = vd->vdev_spa->spa_vdev_removal;
+
+	if (vd->vdev_ops == &vdev_indirect_ops || (svr != NULL &&
+	    svr->svr_vdev_id == vd->vdev_id && svr->svr_copy_done)) {
+		metaslab_claim_cb_arg_t arg;
+
+		arg.mcca_txg = txg;
+		arg.mcca_error = 0;
+		vdev_indirect_remap(vd, offset, size, metaslab_claim_impl_cb,
+		    &arg);
+		return (arg.mcca_error);
+	}
+
+	return (metaslab_claim_concrete(vd, offset, size, txg));
+}
+
+static int
+metaslab_claim_dva(spa_t *spa, const dva_t *dva, uint64_t txg)
+{
+	uint64_t vdev = DVA_GET_VDEV(dva);
+	uint64_t offset = DVA_GET_OFFSET(dva);
+	uint64_t size = DVA_GET_ASIZE(dva);
+	vdev_t *vd;
+
+	ASSERT(DVA_IS_VALID(dva));
+
+	if ((vd = vdev_lookup_top(spa, vdev)) == NULL)
+		return (SET_ERROR(ENXIO));
+
+	if (DVA_GET_GANG(dva))
+		size = vdev_psize_to_asize(vd, SPA_GANGBLOCKSIZE);
+
+	return (metaslab_claim_impl(vd, offset, size, txg));
+}
+
 /*
  * Reserve some allocation slots. The reservation system must be called
  * before we call into the allocator. If there aren't any available slots
@@ -3352,7 +3805,12 @@ metaslab_class_throttle_reserve(metaslab_class_t *mc, int slots, zio_t *zio,
 	if (reserved_slots < mc->mc_alloc_max_slots)
 		available_slots = mc->mc_alloc_max_slots - reserved_slots;
 
-	if (slots <= available_slots || GANG_ALLOCATION(flags)) {
+	/*
+	 * We always allow reservations for gang blocks and for I/Os that
+	 * are being moved over from another allocation class.
+	 */
+	if (slots <= available_slots || GANG_ALLOCATION(flags) ||
+	    (flags & METASLAB_MUST_RESERVE)) {
 		int d;
 
 		/*
@@ -3550,8 +4008,16 @@ metaslab_check_free(spa_t *spa, const blkptr_t *bp)
 		vdev_t *vd = vdev_lookup_top(spa, vdev);
 		uint64_t offset = DVA_GET_OFFSET(&bp->blk_dva[i]);
 		uint64_t size = DVA_GET_ASIZE(&bp->blk_dva[i]);
-		metaslab_t *msp = vd->vdev_ms[offset >> vd->vdev_ms_shift];
+		metaslab_t *msp;
+
+		/*
+		 * Once a removal has copied everything the whole vdev is
+		 * freed at once, and later frees go through its mapping.
+		 */
+		if (!vdev_is_concrete(vd) || vd->vdev_removing)
+			continue;
 
+		msp = vd->vdev_ms[offset >> vd->vdev_ms_shift];
 		if (msp->ms_loaded)
 			range_tree_verify(msp->ms_tree, offset, size);
 
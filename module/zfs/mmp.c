@@ -229,7 +229,7 @@ vdev_random_leaf(spa_t *spa)
 	while (!vd->vdev_ops->vdev_op_leaf) {
 		child = vd->vdev_child[spa_get_random(vd->vdev_children)];
 
-		if (!vdev_writeable(child))
+		if (!vdev_writeable(child) || !vdev_is_concrete(child))
 			continue;
 
 		if (child->vdev_ops->vdev_op_leaf && child->vdev_mmp_pending) {
@@ -53,6 +53,7 @@
 #include <sys/ddt.h>
 #include <sys/vdev_impl.h>
 #include <sys/vdev_disk.h>
+#include <sys/vdev_trim.h>
 #include <sys/metaslab.h>
 #include <sys/metaslab_impl.h>
 #include <sys/mmp.h>
@@ -148,6 +149,7 @@ const zio_taskq_info_t zio_taskqs[ZIO_TYPES][ZIO_TASKQ_TYPES] = {
 	{ ZTI_P(12, 8),	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* FREE */
 	{ ZTI_ONE,	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* CLAIM */
 	{ ZTI_ONE,	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* IOCTL */
+	{ ZTI_N(4),	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* TRIM */
 };
 
 static sysevent_t *spa_event_create(spa_t *spa, vdev_t *vd, nvlist_t *hist_nvl,
@@ -218,8 +220,14 @@ spa_prop_get_config(spa_t *spa, nvlist_t **nvp)
 	ASSERT(MUTEX_HELD(&spa->spa_props_lock));
 
 	if (rvd != NULL) {
-		alloc = metaslab_class_get_alloc(spa_normal_class(spa));
-		size = metaslab_class_get_space(spa_normal_class(spa));
+		alloc = metaslab_class_get_alloc(mc);
+		alloc += metaslab_class_get_alloc(spa_special_class(spa));
+		alloc += metaslab_class_get_alloc(spa_dedup_class(spa));
+
+		size = metaslab_class_get_space(mc);
+		size += metaslab_class_get_space(spa_special_class(spa));
+		size += metaslab_class_get_space(spa_dedup_class(spa));
+
 		spa_prop_add_list(*nvp, ZPOOL_PROP_NAME, spa_name(spa), 0, src);
 		spa_prop_add_list(*nvp, ZPOOL_PROP_SIZE, NULL, size, src);
 		spa_prop_add_list(*nvp, ZPOOL_PROP_ALLOCATED, NULL, alloc, src);
@@ -1116,6 +1124,8 @@ spa_activate(spa_t *spa, int mode)
 
 	spa->spa_normal_class = metaslab_class_create(spa, zfs_metaslab_ops);
 	spa->spa_log_class = metaslab_class_create(spa, zfs_metaslab_ops);
+	spa->spa_special_class = metaslab_class_create(spa, zfs_metaslab_ops);
+	spa->spa_dedup_class = metaslab_class_create(spa, zfs_metaslab_ops);
 
 	/* Try to create a covering process */
 	mutex_enter(&spa->spa_proc_lock);
@@ -1169,6 +1179,11 @@ spa_activate(spa_t *spa, int mode)
 	    spa_error_entry_compare, sizeof (spa_error_entry_t),
 	    offsetof(spa_error_entry_t, se_avl));
 
+	avl_create(&spa->spa_log_sms, spa_log_sm_compare,
+	    sizeof (spa_log_sm_t), offsetof(spa_log_sm_t, sls_node));
+	avl_create(&spa->spa_metaslabs_by_flushed, metaslab_unflushed_compare,
+	    sizeof (metaslab_t), offsetof(metaslab_t, ms_unflushed_node));
+
 	spa_keystore_init(&spa->spa_keystore);
 
 	/*
@@ -1243,6 +1258,12 @@ spa_deactivate(spa_t *spa)
 	metaslab_class_destroy(spa->spa_log_class);
 	spa->spa_log_class = NULL;
 
+	metaslab_class_destroy(spa->spa_special_class);
+	spa->spa_special_class = NULL;
+
+	metaslab_class_destroy(spa->spa_dedup_class);
+	spa->spa_dedup_class = NULL;
+
 	/*
 	 * If this was part of an import or the open otherwise failed, we may
 	 * still have errors left in the queues.  Empty them just in case.
@@ -1251,6 +1272,9 @@ spa_deactivate(spa_t *spa)
 	avl_destroy(&spa->spa_errlist_scrub);
 	avl_destroy(&spa->spa_errlist_last);
 
+	avl_destroy(&spa->spa_log_sms);
+	avl_destroy(&spa->spa_metaslabs_by_flushed);
+
 	spa_keystore_fini(&spa->spa_keystore);
 
 	spa->spa_state = POOL_STATE_UNINITIALIZED;
@@ -1344,6 +1368,25 @@ spa_unload(spa_t *spa)
 	 */
 	spa_async_suspend(spa);
 
+	/*
+	 * Stop any L2ARC rebuild still in progress.
+	 */
+	l2arc_spa_rebuild_stop(spa);
+
+	/*
+	 * Stop manual and automatic TRIM, a manual TRIM which is still
+	 * active will be resumed when the pool is next imported.
+	 */
+	if (spa->spa_root_vdev != NULL) {
+		vdev_trim_stop_all(spa->spa_root_vdev, VDEV_TRIM_ACTIVE);
+		vdev_autotrim_stop_all(spa);
+	}
+
+	/*
+	 * Stop the device removal thread, it is restarted on import.
+	 */
+	spa_vdev_remove_suspend(spa);
+
 	/*
 	 * Stop syncing.
 	 */
@@ -1351,6 +1394,7 @@ spa_unload(spa_t *spa)
 		txg_sync_stop(spa->spa_dsl_pool);
 		spa->spa_sync_on = B_FALSE;
 	}
+	spa_vdev_remove_fini(spa);
 
 	/*
 	 * Even though vdev_free() also calls vdev_metaslab_fini, we need
@@ -1388,6 +1432,8 @@ spa_unload(spa_t *spa)
 	if (spa->spa_root_vdev)
 		vdev_free(spa->spa_root_vdev);
 	ASSERT(spa->spa_root_vdev == NULL);
+	ASSERT0(avl_numnodes(&spa->spa_metaslabs_by_flushed));
+	spa_log_sm_unload(spa);
 
 	/*
 	 * Close the dsl pool.
@@ -2782,6 +2828,13 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, EIO));
 	spa->spa_meta_objset = spa->spa_dsl_pool->dp_meta_objset;
 
+	/*
+	 * Open the indirect mappings of removed vdevs before anything else
+	 * is read which may have been copied off them.
+	 */
+	if (spa_remove_init(spa) != 0)
+		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, EIO));
+
 	if (spa_dir_prop(spa, DMU_POOL_CONFIG, &spa->spa_config_object) != 0)
 		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, EIO));
 
@@ -3070,6 +3123,7 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 
 	if (error == 0) {
 		uint64_t autoreplace = 0;
+		uint64_t autotrim = SPA_AUTOTRIM_OFF;
 
 		spa_prop_find(spa, ZPOOL_PROP_BOOTFS, &spa->spa_bootfs);
 		spa_prop_find(spa, ZPOOL_PROP_AUTOREPLACE, &autoreplace);
@@ -3077,10 +3131,12 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 		spa_prop_find(spa, ZPOOL_PROP_FAILUREMODE, &spa->spa_failmode);
 		spa_prop_find(spa, ZPOOL_PROP_AUTOEXPAND, &spa->spa_autoexpand);
 		spa_prop_find(spa, ZPOOL_PROP_MULTIHOST, &spa->spa_multihost);
+		spa_prop_find(spa, ZPOOL_PROP_AUTOTRIM, &autotrim);
 		spa_prop_find(spa, ZPOOL_PROP_DEDUPDITTO,
 		    &spa->spa_dedup_ditto);
 
 		spa->spa_autoreplace = (autoreplace != 0);
+		spa->spa_autotrim = autotrim;
 	}
 
 	/*
@@ -3120,6 +3176,14 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 	 */
 	vdev_load(rvd);
 
+	/*
+	 * Bring the metaslabs up to date with the changes which are only
+	 * in the log space maps.
+	 */
+	error = spa_log_sm_load(spa);
+	if (error != 0)
+		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, error));
+
 	/*
 	 * Propagate the leaf DTLs we just loaded all the way up the tree.
 	 */
@@ -3244,7 +3308,9 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 			need_update = B_TRUE;
 
 		for (c = 0; c < rvd->vdev_children; c++)
-			if (rvd->vdev_child[c]->vdev_ms_array == 0)
+			if (vdev_is_concrete(rvd->vdev_child[c]) &&
+			    !rvd->vdev_child[c]->vdev_removing &&
+			    rvd->vdev_child[c]->vdev_ms_array == 0)
 				need_update = B_TRUE;
 
 		/*
@@ -3261,6 +3327,18 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 		    vdev_resilver_needed(rvd, NULL, NULL))
 			spa_async_request(spa, SPA_ASYNC_RESILVER);
 
+		/*
+		 * Resume any manual TRIM which was interrupted and start
+		 * the automatic TRIM threads when enabled.
+		 */
+		spa_async_request(spa, SPA_ASYNC_TRIM_RESTART);
+		spa_async_request(spa, SPA_ASYNC_AUTOTRIM_RESTART);
+
+		/*
+		 * Resume a device removal which was interrupted.
+		 */
+		spa_restart_removal(spa);
+
 		/*
 		 * Log the fact that we booted up (so that we can detect if
 		 * we rebooted in the middle of an operation).
@@ -3279,6 +3357,12 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 		dsl_pool_clean_tmp_userrefs(spa->spa_dsl_pool);
 	}
 
+	/*
+	 * Start restoring the contents of persistent cache devices.
+	 */
+	if (state != SPA_LOAD_TRYIMPORT)
+		l2arc_spa_rebuild_start(spa);
+
 	return (0);
 }
 
@@ -4016,6 +4100,7 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	uint64_t version, obj, root_dsobj = 0;
 	boolean_t has_features;
 	boolean_t has_encryption;
+	boolean_t has_allocclass;
 	spa_feature_t feat;
 	char *feat_name;
 	nvpair_t *elem;
@@ -4061,6 +4146,7 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 
 	has_features = B_FALSE;
 	has_encryption = B_FALSE;
+	has_allocclass = B_FALSE;
 	for (elem = nvlist_next_nvpair(props, NULL);
 	    elem != NULL; elem = nvlist_next_nvpair(props, elem)) {
 		if (zpool_prop_feature(nvpair_name(elem))) {
@@ -4070,6 +4156,8 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 			VERIFY0(zfeature_lookup_name(feat_name, &feat));
 			if (feat == SPA_FEATURE_ENCRYPTION)
 				has_encryption = B_TRUE;
+			if (feat == SPA_FEATURE_ALLOCATION_CLASSES)
+				has_allocclass = B_TRUE;
 		}
 	}
 
@@ -4120,6 +4208,17 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	if (error == 0 && !zfs_allocatable_devs(nvroot))
 		error = SET_ERROR(EINVAL);
 
+	/*
+	 * Special and dedup vdevs require the allocation_classes feature.
+	 */
+	for (c = 0; error == 0 && !has_allocclass &&
+	    c < rvd->vdev_children; c++) {
+		vdev_alloc_bias_t bias = rvd->vdev_child[c]->vdev_alloc_bias;
+
+		if (bias == VDEV_BIAS_SPECIAL || bias == VDEV_BIAS_DEDUP)
+			error = SET_ERROR(ENOTSUP);
+	}
+
 	if (error == 0 &&
 	    (error = vdev_create(rvd, txg, B_FALSE)) == 0 &&
 	    (error = spa_validate_aux(spa, nvroot, txg,
@@ -4248,6 +4347,7 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	spa->spa_failmode = zpool_prop_default_numeric(ZPOOL_PROP_FAILUREMODE);
 	spa->spa_autoexpand = zpool_prop_default_numeric(ZPOOL_PROP_AUTOEXPAND);
 	spa->spa_multihost = zpool_prop_default_numeric(ZPOOL_PROP_MULTIHOST);
+	spa->spa_autotrim = zpool_prop_default_numeric(ZPOOL_PROP_AUTOTRIM);
 
 	if (props != NULL) {
 		spa_configfile_set(spa, props, B_FALSE);
@@ -4774,6 +4874,26 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
 	if ((error = spa_validate_aux(spa, nvroot, txg, VDEV_ALLOC_ADD)) != 0)
 		return (spa_vdev_exit(spa, vd, txg, error));
 
+	/*
+	 * While a top-level vdev is being removed its data may be copied to
+	 * any new vdev, which must then meet the same requirements as the
+	 * existing ones, see spa_vdev_remove_top_check().
+	 */
+	if (spa->spa_vdev_removal != NULL) {
+		uint64_t ashift = vdev_lookup_top(spa,
+		    spa->spa_vdev_removal->svr_vdev_id)->vdev_ashift;
+
+		for (c = 0; c < vd->vdev_children; c++) {
+			tvd = vd->vdev_child[c];
+			if (tvd->vdev_islog)
+				continue;
+			if (vdev_contains_raidz(tvd))
+				return (spa_vdev_exit(spa, vd, txg, ENOTSUP));
+			if (tvd->vdev_ashift != ashift)
+				return (spa_vdev_exit(spa, vd, txg, EINVAL));
+		}
+	}
+
 	/*
 	 * Transfer each new top-level vdev from vd to rvd.
 	 */
@@ -4827,6 +4947,96 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
 	mutex_enter(&spa_namespace_lock);
 	spa_config_update(spa, SPA_CONFIG_UPDATE_POOL);
 	spa_event_notify(spa, NULL, NULL, ESC_ZFS_VDEV_ADD);
+	vdev_autotrim_restart(spa);
+	mutex_exit(&spa_namespace_lock);
+
+	return (0);
+}
+
+/*
+ * Start, cancel or suspend a manual TRIM of the leaf vdev with the given
+ * guid.  A rate of zero leaves the TRIM rate unchanged, which for a new
+ * TRIM means it is not rate limited.
+ */
+int
+spa_vdev_trim(spa_t *spa, uint64_t guid, uint64_t cmd_type, uint64_t rate)
+{
+	vdev_t *vd;
+
+	/*
+	 * We hold the namespace lock through the whole function
+	 * to prevent any changes to the pool while we're starting or
+	 * stopping TRIM.  The config and state locks are held so that
+	 * we can properly assess the vdev state before we commit to
+	 * the TRIM operation.
+	 */
+	mutex_enter(&spa_namespace_lock);
+	spa_config_enter(spa, SCL_CONFIG | SCL_STATE, FTAG, RW_READER);
+
+	/* Look up vdev and ensure it's a leaf. */
+	vd = spa_lookup_by_guid(spa, guid, B_FALSE);
+	if (vd == NULL || vd->vdev_detached) {
+		spa_config_exit(spa, SCL_CONFIG | SCL_STATE, FTAG);
+		mutex_exit(&spa_namespace_lock);
+		return (SET_ERROR(ENODEV));
+	} else if (!vd->vdev_ops->vdev_op_leaf || !vdev_is_concrete(vd)) {
+		spa_config_exit(spa, SCL_CONFIG | SCL_STATE, FTAG);
+		mutex_exit(&spa_namespace_lock);
+		return (SET_ERROR(EINVAL));
+	} else if (!vdev_writeable(vd)) {
+		spa_config_exit(spa, SCL_CONFIG | SCL_STATE, FTAG);
+		mutex_exit(&spa_namespace_lock);
+		return (SET_ERROR(EROFS));
+	} else if (!vd->vdev_has_trim) {
+		spa_config_exit(spa, SCL_CONFIG | SCL_STATE, FTAG);
+		mutex_exit(&spa_namespace_lock);
+		return (SET_ERROR(EOPNOTSUPP));
+	}
+
+	mutex_enter(&vd->vdev_trim_lock);
+	spa_config_exit(spa, SCL_CONFIG | SCL_STATE, FTAG);
+
+	/*
+	 * When we activate a TRIM action we check to see if the
+	 * vdev_trim_thread is NULL.  We do this instead of using the
+	 * vdev_trim_state since there might be a previous TRIM process
+	 * which has completed but the thread is not exited.
+	 */
+	if (cmd_type == POOL_TRIM_START &&
+	    (vd->vdev_trim_thread != NULL || vd->vdev_top->vdev_removing)) {
+		mutex_exit(&vd->vdev_trim_lock);
+		mutex_exit(&spa_namespace_lock);
+		return (SET_ERROR(EBUSY));
+	} else if (cmd_type == POOL_TRIM_CANCEL &&
+	    (vd->vdev_trim_state != VDEV_TRIM_ACTIVE &&
+	    vd->vdev_trim_state != VDEV_TRIM_SUSPENDED)) {
+		mutex_exit(&vd->vdev_trim_lock);
+		mutex_exit(&spa_namespace_lock);
+		return (SET_ERROR(ESRCH));
+	} else if (cmd_type == POOL_TRIM_SUSPEND &&
+	    vd->vdev_trim_state != VDEV_TRIM_ACTIVE) {
+		mutex_exit(&vd->vdev_trim_lock);
+		mutex_exit(&spa_namespace_lock);
+		return (SET_ERROR(ESRCH));
+	}
+
+	switch (cmd_type) {
+	case POOL_TRIM_START:
+		vdev_trim(vd, rate);
+		break;
+	case POOL_TRIM_CANCEL:
+		vdev_trim_stop(vd, VDEV_TRIM_CANCELED);
+		break;
+	case POOL_TRIM_SUSPEND:
+		vdev_trim_stop(vd, VDEV_TRIM_SUSPENDED);
+		break;
+	default:
+		panic("invalid cmd_type %llu", (unsigned long long)cmd_type);
+	}
+	mutex_exit(&vd->vdev_trim_lock);
+
+	/* Sync out the TRIM state */
+	txg_wait_synced(spa->spa_dsl_pool, 0);
 	mutex_exit(&spa_namespace_lock);
 
 	return (0);
@@ -4860,6 +5070,13 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 
 	txg = spa_vdev_enter(spa);
 
+	/*
+	 * A new device would have to be resilvered from data the removal
+	 * is moving around.
+	 */
+	if (spa_vdev_remove_active(spa))
+		return (spa_vdev_exit(spa, NULL, txg, EBUSY));
+
 	oldvd = spa_lookup_by_guid(spa, guid, B_FALSE);
 
 	if (oldvd == NULL)
@@ -5325,6 +5542,18 @@ spa_vdev_split_mirror(spa_t *spa, char *newname, nvlist_t *config,
 	if (spa_lookup(newname) != NULL)
 		return (spa_vdev_exit(spa, NULL, txg, EEXIST));
 
+	/*
+	 * The new pool could not resolve blocks which were copied off a
+	 * removed vdev, or are being copied.
+	 */
+	if (spa_vdev_remove_active(spa))
+		return (spa_vdev_exit(spa, NULL, txg, ENOTSUP));
+	for (c = 0; c < spa->spa_root_vdev->vdev_children; c++) {
+		if (spa->spa_root_vdev->vdev_child[c]->vdev_ops ==
+		    &vdev_indirect_ops)
+			return (spa_vdev_exit(spa, NULL, txg, ENOTSUP));
+	}
+
 	/*
 	 * scan through all the children to ensure they're all mirrors
 	 */
@@ -5418,6 +5647,16 @@ spa_vdev_split_mirror(spa_t *spa, char *newname, nvlist_t *config,
 		    vml[c]->vdev_top->vdev_asize) == 0);
 		VERIFY(nvlist_add_uint64(child[c], ZPOOL_CONFIG_ASHIFT,
 		    vml[c]->vdev_top->vdev_ashift) == 0);
+		if (vml[c]->vdev_top->vdev_alloc_bias == VDEV_BIAS_SPECIAL) {
+			VERIFY0(nvlist_add_string(child[c],
+			    ZPOOL_CONFIG_ALLOCATION_BIAS,
+			    VDEV_ALLOC_BIAS_SPECIAL));
+		} else if (vml[c]->vdev_top->vdev_alloc_bias ==
+		    VDEV_BIAS_DEDUP) {
+			VERIFY0(nvlist_add_string(child[c],
+			    ZPOOL_CONFIG_ALLOCATION_BIAS,
+			    VDEV_ALLOC_BIAS_DEDUP));
+		}
 
 		/* transfer per-vdev ZAPs */
 		ASSERT3U(vml[c]->vdev_leaf_zap, !=, 0);
@@ -5722,8 +5961,8 @@ spa_vdev_remove_from_namespace(spa_t *spa, vdev_t *vd)
  * grab and release the spa_config_lock while still holding the namespace
  * lock.  During each step the configuration is synced out.
  *
- * Currently, this supports removing only hot spares, slogs, and level 2 ARC
- * devices.
+ * This supports removing hot spares, slogs, level 2 ARC devices, and
+ * top-level mirror and disk vdevs.  The latter are only started here.
  */
 int
 spa_vdev_remove(spa_t *spa, uint64_t guid, boolean_t unspare)
@@ -5816,9 +6055,16 @@ spa_vdev_remove(spa_t *spa, uint64_t guid, boolean_t unspare)
 		ev = spa_event_create(spa, vd, NULL, ESC_ZFS_VDEV_REMOVE_DEV);
 		spa_vdev_remove_from_namespace(spa, vd);
 
+	} else if (vd != NULL && vd == vd->vdev_top) {
+		/*
+		 * Normal top-level vdevs are copied off in the background,
+		 * see vdev_removal.c.
+		 */
+		ASSERT(!locked);
+		error = spa_vdev_remove_top(vd, &txg);
 	} else if (vd != NULL) {
 		/*
-		 * Normal vdevs cannot be removed (yet).
+		 * Only whole top-level vdevs can be removed.
 		 */
 		error = SET_ERROR(ENOTSUP);
 	} else {
@@ -6189,12 +6435,37 @@ spa_async_thread(void *arg)
 	if (tasks & SPA_ASYNC_RESILVER_DONE)
 		spa_vdev_resilver_done(spa);
 
+	/*
+	 * Finish, or cancel after an error, a device removal whose copy
+	 * thread is done.
+	 */
+	if (tasks & SPA_ASYNC_REMOVE_COMPLETE)
+		spa_vdev_remove_complete(spa);
+
 	/*
 	 * Kick off a resilver.
 	 */
 	if (tasks & SPA_ASYNC_RESILVER)
 		dsl_resilver_restart(spa->spa_dsl_pool, 0);
 
+	/*
+	 * Resume any manual TRIM which was interrupted.
+	 */
+	if ((tasks & SPA_ASYNC_TRIM_RESTART) && !spa_suspended(spa)) {
+		mutex_enter(&spa_namespace_lock);
+		vdev_trim_restart(spa->spa_root_vdev);
+		mutex_exit(&spa_namespace_lock);
+	}
+
+	/*
+	 * Start or stop the automatic TRIM threads.
+	 */
+	if ((tasks & SPA_ASYNC_AUTOTRIM_RESTART) && !spa_suspended(spa)) {
+		mutex_enter(&spa_namespace_lock);
+		vdev_autotrim_restart(spa);
+		mutex_exit(&spa_namespace_lock);
+	}
+
 	/*
 	 * Let the world know that we're done.
 	 */
@@ -6683,6 +6954,11 @@ spa_sync_props(void *arg, dmu_tx_t *tx)
 			case ZPOOL_PROP_MULTIHOST:
 				spa->spa_multihost = intval;
 				break;
+			case ZPOOL_PROP_AUTOTRIM:
+				spa->spa_autotrim = intval;
+				spa_async_request(spa,
+				    SPA_ASYNC_AUTOTRIM_RESTART);
+				break;
 			case ZPOOL_PROP_DEDUPDITTO:
 				spa->spa_dedup_ditto = intval;
 				break;
@@ -6787,7 +7063,9 @@ spa_sync(spa_t *spa, uint64_t txg)
 	int error;
 	uint32_t max_queue_depth = zfs_vdev_async_write_max_active *
 	    zfs_vdev_queue_depth_pct / 100;
-	uint64_t queue_depth_total;
+	uint64_t normal_queue_depth_total;
+	uint64_t special_queue_depth_total;
+	uint64_t dedup_queue_depth_total;
 	int c;
 
 	VERIFY(spa_writeable(spa));
@@ -6863,12 +7141,14 @@ spa_sync(spa_t *spa, uint64_t txg)
 	 * The max queue depth will not change in the middle of syncing
 	 * out this txg.
 	 */
-	queue_depth_total = 0;
+	normal_queue_depth_total = 0;
+	special_queue_depth_total = 0;
+	dedup_queue_depth_total = 0;
 	for (c = 0; c < rvd->vdev_children; c++) {
 		vdev_t *tvd = rvd->vdev_child[c];
 		metaslab_group_t *mg = tvd->vdev_mg;
 
-		if (mg == NULL || mg->mg_class != spa_normal_class(spa) ||
+		if (mg == NULL || mg->mg_class == spa_log_class(spa) ||
 		    !metaslab_group_initialized(mg))
 			continue;
 
@@ -6879,15 +7159,36 @@ spa_sync(spa_t *spa, uint64_t txg)
 		 */
 		ASSERT0(refcount_count(&mg->mg_alloc_queue_depth));
 		mg->mg_max_alloc_queue_depth = max_queue_depth;
-		queue_depth_total += mg->mg_max_alloc_queue_depth;
+
+		if (mg->mg_class == spa_normal_class(spa)) {
+			normal_queue_depth_total +=
+			    mg->mg_max_alloc_queue_depth;
+		} else if (mg->mg_class == spa_special_class(spa)) {
+			special_queue_depth_total +=
+			    mg->mg_max_alloc_queue_depth;
+		} else if (mg->mg_class == spa_dedup_class(spa)) {
+			dedup_queue_depth_total +=
+			    mg->mg_max_alloc_queue_depth;
+		}
 	}
+
 	mc = spa_normal_class(spa);
 	ASSERT0(refcount_count(&mc->mc_alloc_slots));
-	mc->mc_alloc_max_slots = queue_depth_total;
+	mc->mc_alloc_max_slots = normal_queue_depth_total;
+	mc->mc_alloc_throttle_enabled = zio_dva_throttle_enabled;
+
+	mc = spa_special_class(spa);
+	ASSERT0(refcount_count(&mc->mc_alloc_slots));
+	mc->mc_alloc_max_slots = special_queue_depth_total;
 	mc->mc_alloc_throttle_enabled = zio_dva_throttle_enabled;
 
-	ASSERT3U(mc->mc_alloc_max_slots, <=,
-	    max_queue_depth * rvd->vdev_children);
+	mc = spa_dedup_class(spa);
+	ASSERT0(refcount_count(&mc->mc_alloc_slots));
+	mc->mc_alloc_max_slots = dedup_queue_depth_total;
+	mc->mc_alloc_throttle_enabled = zio_dva_throttle_enabled;
+
+	ASSERT3U(normal_queue_depth_total + special_queue_depth_total +
+	    dedup_queue_depth_total, <=, max_queue_depth * rvd->vdev_children);
 
 	/*
 	 * Iterate to convergence.
@@ -6918,6 +7219,9 @@ spa_sync(spa_t *spa, uint64_t txg)
 		ddt_sync(spa, txg);
 		dsl_scan_sync(dp, tx);
 
+		if (pass == 1)
+			spa_log_sm_sync_start(spa, tx);
+
 		while ((vd = txg_list_remove(&spa->spa_vdev_txg_list, txg)))
 			vdev_sync(vd, txg);
 
@@ -7070,6 +7374,13 @@ spa_sync(spa_t *spa, uint64_t txg)
 	 * that txg has been completed.
 	 */
 	spa->spa_ubsync = spa->spa_uberblock;
+
+	/*
+	 * Wake the automatic TRIM threads to process the frees from
+	 * this txg.
+	 */
+	vdev_autotrim_kick(spa);
+
 	spa_config_exit(spa, SCL_CONFIG, FTAG);
 
 	spa_handle_ignored_writes(spa);
@@ -558,6 +558,10 @@ spa_config_update(spa_t *spa, int what)
 		 */
 		for (c = 0; c < rvd->vdev_children; c++) {
 			vdev_t *tvd = rvd->vdev_child[c];
+
+			/* Removed vdevs are never allocated from again. */
+			if (tvd->vdev_ops == &vdev_indirect_ops)
+				continue;
 			if (tvd->vdev_ms_array == 0)
 				vdev_metaslab_set_size(tvd);
 			vdev_expand(tvd, txg);
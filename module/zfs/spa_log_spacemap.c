@@ -0,0 +1,412 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa_impl.h>
+#include <sys/dmu.h>
+#include <sys/dmu_tx.h>
+#include <sys/dmu_objset.h>
+#include <sys/zap.h>
+#include <sys/vdev_impl.h>
+#include <sys/metaslab.h>
+#include <sys/metaslab_impl.h>
+#include <sys/zfeature.h>
+#include <sys/spa_log_spacemap.h>
+
+/*
+ * Log space maps.
+ *
+ * Without them every metaslab changed in a txg has its allocs and frees
+ * appended to its own space map, so a txg which frees blocks all over
+ * the pool writes one small space map block per metaslab.  With the
+ * log_spacemap feature active the changes of each txg are appended to a
+ * single log space map instead, one object per txg, in which each entry
+ * names the vdev it applies to.  The changes are also kept in-core, in
+ * the ms_unflushed_allocs and ms_unflushed_frees trees of the metaslab.
+ *
+ * In pass 1 of every txg that does any work, spa_log_sm_sync_start()
+ * picks a few metaslabs, those holding the oldest logged changes first,
+ * and metaslab_sync() flushes them: it writes their unflushed changes to
+ * their own space map as before, and persists the txg from which on the
+ * logs apply to them again in the vdev's unflushed txgs object.  Logs
+ * older than the oldest change still unflushed are destroyed.  Enough
+ * metaslabs are flushed that each is flushed at least every
+ * zfs_unflushed_log_txg_max txgs, and more while the unflushed trees use
+ * more memory than the budget given by zfs_unflushed_max_mem_amt and
+ * zfs_unflushed_max_mem_ppm.
+ *
+ * On import spa_log_sm_load() replays the logs, oldest first, into the
+ * unflushed trees of the metaslabs they apply to.  Whoever reads a space
+ * map of a logging metaslab applies the unflushed trees on top of it.
+ */
+
+/*
+ * Upper bound of the memory used by the unflushed trees of all
+ * metaslabs, in bytes, and in parts per million of physical memory.
+ * The smaller one applies.
+ */
+unsigned long zfs_unflushed_max_mem_amt = 1ULL << 30;
+unsigned long zfs_unflushed_max_mem_ppm = 1000;
+
+/*
+ * Number of txgs after which a logged change is flushed to the space map
+ * of its metaslab, which bounds the number of logs to replay on import.
+ */
+unsigned long zfs_unflushed_log_txg_max = 1000;
+
+/*
+ * Metaslabs flushed at least in every txg that changes anything.
+ */
+unsigned long zfs_min_metaslabs_to_flush = 1;
+
+/*
+ * Block size of the log space map objects.
+ */
+int zfs_log_sm_blksz = 1 << 17;
+
+boolean_t
+spa_log_sm_enabled(spa_t *spa)
+{
+	return (spa_feature_is_active(spa, SPA_FEATURE_LOG_SPACEMAP));
+}
+
+int
+spa_log_sm_compare(const void *x1, const void *x2)
+{
+	const spa_log_sm_t *s1 = x1;
+	const spa_log_sm_t *s2 = x2;
+
+	return (AVL_CMP(s1->sls_txg, s2->sls_txg));
+}
+
+static uint64_t
+spa_log_sm_mem_limit(void)
+{
+	uint64_t limit = (uint64_t)physmem * PAGESIZE / 1000000 *
+	    zfs_unflushed_max_mem_ppm;
+
+	return (MIN(limit, zfs_unflushed_max_mem_amt));
+}
+
+/*
+ * Destroy the logs whose changes have all been flushed.
+ */
+static void
+spa_log_sm_retire(spa_t *spa, uint64_t min_txg, dmu_tx_t *tx)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	spa_log_sm_t *sls;
+
+	mutex_enter(&spa->spa_log_sm_lock);
+	while ((sls = avl_first(&spa->spa_log_sms)) != NULL &&
+	    sls->sls_txg < min_txg) {
+		VERIFY0(dmu_object_free(mos, sls->sls_object, tx));
+		VERIFY0(zap_remove_int(mos, spa->spa_log_sm_zap,
+		    sls->sls_txg, tx));
+		if (spa->spa_syncing_log_sm == sls)
+			spa->spa_syncing_log_sm = NULL;
+		avl_remove(&spa->spa_log_sms, sls);
+		kmem_free(sls, sizeof (*sls));
+	}
+	mutex_exit(&spa->spa_log_sm_lock);
+}
+
+/*
+ * Called in pass 1 of spa_sync(), before the vdevs are synced.  Retire
+ * the logs which are no longer needed and mark the metaslabs to flush in
+ * this txg dirty.
+ */
+void
+spa_log_sm_sync_start(spa_t *spa, dmu_tx_t *tx)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	avl_tree_t *t = &spa->spa_metaslabs_by_flushed;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	uint64_t nflushed = 0, want, mem, limit;
+	metaslab_t *msp;
+
+	ASSERT3U(spa_sync_pass(spa), ==, 1);
+
+	spa->spa_log_flushed_ms = 0;
+
+	/*
+	 * Leave txgs which change nothing alone, so an idle pool stays idle.
+	 */
+	if (!spa_feature_is_enabled(spa, SPA_FEATURE_LOG_SPACEMAP) ||
+	    !dmu_objset_is_dirty(mos, txg))
+		return;
+
+	if (!spa_log_sm_enabled(spa)) {
+		spa->spa_log_sm_zap = zap_create_link(mos,
+		    DMU_OTN_ZAP_METADATA, DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_LOG_SPACEMAP_ZAP, tx);
+		spa_feature_incr(spa, SPA_FEATURE_LOG_SPACEMAP, tx);
+		return;
+	}
+
+	mutex_enter(&spa->spa_flushed_ms_lock);
+	msp = avl_first(t);
+	spa_log_sm_retire(spa, (msp != NULL) ? msp->ms_unflushed_txg : txg,
+	    tx);
+
+	want = MAX(zfs_min_metaslabs_to_flush,
+	    howmany(avl_numnodes(t), MAX(zfs_unflushed_log_txg_max, 1)));
+	mem = spa->spa_log_unflushed_segs * sizeof (range_seg_t);
+	limit = spa_log_sm_mem_limit();
+
+	for (; msp != NULL; msp = AVL_NEXT(t, msp)) {
+		uint64_t segs = metaslab_unflushed_segs(msp);
+
+		if (nflushed >= want && mem <= limit &&
+		    msp->ms_unflushed_txg + zfs_unflushed_log_txg_max > txg)
+			break;
+
+		msp->ms_flush_txg = txg;
+		vdev_dirty(msp->ms_group->mg_vd, VDD_METASLAB, msp, txg);
+		mem -= MIN(mem, segs * sizeof (range_seg_t));
+		nflushed++;
+	}
+	mutex_exit(&spa->spa_flushed_ms_lock);
+
+	spa->spa_log_flushed_ms = nflushed;
+}
+
+/*
+ * Return the log of the syncing txg, creating it on the first append.
+ */
+static spa_log_sm_t *
+spa_log_sm_syncing(spa_t *spa, dmu_tx_t *tx)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	uint64_t txg = dmu_tx_get_txg(tx);
+	spa_log_sm_t *sls = spa->spa_syncing_log_sm;
+
+	ASSERT(MUTEX_HELD(&spa->spa_log_sm_lock));
+
+	if (sls != NULL && sls->sls_txg == txg)
+		return (sls);
+
+	sls = kmem_zalloc(sizeof (*sls), KM_SLEEP);
+	sls->sls_txg = txg;
+	sls->sls_object = dmu_object_alloc(mos, DMU_OTN_UINT64_METADATA,
+	    zfs_log_sm_blksz, DMU_OT_NONE, 0, tx);
+	VERIFY0(zap_add_int_key(mos, spa->spa_log_sm_zap, txg,
+	    sls->sls_object, tx));
+	avl_add(&spa->spa_log_sms, sls);
+	spa->spa_syncing_log_sm = sls;
+
+	return (sls);
+}
+
+/*
+ * Append the segments of rt, of the given type, to the log of the
+ * syncing txg.  Called by metaslab_sync() with the lock of rt held, which
+ * is dropped across the write like space_map_write() does.
+ */
+void
+spa_log_sm_append(spa_t *spa, uint64_t vdev_id, range_tree_t *rt,
+    maptype_t maptype, dmu_tx_t *tx)
+{
+	uint64_t nsegs = avl_numnodes(&rt->rt_root);
+	uint64_t size = nsegs * SLS_ENTRY_SIZE;
+	spa_log_sm_t *sls;
+	range_seg_t *rs;
+	uint64_t *entries, *e;
+
+	ASSERT(MUTEX_HELD(rt->rt_lock));
+	ASSERT(dmu_tx_is_syncing(tx));
+
+	if (nsegs == 0)
+		return;
+
+	entries = e = vmem_alloc(size, KM_SLEEP);
+	for (rs = avl_first(&rt->rt_root); rs != NULL;
+	    rs = AVL_NEXT(&rt->rt_root, rs)) {
+		*e++ = SLS_VALID_ENCODE(1) | SLS_VDEV_ENCODE(vdev_id) |
+		    SLS_TYPE_ENCODE(maptype) |
+		    SLS_RUN_ENCODE(rs->rs_end - rs->rs_start);
+		*e++ = rs->rs_start;
+	}
+
+	mutex_exit(rt->rt_lock);
+	mutex_enter(&spa->spa_log_sm_lock);
+	sls = spa_log_sm_syncing(spa, tx);
+	dmu_write(spa_meta_objset(spa), sls->sls_object, sls->sls_length,
+	    size, entries, tx);
+	sls->sls_length += size;
+	mutex_exit(&spa->spa_log_sm_lock);
+	mutex_enter(rt->rt_lock);
+
+	vmem_free(entries, size);
+}
+
+static void
+spa_log_sm_replay_entry(spa_t *spa, uint64_t txg, uint64_t entry,
+    uint64_t offset)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	uint64_t vdev_id = SLS_VDEV_DECODE(entry);
+	metaslab_t *msp;
+	vdev_t *vd;
+
+	if (vdev_id >= rvd->vdev_children)
+		return;
+
+	/*
+	 * Only vdevs with an unflushed txgs object log their changes.  The
+	 * entries of a removed vdev, or of the vdev whose slot a new one
+	 * took, no longer apply.
+	 */
+	vd = rvd->vdev_child[vdev_id];
+	if (vd->vdev_ms_unflushed_object == 0 ||
+	    (offset >> vd->vdev_ms_shift) >= vd->vdev_ms_count)
+		return;
+
+	msp = vd->vdev_ms[offset >> vd->vdev_ms_shift];
+	if (msp->ms_sm == NULL || txg < msp->ms_unflushed_txg)
+		return;
+
+	metaslab_unflushed_replay(msp, offset, SLS_RUN_DECODE(entry),
+	    SLS_TYPE_DECODE(entry));
+}
+
+static int
+spa_log_sm_replay(spa_t *spa, spa_log_sm_t *sls)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	dmu_object_info_t doi;
+	uint64_t *buf, bufsize, off, i;
+	int error;
+
+	error = dmu_object_info(mos, sls->sls_object, &doi);
+	if (error != 0)
+		return (error);
+
+	bufsize = doi.doi_data_block_size;
+	buf = vmem_alloc(bufsize, KM_SLEEP);
+
+	/*
+	 * The log is written in order, and ends at the first entry without
+	 * the valid bit.
+	 */
+	for (off = 0; off < doi.doi_max_offset; off += bufsize) {
+		error = dmu_read(mos, sls->sls_object, off, bufsize, buf,
+		    DMU_READ_PREFETCH);
+		if (error != 0)
+			break;
+
+		for (i = 0; i < bufsize / sizeof (uint64_t); i += 2) {
+			if (!SLS_VALID_DECODE(buf[i]))
+				goto out;
+
+			spa_log_sm_replay_entry(spa, sls->sls_txg, buf[i],
+			    buf[i + 1]);
+			sls->sls_length += SLS_ENTRY_SIZE;
+		}
+	}
+out:
+	vmem_free(buf, bufsize);
+
+	return (error);
+}
+
+/*
+ * Read the list of logs and replay them into the unflushed trees of the
+ * metaslabs, oldest first.  Called by spa_load() once the metaslabs have
+ * been opened.
+ */
+int
+spa_log_sm_load(spa_t *spa)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	spa_log_sm_t *sls;
+	int error;
+
+	if (!spa_log_sm_enabled(spa))
+		return (0);
+
+	error = zap_lookup(mos, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_LOG_SPACEMAP_ZAP, sizeof (uint64_t), 1,
+	    &spa->spa_log_sm_zap);
+	if (error != 0)
+		return (error);
+
+	for (zap_cursor_init(&zc, mos, spa->spa_log_sm_zap);
+	    (error = zap_cursor_retrieve(&zc, &za)) == 0;
+	    zap_cursor_advance(&zc)) {
+		sls = kmem_zalloc(sizeof (*sls), KM_SLEEP);
+		sls->sls_txg = zfs_strtonum(za.za_name, NULL);
+		sls->sls_object = za.za_first_integer;
+		avl_add(&spa->spa_log_sms, sls);
+	}
+	zap_cursor_fini(&zc);
+	if (error != ENOENT)
+		return (error);
+
+	for (sls = avl_first(&spa->spa_log_sms); sls != NULL;
+	    sls = AVL_NEXT(&spa->spa_log_sms, sls)) {
+		error = spa_log_sm_replay(spa, sls);
+		if (error != 0)
+			return (error);
+	}
+
+	return (0);
+}
+
+void
+spa_log_sm_unload(spa_t *spa)
+{
+	spa_log_sm_t *sls;
+
+	mutex_enter(&spa->spa_log_sm_lock);
+	while ((sls = avl_first(&spa->spa_log_sms)) != NULL) {
+		avl_remove(&spa->spa_log_sms, sls);
+		kmem_free(sls, sizeof (*sls));
+	}
+	spa->spa_syncing_log_sm = NULL;
+	spa->spa_log_sm_zap = 0;
+	mutex_exit(&spa->spa_log_sm_lock);
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+/* BEGIN CSTYLED */
+module_param(zfs_unflushed_max_mem_amt, ulong, 0644);
+MODULE_PARM_DESC(zfs_unflushed_max_mem_amt,
+	"Max memory of unflushed metaslab changes, in bytes");
+
+module_param(zfs_unflushed_max_mem_ppm, ulong, 0644);
+MODULE_PARM_DESC(zfs_unflushed_max_mem_ppm,
+	"Max memory of unflushed metaslab changes, in ppm of physical memory");
+
+module_param(zfs_unflushed_log_txg_max, ulong, 0644);
+MODULE_PARM_DESC(zfs_unflushed_log_txg_max,
+	"Txgs after which a logged metaslab change is flushed");
+
+module_param(zfs_min_metaslabs_to_flush, ulong, 0644);
+MODULE_PARM_DESC(zfs_min_metaslabs_to_flush,
+	"Min metaslabs flushed per txg");
+
+module_param(zfs_log_sm_blksz, int, 0644);
+MODULE_PARM_DESC(zfs_log_sm_blksz, "Block size of log space maps");
+/* END CSTYLED */
+#endif
@@ -253,6 +253,7 @@ typedef struct spa_txg_history {
 	uint64_t	reads;		/* number of read operations */
 	uint64_t	writes;		/* number of write operations */
 	uint64_t	ndirty;		/* number of dirty bytes */
+	uint64_t	msflush;	/* number of metaslabs flushed */
 	hrtime_t	times[TXG_STATE_COMMITTED]; /* completion times */
 	list_node_t	sth_link;
 } spa_txg_history_t;
@@ -261,9 +262,9 @@ static int
 spa_txg_history_headers(char *buf, size_t size)
 {
 	(void) snprintf(buf, size, "%-8s %-16s %-5s %-12s %-12s %-12s "
-	    "%-8s %-8s %-12s %-12s %-12s %-12s\n", "txg", "birth", "state",
-	    "ndirty", "nread", "nwritten", "reads", "writes",
-	    "otime", "qtime", "wtime", "stime");
+	    "%-8s %-8s %-8s %-12s %-12s %-12s %-12s\n", "txg", "birth",
+	    "state", "ndirty", "nread", "nwritten", "reads", "writes",
+	    "msflush", "otime", "qtime", "wtime", "stime");
 
 	return (0);
 }
@@ -302,13 +303,14 @@ spa_txg_history_data(char *buf, size_t size, void *data)
 		    sth->times[TXG_STATE_WAIT_FOR_SYNC];
 
 	(void) snprintf(buf, size, "%-8llu %-16llu %-5c %-12llu "
-	    "%-12llu %-12llu %-8llu %-8llu %-12llu %-12llu %-12llu %-12llu\n",
+	    "%-12llu %-12llu %-8llu %-8llu %-8llu %-12llu %-12llu %-12llu "
+	    "%-12llu\n",
 	    (longlong_t)sth->txg, sth->times[TXG_STATE_BIRTH], state,
 	    (u_longlong_t)sth->ndirty,
 	    (u_longlong_t)sth->nread, (u_longlong_t)sth->nwritten,
 	    (u_longlong_t)sth->reads, (u_longlong_t)sth->writes,
-	    (u_longlong_t)open, (u_longlong_t)quiesce, (u_longlong_t)wait,
-	    (u_longlong_t)sync);
+	    (u_longlong_t)sth->msflush, (u_longlong_t)open,
+	    (u_longlong_t)quiesce, (u_longlong_t)wait, (u_longlong_t)sync);
 
 	return (0);
 }
@@ -484,7 +486,8 @@ spa_txg_history_set(spa_t *spa, uint64_t txg, txg_state_t completed_state,
  */
 static int
 spa_txg_history_set_io(spa_t *spa, uint64_t txg, uint64_t nread,
-    uint64_t nwritten, uint64_t reads, uint64_t writes, uint64_t ndirty)
+    uint64_t nwritten, uint64_t reads, uint64_t writes, uint64_t ndirty,
+    uint64_t msflush)
 {
 	spa_stats_history_t *ssh = &spa->spa_stats.txg_history;
 	spa_txg_history_t *sth;
@@ -502,6 +505,7 @@ spa_txg_history_set_io(spa_t *spa, uint64_t txg, uint64_t nread,
 			sth->reads = reads;
 			sth->writes = writes;
 			sth->ndirty = ndirty;
+			sth->msflush = msflush;
 			error = 0;
 			break;
 		}
@@ -554,7 +558,7 @@ spa_txg_history_fini_io(spa_t *spa, txg_stat_t *ts)
 	    ts->vs2.vs_bytes[ZIO_TYPE_WRITE] - ts->vs1.vs_bytes[ZIO_TYPE_WRITE],
 	    ts->vs2.vs_ops[ZIO_TYPE_READ] - ts->vs1.vs_ops[ZIO_TYPE_READ],
 	    ts->vs2.vs_ops[ZIO_TYPE_WRITE] - ts->vs1.vs_ops[ZIO_TYPE_WRITE],
-	    ts->ndirty);
+	    ts->ndirty, spa->spa_log_flushed_ms);
 
 	kmem_free(ts, sizeof (txg_stat_t));
 }
@@ -711,6 +715,113 @@ spa_io_history_destroy(spa_t *spa)
 	mutex_destroy(&ssh->lock);
 }
 
+/*
+ * ==========================================================================
+ * SPA Device Removal Routines
+ * ==========================================================================
+ */
+
+/*
+ * Progress of the current, or last, device removal, and the memory used
+ * by the in-core indirect mappings of removed vdevs.
+ */
+typedef struct spa_removal_stats {
+	kstat_named_t	vdev;
+	kstat_named_t	state;
+	kstat_named_t	to_copy;
+	kstat_named_t	copied;
+	kstat_named_t	remaining;
+	kstat_named_t	bytes_per_sec;
+	kstat_named_t	mapping_entries;
+	kstat_named_t	mapping_memory;
+} spa_removal_stats_t;
+
+static spa_removal_stats_t spa_removal_stats_template = {
+	{ "vdev",			KSTAT_DATA_UINT64 },
+	{ "state",			KSTAT_DATA_UINT64 },
+	{ "to_copy",			KSTAT_DATA_UINT64 },
+	{ "copied",			KSTAT_DATA_UINT64 },
+	{ "remaining",			KSTAT_DATA_UINT64 },
+	{ "bytes_per_sec",		KSTAT_DATA_UINT64 },
+	{ "mapping_entries",		KSTAT_DATA_UINT64 },
+	{ "mapping_memory",		KSTAT_DATA_UINT64 },
+};
+
+static int
+spa_removal_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_removal_stats_t *srs = ksp->ks_data;
+	pool_removal_stat_t prs;
+	uint64_t rate, entries, memory;
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+	if (spa_removal_get_stats(spa, &prs) != 0) {
+		bzero(&prs, sizeof (prs));
+		prs.prs_removing_vdev = -1ULL;
+	}
+	spa_removal_kstat_update(spa, &rate, &entries, &memory);
+	spa_config_exit(spa, SCL_CONFIG, FTAG);
+
+	srs->vdev.value.ui64 = prs.prs_removing_vdev;
+	srs->state.value.ui64 = prs.prs_state;
+	srs->to_copy.value.ui64 = prs.prs_to_copy;
+	srs->copied.value.ui64 = prs.prs_copied;
+	srs->remaining.value.ui64 = (prs.prs_state == DSS_SCANNING &&
+	    prs.prs_to_copy > prs.prs_copied) ?
+	    prs.prs_to_copy - prs.prs_copied : 0;
+	srs->bytes_per_sec.value.ui64 = rate;
+	srs->mapping_entries.value.ui64 = entries;
+	srs->mapping_memory.value.ui64 = memory;
+
+	return (0);
+}
+
+static void
+spa_removal_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.removal;
+	char *name;
+	kstat_t *ksp;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->size = sizeof (spa_removal_stats_t);
+	ssh->private = kmem_alloc(ssh->size, KM_SLEEP);
+	bcopy(&spa_removal_stats_template, ssh->private, ssh->size);
+
+	name = kmem_asprintf("zfs/%s", spa_name(spa));
+
+	ksp = kstat_create(name, 0, "removal", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (spa_removal_stats_t) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = ssh->private;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_removal_update;
+		kstat_install(ksp);
+	}
+	strfree(name);
+}
+
+static void
+spa_removal_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.removal;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	kmem_free(ssh->private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
 /*
  * ==========================================================================
  * SPA MMP History Routines
@@ -904,6 +1015,215 @@ spa_mmp_history_add(uint64_t txg, uint64_t timestamp, uint64_t mmp_delay,
 	mutex_exit(&ssh->lock);
 }
 
+/*
+ * ==========================================================================
+ * SPA Mirror Child Routines
+ * ==========================================================================
+ */
+
+/*
+ * Mirror statistics - How many reads each child of a mirror, replacing or
+ * spare vdev served and why it was selected, along with the decaying
+ * device estimates the selection is based on.  The entries are a snapshot
+ * of the vdev tree taken when the kstat is read.  Writing the kstat
+ * resets the read counts.
+ */
+typedef struct spa_mirror_child {
+	uint64_t	vdev_guid;
+	uint64_t	reads[VDEV_MIRROR_SEL_TYPES];
+	uint64_t	latency;	/* nanoseconds */
+	uint64_t	throughput;	/* bytes per second */
+	char		*vdev_path;
+} spa_mirror_child_t;
+
+static int
+spa_mirror_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-24s %-12s %-12s %-12s %-12s %-12s "
+	    "%-12s %s\n", "vdev_guid", "load", "latency", "spread", "retry",
+	    "lat_ns", "bytes_sec", "vdev_path");
+	return (0);
+}
+
+static int
+spa_mirror_data(char *buf, size_t size, void *data)
+{
+	spa_mirror_child_t *smc = (spa_mirror_child_t *)data;
+
+	(void) snprintf(buf, size, "%-24llu %-12llu %-12llu %-12llu %-12llu "
+	    "%-12llu %-12llu %s\n", (u_longlong_t)smc->vdev_guid,
+	    (u_longlong_t)smc->reads[VDEV_MIRROR_SEL_LOAD],
+	    (u_longlong_t)smc->reads[VDEV_MIRROR_SEL_LATENCY],
+	    (u_longlong_t)smc->reads[VDEV_MIRROR_SEL_SPREAD],
+	    (u_longlong_t)smc->reads[VDEV_MIRROR_SEL_RETRY],
+	    (u_longlong_t)smc->latency, (u_longlong_t)smc->throughput,
+	    (smc->vdev_path ? smc->vdev_path : "-"));
+
+	return (0);
+}
+
+/*
+ * Calculate the address for the next spa_mirror_child_t entry.  The
+ * ssh->lock will be held until ksp->ks_ndata entries are processed.
+ */
+static void *
+spa_mirror_addr(kstat_t *ksp, loff_t n)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.mirror;
+	spa_mirror_child_t *smc = ssh->private;
+
+	ASSERT(MUTEX_HELD(&ssh->lock));
+
+	if (n >= ssh->size)
+		return (NULL);
+
+	return (&smc[n]);
+}
+
+static void
+spa_mirror_free(spa_stats_history_t *ssh)
+{
+	spa_mirror_child_t *smc = ssh->private;
+	int i;
+
+	for (i = 0; i < ssh->size; i++) {
+		if (smc[i].vdev_path)
+			strfree(smc[i].vdev_path);
+	}
+	if (smc != NULL)
+		kmem_free(smc, ssh->count * sizeof (spa_mirror_child_t));
+
+	ssh->private = NULL;
+	ssh->count = 0;
+	ssh->size = 0;
+}
+
+/*
+ * Visit the children of all mirror, replacing and spare vdevs below vd.
+ * Their counts are reset when writing, otherwise they are copied to smc,
+ * or only counted when smc is NULL.  Returns the number of children.
+ */
+static uint64_t
+spa_mirror_walk(vdev_t *vd, spa_mirror_child_t *smc, int rw)
+{
+	vdev_ops_t *ops = vd->vdev_ops;
+	uint64_t n = 0;
+	int c;
+
+	for (c = 0; c < vd->vdev_children; c++) {
+		vdev_t *cvd = vd->vdev_child[c];
+
+		if (ops == &vdev_mirror_ops || ops == &vdev_replacing_ops ||
+		    ops == &vdev_spare_ops) {
+			if (rw == KSTAT_WRITE) {
+				bzero(cvd->vdev_mirror_reads,
+				    sizeof (cvd->vdev_mirror_reads));
+			} else if (smc != NULL) {
+				spa_mirror_child_t *s = &smc[n];
+
+				s->vdev_guid = cvd->vdev_guid;
+				bcopy(cvd->vdev_mirror_reads, s->reads,
+				    sizeof (s->reads));
+				s->latency = cvd->vdev_queue.vq_lat_avg;
+				s->throughput = cvd->vdev_queue.vq_bw_avg;
+				if (cvd->vdev_path != NULL)
+					s->vdev_path = strdup(cvd->vdev_path);
+			}
+			n++;
+		}
+
+		n += spa_mirror_walk(cvd, (smc != NULL) ? &smc[n] : NULL, rw);
+	}
+
+	return (n);
+}
+
+/*
+ * Snapshot the mirror children when the kstat is read, or reset their
+ * read counts when it is written.  The ssh->lock will be held until
+ * ksp->ks_ndata entries are processed.
+ */
+static int
+spa_mirror_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.mirror;
+	vdev_t *rvd = spa->spa_root_vdev;
+
+	ASSERT(MUTEX_HELD(&ssh->lock));
+
+	spa_mirror_free(ssh);
+
+	spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+	if (rvd != NULL) {
+		if (rw == KSTAT_WRITE) {
+			(void) spa_mirror_walk(rvd, NULL, rw);
+		} else {
+			ssh->count = spa_mirror_walk(rvd, NULL, rw);
+			if (ssh->count != 0) {
+				ssh->private = kmem_zalloc(ssh->count *
+				    sizeof (spa_mirror_child_t), KM_SLEEP);
+				ssh->size = spa_mirror_walk(rvd,
+				    ssh->private, rw);
+				ASSERT3U(ssh->size, ==, ssh->count);
+			}
+		}
+	}
+	spa_config_exit(spa, SCL_CONFIG, FTAG);
+
+	ksp->ks_ndata = ssh->size;
+	ksp->ks_data_size = ssh->size * sizeof (spa_mirror_child_t);
+
+	return (0);
+}
+
+static void
+spa_mirror_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.mirror;
+	char *name;
+	kstat_t *ksp;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = 0;
+	ssh->size = 0;
+	ssh->private = NULL;
+
+	name = kmem_asprintf("zfs/%s", spa_name(spa));
+
+	ksp = kstat_create(name, 0, "mirror", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = NULL;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_mirror_update;
+		kstat_set_raw_ops(ksp, spa_mirror_headers,
+		    spa_mirror_data, spa_mirror_addr);
+		kstat_install(ksp);
+	}
+	strfree(name);
+}
+
+static void
+spa_mirror_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.mirror;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	mutex_enter(&ssh->lock);
+	spa_mirror_free(ssh);
+	mutex_exit(&ssh->lock);
+
+	mutex_destroy(&ssh->lock);
+}
+
 void
 spa_stats_init(spa_t *spa)
 {
@@ -912,6 +1232,8 @@ spa_stats_init(spa_t *spa)
 	spa_tx_assign_init(spa);
 	spa_io_history_init(spa);
 	spa_mmp_history_init(spa);
+	spa_removal_init(spa);
+	spa_mirror_init(spa);
 }
 
 void
@@ -922,6 +1244,8 @@ spa_stats_destroy(spa_t *spa)
 	spa_read_history_destroy(spa);
 	spa_io_history_destroy(spa);
 	spa_mmp_history_destroy(spa);
+	spa_removal_destroy(spa);
+	spa_mirror_destroy(spa);
 }
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
@@ -34,7 +34,10 @@
 #include <sys/spa_impl.h>
 #include <sys/dmu.h>
 #include <sys/dmu_tx.h>
+#include <sys/dmu_objset.h>
 #include <sys/vdev_impl.h>
+#include <sys/vdev_indirect_mapping.h>
+#include <sys/vdev_trim.h>
 #include <sys/uberblock_impl.h>
 #include <sys/metaslab.h>
 #include <sys/metaslab_impl.h>
@@ -49,6 +52,7 @@
 #include <sys/abd.h>
 #include <sys/zvol.h>
 #include <sys/zfs_ratelimit.h>
+#include <sys/zfeature.h>
 
 /*
  * When a vdev is added, it will be divided into approximately (but no
@@ -70,6 +74,7 @@ static vdev_ops_t *vdev_ops_table[] = {
 	&vdev_file_ops,
 	&vdev_missing_ops,
 	&vdev_hole_ops,
+	&vdev_indirect_ops,
 	NULL
 };
 
@@ -107,6 +112,17 @@ vdev_default_asize(vdev_t *vd, uint64_t psize)
 	return (asize);
 }
 
+/*
+ * Default translation function: a leaf vdev or a mirror child maps a
+ * logical range one-to-one onto its physical range.
+ */
+void
+vdev_default_xlate(vdev_t *vd, const range_seg_t *in, range_seg_t *res)
+{
+	res->rs_start = in->rs_start;
+	res->rs_end = in->rs_end;
+}
+
 /*
  * Get the minimum allocatable size. We define the allocatable size as
  * the vdev's asize rounded to the nearest metaslab. This allows us to
@@ -366,6 +382,14 @@ vdev_alloc_common(spa_t *spa, uint_t id, uint64_t guid, vdev_ops_t *ops)
 	mutex_init(&vd->vdev_stat_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&vd->vdev_probe_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&vd->vdev_queue_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&vd->vdev_scan_io_queue_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&vd->vdev_trim_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&vd->vdev_trim_io_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&vd->vdev_autotrim_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&vd->vdev_trim_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&vd->vdev_trim_io_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&vd->vdev_autotrim_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&vd->vdev_autotrim_kick_cv, NULL, CV_DEFAULT, NULL);
 
 	for (t = 0; t < DTL_TYPES; t++) {
 		vd->vdev_dtl[t] = range_tree_create(NULL, NULL,
@@ -382,6 +406,24 @@ vdev_alloc_common(spa_t *spa, uint_t id, uint64_t guid, vdev_ops_t *ops)
 	return (vd);
 }
 
+/*
+ * Map an allocation bias name from the pool configuration to its value.
+ */
+static vdev_alloc_bias_t
+vdev_derive_alloc_bias(const char *bias)
+{
+	vdev_alloc_bias_t alloc_bias = VDEV_BIAS_NONE;
+
+	if (strcmp(bias, VDEV_ALLOC_BIAS_LOG) == 0)
+		alloc_bias = VDEV_BIAS_LOG;
+	else if (strcmp(bias, VDEV_ALLOC_BIAS_SPECIAL) == 0)
+		alloc_bias = VDEV_BIAS_SPECIAL;
+	else if (strcmp(bias, VDEV_ALLOC_BIAS_DEDUP) == 0)
+		alloc_bias = VDEV_BIAS_DEDUP;
+
+	return (alloc_bias);
+}
+
 /*
  * Allocate a new vdev.  The 'alloctype' is used to control whether we are
  * creating a new vdev or loading an existing one - the behavior is slightly
@@ -394,7 +436,9 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	vdev_ops_t *ops;
 	char *type;
 	uint64_t guid = 0, islog, nparity;
+	vdev_alloc_bias_t alloc_bias;
 	vdev_t *vd;
+	char *bias = NULL;
 	char *tmp = NULL;
 	int rc;
 
@@ -447,6 +491,28 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	if (ops == &vdev_hole_ops && spa_version(spa) < SPA_VERSION_HOLES)
 		return (SET_ERROR(ENOTSUP));
 
+	/*
+	 * Determine the allocation class of a top-level vdev.  Adding a
+	 * special or dedup vdev to an existing pool requires the feature
+	 * to be enabled; spa_create() checks this for new pools.
+	 */
+	alloc_bias = VDEV_BIAS_NONE;
+	if (parent != NULL && parent->vdev_parent == NULL &&
+	    alloctype != VDEV_ALLOC_ATTACH &&
+	    nvlist_lookup_string(nv, ZPOOL_CONFIG_ALLOCATION_BIAS,
+	    &bias) == 0) {
+		alloc_bias = vdev_derive_alloc_bias(bias);
+		if (alloc_bias == VDEV_BIAS_NONE || islog)
+			return (SET_ERROR(EINVAL));
+		if (alloctype == VDEV_ALLOC_ADD &&
+		    spa->spa_load_state != SPA_LOAD_CREATE &&
+		    !spa_feature_is_enabled(spa,
+		    SPA_FEATURE_ALLOCATION_CLASSES))
+			return (SET_ERROR(ENOTSUP));
+	}
+	if (islog)
+		alloc_bias = VDEV_BIAS_LOG;
+
 	/*
 	 * Set the nparity property for RAID-Z vdevs.
 	 */
@@ -486,6 +552,7 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	vd = vdev_alloc_common(spa, id, guid, ops);
 
 	vd->vdev_islog = islog;
+	vd->vdev_alloc_bias = alloc_bias;
 	vd->vdev_nparity = nparity;
 
 	if (nvlist_lookup_string(nv, ZPOOL_CONFIG_PATH, &vd->vdev_path) == 0)
@@ -557,6 +624,8 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 		    &vd->vdev_removing);
 		(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_VDEV_TOP_ZAP,
 		    &vd->vdev_top_zap);
+		(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_INDIRECT_OBJECT,
+		    &vd->vdev_indirect_object);
 	} else {
 		ASSERT0(vd->vdev_top_zap);
 	}
@@ -566,8 +635,23 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 		    alloctype == VDEV_ALLOC_ADD ||
 		    alloctype == VDEV_ALLOC_SPLIT ||
 		    alloctype == VDEV_ALLOC_ROOTPOOL);
-		vd->vdev_mg = metaslab_group_create(islog ?
-		    spa_log_class(spa) : spa_normal_class(spa), vd);
+		metaslab_class_t *mc;
+
+		switch (alloc_bias) {
+		case VDEV_BIAS_LOG:
+			mc = spa_log_class(spa);
+			break;
+		case VDEV_BIAS_SPECIAL:
+			mc = spa_special_class(spa);
+			break;
+		case VDEV_BIAS_DEDUP:
+			mc = spa_dedup_class(spa);
+			break;
+		default:
+			mc = spa_normal_class(spa);
+			break;
+		}
+		vd->vdev_mg = metaslab_group_create(mc, vd);
 	}
 
 	if (vd->vdev_ops->vdev_op_leaf &&
@@ -680,6 +764,11 @@ vdev_free(vdev_t *vd)
 		metaslab_group_destroy(vd->vdev_mg);
 	}
 
+	if (vd->vdev_indirect_mapping != NULL) {
+		vdev_indirect_mapping_close(vd->vdev_indirect_mapping);
+		vd->vdev_indirect_mapping = NULL;
+	}
+
 	ASSERT0(vd->vdev_stat.vs_space);
 	ASSERT0(vd->vdev_stat.vs_dspace);
 	ASSERT0(vd->vdev_stat.vs_alloc);
@@ -690,6 +779,8 @@ vdev_free(vdev_t *vd)
 	vdev_remove_child(vd->vdev_parent, vd);
 
 	ASSERT(vd->vdev_parent == NULL);
+	ASSERT3P(vd->vdev_trim_thread, ==, NULL);
+	ASSERT3P(vd->vdev_autotrim_thread, ==, NULL);
 
 	/*
 	 * Clean up vdev structure.
@@ -697,6 +788,13 @@ vdev_free(vdev_t *vd)
 	vdev_queue_fini(vd);
 	vdev_cache_fini(vd);
 
+	mutex_enter(&vd->vdev_scan_io_queue_lock);
+	if (vd->vdev_scan_io_queue != NULL) {
+		dsl_scan_io_queue_destroy(vd->vdev_scan_io_queue);
+		vd->vdev_scan_io_queue = NULL;
+	}
+	mutex_exit(&vd->vdev_scan_io_queue_lock);
+
 	if (vd->vdev_path)
 		spa_strfree(vd->vdev_path);
 	if (vd->vdev_devid)
@@ -727,9 +825,17 @@ vdev_free(vdev_t *vd)
 	mutex_exit(&vd->vdev_dtl_lock);
 
 	mutex_destroy(&vd->vdev_queue_lock);
+	mutex_destroy(&vd->vdev_scan_io_queue_lock);
 	mutex_destroy(&vd->vdev_dtl_lock);
 	mutex_destroy(&vd->vdev_stat_lock);
 	mutex_destroy(&vd->vdev_probe_lock);
+	mutex_destroy(&vd->vdev_trim_lock);
+	mutex_destroy(&vd->vdev_trim_io_lock);
+	mutex_destroy(&vd->vdev_autotrim_lock);
+	cv_destroy(&vd->vdev_trim_cv);
+	cv_destroy(&vd->vdev_trim_io_cv);
+	cv_destroy(&vd->vdev_autotrim_cv);
+	cv_destroy(&vd->vdev_autotrim_kick_cv);
 
 	zfs_ratelimit_fini(&vd->vdev_delay_rl);
 	zfs_ratelimit_fini(&vd->vdev_checksum_rl);
@@ -775,6 +881,8 @@ vdev_top_transfer(vdev_t *svd, vdev_t *tvd)
 	if (tvd->vdev_mg != NULL)
 		tvd->vdev_mg->mg_vd = tvd;
 
+	dsl_scan_io_queue_vdev_xfer(svd, tvd);
+
 	tvd->vdev_stat.vs_alloc = svd->vdev_stat.vs_alloc;
 	tvd->vdev_stat.vs_space = svd->vdev_stat.vs_space;
 	tvd->vdev_stat.vs_dspace = svd->vdev_stat.vs_dspace;
@@ -807,6 +915,9 @@ vdev_top_transfer(vdev_t *svd, vdev_t *tvd)
 
 	tvd->vdev_islog = svd->vdev_islog;
 	svd->vdev_islog = 0;
+
+	tvd->vdev_alloc_bias = svd->vdev_alloc_bias;
+	svd->vdev_alloc_bias = VDEV_BIAS_NONE;
 }
 
 static void
@@ -952,6 +1063,20 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 	vd->vdev_ms = mspp;
 	vd->vdev_ms_count = newc;
 
+	/*
+	 * The object holding the txg from which on the log space maps apply
+	 * to each metaslab, see spa_log_spacemap.c.
+	 */
+	if (txg == 0 && oldc == 0 && vd->vdev_top_zap != 0) {
+		error = zap_lookup(mos, vd->vdev_top_zap,
+		    VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS, sizeof (uint64_t), 1,
+		    &vd->vdev_ms_unflushed_object);
+		if (error == ENOENT)
+			error = 0;
+		if (error)
+			return (error);
+	}
+
 	for (m = oldc; m < newc; m++) {
 		uint64_t object = 0;
 
@@ -967,6 +1092,15 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 		    &(vd->vdev_ms[m]));
 		if (error)
 			return (error);
+
+		if (txg == 0 && vd->vdev_ms_unflushed_object != 0) {
+			error = dmu_read(mos, vd->vdev_ms_unflushed_object,
+			    m * sizeof (uint64_t), sizeof (uint64_t),
+			    &vd->vdev_ms[m]->ms_unflushed_txg,
+			    DMU_READ_PREFETCH);
+			if (error)
+				return (error);
+		}
 	}
 
 	if (txg == 0)
@@ -1316,9 +1450,10 @@ vdev_open(vdev_t *vd)
 	}
 
 	/*
-	 * For hole or missing vdevs we just return success.
+	 * For hole, missing or indirect vdevs we just return success.
 	 */
-	if (vd->vdev_ishole || vd->vdev_ops == &vdev_missing_ops)
+	if (vd->vdev_ishole || vd->vdev_ops == &vdev_missing_ops ||
+	    vd->vdev_ops == &vdev_indirect_ops)
 		return (0);
 
 	for (c = 0; c < vd->vdev_children; c++) {
@@ -2125,6 +2260,10 @@ vdev_construct_zaps(vdev_t *vd, dmu_tx_t *tx)
 		}
 		if (vd == vd->vdev_top && vd->vdev_top_zap == 0) {
 			vd->vdev_top_zap = vdev_create_link_zap(vd, tx);
+			if (vd->vdev_alloc_bias == VDEV_BIAS_SPECIAL ||
+			    vd->vdev_alloc_bias == VDEV_BIAS_DEDUP)
+				spa_activate_allocation_classes(vd->vdev_spa,
+				    tx);
 		}
 	}
 	for (i = 0; i < vd->vdev_children; i++) {
@@ -2308,6 +2447,7 @@ vdev_load(vdev_t *vd)
 	 * If this is a top-level vdev, initialize its metaslabs.
 	 */
 	if (vd == vd->vdev_top && !vd->vdev_ishole &&
+	    vd->vdev_ops != &vdev_indirect_ops &&
 	    (vd->vdev_ashift == 0 || vd->vdev_asize == 0 ||
 	    vdev_metaslab_init(vd, 0) != 0))
 		vdev_set_state(vd, B_FALSE, VDEV_STATE_CANT_OPEN,
@@ -2396,7 +2536,8 @@ vdev_remove(vdev_t *vd, uint64_t txg)
 			 */
 			metaslab_group_histogram_remove(mg, msp);
 
-			VERIFY0(space_map_allocated(msp->ms_sm));
+			VERIFY0(msp->ms_allocated_space);
+			metaslab_unflushed_drop(msp);
 			space_map_free(msp->ms_sm, tx);
 			space_map_close(msp->ms_sm);
 			msp->ms_sm = NULL;
@@ -2415,6 +2556,13 @@ vdev_remove(vdev_t *vd, uint64_t txg)
 		vd->vdev_ms_array = 0;
 	}
 
+	if (vd->vdev_ms_unflushed_object != 0) {
+		VERIFY0(zap_remove(mos, vd->vdev_top_zap,
+		    VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS, tx));
+		(void) dmu_object_free(mos, vd->vdev_ms_unflushed_object, tx);
+		vd->vdev_ms_unflushed_object = 0;
+	}
+
 	if (vd->vdev_islog && vd->vdev_top_zap != 0) {
 		vdev_destroy_unlink_zap(vd, vd->vdev_top_zap, tx);
 		vd->vdev_top_zap = 0;
@@ -2437,6 +2585,32 @@ vdev_sync_done(vdev_t *vd, uint64_t txg)
 		metaslab_sync_reassess(vd->vdev_mg);
 }
 
+static void
+vdev_ms_unflushed_create(vdev_t *vd, uint64_t txg)
+{
+	spa_t *spa = vd->vdev_spa;
+	objset_t *mos = spa->spa_meta_objset;
+	uint64_t size = vd->vdev_ms_count * sizeof (uint64_t);
+	uint64_t *txgs, m;
+	dmu_tx_t *tx;
+
+	ASSERT(vd == vd->vdev_top);
+
+	tx = dmu_tx_create_assigned(spa->spa_dsl_pool, txg);
+	vd->vdev_ms_unflushed_object = dmu_object_alloc(mos,
+	    DMU_OTN_UINT64_METADATA, 0, DMU_OT_NONE, 0, tx);
+	VERIFY0(zap_add(mos, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS, sizeof (uint64_t), 1,
+	    &vd->vdev_ms_unflushed_object, tx));
+
+	txgs = vmem_alloc(size, KM_SLEEP);
+	for (m = 0; m < vd->vdev_ms_count; m++)
+		txgs[m] = txg;
+	dmu_write(mos, vd->vdev_ms_unflushed_object, 0, size, txgs, tx);
+	vmem_free(txgs, size);
+	dmu_tx_commit(tx);
+}
+
 void
 vdev_sync(vdev_t *vd, uint64_t txg)
 {
@@ -2447,7 +2621,8 @@ vdev_sync(vdev_t *vd, uint64_t txg)
 
 	ASSERT(!vd->vdev_ishole);
 
-	if (vd->vdev_ms_array == 0 && vd->vdev_ms_shift != 0) {
+	if (vd->vdev_ms_array == 0 && vd->vdev_ms_shift != 0 &&
+	    !vd->vdev_removing) {
 		ASSERT(vd == vd->vdev_top);
 		tx = dmu_tx_create_assigned(spa->spa_dsl_pool, txg);
 		vd->vdev_ms_array = dmu_object_alloc(spa->spa_meta_objset,
@@ -2457,6 +2632,19 @@ vdev_sync(vdev_t *vd, uint64_t txg)
 		dmu_tx_commit(tx);
 	}
 
+	/*
+	 * Once the log_spacemap feature is active, the metaslabs of the vdev
+	 * start logging their changes when it has somewhere to record which
+	 * logs apply to them.  This happens before any of them is synced in
+	 * this txg, so they all apply from this txg on.  Txgs which would
+	 * otherwise not change the pool are left alone.
+	 */
+	if (spa_sync_pass(spa) == 1 && spa_log_sm_enabled(spa) &&
+	    vd->vdev_ms_unflushed_object == 0 && vd->vdev_top_zap != 0 &&
+	    vd->vdev_ms_count != 0 && !vd->vdev_removing &&
+	    dmu_objset_is_dirty(spa->spa_meta_objset, txg))
+		vdev_ms_unflushed_create(vd, txg);
+
 	/*
 	 * Remove the metadata associated with this vdev once it's empty.
 	 */
@@ -2655,6 +2843,14 @@ vdev_online(spa_t *spa, uint64_t guid, uint64_t flags, vdev_state_t *newstate)
 		spa_async_request(spa, SPA_ASYNC_CONFIG_UPDATE);
 	}
 
+	/* Restart a manual TRIM which was interrupted by the offline. */
+	mutex_enter(&vd->vdev_trim_lock);
+	if (vdev_writeable(vd) && !vd->vdev_top->vdev_removing &&
+	    vd->vdev_has_trim && vd->vdev_trim_thread == NULL &&
+	    vd->vdev_trim_state == VDEV_TRIM_ACTIVE)
+		vdev_trim(vd, vd->vdev_trim_rate);
+	mutex_exit(&vd->vdev_trim_lock);
+
 	if (wasoffline ||
 	    (oldstate < VDEV_STATE_DEGRADED &&
 	    vd->vdev_state >= VDEV_STATE_DEGRADED))
@@ -2876,7 +3072,7 @@ vdev_allocatable(vdev_t *vd)
 	 * we're asking two separate questions about it.
 	 */
 	return (!(state < VDEV_STATE_DEGRADED && state != VDEV_STATE_CLOSED) &&
-	    !vd->vdev_cant_write && !vd->vdev_ishole &&
+	    !vd->vdev_cant_write && vdev_is_concrete(vd) &&
 	    vd->vdev_mg->mg_initialized);
 }
 
@@ -2901,7 +3097,7 @@ static void
 vdev_get_child_stat(vdev_t *cvd, vdev_stat_t *vs, vdev_stat_t *cvs)
 {
 	int t;
-	for (t = 0; t < ZIO_TYPES; t++) {
+	for (t = 0; t < VS_ZIO_TYPES; t++) {
 		vs->vs_ops[t] += cvs->vs_ops[t];
 		vs->vs_bytes[t] += cvs->vs_bytes[t];
 	}
@@ -3019,9 +3215,16 @@ vdev_get_stats_ex(vdev_t *vd, vdev_stat_t *vs, vdev_stat_ex_t *vsx)
 		}
 		vs->vs_esize = vd->vdev_max_asize - vd->vdev_asize;
 		if (vd->vdev_aux == NULL && vd == vd->vdev_top &&
-		    !vd->vdev_ishole) {
+		    vdev_is_concrete(vd)) {
 			vs->vs_fragmentation = vd->vdev_mg->mg_fragmentation;
 		}
+		if (vd->vdev_ops->vdev_op_leaf) {
+			vs->vs_trim_notsup = !vd->vdev_has_trim;
+			vs->vs_trim_bytes_done = vd->vdev_trim_bytes_done;
+			vs->vs_trim_bytes_est = vd->vdev_trim_bytes_est;
+			vs->vs_trim_state = vd->vdev_trim_state;
+			vs->vs_trim_action_time = vd->vdev_trim_action_time;
+		}
 	}
 
 	ASSERT(spa_config_held(vd->vdev_spa, SCL_ALL, RW_READER) != 0);
@@ -3125,9 +3328,17 @@ vdev_stat_update(zio_t *zio, uint64_t psize)
 		 */
 		if (vd->vdev_ops->vdev_op_leaf &&
 		    (zio->io_priority < ZIO_PRIORITY_NUM_QUEUEABLE)) {
+			zio_type_t vs_type = type;
 
-			vs->vs_ops[type]++;
-			vs->vs_bytes[type] += psize;
+			/*
+			 * TRIM ops and bytes are reported to user space as
+			 * ZIO_TYPE_IOCTL to preserve the vdev_stat_t layout.
+			 */
+			if (type == ZIO_TYPE_TRIM)
+				vs_type = ZIO_TYPE_IOCTL;
+
+			vs->vs_ops[vs_type]++;
+			vs->vs_bytes[vs_type] += psize;
 
 			if (flags & ZIO_FLAG_DELEGATED) {
 				vsx->vsx_agg_histo[zio->io_priority]
@@ -3258,7 +3469,12 @@ vdev_space_update(vdev_t *vd, int64_t alloc_delta, int64_t defer_delta,
 	vd->vdev_stat.vs_dspace += dspace_delta;
 	mutex_exit(&vd->vdev_stat_lock);
 
-	if (mc == spa_normal_class(spa)) {
+	/*
+	 * Log devices are not counted as pool capacity, but the special
+	 * and dedup classes hold pool data and are included in the totals.
+	 */
+	if (mc == spa_normal_class(spa) || mc == spa_special_class(spa) ||
+	    mc == spa_dedup_class(spa)) {
 		mutex_enter(&rvd->vdev_stat_lock);
 		rvd->vdev_stat.vs_alloc += alloc_delta;
 		rvd->vdev_stat.vs_space += space_delta;
@@ -3347,8 +3563,12 @@ vdev_config_dirty(vdev_t *vd)
 	} else {
 		ASSERT(vd == vd->vdev_top);
 
+		/*
+		 * Holes and indirect vdevs have no labels of their own, they
+		 * are described in the labels of the other top-level vdevs.
+		 */
 		if (!list_link_active(&vd->vdev_config_dirty_node) &&
-		    !vd->vdev_ishole)
+		    vdev_is_concrete(vd))
 			list_insert_head(&spa->spa_config_dirty_list, vd);
 	}
 }
@@ -3641,6 +3861,45 @@ vdev_is_bootable(vdev_t *vd)
 	return (B_TRUE);
 }
 
+/*
+ * Returns B_TRUE if the vdev is backed by real storage, i.e. it is not
+ * a hole, a missing placeholder or a removed (indirect) vdev.
+ */
+boolean_t
+vdev_is_concrete(vdev_t *vd)
+{
+	vdev_ops_t *ops = vd->vdev_ops;
+
+	return (ops != &vdev_hole_ops && ops != &vdev_missing_ops &&
+	    ops != &vdev_indirect_ops);
+}
+
+/*
+ * Translate a logical range on the top-level vdev to the physical range
+ * on the passed vdev by walking up to the top-level and applying each
+ * parent's translation function as the recursion unwinds.
+ */
+void
+vdev_xlate(vdev_t *vd, const range_seg_t *logical_rs, range_seg_t *physical_rs)
+{
+	vdev_t *pvd = vd->vdev_parent;
+	range_seg_t intermediate;
+
+	if (vd == vd->vdev_top) {
+		physical_rs->rs_start = logical_rs->rs_start;
+		physical_rs->rs_end = logical_rs->rs_end;
+		return;
+	}
+
+	vdev_xlate(pvd, logical_rs, physical_rs);
+
+	ASSERT3P(pvd->vdev_ops->vdev_op_xlate, !=, NULL);
+	pvd->vdev_ops->vdev_op_xlate(vd, physical_rs, &intermediate);
+
+	physical_rs->rs_start = intermediate.rs_start;
+	physical_rs->rs_end = intermediate.rs_end;
+}
+
 /*
  * Load the state from the original vdev tree (ovd) which
  * we've retrieved from the MOS config object. If the original
@@ -327,6 +327,9 @@ skip_open:
 	/* Inform the ZIO pipeline that we are non-rotational */
 	v->vdev_nonrot = blk_queue_nonrot(bdev_get_queue(vd->vd_bdev));
 
+	/* Is backed by a block device which supports discard */
+	v->vdev_has_trim = blk_queue_discard(bdev_get_queue(vd->vd_bdev));
+
 	/* Physical volume size in bytes */
 	*psize = bdev_capacity(vd->vd_bdev);
 
@@ -738,6 +741,12 @@ vdev_disk_io_start(zio_t *zio)
 #endif
 		break;
 
+	case ZIO_TYPE_TRIM:
+		zio->io_error = -blkdev_issue_discard(vd->vd_bdev,
+		    zio->io_offset >> 9, zio->io_size >> 9, GFP_NOFS, 0);
+		zio_interrupt(zio);
+		return;
+
 	default:
 		zio->io_error = SET_ERROR(ENOTSUP);
 		zio_interrupt(zio);
@@ -842,6 +851,7 @@ vdev_ops_t vdev_disk_ops = {
 	NULL,
 	vdev_disk_hold,
 	vdev_disk_rele,
+	NULL,
 	VDEV_TYPE_DISK,		/* name of this vdev type */
 	B_TRUE			/* leaf vdev */
 };
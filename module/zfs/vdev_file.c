@@ -63,6 +63,13 @@ vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
 	/* Rotational optimizations only make sense on block devices */
 	vd->vdev_nonrot = B_TRUE;
 
+	/*
+	 * Allow TRIM on file based vdevs.  This may not always be supported,
+	 * since it depends on your kernel version and underlying filesystem
+	 * type but it is always safe to attempt.
+	 */
+	vd->vdev_has_trim = B_TRUE;
+
 	/*
 	 * We must have a pathname, and it must be absolute.
 	 */
@@ -186,6 +193,28 @@ vdev_file_io_fsync(void *arg)
 	zio_interrupt(zio);
 }
 
+/*
+ * Punch a hole over the trimmed range so the underlying filesystem can
+ * release the blocks.  The file size is left unchanged.
+ */
+static void
+vdev_file_io_trim(void *arg)
+{
+	zio_t *zio = (zio_t *)arg;
+	vdev_file_t *vf = zio->io_vd->vdev_tsd;
+	struct flock flck;
+
+	bzero(&flck, sizeof (flck));
+	flck.l_whence = SEEK_SET;
+	flck.l_start = zio->io_offset;
+	flck.l_len = zio->io_size;
+
+	zio->io_error = VOP_SPACE(vf->vf_vnode, F_FREESP, &flck,
+	    0, 0, kcred, NULL);
+
+	zio_interrupt(zio);
+}
+
 static void
 vdev_file_io_start(zio_t *zio)
 {
@@ -229,6 +258,10 @@ vdev_file_io_start(zio_t *zio)
 
 		zio_execute(zio);
 		return;
+	} else if (zio->io_type == ZIO_TYPE_TRIM) {
+		VERIFY3U(taskq_dispatch(vdev_file_taskq, vdev_file_io_trim,
+		    zio, TQ_SLEEP), !=, TASKQID_INVALID);
+		return;
 	}
 
 	zio->io_target_timestamp = zio_handle_io_delay(zio);
@@ -253,6 +286,7 @@ vdev_ops_t vdev_file_ops = {
 	NULL,
 	vdev_file_hold,
 	vdev_file_rele,
+	NULL,
 	VDEV_TYPE_FILE,		/* name of this vdev type */
 	B_TRUE			/* leaf vdev */
 };
@@ -287,6 +321,7 @@ vdev_ops_t vdev_disk_ops = {
 	NULL,
 	vdev_file_hold,
 	vdev_file_rele,
+	NULL,
 	VDEV_TYPE_DISK,		/* name of this vdev type */
 	B_TRUE			/* leaf vdev */
 };
@@ -0,0 +1,212 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/vdev_impl.h>
+#include <sys/fs/zfs.h>
+#include <sys/zio.h>
+#include <sys/abd.h>
+#include <sys/vdev_indirect_mapping.h>
+
+/*
+ * An indirect vdev takes the place of a top-level vdev which has been
+ * removed (see vdev_removal.c).  It has no children and no storage of its
+ * own; it only holds the indirect mapping from its offsets to the places
+ * the data was copied to.  Block pointers which still reference the
+ * removed vdev are never rewritten, instead every I/O and every free or
+ * claim of such a DVA is translated through the mapping.  Because the
+ * copied data was allocated in large chunks, a block almost always maps
+ * to a single destination and is read with one child I/O.
+ */
+
+typedef struct vdev_indirect_remap_arg {
+	zio_t		*vira_zio;
+	uint64_t	vira_covered;	/* bytes of the I/O mapped */
+} vdev_indirect_remap_arg_t;
+
+/*
+ * Translate [offset, offset + asize) of an indirect, or removing, vdev
+ * through its mapping and call func for each destination piece.  The
+ * split_offset passed to func is the offset of the piece within the
+ * range.  The destination vdev may itself be indirect, in which case
+ * the caller's handling (e.g. metaslab_free_dva()) recurses.
+ */
+void
+vdev_indirect_remap(vdev_t *vd, uint64_t offset, uint64_t asize,
+    void (*func)(uint64_t, vdev_t *, uint64_t, uint64_t, void *), void *arg)
+{
+	vdev_indirect_mapping_entry_phys_t *entries;
+	spa_t *spa = vd->vdev_spa;
+	int n, i;
+
+	ASSERT(spa_config_held(spa, SCL_ALL, RW_READER) != 0);
+	ASSERT3P(vd->vdev_indirect_mapping, !=, NULL);
+
+	n = vdev_indirect_mapping_entries_in_range(vd->vdev_indirect_mapping,
+	    offset, asize, &entries);
+
+	for (i = 0; i < n; i++) {
+		vdev_indirect_mapping_entry_phys_t *vimep = &entries[i];
+		uint64_t src = vimep->vimep_src;
+		uint64_t len = DVA_GET_ASIZE(&vimep->vimep_dst);
+		uint64_t start = MAX(src, offset);
+		uint64_t end = MIN(src + len, offset + asize);
+		vdev_t *dst_vd;
+
+		dst_vd = vdev_lookup_top(spa, DVA_GET_VDEV(&vimep->vimep_dst));
+		ASSERT3P(dst_vd, !=, NULL);
+
+		func(start - offset, dst_vd,
+		    DVA_GET_OFFSET(&vimep->vimep_dst) + (start - src),
+		    end - start, arg);
+	}
+
+	if (n != 0)
+		kmem_free(entries, n * sizeof (*entries));
+}
+
+/* ARGSUSED */
+static int
+vdev_indirect_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
+    uint64_t *ashift)
+{
+	*psize = *max_psize = vd->vdev_asize +
+	    VDEV_LABEL_START_SIZE + VDEV_LABEL_END_SIZE;
+	*ashift = vd->vdev_ashift;
+
+	/*
+	 * There are no metaslabs for vdev_metaslab_init() to set this up.
+	 * Blocks still pointing here must be charged the same deflated
+	 * size they were born with; only raidz vdevs, which can't be
+	 * removed, deflate.
+	 */
+	vd->vdev_deflate_ratio = (1 << 17) /
+	    (vdev_psize_to_asize(vd, 1 << 17) >> SPA_MINBLOCKSHIFT);
+
+	return (0);
+}
+
+/* ARGSUSED */
+static void
+vdev_indirect_close(vdev_t *vd)
+{
+}
+
+static void
+vdev_indirect_child_io_done(zio_t *zio)
+{
+	zio_t *pio = zio->io_private;
+
+	mutex_enter(&pio->io_lock);
+	pio->io_error = zio_worst_error(pio->io_error, zio->io_error);
+	mutex_exit(&pio->io_lock);
+
+	abd_put(zio->io_abd);
+}
+
+static void
+vdev_indirect_io_start_cb(uint64_t split_offset, vdev_t *vd, uint64_t offset,
+    uint64_t size, void *arg)
+{
+	vdev_indirect_remap_arg_t *vira = arg;
+	zio_t *zio = vira->vira_zio;
+	blkptr_t *bp = NULL;
+
+	/*
+	 * When the whole block was copied to one place pass the bp down,
+	 * so the destination verifies the checksum itself and a mirror
+	 * can repair a damaged copy.  A split block is only checked once
+	 * it has been reassembled here.
+	 */
+	if (split_offset == 0 && size == zio->io_size)
+		bp = zio->io_bp;
+
+	vira->vira_covered += size;
+
+	zio_nowait(zio_vdev_child_io(zio, bp, vd, offset,
+	    abd_get_offset_size(zio->io_abd, split_offset, size),
+	    size, zio->io_type, zio->io_priority, 0,
+	    vdev_indirect_child_io_done, zio));
+}
+
+static void
+vdev_indirect_io_start(zio_t *zio)
+{
+	vdev_indirect_remap_arg_t vira;
+
+	if (zio->io_type != ZIO_TYPE_READ && zio->io_type != ZIO_TYPE_WRITE) {
+		zio->io_error = SET_ERROR(ENOTSUP);
+		zio_execute(zio);
+		return;
+	}
+
+	/*
+	 * While the pool is being loaded the mapping may not be open yet,
+	 * see spa_remove_init().  Fail the I/O so that a ditto copy is
+	 * tried instead.
+	 */
+	if (zio->io_vd->vdev_indirect_mapping == NULL) {
+		zio->io_error = SET_ERROR(EIO);
+		zio_execute(zio);
+		return;
+	}
+
+	vira.vira_zio = zio;
+	vira.vira_covered = 0;
+	vdev_indirect_remap(zio->io_vd, zio->io_offset, zio->io_size,
+	    vdev_indirect_io_start_cb, &vira);
+
+	/*
+	 * Only allocated space was copied, so any live block is mapped in
+	 * full.  A hole in the mapping means the bp is damaged.
+	 */
+	if (vira.vira_covered != zio->io_size) {
+		mutex_enter(&zio->io_lock);
+		zio->io_error = zio_worst_error(zio->io_error,
+		    SET_ERROR(ECKSUM));
+		mutex_exit(&zio->io_lock);
+	}
+
+	zio_execute(zio);
+}
+
+/* ARGSUSED */
+static void
+vdev_indirect_io_done(zio_t *zio)
+{
+}
+
+vdev_ops_t vdev_indirect_ops = {
+	vdev_indirect_open,
+	vdev_indirect_close,
+	vdev_default_asize,
+	vdev_indirect_io_start,
+	vdev_indirect_io_done,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	VDEV_TYPE_INDIRECT,	/* name of this vdev type */
+	B_FALSE			/* leaf vdev */
+};
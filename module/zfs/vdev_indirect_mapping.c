@@ -0,0 +1,308 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/dmu_tx.h>
+#include <sys/dsl_pool.h>
+#include <sys/spa.h>
+#include <sys/vdev_indirect_mapping.h>
+#include <sys/zfs_context.h>
+
+/*
+ * The mapping is a DMU_OTN_UINT64_METADATA object holding a packed array
+ * of vdev_indirect_mapping_entry_phys_t, with the summary kept in the
+ * bonus buffer.  Entries are only ever appended, in increasing order of
+ * source offset, by the removal sync task.  The entire array is kept in
+ * core so that remapping an I/O never has to read from the pool.  Each
+ * entry is 24 bytes, so a removed vdev with one million allocated
+ * segments costs about 24MB of memory.
+ */
+
+#define	VIM_ENTRY_SIZE	(sizeof (vdev_indirect_mapping_entry_phys_t))
+
+static void
+vdev_indirect_mapping_verify(vdev_indirect_mapping_t *vim)
+{
+	ASSERT(vim != NULL);
+	ASSERT(vim->vim_object != 0);
+	ASSERT(vim->vim_objset != NULL);
+	ASSERT(vim->vim_phys != NULL);
+	ASSERT(vim->vim_dbuf != NULL);
+	ASSERT3U(vim->vim_phys->vimp_num_entries, <=, vim->vim_entries_alloc);
+}
+
+uint64_t
+vdev_indirect_mapping_object(vdev_indirect_mapping_t *vim)
+{
+	vdev_indirect_mapping_verify(vim);
+
+	return (vim->vim_object);
+}
+
+uint64_t
+vdev_indirect_mapping_num_entries(vdev_indirect_mapping_t *vim)
+{
+	vdev_indirect_mapping_verify(vim);
+
+	return (vim->vim_phys->vimp_num_entries);
+}
+
+uint64_t
+vdev_indirect_mapping_max_offset(vdev_indirect_mapping_t *vim)
+{
+	vdev_indirect_mapping_verify(vim);
+
+	return (vim->vim_phys->vimp_max_offset);
+}
+
+uint64_t
+vdev_indirect_mapping_bytes_mapped(vdev_indirect_mapping_t *vim)
+{
+	vdev_indirect_mapping_verify(vim);
+
+	return (vim->vim_phys->vimp_bytes_mapped);
+}
+
+/*
+ * Memory used by the in-core copy of the mapping.
+ */
+uint64_t
+vdev_indirect_mapping_size(vdev_indirect_mapping_t *vim)
+{
+	vdev_indirect_mapping_verify(vim);
+
+	return (vim->vim_entries_alloc * VIM_ENTRY_SIZE);
+}
+
+uint64_t
+vdev_indirect_mapping_alloc(objset_t *os, dmu_tx_t *tx)
+{
+	vdev_indirect_mapping_phys_t *vimp;
+	dmu_buf_t *db;
+	uint64_t object;
+
+	ASSERT(dmu_tx_is_syncing(tx));
+
+	object = dmu_object_alloc(os, DMU_OTN_UINT64_METADATA,
+	    SPA_OLD_MAXBLOCKSIZE, DMU_OTN_UINT64_METADATA,
+	    sizeof (vdev_indirect_mapping_phys_t), tx);
+
+	VERIFY0(dmu_bonus_hold(os, object, FTAG, &db));
+	dmu_buf_will_dirty(db, tx);
+	vimp = db->db_data;
+	bzero(vimp, sizeof (*vimp));
+	dmu_buf_rele(db, FTAG);
+
+	return (object);
+}
+
+void
+vdev_indirect_mapping_free(objset_t *os, uint64_t object, dmu_tx_t *tx)
+{
+	ASSERT(dmu_tx_is_syncing(tx));
+
+	VERIFY0(dmu_object_free(os, object, tx));
+}
+
+/*
+ * Read the mapping into core.  This can fail with EIO at import when the
+ * object's own blocks live on another indirect vdev whose mapping has not
+ * been opened yet, see spa_remove_init().
+ */
+int
+vdev_indirect_mapping_open(objset_t *os, uint64_t object,
+    vdev_indirect_mapping_t **vimp)
+{
+	vdev_indirect_mapping_t *vim;
+	dmu_object_info_t doi;
+	uint64_t n;
+	int error;
+
+	error = dmu_object_info(os, object, &doi);
+	if (error != 0)
+		return (error);
+	if (doi.doi_bonus_size < sizeof (vdev_indirect_mapping_phys_t))
+		return (SET_ERROR(ECKSUM));
+
+	vim = kmem_zalloc(sizeof (*vim), KM_SLEEP);
+	error = dmu_bonus_hold(os, object, vim, &vim->vim_dbuf);
+	if (error != 0) {
+		kmem_free(vim, sizeof (*vim));
+		return (error);
+	}
+
+	rw_init(&vim->vim_lock, NULL, RW_DEFAULT, NULL);
+	vim->vim_objset = os;
+	vim->vim_object = object;
+	vim->vim_phys = vim->vim_dbuf->db_data;
+
+	n = vim->vim_phys->vimp_num_entries;
+	if (n != 0) {
+		vim->vim_entries = vmem_alloc(n * VIM_ENTRY_SIZE, KM_SLEEP);
+		vim->vim_entries_alloc = n;
+		error = dmu_read(os, object, 0, n * VIM_ENTRY_SIZE,
+		    vim->vim_entries, DMU_READ_PREFETCH);
+		if (error != 0) {
+			vdev_indirect_mapping_close(vim);
+			return (error);
+		}
+	}
+
+	vdev_indirect_mapping_verify(vim);
+	*vimp = vim;
+
+	return (0);
+}
+
+void
+vdev_indirect_mapping_close(vdev_indirect_mapping_t *vim)
+{
+	vdev_indirect_mapping_verify(vim);
+
+	if (vim->vim_entries_alloc != 0) {
+		vmem_free(vim->vim_entries,
+		    vim->vim_entries_alloc * VIM_ENTRY_SIZE);
+	}
+
+	dmu_buf_rele(vim->vim_dbuf, vim);
+	rw_destroy(&vim->vim_lock);
+	kmem_free(vim, sizeof (*vim));
+}
+
+/*
+ * Append the entries on vime_list, which must be sorted by source offset
+ * and lie above the current max offset, and advance the max offset.  The
+ * list is emptied.  Called from syncing context.
+ */
+void
+vdev_indirect_mapping_add_entries(vdev_indirect_mapping_t *vim,
+    list_t *vime_list, uint64_t max_offset, dmu_tx_t *tx)
+{
+	vdev_indirect_mapping_phys_t *vimp = vim->vim_phys;
+	vdev_indirect_mapping_entry_t *vime;
+	vdev_indirect_mapping_entry_phys_t *buf;
+	uint64_t old_count = vimp->vimp_num_entries;
+	uint64_t count = 0, i;
+
+	ASSERT(dmu_tx_is_syncing(tx));
+	ASSERT3U(max_offset, >=, vimp->vimp_max_offset);
+	vdev_indirect_mapping_verify(vim);
+
+	for (vime = list_head(vime_list); vime != NULL;
+	    vime = list_next(vime_list, vime))
+		count++;
+
+	rw_enter(&vim->vim_lock, RW_WRITER);
+
+	if (old_count + count > vim->vim_entries_alloc) {
+		uint64_t new_alloc = MAX(vim->vim_entries_alloc * 2,
+		    old_count + count);
+		buf = vmem_alloc(new_alloc * VIM_ENTRY_SIZE, KM_SLEEP);
+		if (vim->vim_entries_alloc != 0) {
+			bcopy(vim->vim_entries, buf,
+			    old_count * VIM_ENTRY_SIZE);
+			vmem_free(vim->vim_entries,
+			    vim->vim_entries_alloc * VIM_ENTRY_SIZE);
+		}
+		vim->vim_entries = buf;
+		vim->vim_entries_alloc = new_alloc;
+	}
+
+	dmu_buf_will_dirty(vim->vim_dbuf, tx);
+
+	for (i = old_count; (vime = list_remove_head(vime_list)) != NULL; i++) {
+		vdev_indirect_mapping_entry_phys_t *vimep = &vime->vime_mapping;
+
+		ASSERT(i == 0 || vimep->vimep_src >=
+		    vim->vim_entries[i - 1].vimep_src +
+		    DVA_GET_ASIZE(&vim->vim_entries[i - 1].vimep_dst));
+		ASSERT3U(vimep->vimep_src, >=, vimp->vimp_max_offset);
+		ASSERT3U(vimep->vimep_src + DVA_GET_ASIZE(&vimep->vimep_dst),
+		    <=, max_offset);
+
+		vim->vim_entries[i] = *vimep;
+		vimp->vimp_bytes_mapped += DVA_GET_ASIZE(&vimep->vimep_dst);
+		kmem_free(vime, sizeof (*vime));
+	}
+
+	if (count != 0) {
+		dmu_write(vim->vim_objset, vim->vim_object,
+		    old_count * VIM_ENTRY_SIZE, count * VIM_ENTRY_SIZE,
+		    &vim->vim_entries[old_count], tx);
+	}
+	vimp->vimp_num_entries = old_count + count;
+	vimp->vimp_max_offset = max_offset;
+
+	rw_exit(&vim->vim_lock);
+}
+
+/*
+ * Return a copy of all entries overlapping [offset, offset + size) in
+ * *out, which the caller frees with kmem_free(), and their number.  The
+ * copy lets callers act on the entries, which may recurse into other
+ * indirect vdevs, without holding vim_lock.
+ */
+int
+vdev_indirect_mapping_entries_in_range(vdev_indirect_mapping_t *vim,
+    uint64_t offset, uint64_t size, vdev_indirect_mapping_entry_phys_t **out)
+{
+	vdev_indirect_mapping_entry_phys_t *entries;
+	uint64_t lo, hi, first, last;
+
+	vdev_indirect_mapping_verify(vim);
+	ASSERT3U(size, >, 0);
+
+	rw_enter(&vim->vim_lock, RW_READER);
+	entries = vim->vim_entries;
+
+	/*
+	 * Find the last entry starting at or before offset.  If it ends
+	 * before offset the range begins in an unmapped gap, and the
+	 * first overlapping entry is the one after it.
+	 */
+	lo = 0;
+	hi = vim->vim_phys->vimp_num_entries;
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+
+		if (entries[mid].vimep_src <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	first = lo;
+	if (first > 0 && entries[first - 1].vimep_src +
+	    DVA_GET_ASIZE(&entries[first - 1].vimep_dst) > offset)
+		first--;
+
+	for (last = first; last < vim->vim_phys->vimp_num_entries &&
+	    entries[last].vimep_src < offset + size; last++)
+		continue;
+
+	if (last > first) {
+		*out = kmem_alloc((last - first) * VIM_ENTRY_SIZE, KM_SLEEP);
+		bcopy(&entries[first], *out, (last - first) * VIM_ENTRY_SIZE);
+	} else {
+		*out = NULL;
+	}
+	rw_exit(&vim->vim_lock);
+
+	return ((int)(last - first));
+}
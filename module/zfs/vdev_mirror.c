@@ -48,6 +48,7 @@ typedef struct mirror_stats {
 
 	kstat_named_t vdev_mirror_stat_preferred_found;
 	kstat_named_t vdev_mirror_stat_preferred_not_found;
+	kstat_named_t vdev_mirror_stat_preferred_latency;
 } mirror_stats_t;
 
 static mirror_stats_t mirror_stats = {
@@ -65,6 +66,8 @@ static mirror_stats_t mirror_stats = {
 	{ "preferred_found",			KSTAT_DATA_UINT64 },
 	/* Preferred child vdev not found or equal load  */
 	{ "preferred_not_found",		KSTAT_DATA_UINT64 },
+	/* Preferred child vdev differs from the one with the lowest load */
+	{ "preferred_latency",			KSTAT_DATA_UINT64 },
 
 };
 
@@ -102,6 +105,7 @@ typedef struct mirror_child {
 	uint64_t	mc_offset;
 	int		mc_error;
 	int		mc_load;
+	int		mc_queue_load;
 	uint8_t		mc_tried;
 	uint8_t		mc_skipped;
 	uint8_t		mc_speculative;
@@ -137,6 +141,13 @@ static int zfs_vdev_mirror_rotating_seek_offset = 1 * 1024 * 1024;
 static int zfs_vdev_mirror_non_rotating_inc = 0;
 static int zfs_vdev_mirror_non_rotating_seek_inc = 1;
 
+/*
+ * When set, the load of each child is scaled by the recent latency of its
+ * device, see vdev_mirror_latency_load().  This directs reads away from
+ * the slower side of a mirror built from devices of different speeds.
+ */
+static int zfs_vdev_mirror_latency_aware = 1;
+
 static inline size_t
 vdev_mirror_map_size(int children)
 {
@@ -236,6 +247,27 @@ vdev_mirror_load(mirror_map_t *mm, vdev_t *vd, uint64_t zio_offset)
 	return (load + zfs_vdev_mirror_rotating_seek_inc);
 }
 
+/*
+ * Scale the load of a child by the decaying latency of its device so that
+ * a read goes to the child expected to complete it first: the pending
+ * I/Os and the new one each cost roughly the average device latency.  A
+ * child without a current estimate counts as the fastest possible so that
+ * it is read from, and measured, again.
+ */
+static int
+vdev_mirror_latency_load(mirror_map_t *mm, vdev_t *vd, int load)
+{
+	uint64_t lat = 0;
+
+	if (mm->mm_root || !zfs_vdev_mirror_latency_aware)
+		return (load);
+
+	if (vd->vdev_ops->vdev_op_leaf)
+		lat = vdev_queue_latency(vd) / NSEC_PER_USEC;
+
+	return ((int)MIN((uint64_t)(load + 1) * MAX(lat, 1), INT_MAX - 1));
+}
+
 /*
  * Avoid inlining the function to keep vdev_mirror_io_start(), which
  * is this functions only caller, as small as possible on the stack.
@@ -403,6 +435,21 @@ vdev_mirror_preferred_child_randomize(zio_t *zio)
 	return (mm->mm_preferred[p]);
 }
 
+/*
+ * Account a read to the selected child, recording why it was selected.
+ */
+static int
+vdev_mirror_child_selected(mirror_map_t *mm, int c, vdev_mirror_sel_t sel)
+{
+	if (sel == VDEV_MIRROR_SEL_LATENCY)
+		MIRROR_BUMP(vdev_mirror_stat_preferred_latency);
+
+	if (!mm->mm_root)
+		atomic_inc_64(&mm->mm_child[c].mc_vd->vdev_mirror_reads[sel]);
+
+	return (c);
+}
+
 /*
  * Try to find a vdev whose DTL doesn't contain the block we want to read
  * prefering vdevs based on determined load.
@@ -415,11 +462,12 @@ vdev_mirror_child_select(zio_t *zio)
 {
 	mirror_map_t *mm = zio->io_vsd;
 	uint64_t txg = zio->io_txg;
-	int c, lowest_load;
+	int c, lowest_load, lowest_queue_load;
 
 	ASSERT(zio->io_bp == NULL || BP_PHYSICAL_BIRTH(zio->io_bp) == txg);
 
 	lowest_load = INT_MAX;
+	lowest_queue_load = INT_MAX;
 	mm->mm_preferred_cnt = 0;
 	for (c = 0; c < mm->mm_children; c++) {
 		mirror_child_t *mc;
@@ -442,7 +490,11 @@ vdev_mirror_child_select(zio_t *zio)
 			continue;
 		}
 
-		mc->mc_load = vdev_mirror_load(mm, mc->mc_vd, mc->mc_offset);
+		mc->mc_queue_load = vdev_mirror_load(mm, mc->mc_vd,
+		    mc->mc_offset);
+		mc->mc_load = vdev_mirror_latency_load(mm, mc->mc_vd,
+		    mc->mc_queue_load);
+		lowest_queue_load = MIN(lowest_queue_load, mc->mc_queue_load);
 		if (mc->mc_load > lowest_load)
 			continue;
 
@@ -454,14 +506,23 @@ vdev_mirror_child_select(zio_t *zio)
 		mm->mm_preferred_cnt++;
 	}
 
-	if (mm->mm_preferred_cnt == 1) {
-		MIRROR_BUMP(vdev_mirror_stat_preferred_found);
-		return (mm->mm_preferred[0]);
-	}
+	if (mm->mm_preferred_cnt >= 1) {
+		vdev_mirror_sel_t sel;
+
+		if (mm->mm_preferred_cnt == 1) {
+			MIRROR_BUMP(vdev_mirror_stat_preferred_found);
+			c = mm->mm_preferred[0];
+			sel = VDEV_MIRROR_SEL_LOAD;
+		} else {
+			MIRROR_BUMP(vdev_mirror_stat_preferred_not_found);
+			c = vdev_mirror_preferred_child_randomize(zio);
+			sel = VDEV_MIRROR_SEL_SPREAD;
+		}
 
-	if (mm->mm_preferred_cnt > 1) {
-		MIRROR_BUMP(vdev_mirror_stat_preferred_not_found);
-		return (vdev_mirror_preferred_child_randomize(zio));
+		if (mm->mm_child[c].mc_queue_load > lowest_queue_load)
+			sel = VDEV_MIRROR_SEL_LATENCY;
+
+		return (vdev_mirror_child_selected(mm, c, sel));
 	}
 
 	/*
@@ -469,8 +530,10 @@ vdev_mirror_child_select(zio_t *zio)
 	 * Look for any child we haven't already tried before giving up.
 	 */
 	for (c = 0; c < mm->mm_children; c++) {
-		if (!mm->mm_child[c].mc_tried)
-			return (c);
+		if (!mm->mm_child[c].mc_tried) {
+			return (vdev_mirror_child_selected(mm, c,
+			    VDEV_MIRROR_SEL_RETRY));
+		}
 	}
 
 	/*
@@ -682,6 +745,7 @@ vdev_ops_t vdev_mirror_ops = {
 	NULL,
 	NULL,
 	NULL,
+	vdev_default_xlate,
 	VDEV_TYPE_MIRROR,	/* name of this vdev type */
 	B_FALSE			/* not a leaf vdev */
 };
@@ -696,6 +760,7 @@ vdev_ops_t vdev_replacing_ops = {
 	NULL,
 	NULL,
 	NULL,
+	vdev_default_xlate,
 	VDEV_TYPE_REPLACING,	/* name of this vdev type */
 	B_FALSE			/* not a leaf vdev */
 };
@@ -710,6 +775,7 @@ vdev_ops_t vdev_spare_ops = {
 	NULL,
 	NULL,
 	NULL,
+	vdev_default_xlate,
 	VDEV_TYPE_SPARE,	/* name of this vdev type */
 	B_FALSE			/* not a leaf vdev */
 };
@@ -737,5 +803,9 @@ MODULE_PARM_DESC(zfs_vdev_mirror_non_rotating_inc,
 module_param(zfs_vdev_mirror_non_rotating_seek_inc, int, 0644);
 MODULE_PARM_DESC(zfs_vdev_mirror_non_rotating_seek_inc,
 	"Non-rotating media load increment for seeking I/O's");
+
+module_param(zfs_vdev_mirror_latency_aware, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_mirror_latency_aware,
+	"Scale mirror child load by recent device latency");
 /* END CSTYLED */
 #endif
@@ -45,9 +45,9 @@
  *
  * ZFS issues I/O operations to leaf vdevs to satisfy and complete zios.  The
  * I/O scheduler determines when and in what order those operations are
- * issued.  The I/O scheduler divides operations into five I/O classes
+ * issued.  The I/O scheduler divides operations into six I/O classes
  * prioritized in the following order: sync read, sync write, async read,
- * async write, and scrub/resilver.  Each queue defines the minimum and
+ * async write, scrub/resilver and trim.  Each queue defines the minimum and
  * maximum number of concurrent operations that may be issued to the device.
  * In addition, the device has an aggregate maximum. Note that the sum of the
  * per-queue minimums must not exceed the aggregate maximum. If the
@@ -152,6 +152,13 @@ uint32_t zfs_vdev_async_write_min_active = 2;
 uint32_t zfs_vdev_async_write_max_active = 10;
 uint32_t zfs_vdev_scrub_min_active = 1;
 uint32_t zfs_vdev_scrub_max_active = 2;
+uint32_t zfs_vdev_trim_min_active = 1;
+/*
+ * TRIM max active is large in comparison to the other values due to the fact
+ * that TRIM I/Os are coalesced at the device layer. This value is set such
+ * that a typical SSD can process the queued I/Os in a single request.
+ */
+uint32_t zfs_vdev_trim_max_active = 64;
 
 /*
  * When the pool has less than zfs_vdev_async_write_active_min_dirty_percent
@@ -213,11 +220,13 @@ vdev_queue_class_tree(vdev_queue_t *vq, zio_priority_t p)
 static inline avl_tree_t *
 vdev_queue_type_tree(vdev_queue_t *vq, zio_type_t t)
 {
-	ASSERT(t == ZIO_TYPE_READ || t == ZIO_TYPE_WRITE);
+	ASSERT(t == ZIO_TYPE_READ || t == ZIO_TYPE_WRITE || t == ZIO_TYPE_TRIM);
 	if (t == ZIO_TYPE_READ)
 		return (&vq->vq_read_offset_tree);
-	else
+	else if (t == ZIO_TYPE_WRITE)
 		return (&vq->vq_write_offset_tree);
+	else
+		return (&vq->vq_trim_offset_tree);
 }
 
 int
@@ -248,6 +257,8 @@ vdev_queue_class_min_active(zio_priority_t p)
 		return (zfs_vdev_async_write_min_active);
 	case ZIO_PRIORITY_SCRUB:
 		return (zfs_vdev_scrub_min_active);
+	case ZIO_PRIORITY_TRIM:
+		return (zfs_vdev_trim_min_active);
 	default:
 		panic("invalid priority %u", p);
 		return (0);
@@ -316,6 +327,8 @@ vdev_queue_class_max_active(spa_t *spa, zio_priority_t p)
 		return (vdev_queue_max_async_writes(spa));
 	case ZIO_PRIORITY_SCRUB:
 		return (zfs_vdev_scrub_max_active);
+	case ZIO_PRIORITY_TRIM:
+		return (zfs_vdev_trim_max_active);
 	default:
 		panic("invalid priority %u", p);
 		return (0);
@@ -376,6 +389,9 @@ vdev_queue_init(vdev_t *vd)
 	avl_create(vdev_queue_type_tree(vq, ZIO_TYPE_WRITE),
 	    vdev_queue_offset_compare, sizeof (zio_t),
 	    offsetof(struct zio, io_offset_node));
+	avl_create(vdev_queue_type_tree(vq, ZIO_TYPE_TRIM),
+	    vdev_queue_offset_compare, sizeof (zio_t),
+	    offsetof(struct zio, io_offset_node));
 
 	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
 		int (*compfn) (const void *, const void *);
@@ -407,6 +423,7 @@ vdev_queue_fini(vdev_t *vd)
 	avl_destroy(&vq->vq_active_tree);
 	avl_destroy(vdev_queue_type_tree(vq, ZIO_TYPE_READ));
 	avl_destroy(vdev_queue_type_tree(vq, ZIO_TYPE_WRITE));
+	avl_destroy(vdev_queue_type_tree(vq, ZIO_TYPE_TRIM));
 
 	mutex_destroy(&vq->vq_lock);
 }
@@ -493,15 +510,6 @@ vdev_queue_pending_remove(vdev_queue_t *vq, zio_t *zio)
 static void
 vdev_queue_agg_io_done(zio_t *aio)
 {
-	if (aio->io_type == ZIO_TYPE_READ) {
-		zio_t *pio;
-		zio_link_t *zl = NULL;
-		while ((pio = zio_walk_parents(aio, &zl)) != NULL) {
-			abd_copy_off(pio->io_abd, aio->io_abd,
-			    0, pio->io_offset - aio->io_offset, pio->io_size);
-		}
-	}
-
 	abd_free(aio->io_abd);
 }
 
@@ -519,7 +527,7 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 {
 	zio_t *first, *last, *aio, *dio, *mandatory, *nio;
 	uint64_t maxgap = 0;
-	uint64_t size;
+	uint64_t size, next_offset;
 	uint64_t limit;
 	int maxblocksize;
 	boolean_t stretch = B_FALSE;
@@ -533,6 +541,13 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 	if (zio->io_flags & ZIO_FLAG_DONT_AGGREGATE || limit == 0)
 		return (NULL);
 
+	/*
+	 * TRIM I/Os carry no data and are already issued in large extents,
+	 * leave any further coalescing to the device.
+	 */
+	if (zio->io_type == ZIO_TYPE_TRIM)
+		return (NULL);
+
 	first = last = zio;
 
 	if (zio->io_type == ZIO_TYPE_READ)
@@ -639,9 +654,38 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 	size = IO_SPAN(first, last);
 	ASSERT3U(size, <=, maxblocksize);
 
-	abd = abd_alloc_for_io(size, B_TRUE);
-	if (abd == NULL)
-		return (NULL);
+	/*
+	 * The aggregated I/O reads into, or writes from, the buffers of the
+	 * zios it is made of, chained to a gang ABD, rather than copying
+	 * them in and out of a buffer of its own.  The gaps between reads
+	 * are read into buffers which are thrown away, and optional writes
+	 * which have no data write zeros from the shared zero page.
+	 */
+	abd = abd_alloc_gang_abd();
+	next_offset = first->io_offset;
+	dio = first;
+	for (;;) {
+		if (dio->io_offset != next_offset) {
+			ASSERT3U(dio->io_type, ==, ZIO_TYPE_READ);
+			ASSERT3U(dio->io_offset, >, next_offset);
+			abd_gang_add(abd, abd_alloc_for_io(
+			    dio->io_offset - next_offset, B_TRUE));
+		}
+
+		if (dio->io_flags & ZIO_FLAG_NODATA) {
+			ASSERT3U(dio->io_type, ==, ZIO_TYPE_WRITE);
+			abd_gang_add(abd, abd_get_zeros(dio->io_size));
+		} else {
+			abd_gang_add(abd, abd_get_offset_size(dio->io_abd, 0,
+			    dio->io_size));
+		}
+		next_offset = dio->io_offset + dio->io_size;
+
+		if (dio == last)
+			break;
+		dio = AVL_NEXT(t, dio);
+	}
+	ASSERT3U(abd->abd_size, ==, size);
 
 	aio = zio_vdev_delegated_io(first->io_vd, first->io_offset,
 	    abd, size, first->io_type, zio->io_priority,
@@ -655,15 +699,6 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 		nio = AVL_NEXT(t, dio);
 		ASSERT3U(dio->io_type, ==, aio->io_type);
 
-		if (dio->io_flags & ZIO_FLAG_NODATA) {
-			ASSERT3U(dio->io_type, ==, ZIO_TYPE_WRITE);
-			abd_zero_off(aio->io_abd,
-			    dio->io_offset - aio->io_offset, dio->io_size);
-		} else if (dio->io_type == ZIO_TYPE_WRITE) {
-			abd_copy_off(aio->io_abd, dio->io_abd,
-			    dio->io_offset - aio->io_offset, 0, dio->io_size);
-		}
-
 		zio_add_child(dio, aio);
 		vdev_queue_io_remove(vq, dio);
 		zio_vdev_io_bypass(dio);
@@ -750,11 +785,13 @@ vdev_queue_io(zio_t *zio)
 		    zio->io_priority != ZIO_PRIORITY_ASYNC_READ &&
 		    zio->io_priority != ZIO_PRIORITY_SCRUB)
 			zio->io_priority = ZIO_PRIORITY_ASYNC_READ;
-	} else {
-		ASSERT(zio->io_type == ZIO_TYPE_WRITE);
+	} else if (zio->io_type == ZIO_TYPE_WRITE) {
 		if (zio->io_priority != ZIO_PRIORITY_SYNC_WRITE &&
 		    zio->io_priority != ZIO_PRIORITY_ASYNC_WRITE)
 			zio->io_priority = ZIO_PRIORITY_ASYNC_WRITE;
+	} else {
+		ASSERT(zio->io_type == ZIO_TYPE_TRIM);
+		ASSERT(zio->io_priority == ZIO_PRIORITY_TRIM);
 	}
 
 	zio->io_flags |= ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE;
@@ -776,6 +813,42 @@ vdev_queue_io(zio_t *zio)
 	return (nio);
 }
 
+/*
+ * Fold the device access time of a completed read or write into the
+ * decaying latency and throughput estimates of the vdev.  Each sample
+ * carries 1/2^VDEV_QUEUE_ESTIMATE_SHIFT of the weight, so the estimates
+ * follow a device whose behavior changes within a few dozen I/Os.
+ */
+#define	VDEV_QUEUE_ESTIMATE_SHIFT	3
+
+static void
+vdev_queue_estimate_update(vdev_queue_t *vq, zio_t *zio)
+{
+	uint64_t lat, bw;
+
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+
+	if (zio->io_error != 0 || zio->io_delay <= 0 ||
+	    (zio->io_type != ZIO_TYPE_READ && zio->io_type != ZIO_TYPE_WRITE))
+		return;
+
+	lat = zio->io_delay;
+	bw = zio->io_size * NANOSEC / lat;
+
+	if (vq->vq_lat_avg == 0) {
+		vq->vq_lat_avg = lat;
+		vq->vq_bw_avg = bw;
+		return;
+	}
+
+	vq->vq_lat_avg = vq->vq_lat_avg -
+	    (vq->vq_lat_avg >> VDEV_QUEUE_ESTIMATE_SHIFT) +
+	    (lat >> VDEV_QUEUE_ESTIMATE_SHIFT);
+	vq->vq_bw_avg = vq->vq_bw_avg -
+	    (vq->vq_bw_avg >> VDEV_QUEUE_ESTIMATE_SHIFT) +
+	    (bw >> VDEV_QUEUE_ESTIMATE_SHIFT);
+}
+
 void
 vdev_queue_io_done(zio_t *zio)
 {
@@ -789,6 +862,7 @@ vdev_queue_io_done(zio_t *zio)
 	zio->io_delta = gethrtime() - zio->io_timestamp;
 	vq->vq_io_complete_ts = gethrtime();
 	vq->vq_io_delta_ts = vq->vq_io_complete_ts - zio->io_timestamp;
+	vdev_queue_estimate_update(vq, zio);
 
 	while ((nio = vdev_queue_io_to_issue(vq)) != NULL) {
 		mutex_exit(&vq->vq_lock);
@@ -805,7 +879,7 @@ vdev_queue_io_done(zio_t *zio)
 }
 
 /*
- * As these two methods are only used for load calculations we're not
+ * As these methods are only used for load calculations we're not
  * concerned if we get an incorrect value on 32bit platforms due to lack of
  * vq_lock mutex use here, instead we prefer to keep it lock free for
  * performance.
@@ -822,6 +896,23 @@ vdev_queue_last_offset(vdev_t *vd)
 	return (vd->vdev_queue.vq_last_offset);
 }
 
+/*
+ * The decaying device latency in nanoseconds, or zero when no I/O has
+ * completed on the vdev within the last second.  A stale estimate is not
+ * reported so that a vdev which stopped being selected because it was slow
+ * is eventually tried again, refreshing its estimate.
+ */
+uint64_t
+vdev_queue_latency(vdev_t *vd)
+{
+	vdev_queue_t *vq = &vd->vdev_queue;
+
+	if (gethrtime() - vq->vq_io_complete_ts > NANOSEC)
+		return (0);
+
+	return (vq->vq_lat_avg);
+}
+
 #if defined(_KERNEL) && defined(HAVE_SPL)
 module_param(zfs_vdev_aggregation_limit, int, 0644);
 MODULE_PARM_DESC(zfs_vdev_aggregation_limit, "Max vdev I/O aggregation size");
@@ -865,6 +956,12 @@ MODULE_PARM_DESC(zfs_vdev_scrub_max_active, "Max active scrub I/Os per vdev");
 module_param(zfs_vdev_scrub_min_active, int, 0644);
 MODULE_PARM_DESC(zfs_vdev_scrub_min_active, "Min active scrub I/Os per vdev");
 
+module_param(zfs_vdev_trim_max_active, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_trim_max_active, "Max active trim I/Os per vdev");
+
+module_param(zfs_vdev_trim_min_active, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_trim_min_active, "Min active trim I/Os per vdev");
+
 module_param(zfs_vdev_sync_read_max_active, int, 0644);
 MODULE_PARM_DESC(zfs_vdev_sync_read_max_active,
 	"Max active sync read I/Os per vdev");
@@ -2338,6 +2338,43 @@ vdev_raidz_need_resilver(vdev_t *vd, uint64_t offset, size_t psize)
 	return (B_FALSE);
 }
 
+/*
+ * Translate a logical range on the RAID-Z vdev to the physical range on
+ * child "cvd".  Blocks are laid out across the children in column order,
+ * so the child's share of the range starts at the first row in which its
+ * column falls inside the range and ends at the last such row.
+ */
+static void
+vdev_raidz_xlate(vdev_t *cvd, const range_seg_t *in, range_seg_t *res)
+{
+	vdev_t *raidvd = cvd->vdev_parent;
+	uint64_t width, tgt_col, ashift, b_start, b_end;
+	uint64_t start_row = 0, end_row = 0;
+
+	ASSERT(raidvd->vdev_ops == &vdev_raidz_ops);
+
+	width = raidvd->vdev_children;
+	tgt_col = cvd->vdev_id;
+	ashift = raidvd->vdev_top->vdev_ashift;
+
+	/* make sure the offsets are block-aligned */
+	ASSERT0(in->rs_start % (1ULL << ashift));
+	ASSERT0(in->rs_end % (1ULL << ashift));
+	b_start = in->rs_start >> ashift;
+	b_end = in->rs_end >> ashift;
+
+	if (b_start > tgt_col)	/* avoid underflow */
+		start_row = ((b_start - tgt_col - 1) / width) + 1;
+	if (b_end > tgt_col)
+		end_row = ((b_end - tgt_col - 1) / width) + 1;
+
+	res->rs_start = start_row << ashift;
+	res->rs_end = end_row << ashift;
+
+	ASSERT3U(res->rs_start, <=, in->rs_start);
+	ASSERT3U(res->rs_end - res->rs_start, <=, in->rs_end - in->rs_start);
+}
+
 vdev_ops_t vdev_raidz_ops = {
 	vdev_raidz_open,
 	vdev_raidz_close,
@@ -2348,6 +2385,7 @@ vdev_ops_t vdev_raidz_ops = {
 	vdev_raidz_need_resilver,
 	NULL,
 	NULL,
+	vdev_raidz_xlate,
 	VDEV_TYPE_RAIDZ,	/* name of this vdev type */
 	B_FALSE			/* not a leaf vdev */
 };
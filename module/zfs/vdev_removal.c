@@ -0,0 +1,1321 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa_impl.h>
+#include <sys/dmu.h>
+#include <sys/dmu_tx.h>
+#include <sys/zap.h>
+#include <sys/vdev_impl.h>
+#include <sys/metaslab.h>
+#include <sys/metaslab_impl.h>
+#include <sys/txg.h>
+#include <sys/zio.h>
+#include <sys/abd.h>
+#include <sys/zfeature.h>
+#include <sys/dsl_pool.h>
+#include <sys/dsl_scan.h>
+#include <sys/dsl_synctask.h>
+#include <sys/vdev_removal.h>
+#include <sys/vdev_indirect_mapping.h>
+#include <sys/fs/zfs.h>
+
+/*
+ * Removal of top-level vdevs.
+ *
+ * A top-level mirror or single-disk vdev is removed by copying everything
+ * allocated on it to the other vdevs of the pool.  The copy thread walks
+ * the vdev one metaslab at a time.  It loads the allocated segments from
+ * the metaslab's space map and copies them in offset order, in chunks of
+ * up to zfs_remove_max_segment bytes, each to one new allocation.  Block
+ * pointers are never rewritten.  Instead the new location of each chunk
+ * is appended to the vdev's indirect mapping (vdev_indirect_mapping.c)
+ * when the txg the chunk was copied in syncs.
+ *
+ * Until everything is copied the removing vdev still serves all reads.
+ * Once the copy is done the source space is freed, and the vdev is then
+ * replaced in the namespace by an indirect vdev (vdev_indirect.c) which
+ * sends all I/O through the mapping.
+ *
+ * metaslab_free_impl() routes frees of the removing vdev's space to
+ * free_from_removing_vdev().  If the range has already been mapped its
+ * copy is freed too.  If its copy is still being written, that free is
+ * left to the sync task of the copy's txg.  Otherwise the range simply
+ * no longer needs to be copied.
+ *
+ * The state is kept in the MOS directory (DMU_POOL_REMOVING) and in the
+ * mapping, so an interrupted removal resumes on import.  It can also be
+ * canceled, which frees the copies made so far.
+ */
+
+/*
+ * Largest chunk of a segment copied to one new allocation.
+ */
+int zfs_remove_max_segment = SPA_MAXBLOCKSIZE;
+
+/*
+ * Copy I/O allowed in flight at once.
+ */
+int zfs_remove_max_copy_bytes = 64 * 1024 * 1024;
+
+typedef struct spa_vdev_copy_arg {
+	spa_vdev_removal_t	*vca_svr;
+	uint64_t		vca_size;
+} spa_vdev_copy_arg_t;
+
+typedef struct spa_vdev_remap_free_arg {
+	vdev_t		*vrfa_vd;
+	uint64_t	vrfa_txg;
+} spa_vdev_remap_free_arg_t;
+
+static void spa_vdev_remove_thread(void *arg);
+
+static void
+spa_sync_removing_state(spa_t *spa, dmu_tx_t *tx)
+{
+	VERIFY0(zap_update(spa->spa_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_REMOVING, sizeof (uint64_t),
+	    sizeof (spa->spa_removing_phys) / sizeof (uint64_t),
+	    &spa->spa_removing_phys, tx));
+}
+
+static spa_vdev_removal_t *
+spa_vdev_removal_create(vdev_t *vd)
+{
+	spa_vdev_removal_t *svr;
+	int i;
+
+	svr = kmem_zalloc(sizeof (*svr), KM_SLEEP);
+	mutex_init(&svr->svr_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&svr->svr_cv, NULL, CV_DEFAULT, NULL);
+	svr->svr_vdev_id = vd->vdev_id;
+	svr->svr_allocd_segs = range_tree_create(NULL, NULL, &svr->svr_lock);
+
+	for (i = 0; i < TXG_SIZE; i++) {
+		svr->svr_frees[i] = range_tree_create(NULL, NULL,
+		    &svr->svr_lock);
+		list_create(&svr->svr_new_segments[i],
+		    sizeof (vdev_indirect_mapping_entry_t),
+		    offsetof(vdev_indirect_mapping_entry_t, vime_node));
+	}
+
+	return (svr);
+}
+
+static void
+spa_vdev_removal_destroy(spa_vdev_removal_t *svr)
+{
+	int i;
+
+	ASSERT3P(svr->svr_thread, ==, NULL);
+	ASSERT0(svr->svr_bytes_inflight);
+
+	mutex_enter(&svr->svr_lock);
+	range_tree_vacate(svr->svr_allocd_segs, NULL, NULL);
+	range_tree_destroy(svr->svr_allocd_segs);
+
+	for (i = 0; i < TXG_SIZE; i++) {
+		vdev_indirect_mapping_entry_t *vime;
+
+		ASSERT3P(svr->svr_zio[i], ==, NULL);
+		range_tree_vacate(svr->svr_frees[i], NULL, NULL);
+		range_tree_destroy(svr->svr_frees[i]);
+		while ((vime = list_remove_head(&svr->svr_new_segments[i])) !=
+		    NULL)
+			kmem_free(vime, sizeof (*vime));
+		list_destroy(&svr->svr_new_segments[i]);
+	}
+	mutex_exit(&svr->svr_lock);
+
+	cv_destroy(&svr->svr_cv);
+	mutex_destroy(&svr->svr_lock);
+	kmem_free(svr, sizeof (*svr));
+}
+
+/*
+ * Run func in syncing context and wait for it.  Unlike dsl_sync_task()
+ * this does not look the pool up by name, so the removal and async
+ * threads can use it while the pool is being exported.
+ */
+static void
+spa_vdev_remove_sync_task(spa_t *spa, dsl_syncfunc_t *func, void *arg)
+{
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	dmu_tx_t *tx;
+	uint64_t txg;
+
+	tx = dmu_tx_create_dd(dp->dp_mos_dir);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+	txg = dmu_tx_get_txg(tx);
+	dsl_sync_task_nowait(dp, func, arg, 0, ZFS_SPACE_CHECK_NONE, tx);
+	dmu_tx_commit(tx);
+
+	txg_wait_synced(dp, txg);
+}
+
+static void
+spa_vdev_remove_clear_cb(void *arg, uint64_t start, uint64_t size)
+{
+	range_tree_clear(arg, start, size);
+}
+
+/*
+ * Load the allocated segments of msp into rt, including its unflushed
+ * changes, less those freed in the syncing txg, which have not reached
+ * the space map yet.
+ */
+static void
+spa_vdev_remove_load_allocated(metaslab_t *msp, range_tree_t *rt)
+{
+	mutex_enter(&msp->ms_lock);
+	if (msp->ms_sm != NULL) {
+		VERIFY0(space_map_load(msp->ms_sm, rt, SM_ALLOC));
+		metaslab_unflushed_load(msp, rt, SM_ALLOC);
+		range_tree_walk(msp->ms_freeingtree, spa_vdev_remove_clear_cb,
+		    rt);
+	}
+	mutex_exit(&msp->ms_lock);
+}
+
+static void
+spa_vdev_remove_remap_free_cb(void *arg, uint64_t offset, uint64_t size)
+{
+	spa_vdev_remap_free_arg_t *vrfa = arg;
+
+	vdev_indirect_remap(vrfa->vrfa_vd, offset, size,
+	    metaslab_free_impl_cb, &vrfa->vrfa_txg);
+}
+
+static void
+spa_vdev_remove_free_source_cb(void *arg, uint64_t offset, uint64_t size)
+{
+	spa_vdev_remap_free_arg_t *vrfa = arg;
+
+	metaslab_free_concrete(vrfa->vrfa_vd, offset, size, vrfa->vrfa_txg);
+}
+
+/*
+ * Called by metaslab_free_impl() in syncing context for every free of the
+ * removing vdev's space.
+ */
+void
+free_from_removing_vdev(vdev_t *vd, uint64_t offset, uint64_t size,
+    uint64_t txg)
+{
+	spa_t *spa = vd->vdev_spa;
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+	uint64_t synced_offset = offset;
+	uint64_t synced_size = 0;
+	uint64_t max_offset;
+	int i;
+
+	ASSERT3U(txg, ==, spa_syncing_txg(spa));
+	ASSERT3U(vd->vdev_id, ==, svr->svr_vdev_id);
+
+	mutex_enter(&svr->svr_lock);
+
+	/*
+	 * Once the copy is done the source space has been freed in full,
+	 * only the copy is still allocated.
+	 */
+	if (svr->svr_copy_done) {
+		mutex_exit(&svr->svr_lock);
+		vdev_indirect_remap(vd, offset, size, metaslab_free_impl_cb,
+		    &txg);
+		return;
+	}
+
+	metaslab_free_concrete(vd, offset, size, txg);
+
+	/* The part already in the mapping: free its copy as well. */
+	max_offset =
+	    vdev_indirect_mapping_max_offset(vd->vdev_indirect_mapping);
+	if (offset < max_offset) {
+		synced_size = MIN(size, max_offset - offset);
+		offset += synced_size;
+		size -= synced_size;
+	}
+
+	/*
+	 * Parts copied in txgs which have not synced yet.  Their copy is
+	 * freed by vdev_mapping_sync() once it is in the mapping.
+	 */
+	for (i = 0; i < TXG_CONCURRENT_STATES && size != 0; i++) {
+		int txgoff = (txg + i) & TXG_MASK;
+
+		max_offset = svr->svr_max_offset_to_sync[txgoff];
+		if (offset < max_offset) {
+			uint64_t inflight = MIN(size, max_offset - offset);
+
+			range_tree_add(svr->svr_frees[txgoff], offset,
+			    inflight);
+			offset += inflight;
+			size -= inflight;
+		}
+	}
+
+	/* The rest no longer needs to be copied. */
+	if (size != 0) {
+		range_tree_clear(svr->svr_allocd_segs, offset, size);
+		svr->svr_bytes_done[txg & TXG_MASK] += size;
+	}
+	mutex_exit(&svr->svr_lock);
+
+	if (synced_size != 0) {
+		vdev_indirect_remap(vd, synced_offset, synced_size,
+		    metaslab_free_impl_cb, &txg);
+	}
+}
+
+/*
+ * Append the entries copied in this txg to the mapping, once the copies
+ * are on disk, and free the copies of ranges freed in the meantime.
+ */
+static void
+vdev_mapping_sync(void *arg, dmu_tx_t *tx)
+{
+	spa_t *spa = arg;
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	int txgoff = txg & TXG_MASK;
+	spa_vdev_remap_free_arg_t vrfa;
+	vdev_t *vd;
+
+	ASSERT3P(svr->svr_zio[txgoff], !=, NULL);
+
+	/* Errors are recorded in svr_error by the copy callbacks. */
+	(void) zio_wait(svr->svr_zio[txgoff]);
+
+	vd = vdev_lookup_top(spa, svr->svr_vdev_id);
+	vrfa.vrfa_vd = vd;
+	vrfa.vrfa_txg = txg;
+
+	mutex_enter(&svr->svr_lock);
+	svr->svr_zio[txgoff] = NULL;
+	vdev_indirect_mapping_add_entries(vd->vdev_indirect_mapping,
+	    &svr->svr_new_segments[txgoff],
+	    svr->svr_max_offset_to_sync[txgoff], tx);
+	svr->svr_max_offset_to_sync[txgoff] = 0;
+	range_tree_vacate(svr->svr_frees[txgoff],
+	    spa_vdev_remove_remap_free_cb, &vrfa);
+	spa->spa_removing_phys.sr_copied += svr->svr_bytes_done[txgoff];
+	svr->svr_bytes_done[txgoff] = 0;
+	mutex_exit(&svr->svr_lock);
+
+	spa_sync_removing_state(spa, tx);
+}
+
+static void
+spa_vdev_copy_error(spa_vdev_removal_t *svr, int error)
+{
+	mutex_enter(&svr->svr_lock);
+	if (svr->svr_error == 0)
+		svr->svr_error = error;
+	mutex_exit(&svr->svr_lock);
+}
+
+static void
+spa_vdev_copy_write_done(zio_t *zio)
+{
+	spa_vdev_copy_arg_t *vca = zio->io_private;
+
+	if (zio->io_error != 0)
+		spa_vdev_copy_error(vca->vca_svr, zio->io_error);
+
+	abd_free(zio->io_abd);
+}
+
+/*
+ * The read is a child of the write, which is only issued here, once the
+ * data is in the buffer.  If the read failed the removal is canceled and
+ * whatever the write puts in the new location is freed.
+ */
+static void
+spa_vdev_copy_read_done(zio_t *zio)
+{
+	spa_vdev_copy_arg_t *vca = zio->io_private;
+
+	if (zio->io_error != 0)
+		spa_vdev_copy_error(vca->vca_svr, zio->io_error);
+
+	zio_nowait(zio_unique_parent(zio));
+}
+
+static void
+spa_vdev_copy_done(zio_t *zio)
+{
+	spa_vdev_copy_arg_t *vca = zio->io_private;
+	spa_vdev_removal_t *svr = vca->vca_svr;
+
+	spa_config_exit(zio->io_spa, SCL_STATE, zio->io_spa);
+
+	mutex_enter(&svr->svr_lock);
+	svr->svr_bytes_inflight -= vca->vca_size;
+	cv_broadcast(&svr->svr_cv);
+	mutex_exit(&svr->svr_lock);
+
+	kmem_free(vca, sizeof (*vca));
+}
+
+static void
+spa_vdev_copy_one(zio_t *czio, vdev_t *src_vd, uint64_t src_offset,
+    vdev_t *dst_vd, uint64_t dst_offset, uint64_t size)
+{
+	abd_t *abd = abd_alloc_for_io(size, B_FALSE);
+	zio_t *wzio;
+
+	wzio = zio_vdev_child_io(czio, NULL, dst_vd, dst_offset, abd, size,
+	    ZIO_TYPE_WRITE, ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL,
+	    spa_vdev_copy_write_done, czio->io_private);
+	zio_nowait(zio_vdev_child_io(wzio, NULL, src_vd, src_offset, abd,
+	    size, ZIO_TYPE_READ, ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_CANFAIL,
+	    spa_vdev_copy_read_done, czio->io_private));
+}
+
+/*
+ * The copy is not checksummed, as a chunk holds many blocks.  A mirror
+ * reads from only one of its sides, so if both vdevs are mirrors every
+ * destination side is written from its own read of a source side.  Damage
+ * on one side of the source then stays on one side of the destination,
+ * where it can still be repaired.
+ */
+static void
+spa_vdev_copy_issue(zio_t *czio, vdev_t *src_vd, uint64_t src_offset,
+    vdev_t *dst_vd, uint64_t dst_offset, uint64_t size)
+{
+	boolean_t by_child = (src_vd->vdev_ops == &vdev_mirror_ops &&
+	    dst_vd->vdev_ops == &vdev_mirror_ops);
+	int c;
+
+	for (c = 0; by_child && c < src_vd->vdev_children; c++) {
+		if (!vdev_readable(src_vd->vdev_child[c]))
+			by_child = B_FALSE;
+	}
+	for (c = 0; by_child && c < dst_vd->vdev_children; c++) {
+		if (!vdev_writeable(dst_vd->vdev_child[c]))
+			by_child = B_FALSE;
+	}
+
+	if (!by_child) {
+		spa_vdev_copy_one(czio, src_vd, src_offset, dst_vd, dst_offset,
+		    size);
+		return;
+	}
+
+	for (c = 0; c < dst_vd->vdev_children; c++) {
+		spa_vdev_copy_one(czio,
+		    src_vd->vdev_child[c % src_vd->vdev_children], src_offset,
+		    dst_vd->vdev_child[c], dst_offset, size);
+	}
+}
+
+/*
+ * Allocate space for the first segment left to copy, up to maxalloc
+ * bytes of it, record the mapping entry and issue the copy in the txg of
+ * tx.  The allocation is tried in the vdev's own class first.  If no
+ * allocation of that size can be made the chunk is made smaller.
+ */
+static int
+spa_vdev_copy_segment(vdev_t *vd, uint64_t maxalloc, dmu_tx_t *tx)
+{
+	spa_t *spa = vd->vdev_spa;
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+	metaslab_class_t *mc = vd->vdev_mg->mg_class;
+	uint64_t minalloc = 1ULL << vd->vdev_ashift;
+	int txgoff = dmu_tx_get_txg(tx) & TXG_MASK;
+	vdev_indirect_mapping_entry_t *vime;
+	spa_vdev_copy_arg_t *vca;
+	zio_alloc_list_t zal;
+	uint64_t offset, size;
+	range_seg_t *rs;
+	zio_t *czio;
+	dva_t dst;
+	int error;
+
+	/*
+	 * Vdev I/O must be issued under SCL_STATE.  Since the copy is not
+	 * part of a logical I/O each chunk takes it, and drops it in
+	 * spa_vdev_copy_done().
+	 */
+	spa_config_enter(spa, SCL_STATE, spa, RW_READER);
+
+	mutex_enter(&svr->svr_lock);
+	rs = avl_first(&svr->svr_allocd_segs->rt_root);
+	if (rs == NULL) {
+		/* Freed since the caller looked. */
+		mutex_exit(&svr->svr_lock);
+		spa_config_exit(spa, SCL_STATE, spa);
+		return (0);
+	}
+	offset = rs->rs_start;
+	size = MIN(rs->rs_end - rs->rs_start, maxalloc);
+
+	/* The removing vdev may have been the last one of its class. */
+	if (mc->mc_rotor == NULL)
+		mc = spa_normal_class(spa);
+
+	metaslab_trace_init(&zal);
+	for (;;) {
+		bzero(&dst, sizeof (dst));
+		error = metaslab_alloc_dva(spa, mc, size, &dst, 0, NULL,
+		    dmu_tx_get_txg(tx), 0, &zal);
+		if (error == ENOSPC && mc != spa_normal_class(spa)) {
+			error = metaslab_alloc_dva(spa, spa_normal_class(spa),
+			    size, &dst, 0, NULL, dmu_tx_get_txg(tx), 0, &zal);
+		}
+		if (error != ENOSPC || size == minalloc)
+			break;
+		size = MAX(P2ROUNDUP(size / 2, minalloc), minalloc);
+	}
+	metaslab_trace_fini(&zal);
+
+	if (error != 0) {
+		mutex_exit(&svr->svr_lock);
+		spa_config_exit(spa, SCL_STATE, spa);
+		return (error);
+	}
+	ASSERT3U(DVA_GET_ASIZE(&dst), ==, size);
+
+	/*
+	 * The mapping of the chunks copied in this txg is appended by
+	 * vdev_mapping_sync(), which first waits for the copy I/O.
+	 */
+	if (svr->svr_zio[txgoff] == NULL) {
+		svr->svr_zio[txgoff] = zio_root(spa, NULL, NULL,
+		    ZIO_FLAG_CANFAIL);
+		dsl_sync_task_nowait(spa_get_dsl(spa), vdev_mapping_sync, spa,
+		    0, ZFS_SPACE_CHECK_NONE, tx);
+	}
+
+	range_tree_remove(svr->svr_allocd_segs, offset, size);
+	svr->svr_max_offset_to_sync[txgoff] = offset + size;
+	svr->svr_bytes_done[txgoff] += size;
+	svr->svr_bytes_inflight += size;
+	svr->svr_pass_copied += size;
+
+	vime = kmem_zalloc(sizeof (*vime), KM_SLEEP);
+	vime->vime_mapping.vimep_src = offset;
+	vime->vime_mapping.vimep_dst = dst;
+	list_insert_tail(&svr->svr_new_segments[txgoff], vime);
+
+	vca = kmem_zalloc(sizeof (*vca), KM_SLEEP);
+	vca->vca_svr = svr;
+	vca->vca_size = size;
+	czio = zio_null(svr->svr_zio[txgoff], spa, NULL, spa_vdev_copy_done,
+	    vca, ZIO_FLAG_CANFAIL);
+	mutex_exit(&svr->svr_lock);
+
+	/*
+	 * The copy callbacks take svr_lock, so the I/O is issued without
+	 * it.  A free of the range from here on is handled as in flight.
+	 */
+	spa_vdev_copy_issue(czio, vd, offset,
+	    vdev_lookup_top(spa, DVA_GET_VDEV(&dst)), DVA_GET_OFFSET(&dst),
+	    size);
+	zio_nowait(czio);
+
+	return (0);
+}
+
+static void
+spa_vdev_remove_load_sync(void *arg, dmu_tx_t *tx)
+{
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+	uint64_t msi = *(uint64_t *)arg;
+	uint64_t max_offset;
+	metaslab_t *msp;
+	range_tree_t *rt;
+	kmutex_t lock;
+	vdev_t *vd;
+
+	vd = vdev_lookup_top(spa, svr->svr_vdev_id);
+	msp = vd->vdev_ms[msi];
+	max_offset =
+	    vdev_indirect_mapping_max_offset(vd->vdev_indirect_mapping);
+
+	/*
+	 * Load into a private tree, so that svr_lock is not held across the
+	 * space map reads while copy I/O completes.  No frees of the vdev
+	 * run concurrently with sync tasks.
+	 */
+	mutex_init(&lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_enter(&lock);
+	rt = range_tree_create(NULL, NULL, &lock);
+	spa_vdev_remove_load_allocated(msp, rt);
+	if (max_offset > msp->ms_start)
+		range_tree_clear(rt, msp->ms_start, max_offset - msp->ms_start);
+
+	mutex_enter(&svr->svr_lock);
+	range_tree_vacate(rt, range_tree_add, svr->svr_allocd_segs);
+	mutex_exit(&svr->svr_lock);
+
+	range_tree_destroy(rt);
+	mutex_exit(&lock);
+	mutex_destroy(&lock);
+}
+
+/*
+ * Everything has been copied and mapped: free the source space still
+ * allocated, after which all I/O goes through the mapping.
+ */
+static void
+spa_vdev_remove_copied_sync(void *arg, dmu_tx_t *tx)
+{
+	spa_t *spa = arg;
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+	spa_vdev_remap_free_arg_t vrfa;
+	range_tree_t *live;
+	kmutex_t lock;
+	uint64_t msi;
+	vdev_t *vd;
+	int i;
+
+	vd = vdev_lookup_top(spa, svr->svr_vdev_id);
+	vrfa.vrfa_vd = vd;
+	vrfa.vrfa_txg = dmu_tx_get_txg(tx);
+
+	mutex_init(&lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_enter(&lock);
+	live = range_tree_create(NULL, NULL, &lock);
+	for (msi = 0; msi < vd->vdev_ms_count; msi++) {
+		spa_vdev_remove_load_allocated(vd->vdev_ms[msi], live);
+		range_tree_vacate(live, spa_vdev_remove_free_source_cb, &vrfa);
+	}
+	range_tree_destroy(live);
+	mutex_exit(&lock);
+	mutex_destroy(&lock);
+
+	mutex_enter(&svr->svr_lock);
+	ASSERT0(range_tree_space(svr->svr_allocd_segs));
+	svr->svr_copy_done = B_TRUE;
+	for (i = 0; i < TXG_SIZE; i++) {
+		ASSERT0(svr->svr_max_offset_to_sync[i]);
+		spa->spa_removing_phys.sr_copied += svr->svr_bytes_done[i];
+		svr->svr_bytes_done[i] = 0;
+	}
+	mutex_exit(&svr->svr_lock);
+
+	spa->spa_removing_phys.sr_state = DSS_FINISHED;
+	spa->spa_removing_phys.sr_end_time = gethrestime_sec();
+	spa_sync_removing_state(spa, tx);
+
+	spa_history_log_internal(spa, "vdev remove copied", tx,
+	    "%s vdev %llu", spa_name(spa), (u_longlong_t)vd->vdev_id);
+}
+
+static void
+spa_vdev_remove_thread(void *arg)
+{
+	spa_t *spa = arg;
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	uint64_t msi, ms_count, maxalloc, txg;
+	int error = 0;
+	vdev_t *vd;
+
+	spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+	vd = vdev_lookup_top(spa, svr->svr_vdev_id);
+	msi = vdev_indirect_mapping_max_offset(vd->vdev_indirect_mapping) >>
+	    vd->vdev_ms_shift;
+	ms_count = vd->vdev_ms_count;
+	maxalloc = MAX(P2ALIGN((uint64_t)zfs_remove_max_segment,
+	    1ULL << vd->vdev_ashift), 1ULL << vd->vdev_ashift);
+	spa_config_exit(spa, SCL_CONFIG, FTAG);
+
+	mutex_enter(&svr->svr_lock);
+	svr->svr_pass_start = gethrtime();
+	svr->svr_pass_copied = 0;
+	mutex_exit(&svr->svr_lock);
+
+	for (; msi < ms_count && error == 0 && !svr->svr_thread_exit; msi++) {
+		spa_vdev_remove_sync_task(spa, spa_vdev_remove_load_sync,
+		    &msi);
+
+		for (;;) {
+			boolean_t empty;
+			dmu_tx_t *tx;
+
+			mutex_enter(&svr->svr_lock);
+			while (svr->svr_bytes_inflight >=
+			    zfs_remove_max_copy_bytes && !svr->svr_thread_exit)
+				cv_wait(&svr->svr_cv, &svr->svr_lock);
+			empty = (range_tree_space(svr->svr_allocd_segs) == 0);
+			error = svr->svr_error;
+			mutex_exit(&svr->svr_lock);
+
+			if (empty || error != 0 || svr->svr_thread_exit)
+				break;
+
+			tx = dmu_tx_create_dd(dp->dp_mos_dir);
+			VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+			spa_config_enter(spa, SCL_CONFIG | SCL_ALLOC, FTAG,
+			    RW_READER);
+			vd = vdev_lookup_top(spa, svr->svr_vdev_id);
+			error = spa_vdev_copy_segment(vd, maxalloc, tx);
+			spa_config_exit(spa, SCL_CONFIG | SCL_ALLOC, FTAG);
+			dmu_tx_commit(tx);
+
+			if (error != 0) {
+				spa_vdev_copy_error(svr, error);
+				break;
+			}
+		}
+	}
+
+	/*
+	 * Let the copies issued so far finish and reach the mapping, so
+	 * that a restart can pick up where this pass left off.
+	 */
+	mutex_enter(&svr->svr_lock);
+	while (svr->svr_bytes_inflight != 0)
+		cv_wait(&svr->svr_cv, &svr->svr_lock);
+	error = svr->svr_error;
+	mutex_exit(&svr->svr_lock);
+	txg_wait_synced(dp, 0);
+
+	if (svr->svr_thread_exit) {
+		zfs_dbgmsg("removal of vdev %llu suspended",
+		    (u_longlong_t)svr->svr_vdev_id);
+	} else if (error != 0) {
+		/* The async thread cancels the removal. */
+		zfs_dbgmsg("removal of vdev %llu failed, error %d",
+		    (u_longlong_t)svr->svr_vdev_id, error);
+		spa_async_request(spa, SPA_ASYNC_REMOVE_COMPLETE);
+	} else {
+		spa_vdev_remove_sync_task(spa, spa_vdev_remove_copied_sync,
+		    spa);
+
+		/*
+		 * The freed source space must leave the defer trees before
+		 * vdev_sync() can release the space maps at completion.
+		 */
+		txg = spa_last_synced_txg(spa);
+		txg_wait_synced(dp, txg + TXG_DEFER_SIZE);
+		spa_async_request(spa, SPA_ASYNC_REMOVE_COMPLETE);
+	}
+
+	mutex_enter(&svr->svr_lock);
+	range_tree_vacate(svr->svr_allocd_segs, NULL, NULL);
+	svr->svr_thread = NULL;
+	cv_broadcast(&svr->svr_cv);
+	mutex_exit(&svr->svr_lock);
+
+	thread_exit();
+}
+
+static void
+vdev_remove_initiate_sync(void *arg, dmu_tx_t *tx)
+{
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	objset_t *mos = spa->spa_meta_objset;
+	spa_vdev_removal_t *svr;
+	vdev_t *vd;
+
+	vd = vdev_lookup_top(spa, (uint64_t)(uintptr_t)arg);
+	ASSERT(vd->vdev_removing);
+	ASSERT0(vd->vdev_indirect_object);
+	ASSERT3P(spa->spa_vdev_removal, ==, NULL);
+
+	vd->vdev_indirect_object = vdev_indirect_mapping_alloc(mos, tx);
+	VERIFY0(vdev_indirect_mapping_open(mos, vd->vdev_indirect_object,
+	    &vd->vdev_indirect_mapping));
+	vdev_config_dirty(vd);
+
+	spa_feature_incr(spa, SPA_FEATURE_DEVICE_REMOVAL, tx);
+
+	bzero(&spa->spa_removing_phys, sizeof (spa->spa_removing_phys));
+	spa->spa_removing_phys.sr_state = DSS_SCANNING;
+	spa->spa_removing_phys.sr_removing_vdev = vd->vdev_id;
+	spa->spa_removing_phys.sr_start_time = gethrestime_sec();
+	spa->spa_removing_phys.sr_to_copy = vd->vdev_stat.vs_alloc;
+	spa_sync_removing_state(spa, tx);
+
+	spa_history_log_internal(spa, "vdev remove started", tx,
+	    "%s vdev %llu %s", spa_name(spa), (u_longlong_t)vd->vdev_id,
+	    (vd->vdev_path != NULL) ? vd->vdev_path : "-");
+
+	svr = spa_vdev_removal_create(vd);
+	spa->spa_vdev_removal = svr;
+	svr->svr_thread = thread_create(NULL, 0, spa_vdev_remove_thread, spa,
+	    0, &p0, TS_RUN, minclsyspri);
+}
+
+/*
+ * True if raidz is used anywhere in the tree of vd, e.g. for a mirror of
+ * raidz vdevs.
+ */
+boolean_t
+vdev_contains_raidz(vdev_t *vd)
+{
+	int c;
+
+	if (vd->vdev_ops == &vdev_raidz_ops)
+		return (B_TRUE);
+
+	for (c = 0; c < vd->vdev_children; c++) {
+		if (vdev_contains_raidz(vd->vdev_child[c]))
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+static int
+spa_vdev_remove_top_check(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	vdev_t *rvd = spa->spa_root_vdev;
+	metaslab_class_t *mc;
+	uint64_t available = 0;
+	int c;
+
+	if (!spa_feature_is_enabled(spa, SPA_FEATURE_DEVICE_REMOVAL))
+		return (SET_ERROR(ENOTSUP));
+
+	if (spa->spa_vdev_removal != NULL)
+		return (SET_ERROR(EBUSY));
+
+	if (vd != vd->vdev_top || !vdev_is_concrete(vd))
+		return (SET_ERROR(ENOTSUP));
+
+	/* Only mirrors and plain disks can be copied off block for block. */
+	if ((vd->vdev_ops != &vdev_mirror_ops && !vd->vdev_ops->vdev_op_leaf) ||
+	    vdev_contains_raidz(vd))
+		return (SET_ERROR(ENOTSUP));
+
+	if (!vdev_readable(vd))
+		return (SET_ERROR(ENXIO));
+
+	if (dsl_scan_resilvering(spa_get_dsl(spa)))
+		return (SET_ERROR(EBUSY));
+
+	/*
+	 * A chunk's new allocation must have the same size as the chunk,
+	 * so every possible destination needs the same ashift and no raidz
+	 * parity overhead.  The space left on them must hold the data.
+	 */
+	mc = vd->vdev_mg->mg_class;
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *cvd = rvd->vdev_child[c];
+
+		if (cvd == vd || !vdev_is_concrete(cvd) || cvd->vdev_islog)
+			continue;
+		if (vdev_contains_raidz(cvd))
+			return (SET_ERROR(ENOTSUP));
+		if (cvd->vdev_ashift != vd->vdev_ashift)
+			return (SET_ERROR(EINVAL));
+		if (cvd->vdev_mg != NULL && !cvd->vdev_removing &&
+		    (cvd->vdev_mg->mg_class == mc ||
+		    cvd->vdev_mg->mg_class == spa_normal_class(spa))) {
+			available += cvd->vdev_stat.vs_space -
+			    MIN(cvd->vdev_stat.vs_alloc,
+			    cvd->vdev_stat.vs_space);
+		}
+	}
+
+	if (available < vd->vdev_stat.vs_alloc + spa_get_slop_space(spa))
+		return (SET_ERROR(ENOSPC));
+
+	return (0);
+}
+
+/*
+ * Start the removal of top-level vdev vd.  Called with the config lock
+ * held by spa_vdev_enter(); it is dropped to let the allocations already
+ * assigned to vd reach the space maps before the copy thread reads them.
+ */
+int
+spa_vdev_remove_top(vdev_t *vd, uint64_t *txg)
+{
+	spa_t *spa = vd->vdev_spa;
+	dmu_tx_t *tx;
+	int error;
+
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+	ASSERT3U(spa_config_held(spa, SCL_ALL, RW_WRITER), ==, SCL_ALL);
+
+	if ((error = spa_vdev_remove_top_check(vd)) != 0)
+		return (error);
+
+	/*
+	 * Stop allocating from the vdev, and wait for the youngest
+	 * allocations and frees to sync and their deferral to end.
+	 */
+	metaslab_group_passivate(vd->vdev_mg);
+	vd->vdev_removing = B_TRUE;
+	vdev_config_dirty(vd);
+	spa_vdev_config_exit(spa, NULL,
+	    *txg + TXG_CONCURRENT_STATES + TXG_DEFER_SIZE, 0, FTAG);
+	*txg = spa_vdev_config_enter(spa);
+
+	tx = dmu_tx_create_assigned(spa_get_dsl(spa), *txg);
+	dsl_sync_task_nowait(spa_get_dsl(spa), vdev_remove_initiate_sync,
+	    (void *)(uintptr_t)vd->vdev_id, 0, ZFS_SPACE_CHECK_NONE, tx);
+	dmu_tx_commit(tx);
+
+	return (0);
+}
+
+static void
+spa_vdev_remove_cancel_sync(void *arg, dmu_tx_t *tx)
+{
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+	objset_t *mos = spa->spa_meta_objset;
+	spa_vdev_remap_free_arg_t vrfa;
+	vdev_indirect_mapping_t *vim;
+	uint64_t max_offset, msi;
+	range_tree_t *live;
+	kmutex_t lock;
+	vdev_t *vd;
+	int i;
+
+	vd = vdev_lookup_top(spa, svr->svr_vdev_id);
+	vim = vd->vdev_indirect_mapping;
+	max_offset = vdev_indirect_mapping_max_offset(vim);
+	vrfa.vrfa_vd = vd;
+	vrfa.vrfa_txg = dmu_tx_get_txg(tx);
+
+	ASSERT3P(svr->svr_thread, ==, NULL);
+	ASSERT(!svr->svr_copy_done);
+
+	/*
+	 * Free the copies of everything copied and not freed since.  The
+	 * copies of ranges freed earlier were freed with them.
+	 */
+	mutex_init(&lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_enter(&lock);
+	live = range_tree_create(NULL, NULL, &lock);
+	for (msi = 0; msi < vd->vdev_ms_count; msi++) {
+		metaslab_t *msp = vd->vdev_ms[msi];
+
+		if (msp->ms_start >= max_offset)
+			break;
+
+		spa_vdev_remove_load_allocated(msp, live);
+		if (msp->ms_start + msp->ms_size > max_offset) {
+			range_tree_clear(live, max_offset,
+			    msp->ms_start + msp->ms_size - max_offset);
+		}
+		range_tree_vacate(live, spa_vdev_remove_remap_free_cb, &vrfa);
+	}
+	range_tree_destroy(live);
+	mutex_exit(&lock);
+	mutex_destroy(&lock);
+
+	mutex_enter(&svr->svr_lock);
+	for (i = 0; i < TXG_SIZE; i++) {
+		ASSERT0(svr->svr_max_offset_to_sync[i]);
+		svr->svr_bytes_done[i] = 0;
+	}
+	vd->vdev_indirect_mapping = NULL;
+	mutex_exit(&svr->svr_lock);
+
+	vdev_indirect_mapping_close(vim);
+	vdev_indirect_mapping_free(mos, vd->vdev_indirect_object, tx);
+	vd->vdev_indirect_object = 0;
+	vd->vdev_removing = B_FALSE;
+	vdev_config_dirty(vd);
+
+	spa->spa_removing_phys.sr_state = DSS_CANCELED;
+	spa->spa_removing_phys.sr_end_time = gethrestime_sec();
+	spa_sync_removing_state(spa, tx);
+	spa_feature_decr(spa, SPA_FEATURE_DEVICE_REMOVAL, tx);
+
+	spa->spa_vdev_removal = NULL;
+
+	spa_history_log_internal(spa, "vdev remove canceled", tx,
+	    "%s vdev %llu %s", spa_name(spa), (u_longlong_t)vd->vdev_id,
+	    (vd->vdev_path != NULL) ? vd->vdev_path : "-");
+}
+
+/*
+ * Stop an active removal and free the copies made so far.  The vdev is
+ * then used for allocations again.  Once the copy is done the removal can
+ * no longer be canceled.
+ */
+int
+spa_vdev_remove_cancel(spa_t *spa)
+{
+	spa_vdev_removal_t *svr;
+	uint64_t vdid;
+	vdev_t *vd;
+
+	/*
+	 * The vdev top lock serializes this with the start and completion
+	 * of a removal, without blocking an export of the pool.
+	 */
+	mutex_enter(&spa->spa_vdev_top_lock);
+
+	svr = spa->spa_vdev_removal;
+	if (svr == NULL || svr->svr_copy_done) {
+		mutex_exit(&spa->spa_vdev_top_lock);
+		return (SET_ERROR(ENOENT));
+	}
+	vdid = svr->svr_vdev_id;
+
+	spa_vdev_remove_suspend(spa);
+	spa_vdev_remove_sync_task(spa, spa_vdev_remove_cancel_sync, NULL);
+
+	spa_config_enter(spa, SCL_CONFIG | SCL_ALLOC, FTAG, RW_WRITER);
+	vd = vdev_lookup_top(spa, vdid);
+	metaslab_group_activate(vd->vdev_mg);
+	spa_vdev_removal_destroy(svr);
+	spa_config_exit(spa, SCL_CONFIG | SCL_ALLOC, FTAG);
+
+	mutex_exit(&spa->spa_vdev_top_lock);
+
+	return (0);
+}
+
+/*
+ * Called by the async thread once the copy thread is done.  The emptied
+ * vdev is replaced in the namespace by an indirect vdev with the same id,
+ * which takes over the mapping.  If the copy failed the removal is
+ * canceled instead.
+ */
+void
+spa_vdev_remove_complete(spa_t *spa)
+{
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+	vdev_t *rvd = spa->spa_root_vdev;
+	vdev_indirect_mapping_t *vim;
+	uint64_t txg, id, asize, ashift, object;
+	vdev_t *vd, *ivd;
+
+	if (svr == NULL)
+		return;
+
+	if (!svr->svr_copy_done) {
+		if (svr->svr_error != 0)
+			(void) spa_vdev_remove_cancel(spa);
+		return;
+	}
+
+	/* The copy thread may not have exited quite yet. */
+	mutex_enter(&svr->svr_lock);
+	while (svr->svr_thread != NULL)
+		cv_wait(&svr->svr_cv, &svr->svr_lock);
+	mutex_exit(&svr->svr_lock);
+
+	txg = spa_vdev_enter(spa);
+	ASSERT3P(spa->spa_vdev_removal, ==, svr);
+	id = svr->svr_vdev_id;
+	vd = vdev_lookup_top(spa, id);
+	ASSERT0(vd->vdev_stat.vs_alloc);
+
+	/*
+	 * Let vdev_sync() release the space maps and metaslab array of the
+	 * now empty vdev, and vdev_dtl_sync() those of its leaves.
+	 */
+	vdev_dirty_leaves(vd, VDD_DTL, txg);
+	vdev_config_dirty(vd);
+	spa_vdev_config_exit(spa, NULL, txg, 0, FTAG);
+	txg = spa_vdev_config_enter(spa);
+
+	vd = vdev_lookup_top(spa, id);
+	spa_event_notify(spa, vd, NULL, ESC_ZFS_VDEV_REMOVE_DEV);
+
+	asize = vd->vdev_asize;
+	ashift = vd->vdev_ashift;
+	object = vd->vdev_indirect_object;
+	vim = vd->vdev_indirect_mapping;
+	vd->vdev_indirect_object = 0;
+	vd->vdev_indirect_mapping = NULL;
+
+	/*
+	 * Allocate the indirect vdev, and with it a new guid, while the
+	 * slot in the root vdev is still filled; the guid uniqueness check
+	 * walks the whole tree.
+	 */
+	ivd = vdev_alloc_common(spa, id, 0, &vdev_indirect_ops);
+
+	(void) vdev_label_init(vd, 0, VDEV_LABEL_REMOVE);
+	if (list_link_active(&vd->vdev_state_dirty_node))
+		vdev_state_clean(vd);
+	if (list_link_active(&vd->vdev_config_dirty_node))
+		vdev_config_clean(vd);
+	vdev_free(vd);
+
+	ivd->vdev_asize = asize;
+	ivd->vdev_ashift = ashift;
+	ivd->vdev_indirect_object = object;
+	ivd->vdev_indirect_mapping = vim;
+	ivd->vdev_mg = metaslab_group_create(spa_normal_class(spa), ivd);
+	vdev_add_child(rvd, ivd);
+	vdev_config_dirty(rvd);
+
+	/* Drop the ZAPs of the removed vdev and its leaves. */
+	if (spa->spa_all_vdev_zaps != 0)
+		spa->spa_avz_action = AVZ_ACTION_REBUILD;
+
+	vdev_reopen(rvd);
+
+	spa->spa_vdev_removal = NULL;
+	spa_vdev_removal_destroy(svr);
+
+	spa_history_log_internal(spa, "vdev remove completed", NULL,
+	    "%s vdev %llu", spa_name(spa), (u_longlong_t)id);
+
+	(void) spa_vdev_exit(spa, NULL, txg, 0);
+}
+
+/*
+ * Wait for the copy thread to stop.  It is restarted by
+ * spa_restart_removal().
+ */
+void
+spa_vdev_remove_suspend(spa_t *spa)
+{
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+
+	if (svr == NULL)
+		return;
+
+	mutex_enter(&svr->svr_lock);
+	svr->svr_thread_exit = B_TRUE;
+	cv_broadcast(&svr->svr_cv);
+	while (svr->svr_thread != NULL)
+		cv_wait(&svr->svr_cv, &svr->svr_lock);
+	svr->svr_thread_exit = B_FALSE;
+	mutex_exit(&svr->svr_lock);
+}
+
+void
+spa_restart_removal(spa_t *spa)
+{
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+
+	if (svr == NULL || !spa_writeable(spa))
+		return;
+
+	if (svr->svr_copy_done) {
+		spa_async_request(spa, SPA_ASYNC_REMOVE_COMPLETE);
+		return;
+	}
+
+	ASSERT3P(svr->svr_thread, ==, NULL);
+	zfs_dbgmsg("restarting removal of vdev %llu",
+	    (u_longlong_t)svr->svr_vdev_id);
+	svr->svr_thread = thread_create(NULL, 0, spa_vdev_remove_thread, spa,
+	    0, &p0, TS_RUN, minclsyspri);
+}
+
+void
+spa_vdev_remove_fini(spa_t *spa)
+{
+	if (spa->spa_vdev_removal != NULL) {
+		spa_vdev_removal_destroy(spa->spa_vdev_removal);
+		spa->spa_vdev_removal = NULL;
+	}
+}
+
+boolean_t
+spa_vdev_remove_active(spa_t *spa)
+{
+	return (spa->spa_vdev_removal != NULL);
+}
+
+/*
+ * Read the removal state and open the indirect mappings at import.
+ */
+int
+spa_remove_init(spa_t *spa)
+{
+	spa_removing_phys_t *sr = &spa->spa_removing_phys;
+	objset_t *mos = spa->spa_meta_objset;
+	vdev_t *rvd = spa->spa_root_vdev;
+	boolean_t progress;
+	int error, c;
+
+	error = zap_lookup(mos, DMU_POOL_DIRECTORY_OBJECT, DMU_POOL_REMOVING,
+	    sizeof (uint64_t), sizeof (*sr) / sizeof (uint64_t), sr);
+	if (error == ENOENT) {
+		bzero(sr, sizeof (*sr));
+		sr->sr_state = DSS_NONE;
+		sr->sr_removing_vdev = -1ULL;
+	} else if (error != 0) {
+		return (error);
+	}
+
+	/*
+	 * A mapping object may itself have been copied off a vdev removed
+	 * later, and can only be read once that vdev's mapping is open.
+	 * Keep opening mappings while that makes progress.
+	 */
+	spa_config_enter(spa, SCL_STATE, FTAG, RW_READER);
+	do {
+		progress = B_FALSE;
+		error = 0;
+		for (c = 0; c < rvd->vdev_children; c++) {
+			vdev_t *vd = rvd->vdev_child[c];
+			int err;
+
+			if (vd->vdev_indirect_object == 0 ||
+			    vd->vdev_indirect_mapping != NULL)
+				continue;
+
+			err = vdev_indirect_mapping_open(mos,
+			    vd->vdev_indirect_object,
+			    &vd->vdev_indirect_mapping);
+			if (err == 0)
+				progress = B_TRUE;
+			else
+				error = err;
+		}
+	} while (error != 0 && progress);
+
+	if (error == 0 && (sr->sr_state == DSS_SCANNING ||
+	    sr->sr_state == DSS_FINISHED)) {
+		vdev_t *vd = vdev_lookup_top(spa, sr->sr_removing_vdev);
+
+		/*
+		 * A finished removal whose vdev is still concrete was
+		 * interrupted before spa_vdev_remove_complete() ran.
+		 */
+		if (vd != NULL && vd->vdev_ops != &vdev_indirect_ops) {
+			ASSERT(vd->vdev_removing);
+			ASSERT3P(vd->vdev_indirect_mapping, !=, NULL);
+			spa->spa_vdev_removal = spa_vdev_removal_create(vd);
+			spa->spa_vdev_removal->svr_copy_done =
+			    (sr->sr_state == DSS_FINISHED);
+		}
+	}
+	spa_config_exit(spa, SCL_STATE, FTAG);
+
+	return (error);
+}
+
+static uint64_t
+spa_removal_mapping_memory(spa_t *spa, uint64_t *entries)
+{
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+	vdev_t *rvd = spa->spa_root_vdev;
+	uint64_t memory = 0;
+	int c;
+
+	*entries = 0;
+	if (rvd == NULL)
+		return (0);
+
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *vd = rvd->vdev_child[c];
+
+		if (vd->vdev_ops != &vdev_indirect_ops ||
+		    vd->vdev_indirect_mapping == NULL)
+			continue;
+		memory += vdev_indirect_mapping_size(vd->vdev_indirect_mapping);
+		*entries += vdev_indirect_mapping_num_entries(
+		    vd->vdev_indirect_mapping);
+	}
+
+	/* The removing vdev's mapping grows, and may go, in syncing context. */
+	if (svr != NULL) {
+		vdev_t *vd = vdev_lookup_top(spa, svr->svr_vdev_id);
+
+		mutex_enter(&svr->svr_lock);
+		if (vd->vdev_indirect_mapping != NULL) {
+			memory += vdev_indirect_mapping_size(
+			    vd->vdev_indirect_mapping);
+			*entries += vdev_indirect_mapping_num_entries(
+			    vd->vdev_indirect_mapping);
+		}
+		mutex_exit(&svr->svr_lock);
+	}
+
+	return (memory);
+}
+
+int
+spa_removal_get_stats(spa_t *spa, pool_removal_stat_t *prs)
+{
+	spa_removing_phys_t *sr = &spa->spa_removing_phys;
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+	uint64_t entries;
+	int i;
+
+	ASSERT(spa_config_held(spa, SCL_CONFIG, RW_READER));
+
+	if (sr->sr_state == DSS_NONE)
+		return (SET_ERROR(ENOENT));
+
+	bzero(prs, sizeof (*prs));
+	prs->prs_state = sr->sr_state;
+	prs->prs_removing_vdev = sr->sr_removing_vdev;
+	prs->prs_start_time = sr->sr_start_time;
+	prs->prs_end_time = sr->sr_end_time;
+	prs->prs_to_copy = sr->sr_to_copy;
+	prs->prs_copied = sr->sr_copied;
+
+	if (svr != NULL) {
+		mutex_enter(&svr->svr_lock);
+		for (i = 0; i < TXG_SIZE; i++)
+			prs->prs_copied += svr->svr_bytes_done[i];
+		mutex_exit(&svr->svr_lock);
+	}
+
+	prs->prs_mapping_memory = spa_removal_mapping_memory(spa, &entries);
+
+	return (0);
+}
+
+/*
+ * Copy rate of the current pass of the copy thread, and the size of all
+ * indirect mappings, for the removal kstat.
+ */
+void
+spa_removal_kstat_update(spa_t *spa, uint64_t *rate, uint64_t *entries,
+    uint64_t *memory)
+{
+	spa_vdev_removal_t *svr = spa->spa_vdev_removal;
+
+	ASSERT(spa_config_held(spa, SCL_CONFIG, RW_READER));
+
+	*rate = 0;
+	if (svr != NULL) {
+		mutex_enter(&svr->svr_lock);
+		if (svr->svr_thread != NULL) {
+			uint64_t ms = NSEC2MSEC(gethrtime() -
+			    svr->svr_pass_start);
+
+			*rate = svr->svr_pass_copied * MILLISEC / MAX(ms, 1);
+		}
+		mutex_exit(&svr->svr_lock);
+	}
+
+	*memory = spa_removal_mapping_memory(spa, entries);
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+EXPORT_SYMBOL(spa_vdev_remove_cancel);
+EXPORT_SYMBOL(spa_removal_get_stats);
+
+/* BEGIN CSTYLED */
+module_param(zfs_remove_max_segment, int, 0644);
+MODULE_PARM_DESC(zfs_remove_max_segment,
+	"Largest contiguous chunk copied by device removal");
+
+module_param(zfs_remove_max_copy_bytes, int, 0644);
+MODULE_PARM_DESC(zfs_remove_max_copy_bytes,
+	"Max device removal copy I/O in flight");
+/* END CSTYLED */
+#endif
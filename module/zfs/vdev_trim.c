@@ -0,0 +1,1029 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/txg.h>
+#include <sys/vdev_impl.h>
+#include <sys/vdev_trim.h>
+#include <sys/metaslab_impl.h>
+#include <sys/dsl_synctask.h>
+#include <sys/zap.h>
+#include <sys/dmu_tx.h>
+
+/*
+ * TRIM is a feature which is used to notify a SSD that some previously
+ * written space is no longer allocated by the pool.  This is useful because
+ * writes to a SSD must be performed to blocks which have first been erased.
+ * Ensuring the SSD always has a supply of erased blocks for new writes
+ * helps prevent the performance from deteriorating.
+ *
+ * There are two supported TRIM methods; manual and automatic.
+ *
+ * Manual TRIM:
+ *
+ * A manual TRIM is initiated by running the 'zpool trim' command.  A single
+ * 'vdev_trim_thread' is created for each leaf vdev, and it is responsible for
+ * managing that vdev TRIM process.  This involves iterating over all the
+ * metaslabs, calculating the unallocated space ranges, and then issuing the
+ * required TRIM I/Os.
+ *
+ * While a metaslab is being actively trimmed it is disabled, which prevents
+ * any new allocations from it.  Once the TRIM I/Os for the metaslab have
+ * completed it is re-enabled and the thread moves on to the next one.  The
+ * progress is recorded in the leaf vdev ZAP after each metaslab so that an
+ * interrupted TRIM can be resumed when the pool is next imported.
+ *
+ * Automatic TRIM:
+ *
+ * An automatic TRIM is enabled by setting the 'autotrim' pool property
+ * to 'on'.  When enabled, a 'vdev_autotrim_thread' is created for each
+ * top-level (not leaf) vdev in the pool.  Each time a txg syncs, ranges
+ * which were freed and have left the deferred free tree are added to the
+ * metaslab's ms_trim tree.  The thread is kicked at the end of every txg
+ * and trims the metaslabs in batches, visiting each metaslab once every
+ * zfs_trim_txg_batch txgs.  This allows frees to accumulate which results
+ * in larger, more efficient TRIM I/Os.
+ *
+ * Both methods issue their I/Os through the vdev queue using the
+ * ZIO_PRIORITY_TRIM class so that they are scheduled alongside, but do
+ * not starve, the normal pool workload.
+ */
+
+/*
+ * Maximum size of TRIM I/O, ranges will be chunked in to 128MiB lengths.
+ */
+unsigned int zfs_trim_extent_bytes_max = 128 * 1024 * 1024;
+
+/*
+ * Minimum size of TRIM I/O, extents smaller than 32Kib will be skipped.
+ */
+unsigned int zfs_trim_extent_bytes_min = 32 * 1024;
+
+/*
+ * Maximum number of queued TRIM I/Os per leaf vdev.  The number of
+ * concurrent TRIM I/Os issued to the device is controlled by the
+ * zfs_vdev_trim_min_active and zfs_vdev_trim_max_active module options.
+ */
+unsigned int zfs_trim_queue_limit = 10;
+
+/*
+ * The number of transaction groups worth of frees which should be
+ * aggregated before TRIM I/Os are issued to a device.  Larger values
+ * result in larger TRIM commands at the cost of a longer delay before
+ * freed space is trimmed.
+ */
+unsigned int zfs_trim_txg_batch = 32;
+
+typedef enum trim_type {
+	TRIM_TYPE_MANUAL = 0,
+	TRIM_TYPE_AUTO = 1
+} trim_type_t;
+
+/*
+ * The trim_args are a control structure which describe how a leaf vdev
+ * should be trimmed.  The core elements are the vdev, the metaslab being
+ * trimmed and a range tree containing the extents to TRIM.  All provided
+ * ranges must be within the metaslab.
+ */
+typedef struct trim_args {
+	vdev_t		*trim_vdev;		/* Leaf vdev to TRIM */
+	range_tree_t	*trim_tree;		/* TRIM ranges (in metaslab) */
+	kmutex_t	trim_lock;		/* protects trim_tree */
+	trim_type_t	trim_type;		/* Manual or auto TRIM */
+	uint64_t	trim_extent_bytes_max;	/* Maximum TRIM I/O size */
+	uint64_t	trim_extent_bytes_min;	/* Minimum TRIM I/O size */
+	hrtime_t	trim_start_time;	/* Start time */
+	uint64_t	trim_bytes_done;	/* Bytes trimmed */
+} trim_args_t;
+
+static void
+vdev_trim_args_init(trim_args_t *ta, vdev_t *vd, trim_type_t type)
+{
+	bzero(ta, sizeof (*ta));
+	mutex_init(&ta->trim_lock, NULL, MUTEX_DEFAULT, NULL);
+	ta->trim_vdev = vd;
+	ta->trim_tree = range_tree_create(NULL, NULL, &ta->trim_lock);
+	ta->trim_type = type;
+	ta->trim_extent_bytes_max = P2ALIGN(zfs_trim_extent_bytes_max,
+	    1ULL << vd->vdev_top->vdev_ashift);
+	ta->trim_extent_bytes_max = MAX(ta->trim_extent_bytes_max,
+	    1ULL << vd->vdev_top->vdev_ashift);
+	ta->trim_extent_bytes_min = zfs_trim_extent_bytes_min;
+}
+
+static void
+vdev_trim_args_fini(trim_args_t *ta)
+{
+	mutex_enter(&ta->trim_lock);
+	range_tree_vacate(ta->trim_tree, NULL, NULL);
+	range_tree_destroy(ta->trim_tree);
+	mutex_exit(&ta->trim_lock);
+	mutex_destroy(&ta->trim_lock);
+}
+
+/*
+ * Determines whether a vdev_trim_thread() should be stopped.
+ */
+static boolean_t
+vdev_trim_should_stop(vdev_t *vd)
+{
+	return (vd->vdev_trim_exit_wanted || !vdev_writeable(vd) ||
+	    vd->vdev_detached || vd->vdev_top->vdev_removing ||
+	    !vd->vdev_has_trim);
+}
+
+/*
+ * Determines whether a vdev_autotrim_thread() should be stopped.
+ */
+static boolean_t
+vdev_autotrim_should_stop(vdev_t *tvd)
+{
+	return (tvd->vdev_autotrim_exit_wanted ||
+	    !vdev_writeable(tvd) || tvd->vdev_removing ||
+	    spa_get_autotrim(tvd->vdev_spa) == SPA_AUTOTRIM_OFF);
+}
+
+/*
+ * Writes the manual TRIM state of the leaf vdev to its ZAP.  The vdev is
+ * looked up by guid since it may have been removed from the pool by the
+ * time this task runs.
+ */
+static void
+vdev_trim_zap_update_sync(void *arg, dmu_tx_t *tx)
+{
+	uint64_t guid = *(uint64_t *)arg;
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	objset_t *mos = spa->spa_meta_objset;
+	uint64_t last_offset, trim_state, action_time, rate;
+	vdev_t *vd;
+
+	kmem_free(arg, sizeof (uint64_t));
+
+	vd = spa_lookup_by_guid(spa, guid, B_FALSE);
+	if (vd == NULL || vd->vdev_leaf_zap == 0 || vd->vdev_top->vdev_removing)
+		return;
+
+	last_offset = vd->vdev_trim_last_offset;
+	trim_state = vd->vdev_trim_state;
+	action_time = vd->vdev_trim_action_time;
+	rate = vd->vdev_trim_rate;
+
+	VERIFY0(zap_update(mos, vd->vdev_leaf_zap,
+	    VDEV_LEAF_ZAP_TRIM_LAST_OFFSET, sizeof (last_offset), 1,
+	    &last_offset, tx));
+	VERIFY0(zap_update(mos, vd->vdev_leaf_zap,
+	    VDEV_LEAF_ZAP_TRIM_STATE, sizeof (trim_state), 1,
+	    &trim_state, tx));
+	VERIFY0(zap_update(mos, vd->vdev_leaf_zap,
+	    VDEV_LEAF_ZAP_TRIM_ACTION_TIME, sizeof (action_time), 1,
+	    &action_time, tx));
+	VERIFY0(zap_update(mos, vd->vdev_leaf_zap,
+	    VDEV_LEAF_ZAP_TRIM_RATE, sizeof (rate), 1, &rate, tx));
+}
+
+/*
+ * Schedule the manual TRIM state of the leaf vdev to be written out in
+ * the currently open txg.  When a tx is provided it is used, otherwise
+ * one is assigned and committed here.
+ */
+static void
+vdev_trim_zap_update(vdev_t *vd, dmu_tx_t *tx)
+{
+	spa_t *spa = vd->vdev_spa;
+	dmu_tx_t *utx = tx;
+	uint64_t *guid;
+
+	if (utx == NULL) {
+		utx = dmu_tx_create_dd(spa_get_dsl(spa)->dp_mos_dir);
+		if (dmu_tx_assign(utx, TXG_WAIT) != 0) {
+			dmu_tx_abort(utx);
+			return;
+		}
+	}
+
+	guid = kmem_zalloc(sizeof (uint64_t), KM_SLEEP);
+	*guid = vd->vdev_guid;
+	dsl_sync_task_nowait(spa_get_dsl(spa), vdev_trim_zap_update_sync,
+	    guid, 2, ZFS_SPACE_CHECK_RESERVED, utx);
+
+	if (tx == NULL)
+		dmu_tx_commit(utx);
+}
+
+static void
+vdev_trim_change_state(vdev_t *vd, vdev_trim_state_t new_state,
+    uint64_t rate)
+{
+	spa_t *spa = vd->vdev_spa;
+	dmu_tx_t *tx;
+
+	ASSERT(MUTEX_HELD(&vd->vdev_trim_lock));
+
+	if (new_state == vd->vdev_trim_state)
+		return;
+
+	/*
+	 * If we're resuming a suspended TRIM preserve the original start
+	 * time, otherwise record when this state change occurred.
+	 */
+	if (vd->vdev_trim_state != VDEV_TRIM_SUSPENDED)
+		vd->vdev_trim_action_time = gethrestime_sec();
+
+	/*
+	 * A TRIM which is started after the previous one completed or was
+	 * canceled begins again from the start of the device.  A new rate,
+	 * when provided, replaces the previously requested one.
+	 */
+	if (new_state == VDEV_TRIM_ACTIVE) {
+		if (vd->vdev_trim_state != VDEV_TRIM_SUSPENDED) {
+			vd->vdev_trim_last_offset = 0;
+			vd->vdev_trim_rate = 0;
+		}
+		if (rate != 0)
+			vd->vdev_trim_rate = rate;
+	}
+
+	vd->vdev_trim_state = new_state;
+
+	tx = dmu_tx_create_dd(spa_get_dsl(spa)->dp_mos_dir);
+	if (dmu_tx_assign(tx, TXG_WAIT) != 0) {
+		dmu_tx_abort(tx);
+		return;
+	}
+
+	vdev_trim_zap_update(vd, tx);
+
+	switch (new_state) {
+	case VDEV_TRIM_ACTIVE:
+		spa_history_log_internal(spa, "trim", tx,
+		    "vdev=%s activated", vd->vdev_path);
+		break;
+	case VDEV_TRIM_SUSPENDED:
+		spa_history_log_internal(spa, "trim", tx,
+		    "vdev=%s suspended", vd->vdev_path);
+		break;
+	case VDEV_TRIM_CANCELED:
+		spa_history_log_internal(spa, "trim", tx,
+		    "vdev=%s canceled", vd->vdev_path);
+		break;
+	case VDEV_TRIM_COMPLETE:
+		spa_history_log_internal(spa, "trim", tx,
+		    "vdev=%s complete", vd->vdev_path);
+		break;
+	default:
+		panic("invalid state %llu", (unsigned long long)new_state);
+	}
+
+	dmu_tx_commit(tx);
+}
+
+/*
+ * Returns the current TRIM rate in bytes/sec for the trim_args.
+ */
+static uint64_t
+vdev_trim_calculate_rate(trim_args_t *ta)
+{
+	return (ta->trim_bytes_done * 1000 /
+	    (NSEC2MSEC(gethrtime() - ta->trim_start_time) + 1));
+}
+
+static void
+vdev_trim_cb(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+
+	if (zio->io_error != 0 && zio->io_error != ENOTSUP &&
+	    zio->io_error != EOPNOTSUPP && zio->io_error != ENOTTY) {
+		mutex_enter(&vd->vdev_stat_lock);
+		vd->vdev_stat.vs_trim_errors++;
+		mutex_exit(&vd->vdev_stat_lock);
+	}
+
+	mutex_enter(&vd->vdev_trim_io_lock);
+	ASSERT3U(vd->vdev_trim_inflight, >, 0);
+	vd->vdev_trim_inflight--;
+	cv_broadcast(&vd->vdev_trim_io_cv);
+	mutex_exit(&vd->vdev_trim_io_lock);
+
+	spa_config_exit(vd->vdev_spa, SCL_STATE_ALL, vd);
+}
+
+/*
+ * Issue a single TRIM I/O for the physical range.  Manual TRIMs are
+ * limited to the requested rate and all TRIMs are limited to
+ * zfs_trim_queue_limit outstanding I/Os per leaf vdev.
+ */
+static int
+vdev_trim_range(trim_args_t *ta, zio_t *rio, uint64_t start, uint64_t size)
+{
+	vdev_t *vd = ta->trim_vdev;
+	spa_t *spa = vd->vdev_spa;
+	boolean_t stop;
+
+	mutex_enter(&vd->vdev_trim_io_lock);
+
+	if (ta->trim_type == TRIM_TYPE_MANUAL) {
+		while (vd->vdev_trim_rate != 0 && !vdev_trim_should_stop(vd) &&
+		    vdev_trim_calculate_rate(ta) > vd->vdev_trim_rate) {
+			(void) cv_timedwait_sig(&vd->vdev_trim_io_cv,
+			    &vd->vdev_trim_io_lock, ddi_get_lbolt() +
+			    MSEC_TO_TICK(10));
+		}
+	}
+	ta->trim_bytes_done += size;
+
+	while (vd->vdev_trim_inflight >= zfs_trim_queue_limit)
+		cv_wait(&vd->vdev_trim_io_cv, &vd->vdev_trim_io_lock);
+	vd->vdev_trim_inflight++;
+	mutex_exit(&vd->vdev_trim_io_lock);
+
+	spa_config_enter(spa, SCL_STATE_ALL, vd, RW_READER);
+
+	if (ta->trim_type == TRIM_TYPE_MANUAL)
+		stop = vdev_trim_should_stop(vd);
+	else
+		stop = vdev_autotrim_should_stop(vd->vdev_top) ||
+		    !vdev_writeable(vd) || vd->vdev_detached ||
+		    !vd->vdev_has_trim;
+
+	if (stop) {
+		mutex_enter(&vd->vdev_trim_io_lock);
+		vd->vdev_trim_inflight--;
+		cv_broadcast(&vd->vdev_trim_io_cv);
+		mutex_exit(&vd->vdev_trim_io_lock);
+		spa_config_exit(spa, SCL_STATE_ALL, vd);
+		return (SET_ERROR(EINTR));
+	}
+
+	if (ta->trim_type == TRIM_TYPE_MANUAL)
+		vd->vdev_trim_bytes_done += size;
+
+	zio_nowait(zio_trim(rio, vd, start, size, vdev_trim_cb, NULL,
+	    ZIO_PRIORITY_TRIM, ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE |
+	    ZIO_FLAG_DONT_RETRY));
+
+	return (0);
+}
+
+/*
+ * Issue TRIMs for all ranges in the trim_args tree.  Ranges smaller than
+ * the minimum extent size are skipped and larger ranges are split in to
+ * chunks no larger than the maximum extent size.  The I/Os are children
+ * of the provided root zio which the caller must wait on.
+ */
+static int
+vdev_trim_ranges(trim_args_t *ta, zio_t *rio)
+{
+	avl_tree_t *rt = &ta->trim_tree->rt_root;
+	uint64_t extent_bytes_max = ta->trim_extent_bytes_max;
+	uint64_t extent_bytes_min = ta->trim_extent_bytes_min;
+	range_seg_t *rs;
+	int error = 0;
+
+	ta->trim_start_time = gethrtime();
+	ta->trim_bytes_done = 0;
+
+	for (rs = avl_first(rt); rs != NULL; rs = AVL_NEXT(rt, rs)) {
+		uint64_t size = rs->rs_end - rs->rs_start;
+		uint64_t off;
+
+		if (extent_bytes_min && size < extent_bytes_min)
+			continue;
+
+		for (off = 0; off < size; off += extent_bytes_max) {
+			error = vdev_trim_range(ta, rio,
+			    VDEV_LABEL_START_SIZE + rs->rs_start + off,
+			    MIN(size - off, extent_bytes_max));
+			if (error != 0)
+				return (error);
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Translates a metaslab range to the physical range on the leaf vdev and
+ * adds it to the trim_args tree.  The caller must hold the trim_lock.
+ */
+static void
+vdev_trim_range_add(void *arg, uint64_t start, uint64_t size)
+{
+	trim_args_t *ta = arg;
+	vdev_t *vd = ta->trim_vdev;
+	range_seg_t logical_rs, physical_rs;
+
+	logical_rs.rs_start = start;
+	logical_rs.rs_end = start + size;
+
+	vdev_xlate(vd, &logical_rs, &physical_rs);
+
+	IMPLY(vd->vdev_top == vd,
+	    logical_rs.rs_start == physical_rs.rs_start);
+	IMPLY(vd->vdev_top == vd,
+	    logical_rs.rs_end == physical_rs.rs_end);
+
+	/* Only a manual trim will be traversing the vdev sequentially. */
+	if (ta->trim_type == TRIM_TYPE_MANUAL) {
+		if (physical_rs.rs_end <= vd->vdev_trim_last_offset)
+			return;
+
+		if (physical_rs.rs_start < vd->vdev_trim_last_offset)
+			physical_rs.rs_start = vd->vdev_trim_last_offset;
+	}
+
+	/*
+	 * With raidz it's possible that the logical range does not live
+	 * on this leaf vdev.  We only add the physical range to this
+	 * vdev's if it has a length greater than 0.
+	 */
+	if (physical_rs.rs_end > physical_rs.rs_start) {
+		range_tree_add(ta->trim_tree, physical_rs.rs_start,
+		    physical_rs.rs_end - physical_rs.rs_start);
+	}
+}
+
+/*
+ * Estimates the number of bytes a manual TRIM of the leaf vdev will cover
+ * and how many of them have already been trimmed, based on the free space
+ * of each metaslab and the last trimmed offset.  The caller must hold the
+ * SCL_CONFIG lock.
+ */
+static void
+vdev_trim_calculate_progress(vdev_t *vd)
+{
+	vdev_t *tvd = vd->vdev_top;
+	uint64_t i;
+
+	ASSERT(spa_config_held(vd->vdev_spa, SCL_CONFIG, RW_READER) ||
+	    spa_config_held(vd->vdev_spa, SCL_CONFIG, RW_WRITER));
+	ASSERT(vd->vdev_leaf_zap != 0);
+
+	vd->vdev_trim_bytes_est = 0;
+	vd->vdev_trim_bytes_done = 0;
+
+	for (i = 0; i < tvd->vdev_ms_count; i++) {
+		metaslab_t *msp = tvd->vdev_ms[i];
+		range_seg_t logical_rs, physical_rs;
+		uint64_t ms_free;
+
+		logical_rs.rs_start = msp->ms_start;
+		logical_rs.rs_end = msp->ms_start + msp->ms_size;
+		vdev_xlate(vd, &logical_rs, &physical_rs);
+
+		mutex_enter(&msp->ms_lock);
+		ms_free = msp->ms_size - msp->ms_allocated_space;
+		mutex_exit(&msp->ms_lock);
+
+		/* Scale the metaslab's free space to this leaf's share. */
+		ms_free = (ms_free / msp->ms_size) *
+		    (physical_rs.rs_end - physical_rs.rs_start) +
+		    ((ms_free % msp->ms_size) *
+		    (physical_rs.rs_end - physical_rs.rs_start)) /
+		    msp->ms_size;
+
+		vd->vdev_trim_bytes_est += ms_free;
+		if (physical_rs.rs_end <= vd->vdev_trim_last_offset)
+			vd->vdev_trim_bytes_done += ms_free;
+	}
+}
+
+/*
+ * Load the manual TRIM state of the leaf vdev from its ZAP.
+ */
+static void
+vdev_trim_load(vdev_t *vd)
+{
+	objset_t *mos = vd->vdev_spa->spa_meta_objset;
+	uint64_t trim_state = VDEV_TRIM_NONE;
+	uint64_t timestamp = 0;
+	int err;
+
+	ASSERT(MUTEX_HELD(&vd->vdev_trim_lock));
+	ASSERT(vd->vdev_leaf_zap != 0);
+
+	err = zap_lookup(mos, vd->vdev_leaf_zap, VDEV_LEAF_ZAP_TRIM_STATE,
+	    sizeof (trim_state), 1, &trim_state);
+	ASSERT(err == 0 || err == ENOENT);
+	vd->vdev_trim_state = trim_state;
+
+	err = zap_lookup(mos, vd->vdev_leaf_zap,
+	    VDEV_LEAF_ZAP_TRIM_ACTION_TIME, sizeof (timestamp), 1, &timestamp);
+	ASSERT(err == 0 || err == ENOENT);
+	vd->vdev_trim_action_time = timestamp;
+
+	if (vd->vdev_trim_state == VDEV_TRIM_ACTIVE ||
+	    vd->vdev_trim_state == VDEV_TRIM_SUSPENDED) {
+		err = zap_lookup(mos, vd->vdev_leaf_zap,
+		    VDEV_LEAF_ZAP_TRIM_LAST_OFFSET,
+		    sizeof (vd->vdev_trim_last_offset), 1,
+		    &vd->vdev_trim_last_offset);
+		ASSERT(err == 0 || err == ENOENT);
+		if (err == ENOENT)
+			vd->vdev_trim_last_offset = 0;
+
+		err = zap_lookup(mos, vd->vdev_leaf_zap,
+		    VDEV_LEAF_ZAP_TRIM_RATE, sizeof (vd->vdev_trim_rate), 1,
+		    &vd->vdev_trim_rate);
+		ASSERT(err == 0 || err == ENOENT);
+		if (err == ENOENT)
+			vd->vdev_trim_rate = 0;
+	}
+
+	spa_config_enter(vd->vdev_spa, SCL_CONFIG, FTAG, RW_READER);
+	vdev_trim_calculate_progress(vd);
+	spa_config_exit(vd->vdev_spa, SCL_CONFIG, FTAG);
+}
+
+/*
+ * Walks each metaslab of the top-level vdev, issuing TRIMs for the free
+ * space which maps to this leaf vdev.  Allocations from a metaslab are
+ * disabled while it is being trimmed.
+ */
+static void
+vdev_trim_thread(void *arg)
+{
+	vdev_t *vd = arg;
+	spa_t *spa = vd->vdev_spa;
+	trim_args_t ta;
+	uint64_t i;
+	int error = 0;
+
+	ASSERT(vdev_is_concrete(vd));
+	spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+
+	vdev_trim_calculate_progress(vd);
+	vdev_trim_args_init(&ta, vd, TRIM_TYPE_MANUAL);
+
+	for (i = 0; error == 0 && i < vd->vdev_top->vdev_ms_count &&
+	    !vdev_trim_should_stop(vd); i++) {
+		metaslab_t *msp = vd->vdev_top->vdev_ms[i];
+		range_seg_t logical_rs, physical_rs;
+		zio_t *rio;
+
+		logical_rs.rs_start = msp->ms_start;
+		logical_rs.rs_end = msp->ms_start + msp->ms_size;
+		vdev_xlate(vd, &logical_rs, &physical_rs);
+
+		/* Skip metaslabs which were trimmed before a restart. */
+		if (physical_rs.rs_end <= vd->vdev_trim_last_offset)
+			continue;
+
+		spa_config_exit(spa, SCL_CONFIG, FTAG);
+		metaslab_disable(msp);
+
+		mutex_enter(&msp->ms_lock);
+		if (msp->ms_freedtree == NULL) {
+			/* This metaslab is not yet available. */
+			mutex_exit(&msp->ms_lock);
+			metaslab_enable(msp);
+			spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+			continue;
+		}
+
+		metaslab_load_wait(msp);
+		if (!msp->ms_loaded)
+			error = metaslab_load(msp);
+
+		if (error == 0) {
+			mutex_enter(&ta.trim_lock);
+			range_tree_walk(msp->ms_tree, vdev_trim_range_add, &ta);
+			mutex_exit(&ta.trim_lock);
+
+			/*
+			 * All free space in this metaslab is about to be
+			 * trimmed, there is no need for an automatic TRIM
+			 * to issue it again.
+			 */
+			range_tree_vacate(msp->ms_trim, NULL, NULL);
+		}
+		mutex_exit(&msp->ms_lock);
+
+		if (error == 0) {
+			rio = zio_root(spa, NULL, NULL, 0);
+			error = vdev_trim_ranges(&ta, rio);
+			(void) zio_wait(rio);
+		}
+
+		metaslab_enable(msp);
+
+		mutex_enter(&ta.trim_lock);
+		range_tree_vacate(ta.trim_tree, NULL, NULL);
+		mutex_exit(&ta.trim_lock);
+
+		/* Record the progress so an interrupted TRIM can resume. */
+		if (error == 0) {
+			vd->vdev_trim_last_offset = physical_rs.rs_end;
+			vdev_trim_zap_update(vd, NULL);
+		}
+
+		spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+	}
+
+	spa_config_exit(spa, SCL_CONFIG, FTAG);
+	vdev_trim_args_fini(&ta);
+
+	mutex_enter(&vd->vdev_trim_lock);
+	if (!vd->vdev_trim_exit_wanted && vdev_writeable(vd)) {
+		if (!vd->vdev_has_trim)
+			vdev_trim_change_state(vd, VDEV_TRIM_CANCELED, 0);
+		else if (error == 0 && !vdev_trim_should_stop(vd))
+			vdev_trim_change_state(vd, VDEV_TRIM_COMPLETE, 0);
+	}
+	ASSERT(vd->vdev_trim_thread != NULL);
+
+	/*
+	 * Drop the vdev_trim_lock while we sync out the txg since it's
+	 * possible that a device might be trying to come online and must
+	 * check to see if it needs to restart a TRIM.  That thread will be
+	 * holding the spa_config_lock which would prevent the txg_wait_synced
+	 * from completing.
+	 */
+	mutex_exit(&vd->vdev_trim_lock);
+	txg_wait_synced(spa_get_dsl(spa), 0);
+	mutex_enter(&vd->vdev_trim_lock);
+
+	vd->vdev_trim_thread = NULL;
+	cv_broadcast(&vd->vdev_trim_cv);
+	mutex_exit(&vd->vdev_trim_lock);
+
+	thread_exit();
+}
+
+/*
+ * Initiates a manual TRIM for the vdev_t.  Callers must hold vdev_trim_lock,
+ * the vdev_t must be a leaf and cannot already be manually trimming.
+ */
+void
+vdev_trim(vdev_t *vd, uint64_t rate)
+{
+	ASSERT(MUTEX_HELD(&vd->vdev_trim_lock));
+	ASSERT(vd->vdev_ops->vdev_op_leaf);
+	ASSERT(vdev_is_concrete(vd));
+	ASSERT3P(vd->vdev_trim_thread, ==, NULL);
+	ASSERT(!vd->vdev_detached);
+	ASSERT(!vd->vdev_trim_exit_wanted);
+	ASSERT(!vd->vdev_top->vdev_removing);
+
+	vdev_trim_change_state(vd, VDEV_TRIM_ACTIVE, rate);
+	vd->vdev_trim_thread = thread_create(NULL, 0,
+	    vdev_trim_thread, vd, 0, &p0, TS_RUN, maxclsyspri);
+}
+
+/*
+ * Stop the manual TRIM of the vdev_t, if one is running, and wait for its
+ * thread to exit.  The TRIM is left in the target state; a TRIM stopped
+ * in the VDEV_TRIM_ACTIVE state is resumed when the pool is next imported.
+ * Callers must hold vdev_trim_lock.
+ */
+void
+vdev_trim_stop(vdev_t *vd, vdev_trim_state_t tgt_state)
+{
+	ASSERT(MUTEX_HELD(&vd->vdev_trim_lock));
+	ASSERT(vd->vdev_ops->vdev_op_leaf);
+	ASSERT(vdev_is_concrete(vd));
+
+	/*
+	 * Allow cancel requests to proceed even if the TRIM thread has
+	 * stopped, so a suspended TRIM can be canceled.
+	 */
+	if (vd->vdev_trim_thread == NULL && (tgt_state != VDEV_TRIM_CANCELED ||
+	    (vd->vdev_trim_state != VDEV_TRIM_ACTIVE &&
+	    vd->vdev_trim_state != VDEV_TRIM_SUSPENDED)))
+		return;
+
+	vdev_trim_change_state(vd, tgt_state, 0);
+	if (vd->vdev_trim_thread == NULL)
+		return;
+
+	vd->vdev_trim_exit_wanted = B_TRUE;
+	mutex_enter(&vd->vdev_trim_io_lock);
+	cv_broadcast(&vd->vdev_trim_io_cv);
+	mutex_exit(&vd->vdev_trim_io_lock);
+
+	while (vd->vdev_trim_thread != NULL)
+		cv_wait(&vd->vdev_trim_cv, &vd->vdev_trim_lock);
+
+	ASSERT3P(vd->vdev_trim_thread, ==, NULL);
+	vd->vdev_trim_exit_wanted = B_FALSE;
+}
+
+/*
+ * Convenience function to stop trimming of a vdev tree and set all trim
+ * thread pointers to NULL.
+ */
+void
+vdev_trim_stop_all(vdev_t *vd, vdev_trim_state_t tgt_state)
+{
+	uint64_t i;
+
+	if (vd->vdev_ops->vdev_op_leaf && vdev_is_concrete(vd)) {
+		mutex_enter(&vd->vdev_trim_lock);
+		vdev_trim_stop(vd, tgt_state);
+		mutex_exit(&vd->vdev_trim_lock);
+		return;
+	}
+
+	for (i = 0; i < vd->vdev_children; i++)
+		vdev_trim_stop_all(vd->vdev_child[i], tgt_state);
+}
+
+/*
+ * Conditionally restarts a manual TRIM given its on-disk state.
+ */
+void
+vdev_trim_restart(vdev_t *vd)
+{
+	uint64_t i;
+
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+	ASSERT(!spa_config_held(vd->vdev_spa, SCL_ALL, RW_WRITER));
+
+	if (vd->vdev_leaf_zap != 0) {
+		mutex_enter(&vd->vdev_trim_lock);
+		vdev_trim_load(vd);
+
+		if (vd->vdev_trim_state == VDEV_TRIM_ACTIVE &&
+		    vdev_writeable(vd) && !vd->vdev_top->vdev_removing &&
+		    vd->vdev_has_trim && vd->vdev_trim_thread == NULL) {
+			vdev_trim(vd, vd->vdev_trim_rate);
+		}
+
+		mutex_exit(&vd->vdev_trim_lock);
+	}
+
+	for (i = 0; i < vd->vdev_children; i++)
+		vdev_trim_restart(vd->vdev_child[i]);
+}
+
+/*
+ * Issues TRIMs for the ranges which were freed in recent txgs.  The
+ * metaslabs are visited in batches, a different subset each txg, such
+ * that each metaslab is processed once every zfs_trim_txg_batch txgs.
+ */
+static void
+vdev_autotrim_thread(void *arg)
+{
+	vdev_t *vd = arg;
+	spa_t *spa = vd->vdev_spa;
+	uint64_t shift = 0;
+
+	mutex_enter(&vd->vdev_autotrim_lock);
+	ASSERT3P(vd->vdev_top, ==, vd);
+	ASSERT3P(vd->vdev_autotrim_thread, !=, NULL);
+	mutex_exit(&vd->vdev_autotrim_lock);
+
+	spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+
+	while (!vdev_autotrim_should_stop(vd)) {
+		uint64_t txgs_per_trim = MAX(zfs_trim_txg_batch, 1);
+		uint64_t i;
+
+		for (i = shift % txgs_per_trim; i < vd->vdev_ms_count &&
+		    !vdev_autotrim_should_stop(vd); i += txgs_per_trim) {
+			metaslab_t *msp = vd->vdev_ms[i];
+			range_tree_t *trim_tree;
+			kmutex_t trim_lock;
+			zio_t *rio;
+			uint64_t c;
+
+			spa_config_exit(spa, SCL_CONFIG, FTAG);
+			metaslab_disable(msp);
+			spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+
+			mutex_enter(&msp->ms_lock);
+
+			/*
+			 * Skip the metaslab when it has no frees to TRIM, or
+			 * when a manual TRIM is already processing it.  The
+			 * manual TRIM covers all free space in the metaslab
+			 * and will vacate the ms_trim tree.
+			 */
+			if (range_tree_space(msp->ms_trim) == 0 ||
+			    msp->ms_disabled > 1) {
+				mutex_exit(&msp->ms_lock);
+				metaslab_enable(msp);
+				continue;
+			}
+
+			mutex_init(&trim_lock, NULL, MUTEX_DEFAULT, NULL);
+			trim_tree = range_tree_create(NULL, NULL, &trim_lock);
+
+			mutex_enter(&trim_lock);
+			range_tree_walk(msp->ms_trim, range_tree_add,
+			    trim_tree);
+			range_tree_vacate(msp->ms_trim, NULL, NULL);
+			mutex_exit(&msp->ms_lock);
+
+			rio = zio_root(spa, NULL, NULL, 0);
+			for (c = 0; c < vd->vdev_children || (c == 0 &&
+			    vd->vdev_ops->vdev_op_leaf); c++) {
+				vdev_t *cvd = vd->vdev_ops->vdev_op_leaf ?
+				    vd : vd->vdev_child[c];
+				trim_args_t ta;
+
+				/*
+				 * Only leaves which are writable and support
+				 * TRIM are trimmed.  Nested mirrors such as
+				 * replacing and spare vdevs are not.
+				 */
+				if (!cvd->vdev_ops->vdev_op_leaf ||
+				    !vdev_writeable(cvd) ||
+				    !cvd->vdev_has_trim || cvd->vdev_detached)
+					continue;
+
+				vdev_trim_args_init(&ta, cvd, TRIM_TYPE_AUTO);
+				mutex_enter(&ta.trim_lock);
+				range_tree_walk(trim_tree, vdev_trim_range_add,
+				    &ta);
+				mutex_exit(&ta.trim_lock);
+
+				(void) vdev_trim_ranges(&ta, rio);
+
+				/* The issued zios no longer reference ta. */
+				vdev_trim_args_fini(&ta);
+			}
+			(void) zio_wait(rio);
+
+			range_tree_vacate(trim_tree, NULL, NULL);
+			range_tree_destroy(trim_tree);
+			mutex_exit(&trim_lock);
+			mutex_destroy(&trim_lock);
+
+			metaslab_enable(msp);
+		}
+
+		spa_config_exit(spa, SCL_CONFIG, FTAG);
+
+		/* Wait for the next txg to sync before the next batch. */
+		mutex_enter(&vd->vdev_autotrim_lock);
+		if (!vd->vdev_autotrim_exit_wanted) {
+			(void) cv_timedwait_sig(&vd->vdev_autotrim_kick_cv,
+			    &vd->vdev_autotrim_lock, ddi_get_lbolt() +
+			    SEC_TO_TICK(zfs_txg_timeout));
+		}
+		mutex_exit(&vd->vdev_autotrim_lock);
+		shift++;
+
+		spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+	}
+
+	spa_config_exit(spa, SCL_CONFIG, FTAG);
+
+	mutex_enter(&vd->vdev_autotrim_lock);
+	vd->vdev_autotrim_thread = NULL;
+	cv_broadcast(&vd->vdev_autotrim_cv);
+	mutex_exit(&vd->vdev_autotrim_lock);
+
+	thread_exit();
+}
+
+/*
+ * Starts an autotrim thread, if needed, for each top-level vdev which can
+ * be trimmed.  A top-level vdev which is a leaf is trimmed by its own
+ * autotrim thread.
+ */
+void
+vdev_autotrim(spa_t *spa)
+{
+	vdev_t *root_vd = spa->spa_root_vdev;
+	uint64_t i;
+
+	for (i = 0; i < root_vd->vdev_children; i++) {
+		vdev_t *tvd = root_vd->vdev_child[i];
+
+		mutex_enter(&tvd->vdev_autotrim_lock);
+		if (vdev_writeable(tvd) && !tvd->vdev_removing &&
+		    tvd->vdev_autotrim_thread == NULL &&
+		    vdev_is_concrete(tvd) && tvd->vdev_ms_count != 0) {
+			ASSERT3P(tvd->vdev_top, ==, tvd);
+
+			tvd->vdev_autotrim_thread = thread_create(NULL, 0,
+			    vdev_autotrim_thread, tvd, 0, &p0, TS_RUN,
+			    maxclsyspri);
+			ASSERT(tvd->vdev_autotrim_thread != NULL);
+		}
+		mutex_exit(&tvd->vdev_autotrim_lock);
+	}
+}
+
+/*
+ * Wait for the vdev_autotrim_thread associated with the passed top-level
+ * vdev to be terminated (canceled or stopped).
+ */
+void
+vdev_autotrim_stop_wait(vdev_t *tvd)
+{
+	mutex_enter(&tvd->vdev_autotrim_lock);
+	if (tvd->vdev_autotrim_thread != NULL) {
+		tvd->vdev_autotrim_exit_wanted = B_TRUE;
+		cv_broadcast(&tvd->vdev_autotrim_kick_cv);
+
+		while (tvd->vdev_autotrim_thread != NULL) {
+			cv_wait(&tvd->vdev_autotrim_cv,
+			    &tvd->vdev_autotrim_lock);
+		}
+
+		ASSERT3P(tvd->vdev_autotrim_thread, ==, NULL);
+		tvd->vdev_autotrim_exit_wanted = B_FALSE;
+	}
+	mutex_exit(&tvd->vdev_autotrim_lock);
+}
+
+/*
+ * Wait for all of the vdev_autotrim_thread associated with the pool to
+ * be terminated (canceled or stopped).
+ */
+void
+vdev_autotrim_stop_all(spa_t *spa)
+{
+	vdev_t *root_vd = spa->spa_root_vdev;
+	uint64_t i;
+
+	for (i = 0; i < root_vd->vdev_children; i++)
+		vdev_autotrim_stop_wait(root_vd->vdev_child[i]);
+}
+
+/*
+ * Conditionally restart all of the vdev_autotrim_thread's for the pool.
+ */
+void
+vdev_autotrim_restart(spa_t *spa)
+{
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+
+	if (spa_get_autotrim(spa) == SPA_AUTOTRIM_ON)
+		vdev_autotrim(spa);
+	else
+		vdev_autotrim_stop_all(spa);
+}
+
+/*
+ * Wake the autotrim threads once a txg has synced so the next batch of
+ * metaslabs is processed.  Called at the end of spa_sync().
+ */
+void
+vdev_autotrim_kick(spa_t *spa)
+{
+	vdev_t *root_vd = spa->spa_root_vdev;
+	uint64_t i;
+
+	ASSERT(spa_config_held(spa, SCL_CONFIG, RW_READER));
+
+	for (i = 0; i < root_vd->vdev_children; i++) {
+		vdev_t *tvd = root_vd->vdev_child[i];
+
+		mutex_enter(&tvd->vdev_autotrim_lock);
+		if (tvd->vdev_autotrim_thread != NULL)
+			cv_broadcast(&tvd->vdev_autotrim_kick_cv);
+		mutex_exit(&tvd->vdev_autotrim_lock);
+	}
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+EXPORT_SYMBOL(vdev_trim);
+EXPORT_SYMBOL(vdev_trim_stop);
+EXPORT_SYMBOL(vdev_trim_stop_all);
+EXPORT_SYMBOL(vdev_trim_restart);
+EXPORT_SYMBOL(vdev_autotrim);
+EXPORT_SYMBOL(vdev_autotrim_stop_wait);
+EXPORT_SYMBOL(vdev_autotrim_stop_all);
+EXPORT_SYMBOL(vdev_autotrim_restart);
+
+/* BEGIN CSTYLED */
+module_param(zfs_trim_extent_bytes_max, uint, 0644);
+MODULE_PARM_DESC(zfs_trim_extent_bytes_max,
+	"Max size of TRIM commands, larger will be split");
+
+module_param(zfs_trim_extent_bytes_min, uint, 0644);
+MODULE_PARM_DESC(zfs_trim_extent_bytes_min,
+	"Min size of TRIM commands, smaller will be skipped");
+
+module_param(zfs_trim_queue_limit, uint, 0644);
+MODULE_PARM_DESC(zfs_trim_queue_limit,
+	"Max queued TRIMs outstanding per leaf vdev");
+
+module_param(zfs_trim_txg_batch, uint, 0644);
+MODULE_PARM_DESC(zfs_trim_txg_batch,
+	"Min number of txgs to aggregate frees before issuing TRIM");
+/* END CSTYLED */
+#endif
@@ -1900,8 +1900,8 @@ zfs_ioc_vdev_add(zfs_cmd_t *zc)
 /*
  * inputs:
  * zc_name		name of the pool
- * zc_nvlist_conf	nvlist of devices to remove
- * zc_cookie		to stop the remove?
+ * zc_guid		guid of the device to remove
+ * zc_cookie		nonzero to cancel the removal of a top-level vdev
  */
 static int
 zfs_ioc_vdev_remove(zfs_cmd_t *zc)
@@ -1912,7 +1912,10 @@ zfs_ioc_vdev_remove(zfs_cmd_t *zc)
 	error = spa_open(zc->zc_name, &spa, FTAG);
 	if (error != 0)
 		return (error);
-	error = spa_vdev_remove(spa, zc->zc_guid, B_FALSE);
+	if (zc->zc_cookie != 0)
+		error = spa_vdev_remove_cancel(spa);
+	else
+		error = spa_vdev_remove(spa, zc->zc_guid, B_FALSE);
 	spa_close(spa, FTAG);
 	return (error);
 }
@@ -3937,6 +3940,24 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 				spa_close(spa, FTAG);
 			}
 
+			if (zio_compress_to_feature(intval) ==
+			    SPA_FEATURE_ZSTD_COMPRESS) {
+				spa_t *spa;
+
+				if (!zio_compress_available(intval))
+					return (SET_ERROR(ENOSYS));
+
+				if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+					return (err);
+
+				if (!spa_feature_is_enabled(spa,
+				    SPA_FEATURE_ZSTD_COMPRESS)) {
+					spa_close(spa, FTAG);
+					return (SET_ERROR(ENOTSUP));
+				}
+				spa_close(spa, FTAG);
+			}
+
 			/*
 			 * If this is a bootable dataset then
 			 * verify that the compression algorithm
@@ -3983,6 +4004,14 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 		}
 		break;
 
+	case ZFS_PROP_SPECIAL_SMALL_BLOCKS:
+		/* Must be zero or a power of two no larger than 128K */
+		if (nvpair_value_uint64(pair, &intval) == 0 && intval != 0 &&
+		    (intval < SPA_MINBLOCKSIZE ||
+		    intval > SPA_OLD_MAXBLOCKSIZE || !ISP2(intval)))
+			return (SET_ERROR(EDOM));
+		break;
+
 	case ZFS_PROP_DNODESIZE:
 		/* Dnode sizes above 512 need the feature to be enabled */
 		if (nvpair_value_uint64(pair, &intval) == 0 &&
@@ -6013,6 +6042,72 @@ out:
 	return (err);
 }
 
+/*
+ * Start, cancel or suspend a manual TRIM of the given leaf vdevs.
+ *
+ * innvl: {
+ *     "trim_command" -> POOL_TRIM_{START|CANCEL|SUSPEND} (uint64)
+ *     "trim_vdevs" -> { guid_name -> guid }  (nvlist of uint64)
+ *     (optional) "trim_rate" -> TRIM rate in bytes/sec (uint64)
+ * }
+ *
+ * outnvl: {
+ *     "trim_vdevs" -> { guid_name -> errno }  (nvlist of int64)
+ * }
+ *
+ * The outnvl only contains the vdevs for which the command failed.
+ */
+static int
+zfs_ioc_pool_trim(const char *poolname, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	spa_t *spa;
+	nvlist_t *vdev_guids, *vdev_errlist;
+	nvpair_t *pair;
+	uint64_t cmd_type, rate = 0;
+	int total_errors = 0;
+	int error;
+
+	if (nvlist_lookup_uint64(innvl, ZPOOL_TRIM_COMMAND, &cmd_type) != 0 ||
+	    (cmd_type != POOL_TRIM_START && cmd_type != POOL_TRIM_CANCEL &&
+	    cmd_type != POOL_TRIM_SUSPEND))
+		return (SET_ERROR(EINVAL));
+
+	if (nvlist_lookup_nvlist(innvl, ZPOOL_TRIM_VDEVS, &vdev_guids) != 0)
+		return (SET_ERROR(EINVAL));
+
+	if (nvlist_exists(innvl, ZPOOL_TRIM_RATE) &&
+	    nvlist_lookup_uint64(innvl, ZPOOL_TRIM_RATE, &rate) != 0)
+		return (SET_ERROR(EINVAL));
+
+	if ((error = spa_open(poolname, &spa, FTAG)) != 0)
+		return (error);
+
+	vdev_errlist = fnvlist_alloc();
+
+	for (pair = nvlist_next_nvpair(vdev_guids, NULL); pair != NULL;
+	    pair = nvlist_next_nvpair(vdev_guids, pair)) {
+		uint64_t vdev_guid = fnvpair_value_uint64(pair);
+
+		error = spa_vdev_trim(spa, vdev_guid, cmd_type, rate);
+		if (error != 0) {
+			char guid_as_str[MAXNAMELEN];
+
+			(void) snprintf(guid_as_str, sizeof (guid_as_str),
+			    "%llu", (unsigned long long)vdev_guid);
+			fnvlist_add_int64(vdev_errlist, guid_as_str, error);
+			total_errors++;
+		}
+	}
+
+	if (fnvlist_size(vdev_errlist) > 0)
+		fnvlist_add_nvlist(outnvl, ZPOOL_TRIM_VDEVS, vdev_errlist);
+	fnvlist_free(vdev_errlist);
+
+	spa_close(spa, FTAG);
+
+	return (total_errors > 0 ? EINVAL : 0);
+}
+
 /*
  * Load a user's wrapping key into the kernel.
  * innvl: {
@@ -6317,6 +6412,10 @@ zfs_ioctl_init(void)
 	    zfs_ioc_pool_sync, zfs_secpolicy_none, POOL_NAME,
 	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_FALSE, B_FALSE);
 
+	zfs_ioctl_register("trim", ZFS_IOC_POOL_TRIM,
+	    zfs_ioc_pool_trim, zfs_secpolicy_config, POOL_NAME,
+	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_TRUE, B_TRUE);
+
 	/* IOCTLS that use the legacy function signature */
 
 	zfs_ioctl_register_legacy(ZFS_IOC_POOL_FREEZE, zfs_ioc_pool_freeze,
@@ -426,6 +426,36 @@ mappedread(struct inode *ip, int nbytes, uio_t *uio)
 unsigned long zfs_read_chunk_size = 1024 * 1024; /* Tunable */
 unsigned long zfs_delete_blocks = DMU_MAX_DELETEBLKCNT;
 
+/*
+ * Decide whether I/O should bypass the ARC, as requested by O_DIRECT or
+ * implied by direct=always.  Only I/O aligned to the file's block size
+ * is done directly; misaligned I/O, and I/O to files that are mmap'ed
+ * and so must stay coherent with the page cache, is buffered as usual.
+ */
+static boolean_t
+zfs_direct_enabled(znode_t *zp, offset_t off, ssize_t len, int ioflag)
+{
+	zfsvfs_t *zfsvfs = ZTOZSB(zp);
+	uint32_t blksz = zp->z_blksz;
+
+	switch (zfsvfs->z_os->os_direct) {
+	case ZFS_DIRECT_DISABLED:
+		return (B_FALSE);
+	case ZFS_DIRECT_STANDARD:
+		if (!(ioflag & O_DIRECT))
+			return (B_FALSE);
+		break;
+	default:
+		break;
+	}
+
+	if (zp->z_is_mapped || !ISP2(blksz))
+		return (B_FALSE);
+
+	return (P2PHASE(off, (offset_t)blksz) == 0 &&
+	    P2PHASE(len, (ssize_t)blksz) == 0);
+}
+
 /*
  * Read bytes from specified file into supplied buffer.
  *
@@ -433,7 +463,8 @@ unsigned long zfs_delete_blocks = DMU_MAX_DELETEBLKCNT;
  *		uio	- structure supplying read location, range info,
  *			  and return buffer.
  *		ioflag	- FSYNC flags; used to provide FRSYNC semantics.
- *			  O_DIRECT flag; used to bypass page cache.
+ *			  O_DIRECT flag; used to bypass page cache, and
+ *			  the ARC for aligned reads.
  *		cr	- credentials of caller.
  *
  *	OUT:	uio	- updated offset and range, buffer filled.
@@ -452,6 +483,7 @@ zfs_read(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 	ssize_t		n, nbytes;
 	int		error = 0;
 	rl_t		*rl;
+	boolean_t	direct;
 #ifdef HAVE_UIO_ZEROCOPY
 	xuio_t		*xuio = NULL;
 #endif /* HAVE_UIO_ZEROCOPY */
@@ -505,6 +537,8 @@ zfs_read(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 
 	ASSERT(uio->uio_loffset < zp->z_size);
 	n = MIN(uio->uio_resid, zp->z_size - uio->uio_loffset);
+	direct = zfs_direct_enabled(zp, uio->uio_loffset, uio->uio_resid,
+	    ioflag);
 
 #ifdef HAVE_UIO_ZEROCOPY
 	if ((uio->uio_extflg == UIO_XUIO) &&
@@ -541,7 +575,10 @@ zfs_read(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 		nbytes = MIN(n, zfs_read_chunk_size -
 		    P2PHASE(uio->uio_loffset, zfs_read_chunk_size));
 
-		if (zp->z_is_mapped && !(ioflag & O_DIRECT)) {
+		if (direct) {
+			error = dmu_read_uio_direct(sa_get_db(zp->z_sa_hdl),
+			    uio, nbytes);
+		} else if (zp->z_is_mapped && !(ioflag & O_DIRECT)) {
 			error = mappedread(ip, nbytes, uio);
 		} else {
 			error = dmu_read_uio_dbuf(sa_get_db(zp->z_sa_hdl),
@@ -571,7 +608,8 @@ out:
  *		uio	- structure supplying write location, range info,
  *			  and data buffer.
  *		ioflag	- FAPPEND flag set if in append mode.
- *			  O_DIRECT flag; used to bypass page cache.
+ *			  O_DIRECT flag; used to bypass page cache, and
+ *			  the ARC for aligned full block writes.
  *		cr	- credentials of caller.
  *
  *	OUT:	uio	- updated offset and range.
@@ -604,6 +642,7 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 	const iovec_t	*aiov = NULL;
 	xuio_t		*xuio = NULL;
 	int		write_eof;
+	boolean_t	direct;
 	int		count = 0;
 	sa_bulk_attr_t	bulk[4];
 	uint64_t	mtime[2], ctime[2];
@@ -717,6 +756,9 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 	/* Will this write extend the file length? */
 	write_eof = (woff + n > zp->z_size);
 
+	/* Full blocks of an aligned direct write bypass the ARC. */
+	direct = zfs_direct_enabled(zp, woff, n, ioflag);
+
 	end_size = MAX(zp->z_size, woff + n);
 
 	/*
@@ -748,7 +790,7 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 			i_iov++;
 #endif
 		} else if (abuf == NULL && n >= max_blksz &&
-		    woff >= zp->z_size &&
+		    (woff >= zp->z_size || direct) &&
 		    P2PHASE(woff, max_blksz) == 0 &&
 		    zp->z_blksz == max_blksz) {
 			/*
@@ -841,8 +883,15 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 				xuio_stat_wbuf_copied();
 			} else {
 				ASSERT(xuio || tx_bytes == max_blksz);
-				dmu_assign_arcbuf(sa_get_db(zp->z_sa_hdl),
-				    woff, abuf, tx);
+				if (direct) {
+					dmu_assign_arcbuf_direct(
+					    sa_get_db(zp->z_sa_hdl), woff,
+					    abuf, tx);
+				} else {
+					dmu_assign_arcbuf(
+					    sa_get_db(zp->z_sa_hdl), woff,
+					    abuf, tx);
+				}
 			}
 			ASSERT(tx_bytes <= uio->uio_resid);
 			uioskip(uio, tx_bytes);
@@ -982,7 +1031,7 @@ zfs_get_done(zgd_t *zgd, int error)
 	zfs_iput_async(ZTOI(zp));
 
 	if (error == 0 && zgd->zgd_bp)
-		zil_add_block(zgd->zgd_zilog, zgd->zgd_bp);
+		zil_lwb_add_block(zgd->zgd_lwb, zgd->zgd_bp);
 
 	kmem_free(zgd, sizeof (zgd_t));
 }
@@ -995,7 +1044,8 @@ static int zil_fault_io = 0;
  * Get data to generate a TX_WRITE intent log record.
  */
 int
-zfs_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
+zfs_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb,
+    zio_t *zio)
 {
 	zfsvfs_t *zfsvfs = arg;
 	objset_t *os = zfsvfs->z_os;
@@ -1007,7 +1057,8 @@ zfs_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
 	zgd_t *zgd;
 	int error = 0;
 
-	ASSERT(zio != NULL);
+	ASSERT3P(lwb, !=, NULL);
+	ASSERT3P(zio, !=, NULL);
 	ASSERT(size != 0);
 
 	/*
@@ -1025,7 +1076,7 @@ zfs_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
 	}
 
 	zgd = (zgd_t *)kmem_zalloc(sizeof (zgd_t), KM_SLEEP);
-	zgd->zgd_zilog = zfsvfs->z_log;
+	zgd->zgd_lwb = lwb;
 	zgd->zgd_private = zp;
 
 	/*
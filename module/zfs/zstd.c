@@ -0,0 +1,362 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/zio_compress.h>
+
+/*
+ * Zstandard compression.
+ *
+ * Like gzip, which is backed by the kernel's zlib or by the userland
+ * libz, the zstd implementation is provided by the platform: lib/zstd in
+ * the Linux kernel (4.14 and newer) and libzstd in userland.  When it is
+ * unavailable zstd_available() returns B_FALSE, the compression property
+ * cannot be set to a zstd value, blocks are written uncompressed, and
+ * existing zstd compressed blocks cannot be read.
+ *
+ * Every compressed block starts with the big-endian length of the zstd
+ * frame which follows it.  The length is required because the frame
+ * decoder rejects the zero padding which follows the frame when the
+ * block is rounded up to the sector size.
+ *
+ * Positive levels (zstd-1 through zstd-19) trade speed for ratio as
+ * usual.  Negative levels (zstd-fast-N) are faster than zstd-1 at the
+ * cost of ratio.  The kernel's lib/zstd predates negative levels, so
+ * there they compress at level 1.
+ *
+ * Compression and decompression contexts are allocated once per CPU and
+ * reused so that the I/O pipeline does not allocate them for every
+ * block.  In the kernel a compression context's workspace is sized for
+ * the level and block size it was last used with, and is only replaced
+ * when a larger one is needed.  Each context is protected by its own
+ * lock.  A thread which finds the context of its CPU busy tries the
+ * others before waiting for its own.
+ */
+
+#if defined(_KERNEL) && defined(HAVE_LINUX_ZSTD)
+#define	ZSTD_SUPPORT
+#include <linux/zstd.h>
+#elif !defined(_KERNEL) && defined(HAVE_ZSTD)
+#define	ZSTD_SUPPORT
+#include <zstd.h>
+#endif
+
+#ifdef ZSTD_SUPPORT
+
+typedef struct zstd_ctx {
+	kmutex_t	zc_lock;
+	void		*zc_ctx;	/* ZSTD_CCtx or ZSTD_DCtx */
+	void		*zc_ws;		/* kernel workspace backing zc_ctx */
+	size_t		zc_ws_size;
+} zstd_ctx_t;
+
+static zstd_ctx_t *zstd_cctx;
+static zstd_ctx_t *zstd_dctx;
+static uint_t zstd_nctx;
+
+/*
+ * Lock and return one of the contexts in the given array, preferring
+ * the one belonging to the current CPU.
+ */
+static zstd_ctx_t *
+zstd_ctx_enter(zstd_ctx_t *ctxs)
+{
+	uint_t i, seq;
+
+	kpreempt_disable();
+	seq = CPU_SEQID % zstd_nctx;
+	kpreempt_enable();
+
+	for (i = 0; i < zstd_nctx; i++) {
+		zstd_ctx_t *zc = &ctxs[(seq + i) % zstd_nctx];
+
+		if (mutex_tryenter(&zc->zc_lock))
+			return (zc);
+	}
+
+	mutex_enter(&ctxs[seq].zc_lock);
+	return (&ctxs[seq]);
+}
+
+static void
+zstd_ctx_exit(zstd_ctx_t *zc)
+{
+	mutex_exit(&zc->zc_lock);
+}
+
+#ifdef _KERNEL
+
+/*
+ * Compress s_len bytes from src into at most d_len bytes at dst using
+ * the kernel's lib/zstd.  Returns the size of the frame, or 0 if it
+ * did not fit.
+ */
+static size_t
+zstd_compress_impl(zstd_ctx_t *zc, void *src, void *dst, size_t s_len,
+    size_t d_len, int level)
+{
+	ZSTD_parameters params;
+	size_t ws_size, c_len;
+
+	params = ZSTD_getParams(MAX(level, 1), s_len, 0);
+	ws_size = ZSTD_CCtxWorkspaceBound(params.cParams);
+
+	if (ws_size > zc->zc_ws_size) {
+		if (zc->zc_ws != NULL)
+			vmem_free(zc->zc_ws, zc->zc_ws_size);
+		zc->zc_ws = vmem_alloc(ws_size, KM_SLEEP);
+		zc->zc_ws_size = ws_size;
+	}
+
+	zc->zc_ctx = ZSTD_initCCtx(zc->zc_ws, zc->zc_ws_size);
+	if (zc->zc_ctx == NULL)
+		return (0);
+
+	c_len = ZSTD_compressCCtx(zc->zc_ctx, dst, d_len, src, s_len, params);
+	if (ZSTD_isError(c_len))
+		return (0);
+
+	return (c_len);
+}
+
+static int
+zstd_decompress_impl(zstd_ctx_t *zc, void *src, void *dst, size_t s_len,
+    size_t d_len)
+{
+	size_t len;
+
+	len = ZSTD_decompressDCtx(zc->zc_ctx, dst, d_len, src, s_len);
+	if (ZSTD_isError(len))
+		return (-1);
+
+	return (0);
+}
+
+static void
+zstd_ctx_init(zstd_ctx_t *zc, boolean_t decompress)
+{
+	mutex_init(&zc->zc_lock, NULL, MUTEX_DEFAULT, NULL);
+
+	/*
+	 * Compression workspaces depend on the level and are sized on
+	 * first use, decompression workspaces have a fixed size.
+	 */
+	if (decompress) {
+		zc->zc_ws_size = ZSTD_DCtxWorkspaceBound();
+		zc->zc_ws = vmem_alloc(zc->zc_ws_size, KM_SLEEP);
+		zc->zc_ctx = ZSTD_initDCtx(zc->zc_ws, zc->zc_ws_size);
+		VERIFY3P(zc->zc_ctx, !=, NULL);
+	}
+}
+
+static void
+zstd_ctx_fini(zstd_ctx_t *zc, boolean_t decompress)
+{
+	if (zc->zc_ws != NULL)
+		vmem_free(zc->zc_ws, zc->zc_ws_size);
+	zc->zc_ws = NULL;
+	zc->zc_ws_size = 0;
+	zc->zc_ctx = NULL;
+	mutex_destroy(&zc->zc_lock);
+}
+
+#else /* _KERNEL */
+
+static size_t
+zstd_compress_impl(zstd_ctx_t *zc, void *src, void *dst, size_t s_len,
+    size_t d_len, int level)
+{
+	size_t c_len;
+
+	c_len = ZSTD_compressCCtx(zc->zc_ctx, dst, d_len, src, s_len, level);
+	if (ZSTD_isError(c_len))
+		return (0);
+
+	return (c_len);
+}
+
+static int
+zstd_decompress_impl(zstd_ctx_t *zc, void *src, void *dst, size_t s_len,
+    size_t d_len)
+{
+	size_t len;
+
+	len = ZSTD_decompressDCtx(zc->zc_ctx, dst, d_len, src, s_len);
+	if (ZSTD_isError(len))
+		return (-1);
+
+	return (0);
+}
+
+static void
+zstd_ctx_init(zstd_ctx_t *zc, boolean_t decompress)
+{
+	mutex_init(&zc->zc_lock, NULL, MUTEX_DEFAULT, NULL);
+
+	/* libzstd sizes and keeps its workspace internally */
+	if (decompress)
+		zc->zc_ctx = ZSTD_createDCtx();
+	else
+		zc->zc_ctx = ZSTD_createCCtx();
+	VERIFY3P(zc->zc_ctx, !=, NULL);
+}
+
+static void
+zstd_ctx_fini(zstd_ctx_t *zc, boolean_t decompress)
+{
+	if (decompress)
+		(void) ZSTD_freeDCtx(zc->zc_ctx);
+	else
+		(void) ZSTD_freeCCtx(zc->zc_ctx);
+	zc->zc_ctx = NULL;
+	mutex_destroy(&zc->zc_lock);
+}
+
+#endif /* _KERNEL */
+
+size_t
+zstd_compress(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int level)
+{
+	zstd_ctx_t *zc;
+	size_t c_len;
+
+	ASSERT(d_len <= s_len);
+
+	/* The frame length is stored in the first 4 bytes. */
+	if (d_len < sizeof (uint32_t))
+		return (s_len);
+
+	zc = zstd_ctx_enter(zstd_cctx);
+	c_len = zstd_compress_impl(zc, s_start,
+	    (char *)d_start + sizeof (uint32_t), s_len,
+	    d_len - sizeof (uint32_t), level);
+	zstd_ctx_exit(zc);
+
+	/*
+	 * Signal an error if the compression routine returned zero or
+	 * the frame did not fit in the destination buffer.
+	 */
+	if (c_len == 0)
+		return (s_len);
+
+	*(uint32_t *)d_start = BE_32(c_len);
+
+	return (c_len + sizeof (uint32_t));
+}
+
+/*ARGSUSED*/
+int
+zstd_decompress(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int level)
+{
+	zstd_ctx_t *zc;
+	uint32_t c_len;
+	int error;
+
+	if (s_len < sizeof (uint32_t))
+		return (-1);
+
+	c_len = BE_IN32(s_start);
+	if (c_len > s_len - sizeof (uint32_t))
+		return (-1);
+
+	zc = zstd_ctx_enter(zstd_dctx);
+	error = zstd_decompress_impl(zc, (char *)s_start + sizeof (uint32_t),
+	    d_start, c_len, d_len);
+	zstd_ctx_exit(zc);
+
+	return (error);
+}
+
+boolean_t
+zstd_available(void)
+{
+	return (B_TRUE);
+}
+
+void
+zstd_init(void)
+{
+	uint_t i;
+
+	zstd_nctx = max_ncpus;
+	zstd_cctx = kmem_zalloc(zstd_nctx * sizeof (zstd_ctx_t), KM_SLEEP);
+	zstd_dctx = kmem_zalloc(zstd_nctx * sizeof (zstd_ctx_t), KM_SLEEP);
+
+	for (i = 0; i < zstd_nctx; i++) {
+		zstd_ctx_init(&zstd_cctx[i], B_FALSE);
+		zstd_ctx_init(&zstd_dctx[i], B_TRUE);
+	}
+}
+
+void
+zstd_fini(void)
+{
+	uint_t i;
+
+	for (i = 0; i < zstd_nctx; i++) {
+		zstd_ctx_fini(&zstd_cctx[i], B_FALSE);
+		zstd_ctx_fini(&zstd_dctx[i], B_TRUE);
+	}
+
+	kmem_free(zstd_cctx, zstd_nctx * sizeof (zstd_ctx_t));
+	kmem_free(zstd_dctx, zstd_nctx * sizeof (zstd_ctx_t));
+	zstd_cctx = NULL;
+	zstd_dctx = NULL;
+	zstd_nctx = 0;
+}
+
+#else /* ZSTD_SUPPORT */
+
+/*ARGSUSED*/
+size_t
+zstd_compress(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int level)
+{
+	return (s_len);
+}
+
+/*ARGSUSED*/
+int
+zstd_decompress(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int level)
+{
+	return (-1);
+}
+
+boolean_t
+zstd_available(void)
+{
+	return (B_FALSE);
+}
+
+void
+zstd_init(void)
+{
+}
+
+void
+zstd_fini(void)
+{
+}
+
+#endif /* ZSTD_SUPPORT */